@@ -0,0 +1,237 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "rcl-bench.h"
+
+#include <string.h>
+
+#include "rcl-time-utils.h"
+
+#define BENCH_MAX_N  ((guint64)1000000000)
+
+struct bench_result
+{
+  gchar   *name;
+  guint64  n;
+  gdouble  ns_per_op;
+  gdouble  allocs_per_op;
+  gboolean ok;
+};
+
+volatile guint64 bench_sink = 0;
+
+static guint64  bench_min_time = 500 * NSEC_PER_MSEC;
+static gchar   *bench_filter   = NULL;
+static GArray  *bench_results  = NULL;
+
+/* counted while a benchmark runs only */
+static volatile gint bench_counting = 0;
+static guint64       bench_allocs   = 0;
+
+
+/***************************************************************
+  Allocation counter:
+
+  The glibc allocator is called through its __libc_* entry points,
+  the executable's malloc() takes precedence over the libc one for
+  every library (GLib, GIO, polkit) as well.
+ */
+extern void *__libc_malloc  ( size_t size );
+extern void *__libc_calloc  ( size_t nmemb, size_t size );
+extern void *__libc_realloc ( void *ptr, size_t size );
+
+static inline void count_alloc( void )
+{
+  if( g_atomic_int_get( &bench_counting ) )
+    __atomic_add_fetch( &bench_allocs, 1, __ATOMIC_RELAXED );
+}
+
+void *malloc( size_t size )
+{
+  count_alloc();
+  return __libc_malloc( size );
+}
+
+void *calloc( size_t nmemb, size_t size )
+{
+  count_alloc();
+  return __libc_calloc( nmemb, size );
+}
+
+void *realloc( void *ptr, size_t size )
+{
+  count_alloc();
+  return __libc_realloc( ptr, size );
+}
+
+
+/***************************************************************
+  Harness:
+ */
+static guint64 bench_now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return timespec_load_nsec( &ts );
+}
+
+static gboolean
+bench_measure( bench_func func, gpointer data, guint64 n, guint64 *elapsed, guint64 *allocs )
+{
+  guint64  start;
+  gboolean ret;
+
+  __atomic_store_n( &bench_allocs, 0, __ATOMIC_RELAXED );
+  g_atomic_int_set( &bench_counting, 1 );
+
+  start = bench_now();
+  ret   = func( n, data );
+  *elapsed = bench_now() - start;
+
+  g_atomic_int_set( &bench_counting, 0 );
+  *allocs = __atomic_load_n( &bench_allocs, __ATOMIC_RELAXED );
+
+  return ret;
+}
+
+static void bench_result_clear( struct bench_result *result )
+{
+  g_free( result->name );
+}
+
+void bench_init( guint min_time_msec, const gchar *filter )
+{
+  if( min_time_msec )
+    bench_min_time = (guint64)min_time_msec * NSEC_PER_MSEC;
+
+  g_free( bench_filter );
+  bench_filter = g_strdup( filter );
+
+  if( !bench_results )
+  {
+    bench_results = g_array_new( FALSE, TRUE, sizeof(struct bench_result) );
+    g_array_set_clear_func( bench_results, (GDestroyNotify)bench_result_clear );
+  }
+}
+
+/*
+  The first run (N = 1) warms up caches and lazy initialization,
+  then N is predicted from the last run as in Go's testing.B:
+ */
+gboolean bench_run( const gchar *name, bench_func func, gpointer data )
+{
+  struct bench_result result;
+  guint64             n = 1, elapsed = 0, allocs = 0;
+
+  if( bench_filter && !strstr( name, bench_filter ) )
+    return TRUE;
+
+  memset( &result, 0, sizeof(result) );
+  result.name = g_strdup( name );
+  result.ok   = bench_measure( func, data, 1, &elapsed, &allocs );
+
+  while( result.ok && elapsed < bench_min_time && n < BENCH_MAX_N )
+  {
+    guint64 next;
+
+    /* aim 20% above the minimal time, grow at most 100x and at least by one */
+    next = elapsed ? (bench_min_time + bench_min_time / 5) * n / elapsed : n * 100;
+    next = MIN( MAX( next, n + 1 ), n * 100 );
+    n    = MIN( next, BENCH_MAX_N );
+
+    result.ok = bench_measure( func, data, n, &elapsed, &allocs );
+  }
+
+  result.n             = n;
+  result.ns_per_op     = (gdouble)elapsed / (gdouble)n;
+  result.allocs_per_op = (gdouble)allocs / (gdouble)n;
+
+  if( result.ok )
+    g_printerr( "%-40s %12" G_GUINT64_FORMAT " %14.1f ns/op %10.2f allocs/op\n",
+                name, n, result.ns_per_op, result.allocs_per_op );
+  else
+    g_warning( "bench: %s: failed", name );
+
+  g_array_append_val( bench_results, result );
+
+  return result.ok;
+}
+
+static void json_string( GString *out, const gchar *s )
+{
+  g_string_append_c( out, '"' );
+  for( ; *s; ++s )
+  {
+    if( *s == '"' || *s == '\\' )
+      g_string_append_printf( out, "\\%c", *s );
+    else if( (guchar)*s < 0x20 )
+      g_string_append_printf( out, "\\u%04x", (guint)*s );
+    else
+      g_string_append_c( out, *s );
+  }
+  g_string_append_c( out, '"' );
+}
+
+/*
+  One JSON object per run, e.g. for comparing releases:
+
+    { "version": "1.0.2", "backend": "simulated", "min_time_ns": 500000000,
+      "benchmarks": [ { "name": "timespec_load", "iterations": 1000000,
+                        "ns_per_op": 1.2, "allocs_per_op": 0.0, "ok": true }, ... ] }
+ */
+void bench_report( FILE *fp, const gchar *backend )
+{
+  GString *out = g_string_new( NULL );
+  guint    i;
+
+  g_string_append_printf( out, "{\n  \"version\": " );
+  json_string( out, PACKAGE_VERSION );
+  g_string_append_printf( out, ",\n  \"backend\": " );
+  json_string( out, backend );
+  g_string_append_printf( out, ",\n  \"min_time_ns\": %" G_GUINT64_FORMAT ",\n  \"benchmarks\": [", bench_min_time );
+
+  for( i = 0; bench_results && i < bench_results->len; ++i )
+  {
+    struct bench_result *r = &g_array_index( bench_results, struct bench_result, i );
+    gchar ns[G_ASCII_DTOSTR_BUF_SIZE], allocs[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_ascii_formatd( ns,     sizeof(ns),     "%.3f", r->ns_per_op );
+    g_ascii_formatd( allocs, sizeof(allocs), "%.3f", r->allocs_per_op );
+
+    g_string_append_printf( out, "%s\n    { \"name\": ", i ? "," : "" );
+    json_string( out, r->name );
+    g_string_append_printf( out, ", \"iterations\": %" G_GUINT64_FORMAT
+                                 ", \"ns_per_op\": %s, \"allocs_per_op\": %s, \"ok\": %s }",
+                            r->n, ns, allocs, r->ok ? "true" : "false" );
+  }
+  g_string_append( out, "\n  ]\n}\n" );
+
+  fputs( out->str, fp );
+  fflush( fp );
+  g_string_free( out, TRUE );
+}
+
+void bench_done( void )
+{
+  g_clear_pointer( &bench_results, g_array_unref );
+  g_clear_pointer( &bench_filter, g_free );
+}
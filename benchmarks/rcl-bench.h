@@ -0,0 +1,48 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_BENCH_H__
+#define __RCL_BENCH_H__
+
+#include "config.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <glib.h>
+
+/*
+  Go-style benchmarks: the function runs N operations, the harness
+  grows N until the run takes at least the minimal time and reports
+  nanoseconds and heap allocations (malloc/calloc/realloc of all
+  threads) per operation.
+ */
+typedef gboolean (*bench_func)( guint64 n, gpointer data );
+
+extern void      bench_init      ( guint min_time_msec, const gchar *filter );
+extern gboolean  bench_run       ( const gchar *name, bench_func func, gpointer data );
+extern void      bench_report    ( FILE *fp, const gchar *backend );
+extern void      bench_done      ( void );
+
+/* keeps the results of the measured code alive */
+extern volatile guint64 bench_sink;
+
+
+#endif /* __RCL_BENCH_H__ */
@@ -0,0 +1,223 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "rcl-mock-polkit.h"
+
+#define POLKIT_NAME       "org.freedesktop.PolicyKit1"
+#define POLKIT_PATH       "/org/freedesktop/PolicyKit1/Authority"
+#define POLKIT_INTERFACE  "org.freedesktop.PolicyKit1.Authority"
+
+static const gchar mock_polkit_xml[] =
+  "<node>"
+  "  <interface name='" POLKIT_INTERFACE "'>"
+  "    <method name='CheckAuthorization'>"
+  "      <arg type='(sa{sv})' name='subject' direction='in'/>"
+  "      <arg type='s' name='action_id' direction='in'/>"
+  "      <arg type='a{ss}' name='details' direction='in'/>"
+  "      <arg type='u' name='flags' direction='in'/>"
+  "      <arg type='s' name='cancellation_id' direction='in'/>"
+  "      <arg type='(bba{ss})' name='result' direction='out'/>"
+  "    </method>"
+  "    <method name='CancelCheckAuthorization'>"
+  "      <arg type='s' name='cancellation_id' direction='in'/>"
+  "    </method>"
+  "    <signal name='Changed'/>"
+  "    <property type='s' name='BackendName' access='read'/>"
+  "    <property type='s' name='BackendVersion' access='read'/>"
+  "    <property type='u' name='BackendFeatures' access='read'/>"
+  "  </interface>"
+  "</node>";
+
+struct mock_polkit
+{
+  gchar           *address;
+  gboolean         authorized;
+  gint             checks;
+
+  GThread         *thread;
+  GMainContext    *context;
+  gint             quit;
+
+  GMutex           lock;
+  GCond            cond;
+  gboolean         ready;
+  GError          *error;
+};
+
+static void
+mock_polkit_method_call( GDBusConnection       *connection,
+                         const gchar           *sender,
+                         const gchar           *object_path,
+                         const gchar           *interface_name,
+                         const gchar           *method_name,
+                         GVariant              *parameters,
+                         GDBusMethodInvocation *invocation,
+                         gpointer               user_data )
+{
+  mock_polkit *mock = (mock_polkit *)user_data;
+
+  if( g_strcmp0( method_name, "CheckAuthorization" ) == 0 )
+  {
+    g_atomic_int_inc( &mock->checks );
+    g_dbus_method_invocation_return_value( invocation,
+                                           g_variant_new( "((bba{ss}))", mock->authorized, FALSE, NULL ) );
+    return;
+  }
+
+  g_dbus_method_invocation_return_value( invocation, NULL );
+}
+
+static GVariant *
+mock_polkit_get_property( GDBusConnection  *connection,
+                          const gchar      *sender,
+                          const gchar      *object_path,
+                          const gchar      *interface_name,
+                          const gchar      *property_name,
+                          GError          **error,
+                          gpointer          user_data )
+{
+  if( g_strcmp0( property_name, "BackendName" ) == 0 )
+    return g_variant_new_string( "timedated-mock" );
+  if( g_strcmp0( property_name, "BackendVersion" ) == 0 )
+    return g_variant_new_string( PACKAGE_VERSION );
+
+  return g_variant_new_uint32( 0 );
+}
+
+static const GDBusInterfaceVTable mock_polkit_vtable =
+{
+  mock_polkit_method_call,
+  mock_polkit_get_property,
+  NULL
+};
+
+static gboolean
+mock_polkit_export( mock_polkit *mock, GDBusConnection *connection, GError **error )
+{
+  GDBusNodeInfo *info;
+  GVariant      *reply;
+  guint          id;
+
+  info = g_dbus_node_info_new_for_xml( mock_polkit_xml, error );
+  if( !info )
+    return FALSE;
+
+  id = g_dbus_connection_register_object( connection, POLKIT_PATH, info->interfaces[0],
+                                          &mock_polkit_vtable, mock, NULL, error );
+  g_dbus_node_info_unref( info );
+  if( !id )
+    return FALSE;
+
+  /* DBUS_NAME_FLAG_DO_NOT_QUEUE */
+  reply = g_dbus_connection_call_sync( connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus", "RequestName",
+                                       g_variant_new( "(su)", POLKIT_NAME, 4 ), G_VARIANT_TYPE( "(u)" ),
+                                       G_DBUS_CALL_FLAGS_NONE, -1, NULL, error );
+  if( !reply )
+    return FALSE;
+  g_variant_unref( reply );
+
+  return TRUE;
+}
+
+static gpointer
+mock_polkit_thread( gpointer user_data )
+{
+  mock_polkit     *mock = (mock_polkit *)user_data;
+  GDBusConnection *connection;
+  GError          *error = NULL;
+
+  g_main_context_push_thread_default( mock->context );
+
+  connection = g_dbus_connection_new_for_address_sync( mock->address,
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                       NULL, NULL, &error );
+  if( connection )
+    (void)mock_polkit_export( mock, connection, &error );
+
+  g_mutex_lock( &mock->lock );
+  mock->error = error;
+  mock->ready = TRUE;
+  g_cond_signal( &mock->cond );
+  g_mutex_unlock( &mock->lock );
+
+  while( !error && !g_atomic_int_get( &mock->quit ) )
+    g_main_context_iteration( mock->context, TRUE );
+
+  if( connection )
+  {
+    (void)g_dbus_connection_close_sync( connection, NULL, NULL );
+    g_object_unref( connection );
+  }
+
+  g_main_context_pop_thread_default( mock->context );
+
+  return NULL;
+}
+
+mock_polkit *mock_polkit_start( const gchar *address, gboolean authorized, GError **error )
+{
+  mock_polkit *mock = g_new0( mock_polkit, 1 );
+
+  mock->address    = g_strdup( address );
+  mock->authorized = authorized;
+  mock->context    = g_main_context_new();
+  g_mutex_init( &mock->lock );
+  g_cond_init( &mock->cond );
+
+  mock->thread = g_thread_new( "mock-polkit", mock_polkit_thread, mock );
+
+  g_mutex_lock( &mock->lock );
+  while( !mock->ready )
+    g_cond_wait( &mock->cond, &mock->lock );
+  g_mutex_unlock( &mock->lock );
+
+  if( mock->error )
+  {
+    g_propagate_error( error, mock->error );
+    mock->error = NULL;
+    mock_polkit_stop( mock );
+    return NULL;
+  }
+
+  return mock;
+}
+
+void mock_polkit_stop( mock_polkit *mock )
+{
+  if( !mock )
+    return;
+
+  g_atomic_int_set( &mock->quit, 1 );
+  g_main_context_wakeup( mock->context );
+  g_thread_join( mock->thread );
+
+  g_main_context_unref( mock->context );
+  g_mutex_clear( &mock->lock );
+  g_cond_clear( &mock->cond );
+  g_free( mock->address );
+  g_free( mock );
+}
+
+guint mock_polkit_checks( mock_polkit *mock )
+{
+  return (guint)g_atomic_int_get( &mock->checks );
+}
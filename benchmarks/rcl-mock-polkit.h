@@ -0,0 +1,41 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_MOCK_POLKIT_H__
+#define __RCL_MOCK_POLKIT_H__
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/*
+  org.freedesktop.PolicyKit1 authority on a private bus. It answers
+  CheckAuthorization from its own thread, so the daemon's synchronous
+  polkit_authority_get_sync() does not block the caller's main loop.
+ */
+typedef struct mock_polkit mock_polkit;
+
+extern mock_polkit *mock_polkit_start  ( const gchar *address, gboolean authorized, GError **error );
+extern void         mock_polkit_stop   ( mock_polkit *mock );
+extern guint        mock_polkit_checks ( mock_polkit *mock );
+
+
+#endif /* __RCL_MOCK_POLKIT_H__ */
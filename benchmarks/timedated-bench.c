@@ -0,0 +1,369 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <glib/gi18n-lib.h>
+#include <locale.h>
+
+#include "rcl-timedate.h"
+#include "rcl-time-utils.h"
+#include "rcl-zone-utils.h"
+#include "rcl-sys.h"
+
+#include "rcl-bench.h"
+#include "rcl-mock-polkit.h"
+#include "rcl-sysroot.h"
+
+/*
+  Hot paths of the daemon measured against the simulated system
+  (see rcl-sys.h), so the benchmarks run without privileges and do
+  not touch the host clock or configuration. JSON results go to the
+  standard output (or --output file), progress to the standard error.
+ */
+
+#define BENCH_TIMEZONE  "Etc/UTC"
+
+
+/***************************************************************
+  Time utilities:
+ */
+static gboolean bench_timespec_load( guint64 n, gpointer data )
+{
+  struct timespec ts;
+  guint64         i, sum = 0;
+
+  for( i = 0; i < n; ++i )
+  {
+    ts.tv_sec  = (time_t)i;
+    ts.tv_nsec = (long)(i % NSEC_PER_SEC);
+    sum += timespec_load( &ts );
+  }
+  bench_sink = sum;
+
+  return TRUE;
+}
+
+static gboolean bench_timespec_store( guint64 n, gpointer data )
+{
+  struct timespec ts;
+  guint64         i, sum = 0;
+
+  for( i = 0; i < n; ++i )
+  {
+    timespec_store( &ts, i * 1000003 );
+    sum += (guint64)ts.tv_nsec;
+  }
+  bench_sink = sum;
+
+  return TRUE;
+}
+
+static gboolean bench_timezone_is_valid( guint64 n, gpointer data )
+{
+  guint64 i;
+
+  for( i = 0; i < n; ++i )
+  {
+    if( !timezone_is_valid( BENCH_TIMEZONE ) )
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean bench_get_timezones( guint64 n, gpointer data )
+{
+  guint64 i;
+
+  for( i = 0; i < n; ++i )
+  {
+    const gchar *const *zones = { NULL };
+
+    if( !get_timezones( &zones ) )
+      return FALSE;
+    timezones_free( &zones );
+  }
+
+  return TRUE;
+}
+
+
+/***************************************************************
+  LocalRTC configuration:
+ */
+static gboolean bench_read_data_local_rtc( guint64 n, gpointer data )
+{
+  gboolean local_rtc;
+  guint64  i;
+
+  for( i = 0; i < n; ++i )
+  {
+    if( !read_data_local_rtc( &local_rtc ) )
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean bench_write_data_local_rtc( guint64 n, gpointer data )
+{
+  guint64 i;
+
+  /* the configuration is UTC again after an even number of writes */
+  for( i = 0; i < n; ++i )
+  {
+    if( !write_data_local_rtc( !(i & 1) ) )
+      return FALSE;
+  }
+  if( n & 1 )
+    (void)write_data_local_rtc( FALSE );
+
+  return TRUE;
+}
+
+
+/***************************************************************
+  Daemon:
+ */
+static gboolean bench_sync_dbus_properties( guint64 n, gpointer data )
+{
+  RclTimedateDaemon *object = (RclTimedateDaemon *)data;
+  guint64            i;
+
+  for( i = 0; i < n; ++i )
+    rcl_daemon_sync_dbus_properties( object );
+
+  return TRUE;
+}
+
+struct polkit_bench
+{
+  GDBusConnection *client;
+  const gchar     *daemon_name;
+  guint64          calls;
+};
+
+struct polkit_call
+{
+  gboolean  done;
+  GError   *error;
+};
+
+static void
+polkit_call_done( GObject *source_object, GAsyncResult *result, gpointer user_data )
+{
+  struct polkit_call *call = (struct polkit_call *)user_data;
+  GVariant           *reply;
+
+  reply = g_dbus_connection_call_finish( G_DBUS_CONNECTION( source_object ), result, &call->error );
+  if( reply )
+    g_variant_unref( reply );
+
+  call->done = TRUE;
+}
+
+/*
+  SetTimezone alternates two zones, so every call is authorized by the
+  (mock) polkit authority, writes /etc/localtime and emits the property
+  change: the whole path of a privileged call as a client sees it.
+ */
+static gboolean bench_set_timezone_polkit( guint64 n, gpointer data )
+{
+  static const gchar *const zones[] = { BENCH_TIMEZONE, "UTC" };
+  struct polkit_bench       *bench  = (struct polkit_bench *)data;
+  guint64                    i;
+
+  for( i = 0; i < n; ++i )
+  {
+    struct polkit_call call = { FALSE, NULL };
+
+    g_dbus_connection_call( bench->client, bench->daemon_name,
+                            "/org/freedesktop/timedate1", "org.freedesktop.timedate1", "SetTimezone",
+                            g_variant_new( "(sb)", zones[bench->calls++ & 1], FALSE ),
+                            NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                            polkit_call_done, &call );
+
+    while( !call.done )
+      g_main_context_iteration( NULL, TRUE );
+
+    if( call.error )
+    {
+      g_warning( "bench: SetTimezone: %s", call.error->message );
+      g_error_free( call.error );
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gboolean run_daemon_benchmarks( void )
+{
+  GTestDBus           *bus;
+  mock_polkit         *mock;
+  GDBusConnection     *connection = NULL, *client = NULL;
+  RclDaemon           *daemon;
+  struct polkit_bench  bench;
+  GError              *error = NULL;
+  gboolean             ret = FALSE;
+
+  /* private bus which the daemon and libpolkit take as the system bus */
+  bus = g_test_dbus_new( G_TEST_DBUS_NONE );
+  g_test_dbus_up( bus );
+  g_setenv( "DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address( bus ), TRUE );
+
+  mock = mock_polkit_start( g_test_dbus_get_bus_address( bus ), TRUE, &error );
+  if( !mock )
+  {
+    g_warning( "bench: Cannot start polkit authority: %s", error->message );
+    g_error_free( error );
+    g_test_dbus_down( bus );
+    g_object_unref( bus );
+    return FALSE;
+  }
+
+  daemon = rcl_daemon_new();
+
+  (void)bench_run( "rcl_daemon_sync_dbus_properties", bench_sync_dbus_properties, RCL_TIMEDATE_DAEMON( daemon ) );
+
+  connection = g_bus_get_sync( G_BUS_TYPE_SYSTEM, NULL, &error );
+  if( connection )
+    client = g_dbus_connection_new_for_address_sync( g_test_dbus_get_bus_address( bus ),
+                                                     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                     NULL, NULL, &error );
+  if( !client )
+  {
+    g_warning( "bench: Cannot connect to the private bus: %s", error->message );
+    g_error_free( error );
+  }
+  else if( rcl_daemon_startup( daemon, connection ) )
+  {
+    bench.client      = client;
+    bench.daemon_name = g_dbus_connection_get_unique_name( connection );
+    bench.calls       = 0;
+
+    ret = bench_run( "SetTimezone (polkit)", bench_set_timezone_polkit, &bench );
+
+    g_debug( "bench: polkit authority checked %u calls", mock_polkit_checks( mock ) );
+    rcl_daemon_shutdown( daemon );
+  }
+
+  g_clear_object( &client );
+  g_clear_object( &daemon );
+  if( connection )
+  {
+    (void)g_dbus_connection_close_sync( connection, NULL, NULL );
+    g_object_unref( connection );
+  }
+
+  mock_polkit_stop( mock );
+  g_test_dbus_down( bus );
+  g_object_unref( bus );
+
+  return ret;
+}
+
+
+/*******
+  main:
+ */
+gint main( gint argc, gchar **argv )
+{
+  GError          *error    = NULL;
+  GOptionContext  *context;
+  gint             min_time = 0;
+  gint             latency  = 0;
+  gchar           *filter   = NULL;
+  gchar           *output   = NULL;
+  gchar           *root;
+  FILE            *fp       = stdout;
+  gboolean         ret      = TRUE;
+
+  const GOptionEntry options[] = {
+    { "min-time",    't', 0, G_OPTION_ARG_INT,      &min_time, _("Minimal run time of every benchmark in msec (500)"), "MSEC" },
+    { "filter",      'f', 0, G_OPTION_ARG_STRING,   &filter,   _("Run benchmarks whose names contain NAME"),          "NAME" },
+    { "output",      'o', 0, G_OPTION_ARG_FILENAME, &output,   _("Write JSON results to FILE"),                        "FILE" },
+    { "rtc-latency", 0,   0, G_OPTION_ARG_INT,      &latency,  _("Simulated RTC ioctl latency in microseconds"),       "USEC" },
+    { NULL }
+  };
+
+  setlocale( LC_ALL, "" );
+
+  context = g_option_context_new( "" );
+  g_option_context_add_main_entries( context, options, NULL );
+  if( !g_option_context_parse( context, &argc, &argv, &error ) )
+  {
+    g_warning( "Failed to parse command-line options: %s", error->message );
+    g_error_free( error );
+    return 1;
+  }
+  g_option_context_free( context );
+
+  root = sysroot_new();
+  if( !root || !sys_set_simulated( root, (guint)MAX( latency, 0 ) ) )
+  {
+    sysroot_free( root );
+    return 1;
+  }
+
+  if( !clock_set_rtc_device( RTC_DEVICE ) )
+  {
+    g_warning( "Invalid RTC device name '%s'", RTC_DEVICE );
+    sysroot_free( root );
+    return 1;
+  }
+
+  bench_init( (guint)MAX( min_time, 0 ), filter );
+
+  ret &= bench_run( "timespec_load",        bench_timespec_load,        NULL );
+  ret &= bench_run( "timespec_store",       bench_timespec_store,       NULL );
+  ret &= bench_run( "timezone_is_valid",    bench_timezone_is_valid,    NULL );
+  ret &= bench_run( "get_timezones",        bench_get_timezones,        NULL );
+  ret &= bench_run( "read_data_local_rtc",  bench_read_data_local_rtc,  NULL );
+  ret &= bench_run( "write_data_local_rtc", bench_write_data_local_rtc, NULL );
+
+  ret &= run_daemon_benchmarks();
+
+  if( output && !(fp = fopen( output, "w" )) )
+  {
+    g_warning( "Cannot write '%s': %s", output, g_strerror( errno ) );
+    fp  = stdout;
+    ret = FALSE;
+  }
+  bench_report( fp, sys_backend_name() );
+  if( fp != stdout )
+    fclose( fp );
+
+  bench_done();
+  sysroot_free( root );
+  g_free( filter );
+  g_free( output );
+
+  return ret ? 0 : 1;
+}
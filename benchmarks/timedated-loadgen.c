@@ -0,0 +1,574 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <glib/gi18n-lib.h>
+#include <locale.h>
+
+#include "rcl-time-utils.h"
+
+#include "rcl-mock-polkit.h"
+#include "rcl-sysroot.h"
+
+/*
+  End-to-end load of the daemon: a private bus with a mock polkit
+  authority, timedated started on it with the simulated system
+  backend and N client connections (one thread each) which issue a
+  weighted mix of calls back to back for the given time. Throughput
+  and latency percentiles per method go to the standard output (or
+  --output file) as JSON, the table to the standard error.
+ */
+
+#if !defined( TIMEDATED_PATH )
+#define TIMEDATED_PATH "/usr/libexec/timedated"
+#endif
+
+#define TIMEDATE_SERVICE_NAME  "org.freedesktop.timedate1"
+#define TIMEDATE_PATH          "/org/freedesktop/timedate1"
+#define TIMEDATE_INTERFACE     "org.freedesktop.timedate1"
+
+#define LOAD_MIX_DEFAULT  "Get=40,GetAll=20,ListTimezones=10,SetTimezone=10,SetTime=10,SetNTP=10"
+#define LOAD_STARTUP      10 /* sec to wait for the daemon on the bus */
+
+enum load_method
+{
+  LOAD_GET,
+  LOAD_GET_ALL,
+  LOAD_LIST_TIMEZONES,
+  LOAD_SET_TIMEZONE,
+  LOAD_SET_TIME,
+  LOAD_SET_NTP,
+  LOAD_METHODS
+};
+
+static const gchar *const load_method_names[LOAD_METHODS] =
+{
+  "Get", "GetAll", "ListTimezones", "SetTimezone", "SetTime", "SetNTP"
+};
+
+struct load
+{
+  const gchar *address;
+  guint        weights[LOAD_METHODS];
+  guint        total_weight;
+  gint         timeout;   /* msec per call */
+  guint64      deadline;  /* CLOCK_MONOTONIC nsec */
+};
+
+struct load_client
+{
+  struct load *load;
+  GThread     *thread;
+  guint64      calls;
+  GArray      *latency[LOAD_METHODS]; /* guint64 nsec */
+  guint64      errors[LOAD_METHODS];
+  gchar       *error;
+};
+
+static guint64 load_now( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return timespec_load_nsec( &ts );
+}
+
+
+/***************************************************************
+  Mix of methods, e.g. "Get=40,SetTime=10":
+ */
+static gboolean parse_mix( struct load *load, const gchar *mix )
+{
+  gchar **items, **item;
+  gint    i;
+
+  memset( load->weights, 0, sizeof(load->weights) );
+  load->total_weight = 0;
+
+  items = g_strsplit( mix, ",", -1 );
+  for( item = items; *item; ++item )
+  {
+    gchar  **kv = g_strsplit( g_strstrip( *item ), "=", 2 );
+    guint64  weight;
+
+    if( !kv[0] || !kv[1] || !g_ascii_string_to_unsigned( kv[1], 10, 0, 1000000, &weight, NULL ) )
+    {
+      g_warning( "loadgen: Invalid mix item '%s'", *item );
+      g_strfreev( kv );
+      g_strfreev( items );
+      return FALSE;
+    }
+
+    for( i = 0; i < LOAD_METHODS; ++i )
+      if( g_ascii_strcasecmp( kv[0], load_method_names[i] ) == 0 )
+        break;
+
+    if( i == LOAD_METHODS )
+    {
+      g_warning( "loadgen: Unknown method '%s'", kv[0] );
+      g_strfreev( kv );
+      g_strfreev( items );
+      return FALSE;
+    }
+
+    load->weights[i]    = (guint)weight;
+    load->total_weight += (guint)weight;
+    g_strfreev( kv );
+  }
+  g_strfreev( items );
+
+  return ( load->total_weight > 0 );
+}
+
+static enum load_method pick_method( struct load *load, GRand *rand )
+{
+  guint r = (guint)g_rand_int_range( rand, 0, (gint32)load->total_weight );
+  gint  i;
+
+  for( i = 0; i < LOAD_METHODS - 1; ++i )
+  {
+    if( r < load->weights[i] )
+      break;
+    r -= load->weights[i];
+  }
+
+  return (enum load_method)i;
+}
+
+
+/***************************************************************
+  Clients:
+
+  Settings alternate between two values, so most calls go through
+  polkit, but the clock and the timezone stay where they were.
+ */
+static GVariant *
+load_call( GDBusConnection *connection, struct load_client *client, enum load_method method, GError **error )
+{
+  static const gchar *const zones[] = { "Etc/UTC", "UTC" };
+  const gchar *interface = TIMEDATE_INTERFACE;
+  const gchar *name      = load_method_names[method];
+  GVariant    *params    = NULL;
+  gboolean     odd       = ( client->calls++ & 1 );
+
+  switch( method )
+  {
+    case LOAD_GET:
+      interface = "org.freedesktop.DBus.Properties";
+      params    = g_variant_new( "(ss)", TIMEDATE_INTERFACE, "TimeUSec" );
+      break;
+    case LOAD_GET_ALL:
+      interface = "org.freedesktop.DBus.Properties";
+      params    = g_variant_new( "(s)", TIMEDATE_INTERFACE );
+      break;
+    case LOAD_LIST_TIMEZONES:
+      break;
+    case LOAD_SET_TIMEZONE:
+      params = g_variant_new( "(sb)", zones[odd], FALSE );
+      break;
+    case LOAD_SET_TIME:
+      params = g_variant_new( "(xbb)", odd ? (gint64)-1000 : (gint64)1000, TRUE, FALSE );
+      break;
+    case LOAD_SET_NTP:
+      params = g_variant_new( "(bb)", odd, FALSE );
+      break;
+    default:
+      break;
+  }
+
+  return g_dbus_connection_call_sync( connection, TIMEDATE_SERVICE_NAME, TIMEDATE_PATH,
+                                      interface, name, params, NULL,
+                                      G_DBUS_CALL_FLAGS_NO_AUTO_START, client->load->timeout,
+                                      NULL, error );
+}
+
+static gpointer
+load_client_thread( gpointer user_data )
+{
+  struct load_client *client = (struct load_client *)user_data;
+  GDBusConnection    *connection;
+  GRand              *rand;
+  GError             *error = NULL;
+
+  connection = g_dbus_connection_new_for_address_sync( client->load->address,
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                       NULL, NULL, &error );
+  if( !connection )
+  {
+    client->error = g_strdup( error->message );
+    g_error_free( error );
+    return NULL;
+  }
+
+  rand = g_rand_new();
+
+  while( load_now() < client->load->deadline )
+  {
+    enum load_method  method = pick_method( client->load, rand );
+    GVariant         *reply;
+    guint64           start, elapsed;
+
+    start   = load_now();
+    reply   = load_call( connection, client, method, &error );
+    elapsed = load_now() - start;
+
+    g_array_append_val( client->latency[method], elapsed );
+
+    if( reply )
+      g_variant_unref( reply );
+    else
+    {
+      if( !client->errors[method] )
+        g_debug( "loadgen: %s: %s", load_method_names[method], error->message );
+      client->errors[method]++;
+      g_clear_error( &error );
+    }
+  }
+
+  g_rand_free( rand );
+  (void)g_dbus_connection_close_sync( connection, NULL, NULL );
+  g_object_unref( connection );
+
+  return NULL;
+}
+
+
+/***************************************************************
+  Daemon under test:
+ */
+static GSubprocess *
+start_daemon( const gchar *daemon_path, const gchar *address, const gchar *root,
+              gint rtc_latency, gboolean verbose, GError **error )
+{
+  GSubprocessLauncher *launcher;
+  GSubprocess         *daemon;
+  gchar               *simulate, *latency;
+
+  launcher = g_subprocess_launcher_new( verbose ? G_SUBPROCESS_FLAGS_NONE
+                                                : G_SUBPROCESS_FLAGS_STDOUT_SILENCE | G_SUBPROCESS_FLAGS_STDERR_SILENCE );
+  g_subprocess_launcher_setenv( launcher, "DBUS_SYSTEM_BUS_ADDRESS", address, TRUE );
+
+  simulate = g_strdup_printf( "--simulate=%s", root );
+  latency  = g_strdup_printf( "--sim-rtc-latency=%d", MAX( rtc_latency, 0 ) );
+
+  daemon = g_subprocess_launcher_spawn( launcher, error, daemon_path, simulate, latency,
+                                        verbose ? "--verbose" : NULL, NULL );
+  g_free( latency );
+  g_free( simulate );
+  g_object_unref( launcher );
+
+  return daemon;
+}
+
+static gboolean wait_daemon( const gchar *address )
+{
+  GDBusConnection *connection;
+  gboolean         ret = FALSE;
+  guint64          deadline = load_now() + (guint64)LOAD_STARTUP * NSEC_PER_SEC;
+
+  connection = g_dbus_connection_new_for_address_sync( address,
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                       NULL, NULL, NULL );
+  if( !connection )
+    return FALSE;
+
+  while( !ret && load_now() < deadline )
+  {
+    GVariant *reply;
+
+    reply = g_dbus_connection_call_sync( connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                         "org.freedesktop.DBus", "NameHasOwner",
+                                         g_variant_new( "(s)", TIMEDATE_SERVICE_NAME ), G_VARIANT_TYPE( "(b)" ),
+                                         G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL );
+    if( reply )
+    {
+      g_variant_get( reply, "(b)", &ret );
+      g_variant_unref( reply );
+    }
+    if( !ret )
+      g_usleep( 20 * USEC_PER_MSEC );
+  }
+
+  g_object_unref( connection );
+
+  return ret;
+}
+
+
+/***************************************************************
+  Report:
+ */
+static gint compare_u64( gconstpointer a, gconstpointer b )
+{
+  guint64 x = *(const guint64 *)a, y = *(const guint64 *)b;
+
+  return ( x > y ) - ( x < y );
+}
+
+static gdouble percentile_usec( GArray *sorted, gdouble p )
+{
+  guint idx;
+
+  if( !sorted->len )
+    return 0.0;
+
+  idx = (guint)( p * (gdouble)sorted->len + 0.999999 );
+  idx = CLAMP( idx, 1, sorted->len ) - 1;
+
+  return (gdouble)g_array_index( sorted, guint64, idx ) / (gdouble)NSEC_PER_USEC;
+}
+
+static void json_number( GString *out, const gchar *name, gdouble value )
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_printf( out, ", \"%s\": %s", name, g_ascii_formatd( buf, sizeof(buf), "%.3f", value ) );
+}
+
+static void
+report( FILE *fp, struct load_client *clients, guint nclients, gdouble seconds )
+{
+  GString *out = g_string_new( NULL );
+  guint64  total = 0;
+  gboolean first = TRUE;
+  gint     m;
+  guint    c;
+
+  g_string_append_printf( out, "{\n  \"version\": \"%s\",\n  \"clients\": %u,\n  \"seconds\": ", PACKAGE_VERSION, nclients );
+  {
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+    g_string_append( out, g_ascii_formatd( buf, sizeof(buf), "%.3f", seconds ) );
+  }
+  g_string_append( out, ",\n  \"methods\": [" );
+
+  g_printerr( "%-14s %10s %8s %12s %10s %10s %10s %10s\n",
+              "method", "calls", "errors", "calls/s", "p50 us", "p99 us", "p999 us", "max us" );
+
+  for( m = 0; m < LOAD_METHODS; ++m )
+  {
+    GArray  *all = g_array_new( FALSE, FALSE, sizeof(guint64) );
+    guint64  errors = 0;
+
+    for( c = 0; c < nclients; ++c )
+    {
+      g_array_append_vals( all, clients[c].latency[m]->data, clients[c].latency[m]->len );
+      errors += clients[c].errors[m];
+    }
+
+    if( all->len )
+    {
+      g_array_sort( all, compare_u64 );
+      total += all->len;
+
+      g_printerr( "%-14s %10u %8" G_GUINT64_FORMAT " %12.1f %10.1f %10.1f %10.1f %10.1f\n",
+                  load_method_names[m], all->len, errors, (gdouble)all->len / seconds,
+                  percentile_usec( all, 0.50 ), percentile_usec( all, 0.99 ),
+                  percentile_usec( all, 0.999 ), percentile_usec( all, 1.0 ) );
+
+      g_string_append_printf( out, "%s\n    { \"method\": \"%s\", \"calls\": %u, \"errors\": %" G_GUINT64_FORMAT,
+                              first ? "" : ",", load_method_names[m], all->len, errors );
+      json_number( out, "calls_per_sec", (gdouble)all->len / seconds );
+      json_number( out, "p50_usec",  percentile_usec( all, 0.50 ) );
+      json_number( out, "p99_usec",  percentile_usec( all, 0.99 ) );
+      json_number( out, "p999_usec", percentile_usec( all, 0.999 ) );
+      json_number( out, "max_usec",  percentile_usec( all, 1.0 ) );
+      g_string_append( out, " }" );
+      first = FALSE;
+    }
+    g_array_unref( all );
+  }
+
+  g_printerr( "%-14s %10" G_GUINT64_FORMAT " %8s %12.1f\n", "total", total, "", (gdouble)total / seconds );
+
+  g_string_append_printf( out, "\n  ],\n  \"calls\": %" G_GUINT64_FORMAT, total );
+  json_number( out, "calls_per_sec", (gdouble)total / seconds );
+  g_string_append( out, "\n}\n" );
+
+  fputs( out->str, fp );
+  fflush( fp );
+  g_string_free( out, TRUE );
+}
+
+
+/*******
+  main:
+ */
+gint main( gint argc, gchar **argv )
+{
+  GError              *error    = NULL;
+  GOptionContext      *context;
+  gchar               *daemon_path = NULL;
+  gchar               *mix      = NULL;
+  gchar               *output   = NULL;
+  gint                 nclients = 8;
+  gint                 duration = 10;
+  gint                 timeout  = 25000;
+  gint                 latency  = 0;
+  gboolean             verbose  = FALSE;
+  struct load          load;
+  struct load_client  *clients  = NULL;
+  GTestDBus           *bus      = NULL;
+  mock_polkit         *mock     = NULL;
+  GSubprocess         *daemon   = NULL;
+  gchar               *root;
+  guint64              start;
+  FILE                *fp       = stdout;
+  gint                 ret      = 1;
+  gint                 c, m;
+
+  const GOptionEntry options[] = {
+    { "daemon",      0,   0, G_OPTION_ARG_FILENAME, &daemon_path, _("timedated executable (" TIMEDATED_PATH ")"),     "PATH" },
+    { "clients",     'c', 0, G_OPTION_ARG_INT,      &nclients, _("Number of concurrent clients (8)"),                "N" },
+    { "duration",    't', 0, G_OPTION_ARG_INT,      &duration, _("Seconds to run (10)"),                            "SEC" },
+    { "mix",         'm', 0, G_OPTION_ARG_STRING,   &mix,      _("Weights of methods (" LOAD_MIX_DEFAULT ")"),      "MIX" },
+    { "timeout",     0,   0, G_OPTION_ARG_INT,      &timeout,  _("Call timeout in msec (25000)"),                    "MSEC" },
+    { "rtc-latency", 0,   0, G_OPTION_ARG_INT,      &latency,  _("Simulated RTC ioctl latency in microseconds"),    "USEC" },
+    { "output",      'o', 0, G_OPTION_ARG_FILENAME, &output,   _("Write JSON results to FILE"),                      "FILE" },
+    { "verbose",     'v', 0, G_OPTION_ARG_NONE,     &verbose,  _("Show the daemon output"),                          NULL },
+    { NULL }
+  };
+
+  setlocale( LC_ALL, "" );
+
+  context = g_option_context_new( "" );
+  g_option_context_add_main_entries( context, options, NULL );
+  if( !g_option_context_parse( context, &argc, &argv, &error ) )
+  {
+    g_warning( "Failed to parse command-line options: %s", error->message );
+    g_error_free( error );
+    return 1;
+  }
+  g_option_context_free( context );
+
+  memset( &load, 0, sizeof(load) );
+  if( nclients < 1 || duration < 1 || !parse_mix( &load, mix ? mix : LOAD_MIX_DEFAULT ) )
+  {
+    g_warning( "Invalid load parameters" );
+    return 1;
+  }
+  load.timeout = timeout;
+
+  root = sysroot_new();
+  if( !root || !sysroot_add_ntp_service( root ) )
+  {
+    sysroot_free( root );
+    return 1;
+  }
+
+  /* private bus which the daemon and libpolkit take as the system bus */
+  bus = g_test_dbus_new( G_TEST_DBUS_NONE );
+  g_test_dbus_up( bus );
+  load.address = g_test_dbus_get_bus_address( bus );
+
+  mock = mock_polkit_start( load.address, TRUE, &error );
+  if( !mock )
+  {
+    g_warning( "loadgen: Cannot start polkit authority: %s", error->message );
+    g_clear_error( &error );
+    goto out;
+  }
+
+  daemon = start_daemon( daemon_path ? daemon_path : TIMEDATED_PATH, load.address, root, latency, verbose, &error );
+  if( !daemon )
+  {
+    g_warning( "loadgen: Cannot start the daemon: %s", error->message );
+    g_clear_error( &error );
+    goto out;
+  }
+
+  if( !wait_daemon( load.address ) )
+  {
+    g_warning( "loadgen: The daemon did not appear on the bus" );
+    goto out;
+  }
+
+  clients = g_new0( struct load_client, nclients );
+
+  start = load_now();
+  load.deadline = start + (guint64)duration * NSEC_PER_SEC;
+
+  for( c = 0; c < nclients; ++c )
+  {
+    clients[c].load = &load;
+    for( m = 0; m < LOAD_METHODS; ++m )
+      clients[c].latency[m] = g_array_new( FALSE, FALSE, sizeof(guint64) );
+    clients[c].thread = g_thread_new( "loadgen-client", load_client_thread, &clients[c] );
+  }
+
+  ret = 0;
+  for( c = 0; c < nclients; ++c )
+  {
+    g_thread_join( clients[c].thread );
+    if( clients[c].error )
+    {
+      g_warning( "loadgen: client %d: %s", c, clients[c].error );
+      ret = 1;
+    }
+  }
+
+  if( output && !(fp = fopen( output, "w" )) )
+  {
+    g_warning( "Cannot write '%s': %s", output, g_strerror( errno ) );
+    fp  = stdout;
+    ret = 1;
+  }
+  report( fp, clients, (guint)nclients, (gdouble)( load_now() - start ) / (gdouble)NSEC_PER_SEC );
+  if( fp != stdout )
+    fclose( fp );
+
+  for( c = 0; c < nclients; ++c )
+  {
+    for( m = 0; m < LOAD_METHODS; ++m )
+      g_array_unref( clients[c].latency[m] );
+    g_free( clients[c].error );
+  }
+  g_free( clients );
+
+out:
+  if( daemon )
+  {
+    g_subprocess_send_signal( daemon, SIGTERM );
+    (void)g_subprocess_wait( daemon, NULL, NULL );
+    g_object_unref( daemon );
+  }
+  mock_polkit_stop( mock );
+  g_test_dbus_down( bus );
+  g_object_unref( bus );
+  sysroot_free( root );
+
+  g_free( daemon_path );
+  g_free( mix );
+  g_free( output );
+
+  return ret;
+}
@@ -0,0 +1,320 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <gio/gunixconnection.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "rcl-handover-utils.h"
+#include "rcl-sys.h"
+
+/* running daemon: */
+static GSocketService       *service       = NULL;
+static ino_t                 service_inode = 0;     /* of HANDOVER_SOCKET as it was bound */
+static handover_export_func  export_cb     = NULL;
+static gpointer              export_data   = NULL;
+static gboolean              export_ready  = FALSE; /* the state is read, see handover_ready() */
+static GSList               *waiting       = NULL;  /* successors connected before the daemon is ready */
+static GSocketConnection    *successor     = NULL;  /* has the current state, waits for the exit */
+
+/* successor: */
+static GSocketConnection    *predecessor        = NULL;
+static GSource              *predecessor_source = NULL;
+static handover_import_func  import_cb          = NULL;
+static gpointer              import_data        = NULL;
+
+
+/***************************************************************
+  Running daemon:
+  ==============
+ */
+static void
+handover_send( GSocketConnection *connection )
+{
+  GError *error = NULL;
+  int     fd;
+
+  fd = export_cb( export_data );
+  if( fd < 0 )
+  {
+    g_debug( "handover: error: Cannot export the state" );
+    return;
+  }
+
+  if( !g_unix_connection_send_fd( G_UNIX_CONNECTION( connection ), fd, NULL, &error ) )
+  {
+    g_debug( "handover: error: Cannot send the state: %s", error->message );
+    g_error_free( error );
+    close( fd );
+    return;
+  }
+  close( fd );
+
+  g_debug( "handover: The state is sent to the successor" );
+
+  /* the last started successor is told when the daemon exits */
+  g_clear_object( &successor );
+  successor = g_object_ref( connection );
+}
+
+static gboolean
+handover_incoming( GSocketService    *listener,
+                   GSocketConnection *connection,
+                   GObject           *source_object,
+                   gpointer           user_data )
+{
+  GCredentials *credentials;
+
+  /* the state is given to the same user only */
+  credentials = g_socket_get_credentials( g_socket_connection_get_socket( connection ), NULL );
+  if( !credentials || g_credentials_get_unix_user( credentials, NULL ) != getuid() )
+  {
+    g_debug( "handover: error: The peer is not allowed" );
+    g_clear_object( &credentials );
+    return TRUE;
+  }
+  g_object_unref( credentials );
+
+  /* the main loop is not blocked: the state is sent by handover_ready() */
+  if( !export_ready )
+  {
+    g_debug( "handover: The successor waits until the state is read" );
+    waiting = g_slist_append( waiting, g_object_ref( connection ) );
+    return TRUE;
+  }
+
+  handover_send( connection );
+
+  return TRUE;
+}
+
+/***************************************************************
+  handover_listen():
+  -----------------
+    Give the state to a successor started with --replace. The socket
+    is created by the owner of the name, the socket of the previous
+    owner is replaced.
+ */
+gboolean handover_listen( handover_export_func export, gpointer user_data )
+{
+  GSocketAddress *address;
+  GStatBuf        st;
+  GError         *error = NULL;
+  gchar          *path;
+
+  if( service || !export )
+    return FALSE;
+
+  export_cb   = export;
+  export_data = user_data;
+
+  (void)sys_mkdir_with_parents( TIMEDATED_RUN_DIR, 0755 );
+  (void)sys_unlink( HANDOVER_SOCKET );
+
+  path    = sys_path( HANDOVER_SOCKET );
+  address = g_unix_socket_address_new( path );
+  service = g_socket_service_new();
+
+  if( !g_socket_listener_add_address( G_SOCKET_LISTENER( service ), address,
+                                      G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                      NULL, NULL, &error ) )
+  {
+    g_debug( "handover: error: Cannot listen on '%s': %s", path, error->message );
+    g_error_free( error );
+    g_clear_object( &service );
+    g_object_unref( address );
+    g_free( path );
+    return FALSE;
+  }
+  g_object_unref( address );
+
+  (void)chmod( path, 0600 );
+  if( sys_stat( HANDOVER_SOCKET, &st ) == 0 )
+    service_inode = st.st_ino;
+  g_free( path );
+
+  g_signal_connect( service, "incoming", G_CALLBACK( handover_incoming ), NULL );
+  g_socket_service_start( service );
+
+  return TRUE;
+}
+
+/***************************************************************
+  handover_ready():
+  ----------------
+    The state is read: send it to the successors connected before
+    and to the next ones at once.
+ */
+void handover_ready( void )
+{
+  GSList *list;
+
+  if( export_ready )
+    return;
+  export_ready = TRUE;
+
+  if( !service )
+    return;
+
+  list    = waiting;
+  waiting = NULL;
+  for( ; list; list = g_slist_delete_link( list, list ) )
+  {
+    handover_send( G_SOCKET_CONNECTION( list->data ) );
+    g_object_unref( list->data );
+  }
+}
+
+/***************************************************************
+  handover_release():
+  ------------------
+    Tell the successor that the daemon exits: the connection is
+    closed when the final state is written to disk.
+ */
+void handover_release( void )
+{
+  GStatBuf  st;
+  GSList   *list;
+
+  if( !service )
+    return;
+
+  g_socket_service_stop( service );
+  g_socket_listener_close( G_SOCKET_LISTENER( service ) );
+  g_clear_object( &service );
+
+  /* the state is not read yet, the successors start from the disk */
+  for( list = waiting; list; list = list->next )
+    (void)g_io_stream_close( G_IO_STREAM( list->data ), NULL, NULL );
+  g_slist_free_full( waiting, g_object_unref );
+  waiting = NULL;
+
+  if( !successor )
+  {
+    /* nobody has taken the place, unless the socket is already a successor's */
+    if( sys_stat( HANDOVER_SOCKET, &st ) == 0 && st.st_ino == service_inode )
+      (void)sys_unlink( HANDOVER_SOCKET );
+    return;
+  }
+
+  (void)g_io_stream_close( G_IO_STREAM( successor ), NULL, NULL );
+  g_clear_object( &successor );
+
+  g_debug( "handover: The successor takes the final state" );
+}
+
+
+/***************************************************************
+  Successor:
+  =========
+ */
+/***************************************************************
+  handover_connect():
+  ------------------
+    The current state of the running daemon, -1 if there is no
+    running daemon. The connection is kept until the running daemon
+    exits.
+ */
+int handover_connect( void )
+{
+  GSocket        *socket;
+  GSocketAddress *address;
+  GError         *error = NULL;
+  gchar          *path;
+  int             fd;
+
+  socket = g_socket_new( G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, &error );
+  if( !socket )
+  {
+    g_debug( "handover: error: %s", error->message );
+    g_error_free( error );
+    return -1;
+  }
+  g_socket_set_timeout( socket, HANDOVER_TIMEOUT );
+
+  path    = sys_path( HANDOVER_SOCKET );
+  address = g_unix_socket_address_new( path );
+  g_free( path );
+
+  if( !g_socket_connect( socket, address, NULL, &error ) )
+  {
+    g_debug( "handover: There is no running daemon: %s", error->message );
+    g_error_free( error );
+    g_object_unref( address );
+    g_object_unref( socket );
+    return -1;
+  }
+  g_object_unref( address );
+
+  predecessor = g_socket_connection_factory_create_connection( socket );
+  g_object_unref( socket );
+
+  fd = g_unix_connection_receive_fd( G_UNIX_CONNECTION( predecessor ), NULL, &error );
+  if( fd < 0 )
+  {
+    g_debug( "handover: error: Cannot receive the state: %s", error->message );
+    g_error_free( error );
+    g_clear_object( &predecessor );
+    return -1;
+  }
+
+  g_debug( "handover: The state is taken from the running daemon" );
+
+  return fd;
+}
+
+static gboolean
+handover_final( GSocket      *socket,
+                GIOCondition  condition,
+                gpointer      user_data )
+{
+  /* nothing is sent anymore: the predecessor has closed the connection */
+  g_debug( "handover: The predecessor has exited" );
+
+  (void)g_io_stream_close( G_IO_STREAM( predecessor ), NULL, NULL );
+  g_clear_object( &predecessor );
+  g_source_unref( predecessor_source );
+  predecessor_source = NULL;
+
+  import_cb( import_data );
+
+  return G_SOURCE_REMOVE;
+}
+
+/***************************************************************
+  handover_watch():
+  ----------------
+    Take the final state when the predecessor exits.
+ */
+void handover_watch( handover_import_func import, gpointer user_data )
+{
+  if( !predecessor || predecessor_source || !import )
+    return;
+
+  import_cb   = import;
+  import_data = user_data;
+
+  predecessor_source = g_socket_create_source( g_socket_connection_get_socket( predecessor ),
+                                               G_IO_IN | G_IO_HUP | G_IO_ERR, NULL );
+  g_source_set_callback( predecessor_source, G_SOURCE_FUNC( handover_final ), NULL, NULL );
+  g_source_attach( predecessor_source, NULL );
+}
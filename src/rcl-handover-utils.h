@@ -0,0 +1,68 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_HANDOVER_UTILS_H__
+#define __RCL_HANDOVER_UTILS_H__
+
+#include "config.h"
+
+#include <string.h>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#if !defined( TIMEDATED_RUN_DIR )
+#define TIMEDATED_RUN_DIR "/run/timedated"
+#endif
+
+#define HANDOVER_SOCKET   TIMEDATED_RUN_DIR "/handover"
+#define HANDOVER_TIMEOUT  1     /* sec to wait for the state of the running daemon */
+
+/*
+  The daemon started with --replace takes the state of the running
+  one over a unix socket before it requests the name. The state is a
+  sealed memory file (see snapshot_memfd()) passed with SCM_RIGHTS:
+
+    successor                          running daemon
+    ---------                          --------------
+    handover_connect()      ----->     export(): the current state
+                                       (once the daemon is ready)
+    requests the name       ----->     loses the name, answers the
+                                       calls which are in progress
+    import(): re-reads the  <-----     handover_release(): closes
+              final state              the connection, exits
+
+  export() returns the file descriptor of the state (it is closed by
+  the caller). The final state is written to disk by the running
+  daemon before it exits, import() is called when the connection is
+  closed.
+ */
+typedef int  (*handover_export_func) ( gpointer user_data );
+typedef void (*handover_import_func) ( gpointer user_data );
+
+extern gboolean  handover_listen   ( handover_export_func export, gpointer user_data );
+extern void      handover_ready    ( void );
+extern void      handover_release  ( void );
+
+extern int       handover_connect  ( void );
+extern void      handover_watch    ( handover_import_func import, gpointer user_data );
+
+
+#endif /* __RCL_HANDOVER_UTILS_H__ */
@@ -0,0 +1,157 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "rcl-leap-utils.h"
+#include "rcl-sys.h"
+
+/*
+  One entry of leap-seconds.list: since the Unix time 'since'
+  the TAI-UTC offset is 'tai_offset' seconds.
+ */
+struct leap_entry
+{
+  gint64  since;
+  gint    tai_offset;
+};
+
+/* The table is sorted by 'since' (the file is sorted, it is checked on load) */
+static struct leap_entry *leap_table   = NULL;
+static gsize              leap_entries = 0;
+static time_t             leap_expires = 0;
+
+
+/***************************************************************
+  leap_table_load():
+  -----------------
+    Parse IERS/tzdata leap-seconds.list:
+
+      #@  3944332800              -- expiration time (NTP seconds)
+      2272060800  10  # 1 Jan 1972 -- NTP seconds, TAI-UTC
+
+    On error the previous table is kept.
+ */
+gboolean leap_table_load( const gchar *path )
+{
+  FILE              *fp;
+  gchar              line[256];
+  GArray            *table;
+  gint64             expires = 0;
+
+  if( !path )
+    path = LEAP_SECONDS_LIST;
+
+  fp = sys_fopen( path, "re" );
+  if( !fp )
+  {
+    g_debug( "leap: error: Cannot open '%s'", path );
+    return FALSE;
+  }
+
+  table = g_array_new( FALSE, TRUE, sizeof(struct leap_entry) );
+
+  while( fgets( line, sizeof(line), fp ) )
+  {
+    struct leap_entry  entry;
+    gint64             ntp;
+    gint               offset;
+
+    if( line[0] == '#' )
+    {
+      if( line[1] == '@' && sscanf( line + 2, "%" G_GINT64_FORMAT, &ntp ) == 1 )
+        expires = ntp - NTP_EPOCH_OFFSET;
+      continue;
+    }
+
+    if( sscanf( line, "%" G_GINT64_FORMAT " %d", &ntp, &offset ) != 2 )
+      continue;
+
+    entry.since      = ntp - NTP_EPOCH_OFFSET;
+    entry.tai_offset = offset;
+
+    if( table->len && entry.since <= g_array_index( table, struct leap_entry, table->len - 1 ).since )
+    {
+      g_debug( "leap: error: '%s' is not sorted", path );
+      fclose( fp );
+      g_array_free( table, TRUE );
+      return FALSE;
+    }
+
+    g_array_append_vals( table, &entry, 1 );
+  }
+
+  fclose( fp );
+
+  if( !table->len )
+  {
+    g_debug( "leap: error: No leap seconds in '%s'", path );
+    g_array_free( table, TRUE );
+    return FALSE;
+  }
+
+  g_free( leap_table );
+  leap_entries = table->len;
+  leap_table   = (struct leap_entry *)g_array_free( table, FALSE );
+  leap_expires = (time_t)expires;
+
+  g_debug( "leap: Loaded %" G_GSIZE_FORMAT " entries from '%s'", leap_entries, path );
+
+  return TRUE;
+}
+
+/***************************************************************
+  leap_table_lookup():
+  -------------------
+    TAI-UTC offset at the time t and the next leap second after t
+    (next_leap is zero if the table does not know one). The delta
+    is +1 for the inserted and -1 for the deleted second.
+ */
+gboolean leap_table_lookup( time_t t, gint *tai_offset, time_t *next_leap, gint *next_delta )
+{
+  gsize lo = 0, hi = leap_entries;
+
+  if( !leap_table )
+    return FALSE;
+
+  /* the first entry after t */
+  while( lo < hi )
+  {
+    gsize mid = lo + (hi - lo) / 2;
+
+    if( leap_table[mid].since <= (gint64)t )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if( tai_offset )
+    *tai_offset = lo ? leap_table[lo - 1].tai_offset : 0;
+
+  if( next_leap )
+    *next_leap = ( lo < leap_entries ) ? (time_t)leap_table[lo].since : 0;
+
+  if( next_delta )
+    *next_delta = ( lo < leap_entries && lo ) ? leap_table[lo].tai_offset - leap_table[lo - 1].tai_offset : 0;
+
+  return TRUE;
+}
+
+time_t leap_table_expires( void )
+{
+  return leap_expires;
+}
@@ -0,0 +1,46 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_LEAP_UTILS_H__
+#define __RCL_LEAP_UTILS_H__
+
+#include "config.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#if !defined( LEAP_SECONDS_LIST )
+#define LEAP_SECONDS_LIST "/usr/share/zoneinfo/leap-seconds.list"
+#endif
+
+/* Seconds between NTP epoch (1900) and Unix epoch (1970) */
+#define NTP_EPOCH_OFFSET  2208988800LL
+
+extern gboolean  leap_table_load     ( const gchar *path );
+extern gboolean  leap_table_lookup   ( time_t t, gint *tai_offset, time_t *next_leap, gint *next_delta );
+extern time_t    leap_table_expires  ( void );
+
+
+#endif /* __RCL_LEAP_UTILS_H__ */
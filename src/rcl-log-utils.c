@@ -0,0 +1,313 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <syslog.h>
+
+#include "rcl-log-utils.h"
+
+/*
+  A writer (any thread) takes the next position with an atomic add and
+  marks its slot with 2 * position + 1 while the record is filled in and
+  with 2 * position + 2 when it is complete. A reader copies the slot and
+  checks that the mark did not change meanwhile, so logging never takes
+  a lock. Only the flushes to stderr or syslog are serialized.
+
+  The time is stored as is; it is formatted at the flush, where the
+  string of the current second is reused.
+ */
+struct log_slot
+{
+  guint64  mark;
+  gint64   time;                        /* g_get_real_time() */
+  guint32  level;
+  gchar    domain[20];
+  gchar    message[LOG_MESSAGE_SIZE];
+};
+
+static struct log_slot  ring[LOG_RING_RECORDS];
+static guint64          head = 0;           /* next position */
+
+static log_output       target  = LOG_OUTPUT_STDERR;
+static gboolean         verbose = FALSE;
+static gboolean         colors  = FALSE;
+
+static GMutex           flush_lock;
+static guint64          flushed = 0;        /* next position to write out */
+static gint             flush_pending = 0;  /* idle flush is scheduled */
+static GString         *flush_buffer = NULL;
+
+
+static const gchar *level_name( guint32 level )
+{
+  if( level & G_LOG_LEVEL_ERROR )    return "error";
+  if( level & G_LOG_LEVEL_CRITICAL ) return "critical";
+  if( level & G_LOG_LEVEL_WARNING )  return "warning";
+  if( level & G_LOG_LEVEL_MESSAGE )  return "message";
+  if( level & G_LOG_LEVEL_INFO )     return "info";
+  return "debug";
+}
+
+static int level_priority( guint32 level )
+{
+  if( level & G_LOG_LEVEL_ERROR )    return LOG_ERR;
+  if( level & G_LOG_LEVEL_CRITICAL ) return LOG_CRIT;
+  if( level & G_LOG_LEVEL_WARNING )  return LOG_WARNING;
+  if( level & G_LOG_LEVEL_MESSAGE )  return LOG_NOTICE;
+  if( level & G_LOG_LEVEL_INFO )     return LOG_INFO;
+  return LOG_DEBUG;
+}
+
+static gboolean is_output( guint32 level )
+{
+  return verbose || ( level & ( G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING | G_LOG_LEVEL_MESSAGE ) );
+}
+
+static gboolean is_error( guint32 level )
+{
+  return ( level & ( G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING ) ) != 0;
+}
+
+/*
+  Copy of the record at position pos:
+  returns 1 on success, 0 if the record is not written yet and -1 if it
+  was overwritten by a newer one.
+ */
+static gint slot_read( guint64 pos, struct log_slot *copy )
+{
+  const struct log_slot *slot = &ring[pos & ( LOG_RING_RECORDS - 1 )];
+  guint64                mark = __atomic_load_n( &slot->mark, __ATOMIC_ACQUIRE );
+
+  if( mark != 2 * pos + 2 )
+    return mark > 2 * pos + 2 ? -1 : 0;
+
+  memcpy( copy, slot, sizeof( *copy ) );
+  __atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+  return __atomic_load_n( &slot->mark, __ATOMIC_RELAXED ) == mark ? 1 : -1;
+}
+
+
+/***************************************************************
+  Output:
+  ======
+ */
+static const gchar *time_stamp( gint64 usec )
+{
+  static time_t  cached = (time_t)-1;
+  static gchar   stamp[16] = "";
+  time_t         sec = (time_t)( usec / G_USEC_PER_SEC );
+  struct tm      tm;
+
+  if( sec != cached && localtime_r( &sec, &tm ) )
+  {
+    strftime( stamp, sizeof( stamp ), "%H:%M:%S", &tm );
+    cached = sec;
+  }
+
+  return stamp;
+}
+
+static void emit( gint64 time, guint32 level, const gchar *message )
+{
+  if( target == LOG_OUTPUT_SYSLOG )
+  {
+    syslog( level_priority( level ), "%s", message );
+    return;
+  }
+
+  /* header in green, errors in red and debug in blue */
+  if( colors )
+    g_string_append_printf( flush_buffer, "%c[%dmTI:%s\t%c[%dm%s\n%c[%dm",
+                            0x1B, 32, time_stamp( time ), 0x1B, is_error( level ) ? 31 : 34, message, 0x1B, 0 );
+  else
+    g_string_append_printf( flush_buffer, "TI:%s\t%s\n", time_stamp( time ), message );
+}
+
+static void emit_lost( guint64 lost )
+{
+  gchar *message = g_strdup_printf( "%" G_GUINT64_FORMAT " log records lost", lost );
+
+  emit( g_get_real_time(), G_LOG_LEVEL_WARNING, message );
+  g_free( message );
+}
+
+static void write_out( void )
+{
+  const gchar *p = flush_buffer->str;
+  gsize        n = flush_buffer->len;
+
+  while( n > 0 )
+  {
+    ssize_t rc = write( STDERR_FILENO, p, n );
+
+    if( rc < 0 )
+    {
+      if( errno == EINTR )
+        continue;
+      break;
+    }
+    p += rc; n -= (gsize)rc;
+  }
+
+  g_string_truncate( flush_buffer, 0 );
+}
+
+/*
+  Write out the records which were not written yet. Stops at a record
+  still being filled in; its writer schedules the next flush.
+ */
+void log_flush( void )
+{
+  struct log_slot  record;
+  guint64          end;
+
+  g_mutex_lock( &flush_lock );
+
+  if( !flush_buffer )
+    flush_buffer = g_string_sized_new( 4096 );
+
+  end = __atomic_load_n( &head, __ATOMIC_ACQUIRE );
+  if( end - flushed > LOG_RING_RECORDS )
+  {
+    emit_lost( end - flushed - LOG_RING_RECORDS );
+    flushed = end - LOG_RING_RECORDS;
+  }
+
+  for( ; flushed < end; ++flushed )
+  {
+    gint rc = slot_read( flushed, &record );
+
+    if( rc == 0 )
+      break;
+    if( rc < 0 )
+    {
+      emit_lost( 1 );
+      continue;
+    }
+    if( is_output( record.level ) )
+      emit( record.time, record.level, record.message );
+  }
+
+  if( flush_buffer->len )
+    write_out();
+
+  g_mutex_unlock( &flush_lock );
+}
+
+static gboolean flush_idle_cb( gpointer user_data )
+{
+  g_atomic_int_set( &flush_pending, 0 );
+  log_flush();
+
+  return G_SOURCE_REMOVE;
+}
+
+
+/***************************************************************
+  log_record:
+  ==========
+ */
+void log_record( const gchar *log_domain, GLogLevelFlags log_level, const gchar *message )
+{
+  guint64          pos  = __atomic_fetch_add( &head, 1, __ATOMIC_RELAXED );
+  struct log_slot *slot = &ring[pos & ( LOG_RING_RECORDS - 1 )];
+  guint32          level = (guint32)( log_level & G_LOG_LEVEL_MASK );
+
+  __atomic_store_n( &slot->mark, 2 * pos + 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+
+  slot->time  = g_get_real_time();
+  slot->level = level;
+  g_strlcpy( slot->domain, log_domain ? log_domain : "", sizeof( slot->domain ) );
+  g_strlcpy( slot->message, message ? message : "", sizeof( slot->message ) );
+
+  __atomic_store_n( &slot->mark, 2 * pos + 2, __ATOMIC_RELEASE );
+
+  if( !is_output( level ) )
+    return;
+
+  /* may be the last record before abort() */
+  if( log_level & ( G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL ) )
+  {
+    log_flush();
+    return;
+  }
+
+  if( g_atomic_int_compare_and_exchange( &flush_pending, 0, 1 ) )
+    g_idle_add_full( G_PRIORITY_LOW, flush_idle_cb, NULL, NULL );
+}
+
+/***************************************************************
+  log_snapshot:
+  ============
+   Last count records, oldest first, as a(tsss).
+ */
+GVariant *log_snapshot( guint count )
+{
+  GVariantBuilder  builder;
+  struct log_slot  record;
+  guint64          end = __atomic_load_n( &head, __ATOMIC_ACQUIRE );
+  guint64          pos;
+
+  if( count > LOG_RING_RECORDS )
+    count = LOG_RING_RECORDS;
+  pos = end > count ? end - count : 0;
+
+  g_variant_builder_init( &builder, G_VARIANT_TYPE( "a(tsss)" ) );
+
+  for( ; pos < end; ++pos )
+  {
+    const gchar *valid;
+
+    if( slot_read( pos, &record ) <= 0 )
+      continue;
+
+    /* truncated messages may end in a partial character */
+    if( !g_utf8_validate( record.domain, -1, &valid ) )
+      *(gchar *)valid = '\0';
+    if( !g_utf8_validate( record.message, -1, &valid ) )
+      *(gchar *)valid = '\0';
+
+    g_variant_builder_add( &builder, "(tsss)", (guint64)record.time, level_name( record.level ), record.domain, record.message );
+  }
+
+  return g_variant_builder_end( &builder );
+}
+
+/***************************************************************
+  log_init:
+  ========
+ */
+void log_init( log_output output, gboolean verbose_output )
+{
+  target  = output;
+  verbose = verbose_output;
+  colors  = ( output == LOG_OUTPUT_STDERR && isatty( STDERR_FILENO ) );
+
+  if( output == LOG_OUTPUT_SYSLOG )
+    openlog( "timedated", LOG_PID, LOG_DAEMON );
+
+  /* records of the exit paths which never reach the main loop */
+  atexit( log_flush );
+}
@@ -0,0 +1,54 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_LOG_UTILS_H__
+#define __RCL_LOG_UTILS_H__
+
+#include "config.h"
+
+#include <string.h>
+#include <sys/types.h>
+
+#include <glib.h>
+
+/*
+  Records of the daemon log domains are kept in a ring in memory (also
+  debug records when the daemon is not verbose) and written out to
+  stderr or syslog later from the main loop.
+ */
+#if !defined( LOG_RING_RECORDS )
+#define LOG_RING_RECORDS  1024  /* power of two */
+#endif
+#define LOG_MESSAGE_SIZE  232   /* longer messages are truncated */
+
+typedef enum
+{
+  LOG_OUTPUT_STDERR,
+  LOG_OUTPUT_SYSLOG
+} log_output;
+
+extern void      log_init     ( log_output output, gboolean verbose );
+extern void      log_record   ( const gchar *log_domain, GLogLevelFlags log_level, const gchar *message );
+extern void      log_flush    ( void );
+
+extern GVariant *log_snapshot ( guint count );
+
+
+#endif /* __RCL_LOG_UTILS_H__ */
+
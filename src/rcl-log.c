@@ -0,0 +1,119 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "rcl-log.h"
+#include "rcl-log-utils.h"
+
+/*
+  org.freedesktop.timedate1.Log: the last records of the in-memory log
+  kept by rcl-log-utils for post-mortem debugging of a daemon which was
+  not started verbose.
+ */
+
+G_DEFINE_TYPE (RclLog, rcl_log, RCL_TYPE_TIMEDATE_LOG_SKELETON)
+
+#define RCL_LOG_PATH  "/org/freedesktop/timedate1"
+
+
+/***************************************************************
+  GetRecords:
+  ==========
+ */
+static gboolean
+handle_get_records( RclTimedateLog        *object,
+                    GDBusMethodInvocation *invocation,
+                    guint                  count,
+                    RclLog                *log )
+{
+  rcl_timedate_log_complete_get_records( object, invocation, log_snapshot( count ) );
+
+  return TRUE;
+}
+
+
+/***************************************************************
+  rcl_log_register:
+ */
+gboolean
+rcl_log_register( RclLog          *log,
+                  GDBusConnection *connection )
+{
+  GError *error = NULL;
+
+  g_dbus_interface_skeleton_export( G_DBUS_INTERFACE_SKELETON( log ),
+                                    connection,
+                                    RCL_LOG_PATH,
+                                    &error );
+  if( error != NULL )
+  {
+    g_warning( "timedated: warning: Cannot export log interface: %s", error->message );
+    g_error_free( error );
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/***************************************************************
+  rcl_log_unregister:
+ */
+void
+rcl_log_unregister( RclLog *log )
+{
+  if( !g_dbus_interface_skeleton_get_connection( G_DBUS_INTERFACE_SKELETON( log ) ) )
+    return;
+
+  g_dbus_interface_skeleton_unexport( G_DBUS_INTERFACE_SKELETON( log ) );
+}
+
+/***************************************************************
+  rcl_log_init:
+ */
+static void
+rcl_log_init( RclLog *log )
+{
+  g_signal_connect( RCL_TIMEDATE_LOG( log ),
+                    "handle-get-records",
+                    G_CALLBACK( handle_get_records ),
+                    log ); /* user_data */
+}
+
+/***************************************************************
+  rcl_log_class_init:
+ */
+static void
+rcl_log_class_init( RclLogClass *klass )
+{
+}
+
+/***************************************************************
+  rcl_log_new:
+ */
+RclLog *
+rcl_log_new( void )
+{
+  return RCL_LOG( g_object_new( RCL_TYPE_LOG, NULL ) );
+}
@@ -0,0 +1,54 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef __RCL_LOG_H__
+#define __RCL_LOG_H__
+
+#include <dbus/rcl-log-generated.h>
+
+G_BEGIN_DECLS
+
+#define RCL_TYPE_LOG         (rcl_log_get_type ())
+#define RCL_LOG(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), RCL_TYPE_LOG, RclLog))
+#define RCL_LOG_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), RCL_TYPE_LOG, RclLogClass))
+#define RCL_IS_LOG(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), RCL_TYPE_LOG))
+#define RCL_IS_LOG_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), RCL_TYPE_LOG))
+#define RCL_LOG_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), RCL_TYPE_LOG, RclLogClass))
+
+typedef struct
+{
+  RclTimedateLogSkeleton  parent;
+} RclLog;
+
+typedef struct
+{
+  RclTimedateLogSkeletonClass parent_class;
+} RclLogClass;
+
+GType   rcl_log_get_type ( void );
+RclLog *rcl_log_new      ( void );
+
+/* private */
+gboolean  rcl_log_register   ( RclLog          *log,
+                               GDBusConnection *connection );
+void      rcl_log_unregister ( RclLog          *log );
+
+G_END_DECLS
+
+#endif /* __RCL_LOG_H__ */
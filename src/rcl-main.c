@@ -35,13 +35,38 @@
 
 
 #include "rcl-timedate.h"
+#include "rcl-timesync.h"
+#include "rcl-metrics.h"
+#include "rcl-log.h"
+#include "rcl-log-utils.h"
+#include "rcl-time-utils.h"
+#include "rcl-sntp.h"
+#include "rcl-snapshot-utils.h"
+#include "rcl-handover-utils.h"
+#include "rcl-sys.h"
 
 #define TIMEDATE_SERVICE_NAME "org.freedesktop.timedate1"
+#define TIMESYNC_SERVICE_NAME "org.freedesktop.timesync1"
+
+#if !defined( IDLE_TIMEOUT_SEC )
+#define IDLE_TIMEOUT_SEC  0  /* never exit */
+#endif
+#define IDLE_EXIT_GRACE   100 /* msec to answer the calls queued before the name was released */
+#define EXIT_DRAIN_MAX    25  /* sec, a call is not answered later than the D-Bus reply timeout */
 
 typedef struct RclState
 {
-  RclDaemon  *daemon;
-  GMainLoop  *loop;
+  RclDaemon    *daemon;
+  RclTimesync  *timesync;
+  guint         timesync_id;
+  RclMetrics   *metrics;
+  RclLog       *log;
+  guint         timedate_id;
+  guint         idle_timeout;
+  guint         idle_timer;
+  gint64        exit_since;
+  gint64        start;
+  GMainLoop    *loop;
 } RclState;
 
 static void
@@ -49,6 +74,25 @@ rcl_state_free( RclState *state )
 {
   rcl_daemon_shutdown( state->daemon );
 
+  /* the final state for the successor started with --replace */
+  handover_release();
+
+  if( state->idle_timer )
+    g_source_remove( state->idle_timer );
+
+  if( state->timedate_id )
+    g_bus_unown_name( state->timedate_id );
+  if( state->timesync_id )
+    g_bus_unown_name( state->timesync_id );
+  rcl_timesync_unregister( state->timesync );
+
+  if( state->metrics )
+    rcl_metrics_unregister( state->metrics );
+  rcl_log_unregister( state->log );
+
+  g_clear_object( &state->log );
+  g_clear_object( &state->metrics );
+  g_clear_object( &state->timesync );
   g_clear_object( &state->daemon );
   g_clear_pointer( &state->loop, g_main_loop_unref );
 
@@ -61,11 +105,67 @@ rcl_state_new( void )
   RclState *state = g_new0( RclState, 1 );
 
   state->daemon = rcl_daemon_new();
+  state->timesync = rcl_timesync_new();
+  state->log = rcl_log_new();
   state->loop = g_main_loop_new( NULL, FALSE );
 
   return state;
 }
 
+/******************
+  rcl_main_exit_cb:
+
+  Calls which came before the name was released (idle exit) or taken
+  over (--replace) are answered and the pending RTC write is done
+  before the daemon exits.
+ */
+static gboolean
+rcl_main_exit_cb( gpointer user_data )
+{
+  RclState *state = user_data;
+
+  if( rcl_daemon_is_busy( state->daemon ) &&
+      g_get_monotonic_time() - state->exit_since < (gint64)EXIT_DRAIN_MAX * G_USEC_PER_SEC )
+    return G_SOURCE_CONTINUE;
+
+  state->idle_timer = 0;
+  g_main_loop_quit( state->loop );
+
+  return G_SOURCE_REMOVE;
+}
+
+/******************
+  rcl_main_idle_cb:
+
+  With --idle-timeout the names are released when the daemon is idle,
+  the next call starts it again by D-Bus activation. The state of the
+  daemon is saved first, the calls which came meanwhile are answered
+  during the grace period.
+ */
+static gboolean
+rcl_main_idle_cb( gpointer user_data )
+{
+  RclState *state = user_data;
+
+  if( !rcl_daemon_is_idle( state->daemon, state->idle_timeout ) )
+    return G_SOURCE_CONTINUE;
+
+  g_debug( "Idle for %u seconds, exiting", state->idle_timeout );
+
+  rcl_daemon_prepare_exit( state->daemon );
+
+  if( state->timesync_id )
+    g_bus_unown_name( state->timesync_id );
+  state->timesync_id = 0;
+  g_bus_unown_name( state->timedate_id );
+  state->timedate_id = 0;
+
+  state->exit_since = g_get_monotonic_time();
+  state->idle_timer = g_timeout_add( IDLE_EXIT_GRACE, rcl_main_exit_cb, state );
+
+  return G_SOURCE_REMOVE;
+}
+
 /************************
   rcl_main_bus_acquired:
  */
@@ -76,11 +176,67 @@ rcl_main_bus_acquired( GDBusConnection *connection,
 {
   RclState *state = user_data;
 
+  rcl_daemon_startup_phase( state->daemon, "bus", state->start );
+
   if( !rcl_daemon_startup( state->daemon, connection ) )
   {
     g_warning( "Could not startup daemon" );
     g_main_loop_quit( state->loop );
+    return;
   }
+
+  /* timesync1 status for clients written for systemd (not fatal) */
+  if( rcl_timesync_register( state->timesync, connection ) )
+    state->timesync_id = g_bus_own_name_on_connection( connection,
+                                                       TIMESYNC_SERVICE_NAME,
+                                                       G_BUS_NAME_OWNER_FLAGS_NONE,
+                                                       NULL, NULL, NULL, NULL );
+
+  /* --metrics: counters and latency histograms of the calls (not fatal) */
+  if( state->metrics )
+    (void)rcl_metrics_register( state->metrics, connection );
+
+  /* the last records of the in-memory log (not fatal) */
+  (void)rcl_log_register( state->log, connection );
+
+  if( state->idle_timeout )
+    state->idle_timer = g_timeout_add_seconds( MAX( state->idle_timeout / 4, 1 ), rcl_main_idle_cb, state );
+}
+
+/*******************************
+  rcl_main_handover_export_cb:
+ */
+static int
+rcl_main_handover_export_cb( gpointer user_data )
+{
+  RclState *state = user_data;
+
+  return rcl_daemon_export_state( state->daemon );
+}
+
+/*******************************
+  rcl_main_handover_import_cb:
+ */
+static void
+rcl_main_handover_import_cb( gpointer user_data )
+{
+  RclState *state = user_data;
+
+  rcl_daemon_import_state( state->daemon );
+}
+
+/*******************************
+  rcl_main_handover_ready_cb:
+ */
+static void
+rcl_main_handover_ready_cb( GObject      *source_object,
+                            GAsyncResult *result,
+                            gpointer      user_data )
+{
+  (void)rcl_daemon_ready_finish( RCL_DAEMON( source_object ), result, NULL );
+
+  /* the state is sent to the successor when it is read */
+  handover_ready();
 }
 
 /*************************
@@ -91,7 +247,14 @@ rcl_main_name_acquired( GDBusConnection *connection,
                         const gchar     *name,
                         gpointer         user_data)
 {
+  RclState *state = user_data;
+
+  rcl_daemon_startup_phase( state->daemon, "name", state->start );
   g_debug( "Acquired the name %s", name );
+
+  /* a daemon started with --replace takes the state from here (not fatal) */
+  if( handover_listen( rcl_main_handover_export_cb, state ) )
+    rcl_daemon_ready_async( state->daemon, rcl_main_handover_ready_cb, NULL );
 }
 
 /*********************
@@ -103,8 +266,25 @@ rcl_main_name_lost( GDBusConnection *connection,
                     gpointer         user_data )
 {
   RclState *state = user_data;
+
+  if( state->exit_since )
+    return;
+
   g_debug( "Name lost, exiting" );
-  g_main_loop_quit( state->loop );
+
+  /* the successor keeps the RTC from now on */
+  rcl_daemon_set_replaced( state->daemon );
+
+  if( state->timesync_id )
+    g_bus_unown_name( state->timesync_id );
+  state->timesync_id = 0;
+
+  if( state->idle_timer )
+    g_source_remove( state->idle_timer );
+
+  /* the successor answers new calls, ours are answered before exit */
+  state->exit_since = g_get_monotonic_time();
+  state->idle_timer = g_timeout_add( IDLE_EXIT_GRACE, rcl_main_exit_cb, state );
 }
 
 /*********************
@@ -128,17 +308,6 @@ rcl_main_sigterm_cb( gpointer user_data )
   return FALSE;
 }
 
-/*************************
-  rcl_main_log_ignore_cb:
- */
-static void
-rcl_main_log_ignore_cb( const gchar    *log_domain,
-                        GLogLevelFlags  log_level,
-                        const gchar    *message,
-                        gpointer        user_data )
-{
-}
-
 /**************************
   rcl_main_log_handler_cb:
  */
@@ -148,39 +317,8 @@ rcl_main_log_handler_cb( const gchar    *log_domain,
                          const gchar    *message,
                          gpointer        user_data )
 {
-  gchar str_time[255];
-  time_t the_time;
-
-  /* header always in green */
-  time( &the_time );
-  strftime( str_time, 254, "%H:%M:%S", localtime( &the_time ) );
-  g_print( "%c[%dmTI:%s\t", 0x1B, 32, str_time );
-
-  /* critical is also in red */
-  if( log_level == G_LOG_LEVEL_CRITICAL ||
-      log_level == G_LOG_LEVEL_WARNING  ||
-      log_level == G_LOG_LEVEL_ERROR )
-  {
-    g_print( "%c[%dm%s\n%c[%dm", 0x1B, 31, message, 0x1B, 0 );
-  }
-  else
-  {
-    /* debug in blue */
-    g_print( "%c[%dm%s\n%c[%dm", 0x1B, 34, message, 0x1B, 0 );
-  }
-}
-
-static gboolean
-rcl_main_timed_cb( gpointer user_data )
-{
-  RclState *state = (RclState *)user_data;
-  RclTimedateDaemon *object = RCL_TIMEDATE_DAEMON( state->daemon );
-
-  /* g_debug( "Synchronize properties" ); */
-
-  rcl_daemon_sync_dbus_properties( object );
-
-  return TRUE;
+  /* into the in-memory log; written out later from the main loop */
+  log_record( log_domain, log_level, message );
 }
 
 /*******
@@ -190,17 +328,37 @@ gint main( gint argc, gchar **argv )
 {
   GError             *error    = NULL;
   GOptionContext     *context;
-  guint               timer_id = 0;
   gboolean            debug    = FALSE;
   gboolean            verbose  = FALSE;
   RclState           *state;
   GBusNameOwnerFlags  bus_flags;
   gboolean            replace  = FALSE;
+  gboolean            hctosys  = FALSE;
+  gchar              *rtc_dev  = NULL;
+  gboolean            precise  = FALSE;
+  gchar             **servers  = NULL;
+  gchar              *sim_root = NULL;
+  gint                sim_rtc  = 0;
+  gboolean            metrics  = FALSE;
+  gboolean            use_syslog = FALSE;
+  gint                idle     = IDLE_TIMEOUT_SEC;
+  gboolean            profile  = FALSE;
+  gint64              start    = g_get_monotonic_time();
 
   const GOptionEntry options[] = {
     { "replace", 'r', 0, G_OPTION_ARG_NONE, &replace, _("Replace the old daemon"),               NULL },
     { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, _("Show extra debugging information"),     NULL },
     { "debug",   'd', 0, G_OPTION_ARG_NONE, &debug,   _("Enable debugging (implies --verbose)"), NULL },
+    { "hctosys", 0,   0, G_OPTION_ARG_NONE, &hctosys, _("Set the system clock from RTC and exit"), NULL },
+    { "rtc-device", 0, 0, G_OPTION_ARG_STRING, &rtc_dev, _("RTC to use, e.g. rtc1"),             "RTC" },
+    { "ntp-server", 0, 0, G_OPTION_ARG_STRING_ARRAY, &servers, _("SNTP server instead of NTP daemon config (repeatable)"), "HOST[:PORT]" },
+    { "precise-step", 0, 0, G_OPTION_ARG_NONE, &precise, _("Lock memory and step the clock with real-time priority"), NULL },
+    { "simulate", 0, 0, G_OPTION_ARG_FILENAME, &sim_root, _("Simulate clocks, RTC and files under ROOT (no privileges)"), "ROOT" },
+    { "sim-rtc-latency", 0, 0, G_OPTION_ARG_INT, &sim_rtc, _("Simulated RTC ioctl latency in microseconds"), "USEC" },
+    { "metrics", 0, 0, G_OPTION_ARG_NONE, &metrics, _("Export call counters and latency histograms on D-Bus"), NULL },
+    { "syslog",  0, 0, G_OPTION_ARG_NONE, &use_syslog, _("Write the log to syslog instead of stderr"), NULL },
+    { "idle-timeout", 0, 0, G_OPTION_ARG_INT, &idle, _("Exit after SEC seconds without calls (0: never)"), "SEC" },
+    { "startup-profile", 0, 0, G_OPTION_ARG_NONE, &profile, _("Print the duration of the startup phases"), NULL },
     { NULL }
   };
 
@@ -228,38 +386,87 @@ gint main( gint argc, gchar **argv )
 
   /* verbose? */
   if( verbose )
-  {
     g_log_set_fatal_mask( NULL, G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL );
-    g_log_set_handler( G_LOG_DOMAIN,
-                       G_LOG_LEVEL_ERROR    |
-                       G_LOG_LEVEL_CRITICAL |
-                       G_LOG_LEVEL_DEBUG    |
-                       G_LOG_LEVEL_WARNING,
-                       rcl_main_log_handler_cb, NULL );
-    g_log_set_handler( "Timedate-Linux",
-                       G_LOG_LEVEL_ERROR    |
-                       G_LOG_LEVEL_CRITICAL |
-                       G_LOG_LEVEL_DEBUG    |
-                       G_LOG_LEVEL_WARNING,
-                       rcl_main_log_handler_cb, NULL );
-  }
   else
-  {
-    /* hide all debugging */
     g_log_set_fatal_mask( NULL, G_LOG_LEVEL_ERROR );
-    g_log_set_handler( G_LOG_DOMAIN,
-                       G_LOG_LEVEL_DEBUG,
-                       rcl_main_log_ignore_cb,
-                       NULL );
-    g_log_set_handler( "Timedate-Linux",
-                       G_LOG_LEVEL_DEBUG,
-                       rcl_main_log_ignore_cb,
-                       NULL );
+
+  /*
+    All records of the daemon domains go to the in-memory log, debug
+    too; without --verbose only messages, warnings and errors are
+    written out.
+   */
+  log_init( use_syslog ? LOG_OUTPUT_SYSLOG : LOG_OUTPUT_STDERR, verbose );
+  g_log_set_handler( G_LOG_DOMAIN,
+                     G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL | G_LOG_FLAG_RECURSION,
+                     rcl_main_log_handler_cb, NULL );
+  g_log_set_handler( "Timedate-Linux",
+                     G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL | G_LOG_FLAG_RECURSION,
+                     rcl_main_log_handler_cb, NULL );
+
+  /* simulated system: must be selected before any clock or file access */
+  if( sim_root )
+  {
+    if( !sys_set_simulated( sim_root, (guint)MAX( sim_rtc, 0 ) ) )
+    {
+      g_warning( "Cannot simulate system under '%s'", sim_root );
+      g_free( sim_root );
+      return 1;
+    }
+    g_free( sim_root );
+  }
+
+  /* RTC used for RTCTimeUSec and RTC writes */
+  if( !clock_set_rtc_device( rtc_dev ? rtc_dev : RTC_DEVICE ) )
+  {
+    g_warning( "Invalid RTC device name '%s'", rtc_dev ? rtc_dev : RTC_DEVICE );
+    g_free( rtc_dev );
+    return 1;
+  }
+  g_free( rtc_dev );
+
+  /* boot time: set the system clock from RTC without touching D-Bus */
+  if( hctosys )
+  {
+    if( !clock_hctosys() )
+    {
+      g_warning( "Cannot set the system clock from RTC" );
+      return 1;
+    }
+    return 0;
   }
 
-  /* initialize state */
+  /* built-in SNTP client servers (e.g. a local responder for tests) */
+  if( servers )
+  {
+    (void)sntp_client_set_servers( (const gchar *const *)servers );
+    g_strfreev( servers );
+  }
+
+  /* low-jitter clock steps: lock memory before the daemon grows */
+  if( precise && !clock_set_precise_step( TRUE ) )
+    g_warning( "Cannot lock memory, clock steps are not precise" );
+
+  /* --replace: the state of the running daemon is taken in place of the snapshot */
+  if( replace )
+  {
+    int fd = handover_connect();
+
+    if( fd >= 0 )
+      snapshot_take_fd( fd );
+  }
+
+  /* initialize state: the system state is read in the background */
   state = rcl_state_new();
+  state->start = start;
+  if( profile )
+    rcl_daemon_set_startup_profile( state->daemon, start );
   rcl_daemon_set_debug( state->daemon, debug );
+  if( metrics )
+    state->metrics = rcl_metrics_new();
+  state->idle_timeout = (guint)MAX( idle, 0 );
+
+  /* and its final state when it exits */
+  handover_watch( rcl_main_handover_import_cb, state );
 
   /* do stuff on ctrl-c */
   g_unix_signal_add_full( G_PRIORITY_DEFAULT,
@@ -280,20 +487,17 @@ gint main( gint argc, gchar **argv )
   if( replace )
     bus_flags |= G_BUS_NAME_OWNER_FLAGS_REPLACE;
 
-  g_bus_own_name( G_BUS_TYPE_SYSTEM,
-                  TIMEDATE_SERVICE_NAME,
-                  bus_flags,
-                  rcl_main_bus_acquired,
-                  rcl_main_name_acquired,
-                  rcl_main_name_lost,
-                  state, NULL );
-
-  g_debug( "Starting timedated version %s", PACKAGE_VERSION );
+  state->timedate_id = g_bus_own_name( G_BUS_TYPE_SYSTEM,
+                                       TIMEDATE_SERVICE_NAME,
+                                       bus_flags,
+                                       rcl_main_bus_acquired,
+                                       rcl_main_name_acquired,
+                                       rcl_main_name_lost,
+                                       state, NULL );
 
-  /* in msec = 1/1000 sec */
-  timer_id = g_timeout_add( 1000, (GSourceFunc)rcl_main_timed_cb, (gpointer)state );
-  g_source_set_name_by_id( timer_id, "[timedate] rcl_main_timed_cb" );
+  g_debug( "Starting timedated version %s (%s system)", PACKAGE_VERSION, sys_backend_name() );
 
+  /* properties are refreshed by the daemon's adaptive sampler and on read */
 
   /* wait for input or timeout */
   g_main_loop_run( state->loop );
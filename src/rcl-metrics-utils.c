@@ -0,0 +1,224 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "rcl-metrics-utils.h"
+
+/*
+  Counters are updated with relaxed atomic adds from the main loop,
+  the GDBus worker thread (call replies) and GTask threads (RTC I/O),
+  no lock is taken. A snapshot reads every counter once; it is not an
+  atomic picture of all of them, but each counter is exact.
+ */
+struct metrics_histogram
+{
+  guint64  count;
+  guint64  sum_usec;
+  guint64  buckets[METRICS_BUCKETS];
+};
+
+struct metrics_counters
+{
+  guint64                   calls;
+  guint64                   errors;
+  struct metrics_histogram  phases[METRICS_PHASES];
+};
+
+static const gchar *const method_names[METRICS_METHODS] =
+{
+  "SetTime", "SlewTime", "SetTimezone", "SetLocalRTC", "SetNTP", "ListTimezones", "Properties", "background"
+};
+
+static const gchar *const phase_names[METRICS_PHASES] =
+{
+  "total", "polkit", "rtc-io", "spawn", "config-io"
+};
+
+static gint                     enabled = 0;
+static struct metrics_counters  counters[METRICS_METHODS];
+
+/* method of the call being handled by the thread (+1, 0 is background) */
+static GPrivate                 scope = G_PRIVATE_INIT( NULL );
+
+
+void metrics_enable( gboolean enable )
+{
+  g_atomic_int_set( &enabled, enable ? 1 : 0 );
+}
+
+gboolean metrics_enabled( void )
+{
+  return g_atomic_int_get( &enabled ) != 0;
+}
+
+/*
+  Method of org.freedesktop.timedate1 (or Properties) by the member name:
+ */
+metrics_method metrics_method_lookup( const gchar *member )
+{
+  gint i;
+
+  if( !g_strcmp0( member, "Get" ) || !g_strcmp0( member, "GetAll" ) || !g_strcmp0( member, "Set" ) )
+    return METRICS_PROPERTIES;
+
+  for( i = 0; i < METRICS_PROPERTIES; ++i )
+    if( !g_strcmp0( member, method_names[i] ) )
+      return (metrics_method)i;
+
+  return METRICS_METHODS;
+}
+
+
+/***************************************************************
+  Recording:
+ */
+static inline void counter_add( guint64 *counter, guint64 value )
+{
+  __atomic_fetch_add( counter, value, __ATOMIC_RELAXED );
+}
+
+static inline guint64 counter_get( const guint64 *counter )
+{
+  return __atomic_load_n( counter, __ATOMIC_RELAXED );
+}
+
+static guint bucket_index( guint64 usec )
+{
+  guint idx = 0;
+
+  while( usec && idx < METRICS_BUCKETS - 1 )
+  {
+    usec >>= 1;
+    ++idx;
+  }
+
+  return idx;
+}
+
+/*
+  Monotonic usec to be passed to metrics_record() or 0 when disabled:
+ */
+gint64 metrics_start( void )
+{
+  return metrics_enabled() ? g_get_monotonic_time() : 0;
+}
+
+void metrics_record( metrics_method method, metrics_phase phase, gint64 start )
+{
+  struct metrics_histogram *h;
+  guint64                   usec;
+
+  if( !start || method >= METRICS_METHODS || phase >= METRICS_PHASES )
+    return;
+
+  usec = (guint64)MAX( g_get_monotonic_time() - start, 0 );
+  h    = &counters[method].phases[phase];
+
+  counter_add( &h->count, 1 );
+  counter_add( &h->sum_usec, usec );
+  counter_add( &h->buckets[bucket_index( usec )], 1 );
+}
+
+/*
+  Phase of the call handled by the current thread:
+ */
+void metrics_phase_done( metrics_phase phase, gint64 start )
+{
+  if( start )
+    metrics_record( metrics_scope(), phase, start );
+}
+
+void metrics_call_done( metrics_method method, gint64 start, gboolean error )
+{
+  if( !start || method >= METRICS_METHODS )
+    return;
+
+  counter_add( &counters[method].calls, 1 );
+  if( error )
+    counter_add( &counters[method].errors, 1 );
+
+  metrics_record( method, METRICS_TOTAL, start );
+}
+
+
+/***************************************************************
+  Scope of the call handled by the thread:
+ */
+metrics_method metrics_scope( void )
+{
+  gint method = GPOINTER_TO_INT( g_private_get( &scope ) );
+
+  return method ? (metrics_method)(method - 1) : METRICS_BACKGROUND;
+}
+
+metrics_method metrics_scope_enter( metrics_method method )
+{
+  metrics_method previous = metrics_scope();
+
+  g_private_set( &scope, GINT_TO_POINTER( (gint)method + 1 ) );
+
+  return previous;
+}
+
+void metrics_scope_leave( metrics_method previous )
+{
+  g_private_set( &scope, GINT_TO_POINTER( (gint)previous + 1 ) );
+}
+
+
+/***************************************************************
+  Snapshot:
+
+    a{s(tta{s(ttat)})}: method -> ( calls, errors,
+                                    phase -> ( count, sum usec, buckets ) )
+ */
+GVariant *metrics_snapshot( void )
+{
+  GVariantBuilder methods;
+  gint            m, p, b;
+
+  g_variant_builder_init( &methods, G_VARIANT_TYPE( "a{s(tta{s(ttat)})}" ) );
+
+  for( m = 0; m < METRICS_METHODS; ++m )
+  {
+    GVariantBuilder phases;
+
+    g_variant_builder_init( &phases, G_VARIANT_TYPE( "a{s(ttat)}" ) );
+
+    for( p = 0; p < METRICS_PHASES; ++p )
+    {
+      struct metrics_histogram *h = &counters[m].phases[p];
+      guint64                   buckets[METRICS_BUCKETS];
+
+      for( b = 0; b < METRICS_BUCKETS; ++b )
+        buckets[b] = counter_get( &h->buckets[b] );
+
+      g_variant_builder_add( &phases, "{s(tt@at)}", phase_names[p],
+                             counter_get( &h->count ), counter_get( &h->sum_usec ),
+                             g_variant_new_fixed_array( G_VARIANT_TYPE_UINT64, buckets,
+                                                        METRICS_BUCKETS, sizeof(guint64) ) );
+    }
+
+    g_variant_builder_add( &methods, "{s(tta{s(ttat)})}", method_names[m],
+                           counter_get( &counters[m].calls ), counter_get( &counters[m].errors ),
+                           &phases );
+  }
+
+  return g_variant_builder_end( &methods );
+}
@@ -0,0 +1,80 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_METRICS_UTILS_H__
+#define __RCL_METRICS_UTILS_H__
+
+#include "config.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <glib.h>
+
+/*
+  Per method call and error counters and latency histograms split into
+  phases. Work done outside of a method (the adaptive sampler, coalesced
+  RTC writes) is counted for METRICS_BACKGROUND.
+ */
+typedef enum
+{
+  METRICS_SET_TIME,
+  METRICS_SLEW_TIME,
+  METRICS_SET_TIMEZONE,
+  METRICS_SET_LOCAL_RTC,
+  METRICS_SET_NTP,
+  METRICS_LIST_TIMEZONES,
+  METRICS_PROPERTIES,       /* Get, GetAll and Set of org.freedesktop.DBus.Properties */
+  METRICS_BACKGROUND,
+  METRICS_METHODS
+} metrics_method;
+
+typedef enum
+{
+  METRICS_TOTAL,            /* call arrival to reply */
+  METRICS_POLKIT,           /* wait for the authorization */
+  METRICS_RTC_IO,
+  METRICS_SPAWN,
+  METRICS_CONFIG_IO,
+  METRICS_PHASES
+} metrics_phase;
+
+/* bucket N counts latencies below 2^N usec (and above the previous one) */
+#define METRICS_BUCKETS  32
+
+extern void            metrics_enable       ( gboolean enable );
+extern gboolean        metrics_enabled      ( void );
+
+extern metrics_method  metrics_method_lookup ( const gchar *member );
+
+extern gint64          metrics_start        ( void );
+extern void            metrics_record       ( metrics_method method, metrics_phase phase, gint64 start );
+extern void            metrics_phase_done   ( metrics_phase phase, gint64 start );
+extern void            metrics_call_done    ( metrics_method method, gint64 start, gboolean error );
+
+extern metrics_method  metrics_scope        ( void );
+extern metrics_method  metrics_scope_enter  ( metrics_method method );
+extern void            metrics_scope_leave  ( metrics_method previous );
+
+extern GVariant       *metrics_snapshot     ( void );
+
+
+#endif /* __RCL_METRICS_UTILS_H__ */
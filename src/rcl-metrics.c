@@ -0,0 +1,150 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "rcl-metrics.h"
+#include "rcl-metrics-utils.h"
+
+/*
+  org.freedesktop.timedate1.Metrics: snapshot of the counters kept by
+  rcl-metrics-utils. The call count, errors and total latency of every
+  method are taken by the connection filter of the daemon (see
+  arrival_filter() in rcl-timedate.c) from the call arrival to its
+  reply, so no handler has to report them.
+ */
+
+struct RclMetricsPrivate
+{
+  gboolean  enabled;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (RclMetrics, rcl_metrics, RCL_TYPE_TIMEDATE_METRICS_SKELETON)
+
+#define RCL_METRICS_PATH  "/org/freedesktop/timedate1"
+
+
+/***************************************************************
+  GetMetrics:
+  ==========
+ */
+static gboolean
+handle_get_metrics( RclTimedateMetrics    *object,
+                    GDBusMethodInvocation *invocation,
+                    RclMetrics            *metrics )
+{
+  rcl_timedate_metrics_complete_get_metrics( object, invocation, metrics_snapshot() );
+
+  return TRUE;
+}
+
+
+/***************************************************************
+  rcl_metrics_register:
+ */
+gboolean
+rcl_metrics_register( RclMetrics      *metrics,
+                      GDBusConnection *connection )
+{
+  GError *error = NULL;
+
+  g_dbus_interface_skeleton_export( G_DBUS_INTERFACE_SKELETON( metrics ),
+                                    connection,
+                                    RCL_METRICS_PATH,
+                                    &error );
+  if( error != NULL )
+  {
+    g_warning( "timedated: warning: Cannot export metrics interface: %s", error->message );
+    g_error_free( error );
+    return FALSE;
+  }
+
+  metrics->priv->enabled = TRUE;
+  metrics_enable( TRUE );
+
+  return TRUE;
+}
+
+/***************************************************************
+  rcl_metrics_unregister:
+ */
+void
+rcl_metrics_unregister( RclMetrics *metrics )
+{
+  GDBusConnection *connection = g_dbus_interface_skeleton_get_connection( G_DBUS_INTERFACE_SKELETON( metrics ) );
+
+  if( !connection )
+    return;
+
+  if( metrics->priv->enabled )
+  {
+    metrics_enable( FALSE );
+    metrics->priv->enabled = FALSE;
+  }
+
+  g_dbus_interface_skeleton_unexport( G_DBUS_INTERFACE_SKELETON( metrics ) );
+}
+
+/***************************************************************
+  rcl_metrics_init:
+ */
+static void
+rcl_metrics_init( RclMetrics *metrics )
+{
+  metrics->priv = rcl_metrics_get_instance_private( metrics );
+
+  g_signal_connect( RCL_TIMEDATE_METRICS( metrics ),
+                    "handle-get-metrics",
+                    G_CALLBACK( handle_get_metrics ),
+                    metrics ); /* user_data */
+}
+
+/***************************************************************
+  rcl_metrics_finalize:
+ */
+static void
+rcl_metrics_finalize( GObject *object )
+{
+  G_OBJECT_CLASS( rcl_metrics_parent_class )->finalize( object );
+}
+
+/***************************************************************
+  rcl_metrics_class_init:
+ */
+static void
+rcl_metrics_class_init( RclMetricsClass *klass )
+{
+  GObjectClass *object_class = G_OBJECT_CLASS( klass );
+
+  object_class->finalize = rcl_metrics_finalize;
+}
+
+/***************************************************************
+  rcl_metrics_new:
+ */
+RclMetrics *
+rcl_metrics_new( void )
+{
+  return RCL_METRICS( g_object_new( RCL_TYPE_METRICS, NULL ) );
+}
@@ -0,0 +1,57 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef __RCL_METRICS_H__
+#define __RCL_METRICS_H__
+
+#include <dbus/rcl-metrics-generated.h>
+
+G_BEGIN_DECLS
+
+#define RCL_TYPE_METRICS         (rcl_metrics_get_type ())
+#define RCL_METRICS(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), RCL_TYPE_METRICS, RclMetrics))
+#define RCL_METRICS_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), RCL_TYPE_METRICS, RclMetricsClass))
+#define RCL_IS_METRICS(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), RCL_TYPE_METRICS))
+#define RCL_IS_METRICS_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), RCL_TYPE_METRICS))
+#define RCL_METRICS_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), RCL_TYPE_METRICS, RclMetricsClass))
+
+typedef struct RclMetricsPrivate RclMetricsPrivate;
+
+typedef struct
+{
+  RclTimedateMetricsSkeleton  parent;
+  RclMetricsPrivate          *priv;
+} RclMetrics;
+
+typedef struct
+{
+  RclTimedateMetricsSkeletonClass parent_class;
+} RclMetricsClass;
+
+GType       rcl_metrics_get_type ( void );
+RclMetrics *rcl_metrics_new      ( void );
+
+/* private */
+gboolean  rcl_metrics_register   ( RclMetrics      *metrics,
+                                   GDBusConnection *connection );
+void      rcl_metrics_unregister ( RclMetrics      *metrics );
+
+G_END_DECLS
+
+#endif /* __RCL_METRICS_H__ */
@@ -18,21 +18,131 @@
  *
  */
 
+
 #include "rcl-ntpd-utils.h"
+#include "rcl-time-utils.h"
+#include "rcl-sntp.h"
+#include "rcl-sys.h"
+#include "rcl-trace.h"
+
+/*
+  NTP control protocol (RFC 1305 Appendix B, mode 6):
+ */
+#define CTL_VERSION          2
+#define CTL_MODE             6
+#define CTL_OP_READVAR       2
+#define CTL_RESPONSE         0x80
+#define CTL_ERROR            0x40
+#define CTL_MORE             0x20
+#define CTL_OP_MASK          0x1f
+#define CTL_HEADER_LEN       12
+#define CTL_DATA_MAX         468
+#define CTL_REPLY_MAX        8192 /* reassembled readvar reply */
+
+struct ntp_control
+{
+  guint8   li_vn_mode;
+  guint8   r_m_e_op;
+  guint16  sequence;
+  guint16  status;
+  guint16  association;
+  guint16  offset;
+  guint16  count;
+  gchar    data[CTL_DATA_MAX];
+} __attribute__((packed));
 
+/*
+  chronyd command and monitoring protocol (candm.h, protocol version 6):
+ */
+#define CHRONY_PROTO_VERSION 6
+#define CHRONY_PKT_REQUEST   1
+#define CHRONY_PKT_REPLY     2
+#define CHRONY_REQ_TRACKING  33
+#define CHRONY_RPY_TRACKING  5
+#define CHRONY_STT_SUCCESS   0
+#define CHRONY_IPADDR_INET4  1
+#define CHRONY_IPADDR_INET6  2
+
+struct chrony_tracking
+{
+  /* reply header */
+  guint8   version;
+  guint8   pkt_type;
+  guint8   res1;
+  guint8   res2;
+  guint16  command;
+  guint16  reply;
+  guint16  status;
+  guint16  pad1;
+  guint16  pad2;
+  guint16  pad3;
+  guint32  sequence;
+  guint32  pad4;
+  guint32  pad5;
+
+  /* RPY_Tracking (up to EOR) */
+  guint32  ref_id;
+  guint8   ip_addr[16];
+  guint16  ip_family;
+  guint16  ip_pad;
+  guint16  stratum;
+  guint16  leap_status;
+  guint32  ref_time_sec_high;
+  guint32  ref_time_sec_low;
+  guint32  ref_time_nsec;
+  guint32  current_correction;
+  guint32  last_offset;
+  guint32  rms_offset;
+  guint32  freq_ppm;
+  guint32  resid_freq_ppm;
+  guint32  skew_ppm;
+  guint32  root_delay;
+  guint32  root_dispersion;
+  guint32  last_update_interval;
+} __attribute__((packed));
+
+struct chrony_request
+{
+  guint8   version;
+  guint8   pkt_type;
+  guint8   res1;
+  guint8   res2;
+  guint16  command;
+  guint16  attempt;
+  guint32  sequence;
+  guint32  pad1;
+  guint32  pad2;
+  /* chronyd drops requests shorter than the reply */
+  guint8   padding[sizeof(struct chrony_tracking) - 20];
+} __attribute__((packed));
+
+/* control query result */
+#define QUERY_OK         1
+#define QUERY_NO_ANSWER  0
+#define QUERY_REFUSED   -1  /* nobody listens: the daemon is not running */
+
+
+static const struct ntp_backend *selected_backend = NULL;
+
+
+/***************************************************************
+  Static functions:
+ */
 static gboolean exec_cmd( const gchar *cmd )
 {
-  int       exit_status;
+  int       exit_status = -1;
   GError   *error = NULL;
   gboolean  ret = TRUE;
 
   if( !cmd || *cmd == '\0' ) return FALSE;
 
-  if( !g_spawn_command_line_sync( cmd, NULL, NULL, &exit_status, &error ) )
+  TRACE_PROBE1( spawn__entry, cmd );
+  if( !sys_spawn( cmd, &exit_status, &error ) )
   {
     g_error_free( error );
     ret = FALSE;
   }
+  TRACE_PROBE2( spawn__return, cmd, exit_status );
   g_free( (gpointer)cmd );
 
   if( exit_status != 0 )
@@ -41,33 +151,36 @@ static gboolean exec_cmd( const gchar *cmd )
   return ret;
 }
 
-gboolean ntp_daemon_installed( void )
+/*
+  Start/stop script control (shared by ntpd and chronyd):
+ */
+static gboolean rc_installed( const gchar *conf, const gchar *rc )
 {
-  if( g_file_test( NTPD_CONF, G_FILE_TEST_EXISTS ) &&
-      g_file_test( NTPD_RC,   G_FILE_TEST_EXISTS )   )
+  if( sys_file_test( conf, G_FILE_TEST_EXISTS ) &&
+      sys_file_test( rc,   G_FILE_TEST_EXISTS )   )
     return TRUE;
   else
     return FALSE;
 }
 
-gboolean ntp_daemon_enabled( void )
+static gboolean rc_enabled( const gchar *conf, const gchar *rc )
 {
-  if( g_file_test( NTPD_CONF, G_FILE_TEST_EXISTS ) &&
-      g_file_test( NTPD_RC,   G_FILE_TEST_EXISTS ) &&
-      g_file_test( NTPD_RC,   G_FILE_TEST_IS_EXECUTABLE ) )
+  if( sys_file_test( conf, G_FILE_TEST_EXISTS ) &&
+      sys_file_test( rc,   G_FILE_TEST_EXISTS ) &&
+      sys_file_test( rc,   G_FILE_TEST_IS_EXECUTABLE ) )
     return TRUE;
   else
     return FALSE;
 }
 
-gboolean ntp_daemon_status( void )
+static gboolean rc_status( const gchar *rc )
 {
   gchar *cmd;
 
-  if( g_file_test( NTPD_RC, G_FILE_TEST_EXISTS ) &&
-      g_file_test( NTPD_RC, G_FILE_TEST_IS_EXECUTABLE ) )
+  if( sys_file_test( rc, G_FILE_TEST_EXISTS ) &&
+      sys_file_test( rc, G_FILE_TEST_IS_EXECUTABLE ) )
   {
-    cmd = g_strconcat( NTPD_RC, " status", NULL );
+    cmd = g_strconcat( rc, " status", NULL );
     if( !exec_cmd( (const gchar *)cmd ) )
       return FALSE;
     else
@@ -77,15 +190,15 @@ gboolean ntp_daemon_status( void )
   return FALSE;
 }
 
-gboolean stop_ntp_daemon( void )
+static gboolean rc_stop( const gchar *conf, const gchar *rc, gboolean (*status)( void ) )
 {
-  if( ntp_daemon_enabled() && !ntp_daemon_status() )
+  if( rc_enabled( conf, rc ) && !status() )
     return TRUE;
 
-  if( ntp_daemon_enabled() )
+  if( rc_enabled( conf, rc ) )
   {
     gchar *cmd;
-    cmd = g_strconcat( NTPD_RC, " stop", NULL );
+    cmd = g_strconcat( rc, " stop", NULL );
     if( !exec_cmd( (const gchar *)cmd ) )
       return FALSE;
     else
@@ -95,15 +208,15 @@ gboolean stop_ntp_daemon( void )
   return FALSE;
 }
 
-gboolean start_ntp_daemon( void )
+static gboolean rc_start( const gchar *conf, const gchar *rc, gboolean (*status)( void ) )
 {
-  if( ntp_daemon_enabled() && ntp_daemon_status() )
+  if( rc_enabled( conf, rc ) && status() )
     return TRUE;
 
-  if( ntp_daemon_enabled() )
+  if( rc_enabled( conf, rc ) )
   {
     gchar *cmd;
-    cmd = g_strconcat( NTPD_RC, " start", NULL );
+    cmd = g_strconcat( rc, " start", NULL );
     if( !exec_cmd( (const gchar *)cmd ) )
       return FALSE;
     else
@@ -113,23 +226,23 @@ gboolean start_ntp_daemon( void )
   return FALSE;
 }
 
-gboolean disable_ntp_daemon( void )
+static gboolean rc_disable( const gchar *conf, const gchar *rc, gboolean (*status)( void ) )
 {
   gchar *cmd;
 
-  if( !ntp_daemon_enabled() )
+  if( !rc_enabled( conf, rc ) )
     return TRUE;
 
-  if( ntp_daemon_status() )
-    (void)stop_ntp_daemon();
+  if( status() )
+    (void)rc_stop( conf, rc, status );
 
-  if(  g_file_test( NTPD_RC, G_FILE_TEST_EXISTS ) &&
-      !g_file_test( NTPD_RC, G_FILE_TEST_IS_EXECUTABLE ) )
+  if(  sys_file_test( rc, G_FILE_TEST_EXISTS ) &&
+      !sys_file_test( rc, G_FILE_TEST_IS_EXECUTABLE ) )
     return TRUE;
 
-  if( g_file_test( NTPD_RC, G_FILE_TEST_EXISTS ) )
+  if( sys_file_test( rc, G_FILE_TEST_EXISTS ) )
   {
-    cmd = g_strconcat( "chmod 0644 ", NTPD_RC, NULL );
+    cmd = g_strconcat( "chmod 0644 ", rc, NULL );
     if( !exec_cmd( (const gchar *)cmd ) )
       return FALSE;
     else
@@ -139,20 +252,20 @@ gboolean disable_ntp_daemon( void )
     return FALSE;
 }
 
-gboolean enable_ntp_daemon( void )
+static gboolean rc_enable( const gchar *conf, const gchar *rc )
 {
   gchar *cmd;
 
-  if( ntp_daemon_enabled() )
+  if( rc_enabled( conf, rc ) )
     return TRUE;
 
-  if( g_file_test( NTPD_RC, G_FILE_TEST_EXISTS ) &&
-      g_file_test( NTPD_RC, G_FILE_TEST_IS_EXECUTABLE ) )
+  if( sys_file_test( rc, G_FILE_TEST_EXISTS ) &&
+      sys_file_test( rc, G_FILE_TEST_IS_EXECUTABLE ) )
     return TRUE;
 
-  if( g_file_test( NTPD_RC, G_FILE_TEST_EXISTS ) )
+  if( sys_file_test( rc, G_FILE_TEST_EXISTS ) )
   {
-    cmd = g_strconcat( "chmod 0755 ", NTPD_RC, NULL );
+    cmd = g_strconcat( "chmod 0755 ", rc, NULL );
     if( !exec_cmd( (const gchar *)cmd ) )
       return FALSE;
     else
@@ -161,3 +274,660 @@ gboolean enable_ntp_daemon( void )
   else
     return FALSE;
 }
+
+/*
+  Wait for a datagram until the deadline (monotonic usec):
+ */
+static gssize recv_until( gint fd, gpointer buf, gsize len, gint64 deadline )
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  gint64        left;
+  gint          rc;
+
+  for( ;; )
+  {
+    left = ( deadline - g_get_monotonic_time() ) / (gint64)1000;
+    if( left <= 0 )
+      return 0;
+
+    rc = poll( &pfd, 1, (gint)left );
+    if( rc < 0 && errno == EINTR )
+      continue;
+    if( rc <= 0 )
+      return 0;
+
+    return recv( fd, buf, len, 0 );
+  }
+}
+
+/*
+  ntpd: read variables of association (0 is the system) over loopback UDP.
+  Returns QUERY_* and the reassembled "name=value,..." text in *vars:
+ */
+static gint ntpd_readvar( guint16 association, gchar **vars )
+{
+  struct sockaddr_in  addr = {};
+  struct ntp_control  req  = {};
+  struct ntp_control  rpy;
+  gchar              *buf;
+  gsize               received = 0, total = 0;
+  guint16             sequence;
+  gint64              deadline;
+  gssize              len;
+  gint                fd, ret = QUERY_NO_ANSWER;
+
+  fd = socket( AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0 );
+  if( fd < 0 )
+    return QUERY_NO_ANSWER;
+
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons( NTPD_CONTROL_PORT );
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+  if( connect( fd, (struct sockaddr *)&addr, sizeof(addr) ) < 0 )
+  {
+    close( fd );
+    return QUERY_NO_ANSWER;
+  }
+
+  sequence = (guint16)g_random_int_range( 1, G_MAXUINT16 );
+
+  req.li_vn_mode  = (CTL_VERSION << 3) | CTL_MODE;
+  req.r_m_e_op    = CTL_OP_READVAR;
+  req.sequence    = htons( sequence );
+  req.association = htons( association );
+
+  if( send( fd, &req, CTL_HEADER_LEN, 0 ) != CTL_HEADER_LEN )
+  {
+    ret = ( errno == ECONNREFUSED ) ? QUERY_REFUSED : QUERY_NO_ANSWER;
+    close( fd );
+    return ret;
+  }
+
+  buf = g_malloc0( CTL_REPLY_MAX + 1 );
+  deadline = g_get_monotonic_time() + (gint64)NTP_QUERY_TIMEOUT * 1000;
+
+  while( (len = recv_until( fd, &rpy, sizeof(rpy), deadline )) != 0 )
+  {
+    gsize offset, count;
+
+    if( len < 0 )
+    {
+      if( errno == ECONNREFUSED )
+        ret = QUERY_REFUSED;
+      break;
+    }
+
+    if( len < CTL_HEADER_LEN                             ||
+        (rpy.li_vn_mode & 0x07) != CTL_MODE              ||
+        !(rpy.r_m_e_op & CTL_RESPONSE)                   ||
+        (rpy.r_m_e_op & CTL_OP_MASK) != CTL_OP_READVAR   ||
+        ntohs( rpy.sequence ) != sequence                  )
+      continue;
+
+    if( rpy.r_m_e_op & CTL_ERROR )
+      break;
+
+    offset = ntohs( rpy.offset );
+    count  = ntohs( rpy.count );
+    if( count > (gsize)len - CTL_HEADER_LEN || offset + count > CTL_REPLY_MAX )
+      break;
+
+    memcpy( buf + offset, rpy.data, count );
+    received += count;
+
+    if( !(rpy.r_m_e_op & CTL_MORE) )
+      total = offset + count;
+
+    if( total && received >= total )
+    {
+      buf[total] = '\0';
+      *vars = buf;
+      buf = NULL;
+      ret = QUERY_OK;
+      break;
+    }
+  }
+
+  g_free( buf );
+  close( fd );
+
+  return ret;
+}
+
+/*
+  Split "name=value, name="quoted, value",\r\n..." into a table:
+ */
+static GHashTable *ntpd_parse_vars( const gchar *vars )
+{
+  GHashTable  *table = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+  const gchar *p = vars;
+
+  while( *p )
+  {
+    const gchar *name, *value;
+    gsize        nlen, vlen = 0;
+
+    while( *p == ',' || g_ascii_isspace( *p ) ) ++p;
+
+    name = p;
+    while( *p && *p != '=' && *p != ',' ) ++p;
+    nlen = p - name;
+    while( nlen && g_ascii_isspace( name[nlen - 1] ) ) --nlen;
+
+    value = p;
+    if( *p == '=' )
+    {
+      value = ++p;
+      if( *p == '"' )
+      {
+        value = ++p;
+        while( *p && *p != '"' ) ++p;
+        vlen = p - value;
+        if( *p ) ++p;
+      }
+      else
+      {
+        while( *p && *p != ',' ) ++p;
+        vlen = p - value;
+        while( vlen && g_ascii_isspace( value[vlen - 1] ) ) --vlen;
+      }
+    }
+
+    if( nlen )
+      g_hash_table_replace( table, g_strndup( name, nlen ), g_strndup( value, vlen ) );
+  }
+
+  return table;
+}
+
+static GHashTable *ntpd_read_table( guint16 association, gint *result )
+{
+  gchar      *vars = NULL;
+  GHashTable *table;
+  gint        ret;
+
+  ret = ntpd_readvar( association, &vars );
+  if( result )
+    *result = ret;
+  if( ret != QUERY_OK )
+    return NULL;
+
+  table = ntpd_parse_vars( vars );
+  g_free( vars );
+
+  return table;
+}
+
+static gint64 var_int( GHashTable *table, const gchar *name )
+{
+  const gchar *value = g_hash_table_lookup( table, name );
+
+  return value ? g_ascii_strtoll( value, NULL, 10 ) : 0;
+}
+
+static gdouble var_double( GHashTable *table, const gchar *name )
+{
+  const gchar *value = g_hash_table_lookup( table, name );
+
+  return value ? g_ascii_strtod( value, NULL ) : 0.0;
+}
+
+/*
+  refid is an IPv4 address, or up to four ASCII characters for stratum 0/1:
+ */
+static guint32 ntpd_refid( const gchar *refid )
+{
+  struct in_addr addr;
+  guint32        ret = 0;
+
+  if( !refid )
+    return 0;
+
+  if( inet_pton( AF_INET, refid, &addr ) == 1 )
+    return addr.s_addr;
+
+  if( *refid == '.' ) ++refid;
+  memcpy( &ret, refid, MIN( strcspn( refid, "." ), sizeof(ret) ) );
+
+  return ret;
+}
+
+static gboolean ntpd_query( struct ntp_status *status )
+{
+  GHashTable  *sys, *peer = NULL;
+  const gchar *host;
+  gint64       association, poll;
+
+  sys = ntpd_read_table( 0, NULL );
+  if( !sys )
+    return FALSE;
+
+  association = var_int( sys, "peer" );
+  if( association > 0 && association <= G_MAXUINT16 )
+    peer = ntpd_read_table( (guint16)association, NULL );
+
+  status->leap                 = (guint)var_int( sys, "leap" );
+  status->version              = (guint)( var_int( sys, "version" ) ? var_int( sys, "version" ) : 4 );
+  status->mode                 = 4; /* server */
+  status->stratum              = (guint)var_int( sys, "stratum" );
+  status->precision            = (gint)var_int( sys, "precision" );
+  status->refid                = ntpd_refid( g_hash_table_lookup( sys, "refid" ) );
+  status->root_delay_usec      = (gint64)( var_double( sys, "rootdelay" ) * (gdouble)USEC_PER_MSEC );
+  status->root_dispersion_usec = (gint64)( var_double( sys, "rootdisp" ) * (gdouble)USEC_PER_MSEC );
+  status->offset_nsec          = (gint64)( var_double( sys, "offset" ) * (gdouble)NSEC_PER_MSEC );
+  status->freq_ppm             = var_double( sys, "frequency" );
+
+  /* "tc" is the system poll exponent, "hpoll" that of the peer */
+  poll = peer && g_hash_table_contains( peer, "hpoll" ) ? var_int( peer, "hpoll" ) : var_int( sys, "tc" );
+  if( poll > 0 && poll < 32 )
+    status->poll_usec = ( (guint64)1 << poll ) * USEC_PER_SEC;
+
+  if( peer )
+  {
+    const gchar *srcadr = g_hash_table_lookup( peer, "srcadr" );
+
+    host = g_hash_table_lookup( peer, "srchost" );
+    if( srcadr )
+      g_strlcpy( status->server_address, srcadr, sizeof(status->server_address) );
+    g_strlcpy( status->server_name, ( host && *host ) ? host : status->server_address, sizeof(status->server_name) );
+    g_hash_table_unref( peer );
+  }
+
+  g_hash_table_unref( sys );
+
+  return TRUE;
+}
+
+/*
+  chronyd: 7-bit exponent, 25-bit coefficient floating point:
+ */
+static gdouble chrony_float( guint32 f )
+{
+  guint32 x = GUINT32_FROM_BE( f );
+  gint32  exp, coef;
+
+  exp = (gint32)( x >> 25 );
+  if( exp >= 1 << 6 )
+    exp -= 1 << 7;
+  exp -= 25;
+
+  coef = (gint32)( x % ( 1U << 25 ) );
+  if( coef >= 1 << 24 )
+    coef -= 1 << 25;
+
+  return ldexp( (gdouble)coef, exp );
+}
+
+/*
+  chronyd replies to the address of the client socket, so the client
+  binds its own socket next to CHRONYD_SOCKET (as chronyc does):
+ */
+static gboolean chrony_tracking( struct chrony_tracking *rpy )
+{
+  struct sockaddr_un     server = {}, client = {};
+  struct chrony_request  req = {};
+  gchar                 *socket_path;
+  gchar                 *dir;
+  guint32                sequence;
+  gint64                 deadline;
+  gssize                 len;
+  gint                   fd;
+  gboolean               ret = FALSE;
+
+  socket_path = sys_path( CHRONYD_SOCKET );
+  if( !g_file_test( socket_path, G_FILE_TEST_EXISTS ) )
+  {
+    g_free( socket_path );
+    return FALSE;
+  }
+
+  fd = socket( AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0 );
+  if( fd < 0 )
+  {
+    g_free( socket_path );
+    return FALSE;
+  }
+
+  server.sun_family = AF_UNIX;
+  g_strlcpy( server.sun_path, socket_path, sizeof(server.sun_path) );
+
+  dir = g_path_get_dirname( socket_path );
+  g_free( socket_path );
+  client.sun_family = AF_UNIX;
+  g_snprintf( client.sun_path, sizeof(client.sun_path), "%s/timedated.%d.sock", dir, (gint)getpid() );
+  g_free( dir );
+
+  (void)unlink( client.sun_path );
+  if( bind( fd, (struct sockaddr *)&client, sizeof(client) ) < 0 )
+  {
+    close( fd );
+    return FALSE;
+  }
+  /* chronyd may run without root privileges */
+  (void)chmod( client.sun_path, 0666 );
+
+  if( connect( fd, (struct sockaddr *)&server, sizeof(server) ) < 0 )
+    goto out;
+
+  sequence = g_random_int();
+
+  req.version  = CHRONY_PROTO_VERSION;
+  req.pkt_type = CHRONY_PKT_REQUEST;
+  req.command  = htons( CHRONY_REQ_TRACKING );
+  req.sequence = sequence;
+
+  if( send( fd, &req, sizeof(req), 0 ) != (gssize)sizeof(req) )
+    goto out;
+
+  deadline = g_get_monotonic_time() + (gint64)NTP_QUERY_TIMEOUT * 1000;
+
+  while( (len = recv_until( fd, rpy, sizeof(*rpy), deadline )) > 0 )
+  {
+    if( len < (gssize)sizeof(*rpy)                    ||
+        rpy->version  != CHRONY_PROTO_VERSION         ||
+        rpy->pkt_type != CHRONY_PKT_REPLY             ||
+        rpy->sequence != sequence                     ||
+        ntohs( rpy->command ) != CHRONY_REQ_TRACKING    )
+      continue;
+
+    ret = ( ntohs( rpy->status ) == CHRONY_STT_SUCCESS &&
+            ntohs( rpy->reply )  == CHRONY_RPY_TRACKING  );
+    break;
+  }
+
+out:
+  close( fd );
+  (void)unlink( client.sun_path );
+
+  return ret;
+}
+
+static gboolean chronyd_query( struct ntp_status *status )
+{
+  struct chrony_tracking rpy;
+
+  if( !chrony_tracking( &rpy ) )
+    return FALSE;
+
+  if( ntohs( rpy.ip_family ) == CHRONY_IPADDR_INET4 )
+    (void)inet_ntop( AF_INET, rpy.ip_addr, status->server_address, sizeof(status->server_address) );
+  else if( ntohs( rpy.ip_family ) == CHRONY_IPADDR_INET6 )
+    (void)inet_ntop( AF_INET6, rpy.ip_addr, status->server_address, sizeof(status->server_address) );
+
+  status->refid = rpy.ref_id;
+
+  /* reference clocks have no address: name them by refid (as chronyc does) */
+  if( status->server_address[0] )
+    g_strlcpy( status->server_name, status->server_address, sizeof(status->server_name) );
+  else
+    memcpy( status->server_name, &status->refid, sizeof(status->refid) );
+
+  status->leap                 = ntohs( rpy.leap_status );
+  status->version              = 4;
+  status->mode                 = 4; /* server */
+  status->stratum              = ntohs( rpy.stratum );
+  status->root_delay_usec      = (gint64)( chrony_float( rpy.root_delay ) * (gdouble)USEC_PER_SEC );
+  status->root_dispersion_usec = (gint64)( chrony_float( rpy.root_dispersion ) * (gdouble)USEC_PER_SEC );
+  status->offset_nsec          = (gint64)( chrony_float( rpy.last_offset ) * (gdouble)NSEC_PER_SEC );
+  status->freq_ppm             = chrony_float( rpy.freq_ppm );
+  status->poll_usec            = (guint64)( chrony_float( rpy.last_update_interval ) * (gdouble)USEC_PER_SEC );
+
+  return TRUE;
+}
+
+
+/***************************************************************
+  Backends:
+ */
+
+/*
+  rc.ntpd: the start/stop script only:
+ */
+static gboolean rc_ntpd_installed( void ) { return rc_installed( NTPD_CONF, NTPD_RC ); }
+static gboolean rc_ntpd_enabled( void )   { return rc_enabled( NTPD_CONF, NTPD_RC ); }
+static gboolean rc_ntpd_status( void )    { return rc_status( NTPD_RC ); }
+static gboolean rc_ntpd_start( void )     { return rc_start( NTPD_CONF, NTPD_RC, rc_ntpd_status ); }
+static gboolean rc_ntpd_stop( void )      { return rc_stop( NTPD_CONF, NTPD_RC, rc_ntpd_status ); }
+static gboolean rc_ntpd_enable( void )    { return rc_enable( NTPD_CONF, NTPD_RC ); }
+static gboolean rc_ntpd_disable( void )   { return rc_disable( NTPD_CONF, NTPD_RC, rc_ntpd_status ); }
+
+/*
+  ntpd: the start/stop script and mode 6 status queries:
+ */
+static gboolean ntpd_status( void )
+{
+  GHashTable *sys;
+  gint        result;
+
+  sys = ntpd_read_table( 0, &result );
+  if( sys )
+  {
+    g_hash_table_unref( sys );
+    return TRUE;
+  }
+
+  /* running with "restrict ... noquery": ask the script */
+  if( result == QUERY_NO_ANSWER )
+    return rc_ntpd_status();
+
+  return FALSE;
+}
+
+static gboolean ntpd_start( void )   { return rc_start( NTPD_CONF, NTPD_RC, ntpd_status ); }
+static gboolean ntpd_stop( void )    { return rc_stop( NTPD_CONF, NTPD_RC, ntpd_status ); }
+static gboolean ntpd_disable( void ) { return rc_disable( NTPD_CONF, NTPD_RC, ntpd_status ); }
+
+/*
+  chronyd: the start/stop script and cmdmon status queries:
+ */
+static gboolean chronyd_installed( void ) { return rc_installed( CHRONY_CONF, CHRONYD_RC ); }
+static gboolean chronyd_enabled( void )   { return rc_enabled( CHRONY_CONF, CHRONYD_RC ); }
+
+static gboolean chronyd_status( void )
+{
+  struct chrony_tracking rpy;
+
+  return chrony_tracking( &rpy );
+}
+
+static gboolean chronyd_start( void )   { return rc_start( CHRONY_CONF, CHRONYD_RC, chronyd_status ); }
+static gboolean chronyd_stop( void )    { return rc_stop( CHRONY_CONF, CHRONYD_RC, chronyd_status ); }
+static gboolean chronyd_enable( void )  { return rc_enable( CHRONY_CONF, CHRONYD_RC ); }
+static gboolean chronyd_disable( void ) { return rc_disable( CHRONY_CONF, CHRONYD_RC, chronyd_status ); }
+
+static const struct ntp_backend rc_ntpd_backend =
+{
+  "rc.ntpd", FALSE,
+  rc_ntpd_installed, rc_ntpd_enabled, rc_ntpd_status,
+  rc_ntpd_start, rc_ntpd_stop, rc_ntpd_enable, rc_ntpd_disable,
+  NULL
+};
+
+static const struct ntp_backend ntpd_backend =
+{
+  "ntpd", FALSE,
+  rc_ntpd_installed, rc_ntpd_enabled, ntpd_status,
+  ntpd_start, ntpd_stop, rc_ntpd_enable, ntpd_disable,
+  ntpd_query
+};
+
+static const struct ntp_backend chronyd_backend =
+{
+  "chronyd", FALSE,
+  chronyd_installed, chronyd_enabled, chronyd_status,
+  chronyd_start, chronyd_stop, chronyd_enable, chronyd_disable,
+  chronyd_query
+};
+
+static const struct ntp_backend sntp_backend =
+{
+  "sntp", TRUE,
+  sntp_client_installed, sntp_client_enabled, sntp_client_status,
+  start_sntp_client, stop_sntp_client, enable_sntp_client, disable_sntp_client,
+  sntp_client_query
+};
+
+/*
+  Prefer the daemon which answers its control protocol, then the
+  installed one; the built-in SNTP client is the last resort:
+ */
+static const struct ntp_backend *probe_backend( void )
+{
+  GHashTable *sys;
+
+  if( chronyd_status() )
+    return &chronyd_backend;
+
+  if( (sys = ntpd_read_table( 0, NULL )) != NULL )
+  {
+    g_hash_table_unref( sys );
+    return &ntpd_backend;
+  }
+
+  /* ntpd is running but does not answer control queries */
+  if( rc_ntpd_installed() && rc_ntpd_status() )
+    return &rc_ntpd_backend;
+
+  if( chronyd_installed() )
+    return &chronyd_backend;
+
+  if( rc_ntpd_installed() )
+    return &ntpd_backend;
+
+  if( sntp_client_installed() )
+    return &sntp_backend;
+
+  return &rc_ntpd_backend;
+}
+
+
+/***************************************************************
+  NTP service control:
+ */
+static const struct ntp_backend *const backends[] =
+{
+  &chronyd_backend, &ntpd_backend, &rc_ntpd_backend, &sntp_backend, NULL
+};
+
+static gsize backend_probed = 0;
+
+/*
+  The backend is probed once; the daemon probes it in a worker thread
+  at startup and other callers wait for the answer:
+ */
+const struct ntp_backend *ntp_backend( void )
+{
+  if( g_once_init_enter( &backend_probed ) )
+  {
+    selected_backend = probe_backend();
+    g_debug( "NTP backend: %s", selected_backend->name );
+    g_once_init_leave( &backend_probed, 1 );
+  }
+
+  return g_atomic_pointer_get( &selected_backend );
+}
+
+/*
+  Take the backend of the previous run without probing (it should be
+  checked later by ntp_backend_probe()). FALSE if it is already probed
+  or there is no backend of this name:
+ */
+gboolean ntp_backend_select( const gchar *name )
+{
+  const struct ntp_backend *const *backend;
+
+  for( backend = backends; *backend; ++backend )
+  {
+    if( g_strcmp0( (*backend)->name, name ) == 0 )
+      break;
+  }
+
+  if( !*backend || !g_once_init_enter( &backend_probed ) )
+    return FALSE;
+
+  selected_backend = *backend;
+  g_debug( "NTP backend: %s (not probed)", selected_backend->name );
+  g_once_init_leave( &backend_probed, 1 );
+
+  return TRUE;
+}
+
+/*
+  Probe the backend again without taking it (in a worker thread while
+  the main loop keeps using the selected one):
+ */
+const struct ntp_backend *ntp_backend_probe( void )
+{
+  return probe_backend();
+}
+
+/*
+  Take the backend found by ntp_backend_probe() (in the main loop).
+  Returns TRUE and the previous backend when it is changed:
+ */
+gboolean ntp_backend_set( const struct ntp_backend *backend, const struct ntp_backend **previous )
+{
+  const struct ntp_backend *old = ntp_backend();
+
+  if( !backend || backend == old )
+    return FALSE;
+
+  g_debug( "NTP backend: %s (was %s)", backend->name, old->name );
+  g_atomic_pointer_set( &selected_backend, backend );
+
+  if( previous )
+    *previous = old;
+
+  return TRUE;
+}
+
+gboolean ntp_daemon_installed( void )
+{
+  return ntp_backend()->installed();
+}
+
+gboolean ntp_daemon_enabled( void )
+{
+  return ntp_backend()->enabled();
+}
+
+gboolean ntp_daemon_status( void )
+{
+  return ntp_backend()->status();
+}
+
+gboolean stop_ntp_daemon( void )
+{
+  return ntp_backend()->stop();
+}
+
+gboolean start_ntp_daemon( void )
+{
+  return ntp_backend()->start();
+}
+
+gboolean disable_ntp_daemon( void )
+{
+  return ntp_backend()->disable();
+}
+
+gboolean enable_ntp_daemon( void )
+{
+  return ntp_backend()->enable();
+}
+
+/*
+  Peer status from the control protocol (FALSE if not available):
+ */
+gboolean ntp_daemon_query( struct ntp_status *status )
+{
+  const struct ntp_backend *backend = ntp_backend();
+
+  if( !status || !backend->query )
+    return FALSE;
+
+  memset( status, 0, sizeof(*status) );
+
+  return backend->query( status );
+}
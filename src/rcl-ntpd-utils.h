@@ -30,6 +30,13 @@
 #include <stdio.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <errno.h>
 #include <unistd.h>
 
 #include <glib.h>
@@ -47,6 +54,66 @@
 #define NTPD_RC "/etc/rc.d/rc.ntpd"
 #endif
 
+#if !defined( CHRONY_CONF )
+#define CHRONY_CONF "/etc/chrony.conf"
+#endif
+
+#if !defined( CHRONYD_RC )
+#define CHRONYD_RC "/etc/rc.d/rc.chronyd"
+#endif
+
+#if !defined( CHRONYD_SOCKET )
+#define CHRONYD_SOCKET "/run/chrony/chronyd.sock"
+#endif
+
+#define NTPD_CONTROL_PORT   123
+#define NTP_QUERY_TIMEOUT   250 /* msec to wait for the control protocol reply */
+
+/*
+  Peer status of the NTP service as reported by its control protocol:
+ */
+struct ntp_status
+{
+  gchar    server_name[256];
+  gchar    server_address[64];
+  guint    leap;
+  guint    version;
+  guint    mode;
+  guint    stratum;
+  gint     precision;
+  guint32  refid;          /* network byte order */
+  gint64   root_delay_usec;
+  gint64   root_dispersion_usec;
+  gint64   offset_nsec;
+  gdouble  freq_ppm;
+  guint64  poll_usec;
+};
+
+/*
+  NTP service backend. The backend is selected at startup by probing
+  (see ntp_backend()) and all ntp_daemon_*() calls go to it:
+ */
+struct ntp_backend
+{
+  const gchar *name;
+  gboolean     builtin; /* runs inside timedated: started when enabled */
+
+  gboolean   (*installed) ( void );
+  gboolean   (*enabled)   ( void );
+  gboolean   (*status)    ( void );
+  gboolean   (*start)     ( void );
+  gboolean   (*stop)      ( void );
+  gboolean   (*enable)    ( void );
+  gboolean   (*disable)   ( void );
+  gboolean   (*query)     ( struct ntp_status *status );
+};
+
+extern const struct ntp_backend *ntp_backend        ( void );
+extern gboolean                  ntp_backend_select ( const gchar *name );
+extern const struct ntp_backend *ntp_backend_probe  ( void );
+extern gboolean                  ntp_backend_set    ( const struct ntp_backend *backend,
+                                                      const struct ntp_backend **previous );
+
 extern gboolean  ntp_daemon_installed ( void );
 extern gboolean  ntp_daemon_enabled   ( void );
 extern gboolean  ntp_daemon_status    ( void );
@@ -54,6 +121,7 @@ extern gboolean  stop_ntp_daemon      ( void );
 extern gboolean  start_ntp_daemon     ( void );
 extern gboolean  disable_ntp_daemon   ( void );
 extern gboolean  enable_ntp_daemon    ( void );
+extern gboolean  ntp_daemon_query     ( struct ntp_status *status );
 
 
 #endif /* __RCL_NTPD_UTILS_H__ */
@@ -0,0 +1,430 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#if !defined( _GNU_SOURCE )
+#define _GNU_SOURCE  /* memfd_create(), file seals */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rcl-snapshot-utils.h"
+#include "rcl-sys.h"
+#include "rcl-zone-utils.h"
+#include "rcl-ntpd-utils.h"
+#include "rcl-sntp.h"
+
+/*
+  File format (the host byte order, the file is not portable):
+
+    struct snapshot_header
+    struct snapshot
+    zones * "timezone\0"     -- the timezone index (see rcl-zone-utils.c)
+
+  The file is replaced by rename(), so it can be mapped without care
+  of concurrent writes. The header is checked before the data is used.
+ */
+#define SNAPSHOT_MAGIC    0x4e534454   /* "TDSN" */
+#define SNAPSHOT_VERSION  1
+
+struct snapshot_header
+{
+  guint32  magic;
+  guint32  version;
+  guint32  size;       /* of the file */
+  guint32  checksum;   /* FNV-1a of the rest of the file */
+  guint32  state_size; /* sizeof(struct snapshot) */
+  guint32  zones;
+};
+
+/* The files the state is read from, in the order of snapshot.stamps[]: */
+static const gchar *const stamp_files[SNAPSHOT_STAMPS] =
+{
+  HWCLOCK_CONF,
+  ADJTIME_CONF,
+  NTPD_CONF,
+  NTPD_RC,
+  CHRONY_CONF,
+  CHRONYD_RC,
+  SNTP_ENABLED_FILE
+};
+
+static guint32 saved_checksum = 0;  /* of the file as it was read or written */
+static int     handover_fd    = -1; /* see snapshot_take_fd() */
+
+
+static guint32 fnv1a( const guint8 *p, gsize len )
+{
+  guint32 hash = 2166136261u;
+
+  while( len-- )
+  {
+    hash ^= *p++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+static void stamp_file( const gchar *path, struct snapshot_stamp *stamp )
+{
+  GStatBuf st;
+
+  memset( stamp, 0, sizeof(*stamp) );
+
+  if( sys_stat( path, &st ) != 0 )
+    return;
+
+  stamp->exists     = TRUE;
+  stamp->mode       = (guint32)st.st_mode;
+  stamp->size       = (gint64)st.st_size;
+  stamp->mtime_nsec = (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + (gint64)st.st_mtim.tv_nsec;
+}
+
+static void read_localtime( gchar *buf, gsize size )
+{
+  gchar *target = sys_read_link( "/etc/localtime", NULL );
+
+  g_strlcpy( buf, target ? target : "", size );
+  g_free( target );
+}
+
+
+/***************************************************************
+  snapshot_stamp():
+  ----------------
+    Take the stamps of the configuration files and the target of
+    /etc/localtime. It should be done before the state is read, so
+    a change made while it is read invalidates the snapshot.
+ */
+void snapshot_stamp( struct snapshot *snap )
+{
+  gint i;
+
+  if( !snap ) return;
+
+  read_localtime( snap->localtime, sizeof(snap->localtime) );
+
+  for( i = 0; i < SNAPSHOT_STAMPS; ++i )
+    stamp_file( stamp_files[i], &snap->stamps[i] );
+}
+
+/*
+  Only stat() and readlink() are done here:
+ */
+static gboolean snapshot_check( const struct snapshot *snap )
+{
+  struct snapshot now;
+  gint            i;
+
+  memset( &now, 0, sizeof(now) );
+  snapshot_stamp( &now );
+
+  if( strcmp( now.localtime, snap->localtime ) != 0 )
+  {
+    g_debug( "snapshot: /etc/localtime is changed" );
+    return FALSE;
+  }
+
+  for( i = 0; i < SNAPSHOT_STAMPS; ++i )
+  {
+    if( memcmp( &now.stamps[i], &snap->stamps[i], sizeof(struct snapshot_stamp) ) != 0 )
+    {
+      g_debug( "snapshot: '%s' is changed", stamp_files[i] );
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static void snapshot_load_zones( const gchar *p, const gchar *end, guint32 zones, guint64 generation )
+{
+  const gchar **index;
+  guint32       n;
+
+  if( !zones || generation != timezones_generation() )
+    return;
+
+  index = g_new0( const gchar *, zones + 1 );
+
+  for( n = 0; n < zones && p < end; ++n )
+  {
+    const gchar *z = memchr( p, '\0', (gsize)( end - p ) );
+
+    if( !z )
+      break;
+    index[n] = p;
+    p = z + 1;
+  }
+
+  if( n == zones )
+    (void)timezones_set_index( index, generation );
+
+  g_free( (gpointer)index );
+}
+
+
+/*
+  Map fd and take the state if it is valid; the checksum of the data
+  is returned for the comparison with the next save:
+ */
+static gboolean snapshot_map( int fd, struct snapshot *snap, guint32 *checksum )
+{
+  const struct snapshot_header *header;
+  gpointer                      map;
+  struct stat                   st;
+  gchar                        *rtc;
+  gboolean                      ret = FALSE;
+
+  if( fstat( fd, &st ) != 0 ||
+      st.st_size < (off_t)( sizeof(struct snapshot_header) + sizeof(struct snapshot) ) )
+    return FALSE;
+
+  map = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  if( map == MAP_FAILED )
+    return FALSE;
+
+  header = (const struct snapshot_header *)map;
+  if( header->magic      != SNAPSHOT_MAGIC           ||
+      header->version    != SNAPSHOT_VERSION         ||
+      header->state_size != sizeof(struct snapshot)  ||
+      header->size       != (guint32)st.st_size      ||
+      header->checksum   != fnv1a( (const guint8 *)map + sizeof(*header), (gsize)st.st_size - sizeof(*header) ) )
+  {
+    g_debug( "snapshot: The snapshot is not valid" );
+    goto out;
+  }
+
+  memcpy( snap, (const guint8 *)map + sizeof(*header), sizeof(*snap) );
+  snap->timezone[sizeof(snap->timezone) - 1]       = '\0';
+  snap->ntp_backend[sizeof(snap->ntp_backend) - 1] = '\0';
+  snap->rtc_device[sizeof(snap->rtc_device) - 1]   = '\0';
+  snap->localtime[sizeof(snap->localtime) - 1]     = '\0';
+
+  if( !snapshot_check( snap ) )
+    goto out;
+
+  snapshot_load_zones( (const gchar *)map + sizeof(*header) + sizeof(*snap),
+                       (const gchar *)map + st.st_size, header->zones, snap->tz_generation );
+
+  /* the drift model belongs to the RTC it was calibrated on */
+  rtc = clock_get_rtc_device();
+  if( snap->has_adjtime && g_strcmp0( rtc ? rtc : "", snap->rtc_device ) == 0 )
+    rtc_adjtime_set( &snap->adjtime );
+  g_free( rtc );
+
+  if( checksum )
+    *checksum = header->checksum;
+  ret = TRUE;
+
+out:
+  munmap( map, (size_t)st.st_size );
+
+  return ret;
+}
+
+/*
+  The file format is built in memory:
+ */
+static GByteArray *snapshot_build( const struct snapshot *snap, guint32 *checksum )
+{
+  struct snapshot_header  header;
+  struct snapshot         data;
+  GByteArray             *file;
+  gchar                 **zones, **p;
+  gchar                  *rtc;
+
+  /* copied field by field: no garbage after strings changes the checksum */
+  memset( &data, 0, sizeof(data) );
+  g_strlcpy( data.timezone, snap->timezone, sizeof(data.timezone) );
+  data.local_rtc   = snap->local_rtc;
+  data.can_ntp     = snap->can_ntp;
+  data.ntp_enabled = snap->ntp_enabled;
+  data.ntp_running = snap->ntp_running;
+  g_strlcpy( data.ntp_backend, snap->ntp_backend, sizeof(data.ntp_backend) );
+  g_strlcpy( data.localtime, snap->localtime, sizeof(data.localtime) );
+  memcpy( data.stamps, snap->stamps, sizeof(data.stamps) );
+
+  rtc = clock_get_rtc_device();
+  g_strlcpy( data.rtc_device, rtc ? rtc : "", sizeof(data.rtc_device) );
+  g_free( rtc );
+  data.has_adjtime = rtc_adjtime_get( &data.adjtime );
+
+  memset( &header, 0, sizeof(header) );
+  zones = timezones_get_index( &data.tz_generation );
+
+  file = g_byte_array_new();
+  g_byte_array_append( file, (const guint8 *)&header, sizeof(header) );
+  g_byte_array_append( file, (const guint8 *)&data, sizeof(data) );
+  for( p = zones; p && *p; ++p )
+  {
+    g_byte_array_append( file, (const guint8 *)*p, strlen( *p ) + 1 );
+    ++header.zones;
+  }
+  g_strfreev( zones );
+
+  header.magic      = SNAPSHOT_MAGIC;
+  header.version    = SNAPSHOT_VERSION;
+  header.size       = file->len;
+  header.state_size = sizeof(struct snapshot);
+  header.checksum   = fnv1a( file->data + sizeof(header), file->len - sizeof(header) );
+  memcpy( file->data, &header, sizeof(header) );
+
+  if( checksum )
+    *checksum = header.checksum;
+
+  return file;
+}
+
+
+/***************************************************************
+  snapshot_take_fd():
+  ------------------
+    The next snapshot_load() maps fd (the state sent by the running
+    daemon, see rcl-handover-utils.c) instead of SNAPSHOT_FILE.
+ */
+void snapshot_take_fd( int fd )
+{
+  if( handover_fd >= 0 )
+    close( handover_fd );
+  handover_fd = fd;
+}
+
+/***************************************************************
+  snapshot_load():
+  ---------------
+    Map SNAPSHOT_FILE and take the state if it is valid. The saved
+    timezone index and RTC drift model are taken as well.
+ */
+gboolean snapshot_load( struct snapshot *snap )
+{
+  gchar    *path;
+  gboolean  ret;
+  int       fd;
+
+  if( !snap ) return FALSE;
+
+  if( handover_fd >= 0 )
+  {
+    ret = snapshot_map( handover_fd, snap, NULL );
+    close( handover_fd );
+    handover_fd = -1;
+
+    if( ret )
+    {
+      g_debug( "snapshot: The state is taken from the running daemon" );
+      return TRUE;
+    }
+  }
+
+  path = sys_path( SNAPSHOT_FILE );
+  fd = open( path, O_RDONLY | O_CLOEXEC );
+  g_free( path );
+  if( fd < 0 )
+    return FALSE;
+
+  ret = snapshot_map( fd, snap, &saved_checksum );
+  close( fd );
+
+  return ret;
+}
+
+/***************************************************************
+  snapshot_save():
+  ---------------
+    Write the state with the current timezone index and RTC drift
+    model. The file is not written if nothing is changed.
+ */
+gboolean snapshot_save( const struct snapshot *snap )
+{
+  GByteArray *file;
+  guint32     checksum;
+  gboolean    ret;
+
+  /* the timezone would be cut */
+  if( !snap || strlen( snap->timezone ) >= sizeof(snap->timezone) - 1 )
+    return FALSE;
+
+  file = snapshot_build( snap, &checksum );
+
+  if( checksum == saved_checksum )
+  {
+    g_byte_array_unref( file );
+    return TRUE;
+  }
+
+  (void)sys_mkdir_with_parents( TIMEDATED_STATE_DIR, 0755 );
+  ret = sys_file_set_contents( SNAPSHOT_FILE, (const gchar *)file->data, (gssize)file->len );
+  if( ret )
+    saved_checksum = checksum;
+  else
+    g_debug( "snapshot: error: Cannot write '%s'", SNAPSHOT_FILE );
+
+  g_byte_array_unref( file );
+
+  return ret;
+}
+
+/***************************************************************
+  snapshot_memfd():
+  ----------------
+    The state in a sealed memory file, to be sent to the successor
+    (-1 on error).
+ */
+int snapshot_memfd( const struct snapshot *snap )
+{
+  GByteArray *file;
+  gsize       done = 0;
+  int         fd;
+
+  if( !snap || strlen( snap->timezone ) >= sizeof(snap->timezone) - 1 )
+    return -1;
+
+  fd = memfd_create( "timedated-snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+  if( fd < 0 )
+    return -1;
+
+  file = snapshot_build( snap, NULL );
+
+  while( done < file->len )
+  {
+    ssize_t n = write( fd, file->data + done, file->len - done );
+
+    if( n < 0 && errno == EINTR )
+      continue;
+    if( n <= 0 )
+      break;
+    done += (gsize)n;
+  }
+
+  if( done < file->len ||
+      fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL ) < 0 )
+  {
+    close( fd );
+    fd = -1;
+  }
+
+  g_byte_array_unref( file );
+
+  return fd;
+}
@@ -0,0 +1,82 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_SNAPSHOT_UTILS_H__
+#define __RCL_SNAPSHOT_UTILS_H__
+
+#include "config.h"
+
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <glib.h>
+
+#include "rcl-time-utils.h"
+
+#if !defined( TIMEDATED_STATE_DIR )
+#define TIMEDATED_STATE_DIR "/var/lib/timedated"
+#endif
+
+#define SNAPSHOT_FILE     TIMEDATED_STATE_DIR "/snapshot"
+#define SNAPSHOT_STAMPS   7     /* configuration files the state is read from */
+
+/*
+  The stamp of a file is compared by stat() only:
+ */
+struct snapshot_stamp
+{
+  gboolean  exists;
+  guint32   mode;
+  gint64    size;
+  gint64    mtime_nsec;
+};
+
+/*
+  The state of the daemon published at startup without reading it
+  again. The snapshot is valid while /etc/localtime points to the same
+  target and the configuration files have the same stamps:
+ */
+struct snapshot
+{
+  gchar                  timezone[64];
+  gboolean               local_rtc;
+  gboolean               can_ntp;
+  gboolean               ntp_enabled;
+  gboolean               ntp_running;    /* is checked again after startup */
+  gchar                  ntp_backend[16];
+
+  gchar                  rtc_device[32];
+  gboolean               has_adjtime;
+  struct rtc_adjtime     adjtime;
+
+  gchar                  localtime[256]; /* the target of /etc/localtime link */
+  struct snapshot_stamp  stamps[SNAPSHOT_STAMPS];
+  guint64                tz_generation;  /* of the timezone index saved with the state */
+};
+
+extern void      snapshot_stamp   ( struct snapshot *snap );
+extern gboolean  snapshot_load    ( struct snapshot *snap );
+extern gboolean  snapshot_save    ( const struct snapshot *snap );
+
+extern void      snapshot_take_fd ( int fd );
+extern int       snapshot_memfd   ( const struct snapshot *snap );
+
+
+#endif /* __RCL_SNAPSHOT_UTILS_H__ */
@@ -0,0 +1,540 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "rcl-sntp.h"
+#include "rcl-ntpd-utils.h"
+#include "rcl-time-utils.h"
+#include "rcl-sys.h"
+
+/*
+  Simple NTP (RFC 4330) client running on the daemon main loop.
+  Servers are taken from NTPD_CONF (server/pool lines), the clock is
+  stepped for large offsets and disciplined by the kernel PLL otherwise.
+ */
+
+#define NTP_EPOCH_DELTA      2208988800ULL  /* 1900 -> 1970 */
+#define NTP_LI_ALARM         3
+#define NTP_MODE_CLIENT      3
+#define NTP_MODE_SERVER      4
+#define NTP_VERSION          4
+
+#define SNTP_STEP_NSEC       ((gint64)(128 * NSEC_PER_MSEC)) /* step larger offsets (as ntpd does) */
+#define SNTP_STABLE_NSEC     ((gint64)(10 * NSEC_PER_MSEC))  /* increase poll interval below this offset */
+
+struct ntp_ts
+{
+  guint32 sec;
+  guint32 frac;
+} __attribute__((packed));
+
+struct ntp_packet
+{
+  guint8         li_vn_mode;
+  guint8         stratum;
+  gint8          poll;
+  gint8          precision;
+  guint32        root_delay;
+  guint32        root_dispersion;
+  guint32        refid;
+  struct ntp_ts  reference;
+  struct ntp_ts  origin;
+  struct ntp_ts  receive;
+  struct ntp_ts  transmit;
+} __attribute__((packed));
+
+static gchar        **sntp_servers = NULL;
+static gboolean       sntp_servers_set = FALSE;
+static guint          sntp_server  = 0;
+static guint          sntp_poll    = SNTP_POLL_MIN;
+static gboolean       sntp_running = FALSE;
+
+static GSocket       *sntp_socket  = NULL;
+static GSource       *sntp_source  = NULL;
+static guint          sntp_timer   = 0;
+static GCancellable  *sntp_cancel  = NULL;
+
+static struct ntp_ts  sntp_cookie;
+static gint64         sntp_sent    = 0;  /* CLOCK_REALTIME nsec of the request */
+static gchar          sntp_address[64];   /* address of the server being queried */
+
+static struct ntp_status sntp_peer;       /* the last valid reply */
+static gboolean          sntp_peer_valid = FALSE;
+
+
+/***************************************************************
+  Static functions:
+ */
+/*
+  NTP seconds wrap every 136 years (the era 1 starts in 2036). The era
+  is the one which puts the time within 68 years of the local clock
+  (RFC 4330, section 3):
+ */
+static gint64 ntp_ts_load( const struct ntp_ts *ts )
+{
+  guint32 sec  = GUINT32_FROM_BE( ts->sec );
+  guint64 frac = (guint64)GUINT32_FROM_BE( ts->frac );
+  gint64  local, t;
+
+  local = (gint64)(now_nsec( CLOCK_REALTIME ) / NSEC_PER_SEC);
+  t     = local + (gint64)(gint32)(sec - (guint32)((guint64)local + NTP_EPOCH_DELTA));
+
+  return t * (gint64)NSEC_PER_SEC + (gint64)((frac * NSEC_PER_SEC) >> 32);
+}
+
+static gint64 ntp_short_load( guint32 v )
+{
+  /* 16.16 fixed point seconds */
+  return (gint64)(((guint64)GUINT32_FROM_BE( v ) * NSEC_PER_SEC) >> 16);
+}
+
+static gchar **read_ntpd_conf_servers( void )
+{
+  GPtrArray  *servers;
+  gchar      *contents = NULL;
+  gchar     **lines;
+  gchar     **l;
+
+  servers = g_ptr_array_new();
+
+  if( sys_file_get_contents( NTPD_CONF, &contents, NULL ) )
+  {
+    lines = g_strsplit( contents, "\n", -1 );
+    for( l = lines; *l; ++l )
+    {
+      gchar **tokens = g_strsplit_set( g_strstrip( *l ), " \t", -1 );
+
+      if( tokens[0] && tokens[1] &&
+          ( !g_strcmp0( tokens[0], "server" ) || !g_strcmp0( tokens[0], "pool" ) ) &&
+          !g_str_has_prefix( tokens[1], "127.127." ) ) /* reference clock drivers */
+      {
+        g_ptr_array_add( servers, g_strdup( tokens[1] ) );
+      }
+      g_strfreev( tokens );
+    }
+    g_strfreev( lines );
+    g_free( contents );
+  }
+
+  g_ptr_array_add( servers, NULL );
+
+  return (gchar **)g_ptr_array_free( servers, FALSE );
+}
+
+static void load_servers( void )
+{
+  if( sntp_servers_set )
+    return;
+
+  g_strfreev( sntp_servers );
+  sntp_servers = read_ntpd_conf_servers();
+}
+
+static void sntp_query( void );
+
+static gboolean sntp_poll_cb( gpointer user_data )
+{
+  sntp_timer = 0;
+  sntp_query();
+
+  return G_SOURCE_REMOVE;
+}
+
+static void sntp_schedule( guint seconds )
+{
+  if( sntp_timer )
+    g_source_remove( sntp_timer );
+
+  sntp_timer = g_timeout_add_seconds( seconds, sntp_poll_cb, NULL );
+}
+
+/*
+  No (valid) reply: try the next server, back off when all of them failed:
+ */
+static void sntp_next_server( void )
+{
+  if( sntp_servers[0] && sntp_servers[++sntp_server] == NULL )
+  {
+    sntp_server = 0;
+    sntp_poll   = MIN( sntp_poll * 2, SNTP_POLL_MAX );
+  }
+
+  sntp_schedule( sntp_server ? 1 : sntp_poll );
+}
+
+static gboolean sntp_timeout_cb( gpointer user_data )
+{
+  sntp_timer = 0;
+
+  g_debug( "sntp: warning: No reply from '%s'", sntp_servers[sntp_server] );
+  sntp_next_server();
+
+  return G_SOURCE_REMOVE;
+}
+
+static void sntp_discipline( gint64 offset, gint64 delay, const struct ntp_packet *p )
+{
+  guint64 maxerror;
+
+  if( ABS( offset ) > SNTP_STEP_NSEC )
+  {
+    g_debug( "sntp: Step the clock by %" G_GINT64_FORMAT " nsec", offset );
+    if( !clock_step_offset_nsec( offset, NULL, NULL ) )
+      g_debug( "sntp: error: Cannot step the clock" );
+    sntp_poll = SNTP_POLL_MIN;
+    return;
+  }
+
+  /* server error bound plus half of the round trip */
+  maxerror = (guint64)((ntp_short_load( p->root_delay ) / 2 + ntp_short_load( p->root_dispersion ) + delay / 2) /
+                       (gint64)NSEC_PER_USEC);
+
+  if( !clock_discipline( offset, sntp_poll, maxerror, (guint64)(ABS( offset ) / (gint64)NSEC_PER_USEC) ) )
+    g_debug( "sntp: error: Cannot discipline the clock" );
+
+  if( ABS( offset ) < SNTP_STABLE_NSEC )
+    sntp_poll = MIN( sntp_poll * 2, SNTP_POLL_MAX );
+  else
+    sntp_poll = SNTP_POLL_MIN;
+}
+
+static gboolean sntp_receive_cb( GSocket *socket, GIOCondition condition, gpointer user_data )
+{
+  struct ntp_packet  p;
+  gssize             len;
+  gint64             t1, t2, t3, t4;
+  gint64             offset, delay;
+
+  len = g_socket_receive_from( socket, NULL, (gchar *)&p, sizeof(p), NULL, NULL );
+  t4  = (gint64)now_nsec( CLOCK_REALTIME );
+
+  if( len < (gssize)sizeof(p) || !sntp_sent )
+    return G_SOURCE_CONTINUE;
+
+  /* the reply to our last request only */
+  if( memcmp( &p.origin, &sntp_cookie, sizeof(sntp_cookie) ) )
+    return G_SOURCE_CONTINUE;
+
+  if( sntp_timer )
+    g_source_remove( sntp_timer );
+  sntp_timer = 0;
+
+  if( (p.li_vn_mode & 0x07) != NTP_MODE_SERVER ||
+      (p.li_vn_mode >> 6) == NTP_LI_ALARM       ||
+      p.stratum == 0 || p.stratum > 15          || /* stratum 0 is Kiss-o'-Death */
+      !p.transmit.sec                             )
+  {
+    g_debug( "sntp: warning: Invalid reply from '%s'", sntp_servers[sntp_server] );
+    sntp_sent = 0;
+    sntp_next_server();
+    return G_SOURCE_CONTINUE;
+  }
+
+  t1 = sntp_sent;
+  t2 = ntp_ts_load( &p.receive );
+  t3 = ntp_ts_load( &p.transmit );
+
+  offset = ((t2 - t1) + (t3 - t4)) / 2;
+  delay  = (t4 - t1) - (t3 - t2);
+
+  sntp_sent = 0;
+
+  g_debug( "sntp: '%s' stratum %u offset %" G_GINT64_FORMAT " nsec delay %" G_GINT64_FORMAT " nsec",
+           sntp_servers[sntp_server], p.stratum, offset, delay );
+
+  sntp_discipline( offset, delay, &p );
+  sntp_schedule( sntp_poll );
+
+  memset( &sntp_peer, 0, sizeof(sntp_peer) );
+  g_strlcpy( sntp_peer.server_name, sntp_servers[sntp_server], sizeof(sntp_peer.server_name) );
+  g_strlcpy( sntp_peer.server_address, sntp_address, sizeof(sntp_peer.server_address) );
+  sntp_peer.leap                 = p.li_vn_mode >> 6;
+  sntp_peer.version              = (p.li_vn_mode >> 3) & 0x07;
+  sntp_peer.mode                 = p.li_vn_mode & 0x07;
+  sntp_peer.stratum              = p.stratum;
+  sntp_peer.precision            = p.precision;
+  sntp_peer.refid                = p.refid;
+  sntp_peer.root_delay_usec      = ntp_short_load( p.root_delay ) / (gint64)NSEC_PER_USEC;
+  sntp_peer.root_dispersion_usec = ntp_short_load( p.root_dispersion ) / (gint64)NSEC_PER_USEC;
+  sntp_peer.offset_nsec          = offset;
+  sntp_peer.poll_usec            = (guint64)sntp_poll * USEC_PER_SEC;
+  sntp_peer_valid = TRUE;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean sntp_open_socket( GSocketFamily family )
+{
+  GError *error = NULL;
+
+  if( sntp_socket && g_socket_get_family( sntp_socket ) == family )
+    return TRUE;
+
+  if( sntp_source )
+  {
+    g_source_destroy( sntp_source );
+    g_source_unref( sntp_source );
+    sntp_source = NULL;
+  }
+  g_clear_object( &sntp_socket );
+
+  sntp_socket = g_socket_new( family, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, &error );
+  if( !sntp_socket )
+  {
+    g_debug( "sntp: error: Cannot create socket: %s", error->message );
+    g_error_free( error );
+    return FALSE;
+  }
+  g_socket_set_blocking( sntp_socket, FALSE );
+
+  sntp_source = g_socket_create_source( sntp_socket, G_IO_IN, NULL );
+  g_source_set_callback( sntp_source, G_SOURCE_FUNC( sntp_receive_cb ), NULL, NULL );
+  g_source_attach( sntp_source, NULL );
+
+  return TRUE;
+}
+
+static void sntp_send( GSocketAddress *address )
+{
+  struct ntp_packet  p = {};
+  GError            *error = NULL;
+
+  if( !sntp_open_socket( g_socket_address_get_family( address ) ) )
+  {
+    sntp_next_server();
+    return;
+  }
+
+  sntp_address[0] = '\0';
+  if( G_IS_INET_SOCKET_ADDRESS( address ) )
+  {
+    gchar *str = g_inet_address_to_string( g_inet_socket_address_get_address( G_INET_SOCKET_ADDRESS( address ) ) );
+    g_strlcpy( sntp_address, str, sizeof(sntp_address) );
+    g_free( str );
+  }
+
+  p.li_vn_mode = (NTP_VERSION << 3) | NTP_MODE_CLIENT;
+
+  /* random transmit timestamp: the server echoes it, and it does not leak our clock */
+  sntp_cookie.sec  = g_random_int();
+  sntp_cookie.frac = g_random_int();
+  p.transmit       = sntp_cookie;
+
+  sntp_sent = (gint64)now_nsec( CLOCK_REALTIME );
+
+  if( g_socket_send_to( sntp_socket, address, (const gchar *)&p, sizeof(p), NULL, &error ) < 0 )
+  {
+    g_debug( "sntp: error: Cannot send to '%s': %s", sntp_servers[sntp_server], error->message );
+    g_error_free( error );
+    sntp_sent = 0;
+    sntp_next_server();
+    return;
+  }
+
+  if( sntp_timer )
+    g_source_remove( sntp_timer );
+  sntp_timer = g_timeout_add_seconds( SNTP_TIMEOUT, sntp_timeout_cb, NULL );
+}
+
+static void sntp_resolved_cb( GObject *source_object, GAsyncResult *result, gpointer user_data )
+{
+  GSocketAddressEnumerator *enumerator = G_SOCKET_ADDRESS_ENUMERATOR( source_object );
+  GSocketAddress           *address;
+  GError                   *error = NULL;
+
+  address = g_socket_address_enumerator_next_finish( enumerator, result, &error );
+  if( !address )
+  {
+    if( error && g_error_matches( error, G_IO_ERROR, G_IO_ERROR_CANCELLED ) )
+    {
+      g_error_free( error );
+      return;
+    }
+    g_debug( "sntp: warning: Cannot resolve '%s': %s", sntp_servers[sntp_server],
+             error ? error->message : "no address" );
+    g_clear_error( &error );
+    sntp_next_server();
+    return;
+  }
+
+  sntp_send( address );
+  g_object_unref( address );
+}
+
+static void sntp_query( void )
+{
+  GSocketConnectable       *connectable;
+  GSocketAddressEnumerator *enumerator;
+  GError                   *error = NULL;
+
+  if( !sntp_running )
+    return;
+
+  if( !sntp_servers || !sntp_servers[0] )
+  {
+    g_debug( "sntp: warning: No NTP servers configured" );
+    sntp_schedule( SNTP_POLL_MAX );
+    return;
+  }
+
+  /* host, host:port, [ipv6]:port */
+  connectable = g_network_address_parse( sntp_servers[sntp_server], SNTP_PORT, &error );
+  if( !connectable )
+  {
+    g_debug( "sntp: warning: Invalid server '%s': %s", sntp_servers[sntp_server], error->message );
+    g_error_free( error );
+    sntp_next_server();
+    return;
+  }
+
+  enumerator = g_socket_connectable_enumerate( connectable );
+  g_socket_address_enumerator_next_async( enumerator, sntp_cancel, sntp_resolved_cb, NULL );
+  g_object_unref( enumerator );
+  g_object_unref( connectable );
+}
+
+
+/***************************************************************
+  SNTP client control:
+ */
+
+/*
+  Use these servers instead of NTPD_CONF (NULL restores NTPD_CONF):
+ */
+gboolean sntp_client_set_servers( const gchar *const *servers )
+{
+  g_strfreev( sntp_servers );
+  sntp_servers     = servers ? g_strdupv( (gchar **)servers ) : NULL;
+  sntp_servers_set = ( servers != NULL );
+  sntp_server      = 0;
+
+  return TRUE;
+}
+
+gboolean sntp_client_installed( void )
+{
+  if( !ENABLE_SNTP )
+    return FALSE;
+
+  load_servers();
+
+  return ( sntp_servers && sntp_servers[0] );
+}
+
+gboolean sntp_client_enabled( void )
+{
+  return ( sntp_client_installed() && sys_file_test( SNTP_ENABLED_FILE, G_FILE_TEST_EXISTS ) );
+}
+
+gboolean sntp_client_status( void )
+{
+  return sntp_running;
+}
+
+/*
+  The last valid server reply (FALSE until the first one):
+ */
+gboolean sntp_client_query( struct ntp_status *status )
+{
+  struct timex txc;
+
+  if( !status || !sntp_running || !sntp_peer_valid )
+    return FALSE;
+
+  *status = sntp_peer;
+
+  if( clock_get_timex( &txc ) )
+    status->freq_ppm = (gdouble)txc.freq / 65536.0;
+
+  return TRUE;
+}
+
+gboolean start_sntp_client( void )
+{
+  if( sntp_running )
+    return TRUE;
+
+  if( !sntp_client_installed() )
+    return FALSE;
+
+  sntp_cancel  = g_cancellable_new();
+  sntp_server  = 0;
+  sntp_poll    = SNTP_POLL_MIN;
+  sntp_running = TRUE;
+
+  g_debug( "sntp: Started with %u server(s)", g_strv_length( sntp_servers ) );
+
+  sntp_query();
+
+  return TRUE;
+}
+
+gboolean stop_sntp_client( void )
+{
+  if( !sntp_running )
+    return TRUE;
+
+  sntp_running = FALSE;
+  sntp_sent    = 0;
+
+  sntp_peer_valid = FALSE;
+
+  if( sntp_cancel )
+    g_cancellable_cancel( sntp_cancel );
+  g_clear_object( &sntp_cancel );
+
+  if( sntp_timer )
+    g_source_remove( sntp_timer );
+  sntp_timer = 0;
+
+  if( sntp_source )
+  {
+    g_source_destroy( sntp_source );
+    g_source_unref( sntp_source );
+    sntp_source = NULL;
+  }
+  g_clear_object( &sntp_socket );
+
+  g_debug( "sntp: Stopped" );
+
+  return TRUE;
+}
+
+gboolean disable_sntp_client( void )
+{
+  (void)stop_sntp_client();
+
+  if( sys_unlink( SNTP_ENABLED_FILE ) < 0 && errno != ENOENT )
+    return FALSE;
+
+  return TRUE;
+}
+
+gboolean enable_sntp_client( void )
+{
+  if( !sntp_client_installed() )
+    return FALSE;
+
+  if( sys_mkdir_with_parents( TIMEDATED_STATE_DIR, 0755 ) < 0 )
+    return FALSE;
+
+  if( !sys_file_set_contents( SNTP_ENABLED_FILE, "", 0 ) )
+    return FALSE;
+
+  return TRUE;
+}
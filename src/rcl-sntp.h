@@ -0,0 +1,66 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_SNTP_H__
+#define __RCL_SNTP_H__
+
+#include "config.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "rcl-ntpd-utils.h"
+
+#if !defined( ENABLE_SNTP )
+#define ENABLE_SNTP 0
+#endif
+
+#if !defined( TIMEDATED_STATE_DIR )
+#define TIMEDATED_STATE_DIR "/var/lib/timedated"
+#endif
+
+#define SNTP_ENABLED_FILE  TIMEDATED_STATE_DIR "/sntp-enabled"
+
+#define SNTP_PORT          123
+#define SNTP_POLL_MIN      32    /* sec */
+#define SNTP_POLL_MAX      2048  /* sec */
+#define SNTP_TIMEOUT       5     /* sec to wait for the server reply */
+
+extern gboolean  sntp_client_set_servers ( const gchar *const *servers );
+
+extern gboolean  sntp_client_installed   ( void );
+extern gboolean  sntp_client_enabled     ( void );
+extern gboolean  sntp_client_status      ( void );
+extern gboolean  sntp_client_query       ( struct ntp_status *status );
+extern gboolean  stop_sntp_client        ( void );
+extern gboolean  start_sntp_client       ( void );
+extern gboolean  disable_sntp_client     ( void );
+extern gboolean  enable_sntp_client      ( void );
+
+
+#endif /* __RCL_SNTP_H__ */
@@ -0,0 +1,701 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "rcl-sys.h"
+#include "rcl-time-utils.h"
+#include "rcl-metrics-utils.h"
+
+static const struct sys_backend *backend = NULL;
+
+/* simulated backend state */
+static gchar        *sim_root        = NULL;
+static guint         sim_rtc_latency = 0;  /* usec added to every RTC ioctl */
+static gint64        sim_offset      = 0;  /* virtual CLOCK_REALTIME - CLOCK_MONOTONIC, nsec */
+static struct timex  sim_timex;
+static GHashTable   *sim_rtc_fds     = NULL;
+
+G_LOCK_DEFINE_STATIC( sim );
+
+
+/***************************************************************
+  Host backend:
+ */
+static int host_clock_gettime( clockid_t clock_id, struct timespec *ts )
+{
+  return clock_gettime( clock_id, ts );
+}
+
+static int host_clock_settime( clockid_t clock_id, const struct timespec *ts )
+{
+  return clock_settime( clock_id, ts );
+}
+
+static int host_clock_nanosleep( clockid_t clock_id, int flags, const struct timespec *request )
+{
+  return clock_nanosleep( clock_id, flags, request, NULL );
+}
+
+static int host_settimeofday( const struct timeval *tv, const struct timezone *tz )
+{
+  return settimeofday( tv, tz );
+}
+
+static int host_adjtimex( struct timex *txc )
+{
+  return adjtimex( txc );
+}
+
+static int host_open( const char *path, int flags )
+{
+  return open( path, flags );
+}
+
+static int host_close( int fd )
+{
+  return close( fd );
+}
+
+static int host_ioctl( int fd, unsigned long request, void *arg )
+{
+  return ioctl( fd, request, arg );
+}
+
+static gboolean host_spawn( const gchar *cmd, gint *wait_status, GError **error )
+{
+  return g_spawn_command_line_sync( cmd, NULL, NULL, wait_status, error );
+}
+
+static const struct sys_backend host_backend =
+{
+  "host",
+  host_clock_gettime, host_clock_settime, host_clock_nanosleep, host_settimeofday,
+  host_adjtimex, host_open, host_close, host_ioctl, host_spawn
+};
+
+
+/***************************************************************
+  Simulated backend:
+ */
+static gint64 sim_realtime_nsec( void )
+{
+  struct timespec ts;
+  gint64          ret;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  G_LOCK( sim );
+  ret = (gint64)timespec_load_nsec( &ts ) + sim_offset;
+  G_UNLOCK( sim );
+
+  return ret;
+}
+
+static void sim_set_realtime_nsec( gint64 nsec )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  G_LOCK( sim );
+  sim_offset = nsec - (gint64)timespec_load_nsec( &ts );
+  G_UNLOCK( sim );
+}
+
+static int sim_clock_gettime( clockid_t clock_id, struct timespec *ts )
+{
+  if( clock_id != CLOCK_REALTIME && clock_id != CLOCK_REALTIME_COARSE )
+    return clock_gettime( clock_id, ts );
+
+  timespec_store_nsec( ts, (guint64)sim_realtime_nsec() );
+
+  return 0;
+}
+
+static int sim_clock_settime( clockid_t clock_id, const struct timespec *ts )
+{
+  if( clock_id != CLOCK_REALTIME || ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= (long)NSEC_PER_SEC )
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  sim_set_realtime_nsec( (gint64)timespec_load_nsec( ts ) );
+
+  return 0;
+}
+
+/*
+  Absolute CLOCK_REALTIME sleeps end at the virtual time:
+ */
+static int sim_clock_nanosleep( clockid_t clock_id, int flags, const struct timespec *request )
+{
+  struct timespec mono;
+  gint64          offset;
+
+  if( clock_id != CLOCK_REALTIME )
+    return clock_nanosleep( clock_id, flags, request, NULL );
+
+  if( !(flags & TIMER_ABSTIME) )
+    return clock_nanosleep( CLOCK_MONOTONIC, 0, request, NULL );
+
+  G_LOCK( sim );
+  offset = sim_offset;
+  G_UNLOCK( sim );
+
+  timespec_store_nsec( &mono, (guint64)MAX( (gint64)timespec_load_nsec( request ) - offset, 0 ) );
+
+  return clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &mono, NULL );
+}
+
+static int sim_settimeofday( const struct timeval *tv, const struct timezone *tz )
+{
+  /* the kernel timezone is not simulated */
+  if( tv )
+    sim_set_realtime_nsec( (gint64)timeval_load( tv ) * (gint64)NSEC_PER_USEC );
+
+  return 0;
+}
+
+/*
+  Kernel PLL state is kept as set; offsets (PLL and single shot) are
+  applied to the virtual clock at once:
+ */
+static int sim_adjtimex( struct timex *txc )
+{
+  gint64 step = 0;
+  int    state;
+
+  G_LOCK( sim );
+
+  if( txc->modes == ADJ_OFFSET_SS_READ )
+  {
+    /* nothing pending */
+  }
+  else if( (txc->modes & ADJ_OFFSET_SINGLESHOT) == ADJ_OFFSET_SINGLESHOT )
+  {
+    step = (gint64)txc->offset * (gint64)NSEC_PER_USEC;
+  }
+  else
+  {
+    if( txc->modes & ADJ_STATUS )
+      sim_timex.status = txc->status;
+    if( txc->modes & ADJ_NANO )
+      sim_timex.status |= STA_NANO;
+    if( txc->modes & ADJ_MICRO )
+      sim_timex.status &= ~STA_NANO;
+    if( txc->modes & ADJ_OFFSET )
+      step = (sim_timex.status & STA_NANO) ? (gint64)txc->offset : (gint64)txc->offset * (gint64)NSEC_PER_USEC;
+    if( txc->modes & ADJ_FREQUENCY )
+      sim_timex.freq = txc->freq;
+    if( txc->modes & ADJ_MAXERROR )
+      sim_timex.maxerror = txc->maxerror;
+    if( txc->modes & ADJ_ESTERROR )
+      sim_timex.esterror = txc->esterror;
+    if( txc->modes & ADJ_TIMECONST )
+      sim_timex.constant = txc->constant;
+    if( txc->modes & ADJ_TAI )
+      sim_timex.tai = (int)txc->constant;
+  }
+
+  sim_offset += step;
+  *txc = sim_timex;
+
+  G_UNLOCK( sim );
+
+  if( sim_timex.status & STA_NANO )
+  {
+    gint64 nsec = sim_realtime_nsec();
+
+    txc->time.tv_sec  = (time_t)(nsec / (gint64)NSEC_PER_SEC);
+    txc->time.tv_usec = (suseconds_t)(nsec % (gint64)NSEC_PER_SEC);
+  }
+  else
+    timeval_store( &txc->time, (guint64)sim_realtime_nsec() / NSEC_PER_USEC );
+
+  if( txc->status & STA_UNSYNC )
+    state = TIME_ERROR;
+  else if( txc->status & STA_INS )
+    state = TIME_INS;
+  else if( txc->status & STA_DEL )
+    state = TIME_DEL;
+  else
+    state = TIME_OK;
+
+  return state;
+}
+
+static gboolean is_rtc_device( const char *path )
+{
+  return ( g_str_has_prefix( path, "/dev/rtc" ) || g_str_has_prefix( path, "/dev/misc/rtc" ) );
+}
+
+static int sim_open( const char *path, int flags )
+{
+  gchar *mapped = sys_path( path );
+  int    fd;
+
+  if( is_rtc_device( path ) )
+  {
+    /* the file holds the RTC time minus the host time in seconds */
+    fd = open( mapped, O_RDWR | O_CLOEXEC );
+    if( fd >= 0 )
+    {
+      G_LOCK( sim );
+      g_hash_table_add( sim_rtc_fds, GINT_TO_POINTER( fd ) );
+      G_UNLOCK( sim );
+    }
+  }
+  else
+    fd = open( mapped, flags );
+
+  g_free( mapped );
+
+  return fd;
+}
+
+static int sim_close( int fd )
+{
+  G_LOCK( sim );
+  g_hash_table_remove( sim_rtc_fds, GINT_TO_POINTER( fd ) );
+  G_UNLOCK( sim );
+
+  return close( fd );
+}
+
+static gboolean sim_rtc_load( int fd, gint64 *delta )
+{
+  gchar   buf[32];
+  ssize_t len;
+
+  len = pread( fd, buf, sizeof(buf) - 1, 0 );
+  if( len < 0 )
+    return FALSE;
+
+  buf[len] = '\0';
+  *delta = g_ascii_strtoll( buf, NULL, 10 );
+
+  return TRUE;
+}
+
+static gboolean sim_rtc_store( int fd, gint64 delta )
+{
+  gchar buf[32];
+  gint  len;
+
+  len = g_snprintf( buf, sizeof(buf), "%" G_GINT64_FORMAT "\n", delta );
+
+  return ( ftruncate( fd, 0 ) == 0 && pwrite( fd, buf, (size_t)len, 0 ) == (ssize_t)len );
+}
+
+/*
+  RTC_RD_TIME and RTC_SET_TIME only; update interrupts are not
+  supported, so the RTC seconds tick is polled (as for most I2C RTCs):
+ */
+static int sim_ioctl( int fd, unsigned long request, void *arg )
+{
+  struct tm  tm;
+  gboolean   rtc;
+  gint64     delta;
+  time_t     t;
+
+  G_LOCK( sim );
+  rtc = g_hash_table_contains( sim_rtc_fds, GINT_TO_POINTER( fd ) );
+  G_UNLOCK( sim );
+
+  if( !rtc )
+  {
+    errno = ENOTTY;
+    return -1;
+  }
+
+  if( sim_rtc_latency )
+    g_usleep( sim_rtc_latency );
+
+  switch( request )
+  {
+    case RTC_RD_TIME:
+      if( !sim_rtc_load( fd, &delta ) )
+        return -1;
+      t = (time_t)( g_get_real_time() / (gint64)USEC_PER_SEC + delta );
+      if( !gmtime_r( &t, &tm ) )
+        return -1;
+      memcpy( arg, &tm, sizeof(struct rtc_time) );
+      return 0;
+
+    case RTC_SET_TIME:
+      memset( &tm, 0, sizeof(tm) );
+      memcpy( &tm, arg, sizeof(struct rtc_time) );
+      t = timegm( &tm );
+      if( t == (time_t)-1 )
+      {
+        errno = EINVAL;
+        return -1;
+      }
+      return sim_rtc_store( fd, (gint64)t - g_get_real_time() / (gint64)USEC_PER_SEC ) ? 0 : -1;
+
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+/*
+  Absolute paths in the command are taken under the root. Commands
+  which do not exist there (e.g. rc.ntpd) are not run at all:
+ */
+static gboolean sim_spawn( const gchar *cmd, gint *wait_status, GError **error )
+{
+  gchar    **argv;
+  gchar    **a;
+  gboolean   ret;
+
+  if( !g_shell_parse_argv( cmd, NULL, &argv, error ) )
+    return FALSE;
+
+  for( a = argv; *a; ++a )
+  {
+    gchar *mapped;
+
+    if( !g_path_is_absolute( *a ) )
+      continue;
+
+    mapped = sys_path( *a );
+    if( a == argv || g_file_test( mapped, G_FILE_TEST_EXISTS ) )
+    {
+      g_free( *a );
+      *a = mapped;
+    }
+    else
+      g_free( mapped );
+  }
+
+  if( g_path_is_absolute( argv[0] ) && !g_file_test( argv[0], G_FILE_TEST_IS_EXECUTABLE ) )
+  {
+    g_set_error( error, G_SPAWN_ERROR, G_SPAWN_ERROR_NOENT, "'%s' is not executable", argv[0] );
+    g_strfreev( argv );
+    return FALSE;
+  }
+
+  ret = g_spawn_sync( NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL, wait_status, error );
+  g_strfreev( argv );
+
+  return ret;
+}
+
+static const struct sys_backend sim_backend =
+{
+  "simulated",
+  sim_clock_gettime, sim_clock_settime, sim_clock_nanosleep, sim_settimeofday,
+  sim_adjtimex, sim_open, sim_close, sim_ioctl, sim_spawn
+};
+
+
+/***************************************************************
+  Backend selection:
+ */
+static const struct sys_backend *sys( void )
+{
+  return backend ? backend : &host_backend;
+}
+
+/*
+  Switch to the simulated backend (before the daemon starts). The
+  virtual clock starts from the host time, unsynchronized:
+ */
+gboolean sys_set_simulated( const gchar *root, guint rtc_latency_usec )
+{
+  struct timespec real, mono;
+
+  if( !root || !g_path_is_absolute( root ) || !g_file_test( root, G_FILE_TEST_IS_DIR ) )
+    return FALSE;
+
+  clock_gettime( CLOCK_REALTIME, &real );
+  clock_gettime( CLOCK_MONOTONIC, &mono );
+
+  G_LOCK( sim );
+
+  g_free( sim_root );
+  sim_root        = g_strdup( root );
+  sim_rtc_latency = rtc_latency_usec;
+  sim_offset      = (gint64)timespec_load_nsec( &real ) - (gint64)timespec_load_nsec( &mono );
+
+  memset( &sim_timex, 0, sizeof(sim_timex) );
+  sim_timex.status    = STA_UNSYNC;
+  sim_timex.maxerror  = 16000000;
+  sim_timex.esterror  = 16000000;
+  sim_timex.constant  = 2;
+  sim_timex.precision = 1;
+  sim_timex.tolerance = 32768000;
+  sim_timex.tick      = 10000;
+
+  if( !sim_rtc_fds )
+    sim_rtc_fds = g_hash_table_new( g_direct_hash, g_direct_equal );
+
+  G_UNLOCK( sim );
+
+  backend = &sim_backend;
+  sys_tzset();
+
+  return TRUE;
+}
+
+const gchar *sys_backend_name( void )
+{
+  return sys()->name;
+}
+
+/*
+  Path of the file as seen by the backend, free with g_free():
+ */
+gchar *sys_path( const gchar *path )
+{
+  if( !sim_root || !path || !g_path_is_absolute( path ) )
+    return g_strdup( path );
+
+  return g_strconcat( sim_root, path, NULL );
+}
+
+
+/***************************************************************
+  System calls:
+ */
+int sys_clock_gettime( clockid_t clock_id, struct timespec *ts )
+{
+  return sys()->clock_gettime( clock_id, ts );
+}
+
+int sys_clock_settime( clockid_t clock_id, const struct timespec *ts )
+{
+  return sys()->clock_settime( clock_id, ts );
+}
+
+/*
+  Returns zero or the error number (as clock_nanosleep(2) does):
+ */
+int sys_clock_nanosleep( clockid_t clock_id, int flags, const struct timespec *request )
+{
+  return sys()->clock_nanosleep( clock_id, flags, request );
+}
+
+int sys_settimeofday( const struct timeval *tv, const struct timezone *tz )
+{
+  return sys()->settimeofday( tv, tz );
+}
+
+int sys_adjtimex( struct timex *txc )
+{
+  return sys()->adjtimex( txc );
+}
+
+int sys_open( const char *path, int flags )
+{
+  return sys()->open( path, flags );
+}
+
+int sys_close( int fd )
+{
+  return sys()->close( fd );
+}
+
+int sys_ioctl( int fd, unsigned long request, void *arg )
+{
+  gint64 start = metrics_start();
+  int    ret;
+
+  /* RTC is the only device the daemon talks to */
+  ret = sys()->ioctl( fd, request, arg );
+  metrics_phase_done( METRICS_RTC_IO, start );
+
+  return ret;
+}
+
+gboolean sys_spawn( const gchar *cmd, gint *wait_status, GError **error )
+{
+  gint64   start = metrics_start();
+  gboolean ret;
+
+  ret = sys()->spawn( cmd, wait_status, error );
+  metrics_phase_done( METRICS_SPAWN, start );
+
+  return ret;
+}
+
+
+/***************************************************************
+  File system (paths are taken under the simulated root):
+ */
+int sys_symlink( const char *target, const char *path )
+{
+  gchar  *mapped = sys_path( path );
+  gint64  start  = metrics_start();
+  int     ret;
+
+  /* relative target resolves under the root as well */
+  ret = symlink( target, mapped );
+  metrics_phase_done( METRICS_CONFIG_IO, start );
+  g_free( mapped );
+
+  return ret;
+}
+
+int sys_unlink( const char *path )
+{
+  gchar  *mapped = sys_path( path );
+  gint64  start  = metrics_start();
+  int     ret;
+
+  ret = unlink( mapped );
+  metrics_phase_done( METRICS_CONFIG_IO, start );
+  g_free( mapped );
+
+  return ret;
+}
+
+int sys_mkdir_with_parents( const gchar *path, gint mode )
+{
+  gchar *mapped = sys_path( path );
+  int    ret;
+
+  ret = g_mkdir_with_parents( mapped, mode );
+  g_free( mapped );
+
+  return ret;
+}
+
+int sys_stat( const gchar *path, GStatBuf *st )
+{
+  gchar *mapped = sys_path( path );
+  int    ret;
+
+  ret = g_stat( mapped, st );
+  g_free( mapped );
+
+  return ret;
+}
+
+/*
+  Canonical path of the mapped file, free with free():
+ */
+char *sys_realpath( const char *path )
+{
+  gchar *mapped = sys_path( path );
+  char  *ret;
+
+  ret = realpath( mapped, NULL );
+  g_free( mapped );
+
+  return ret;
+}
+
+gchar *sys_read_link( const gchar *path, GError **error )
+{
+  gchar  *mapped = sys_path( path );
+  gint64  start  = metrics_start();
+  gchar  *ret;
+
+  ret = g_file_read_link( mapped, error );
+  metrics_phase_done( METRICS_CONFIG_IO, start );
+  g_free( mapped );
+
+  return ret;
+}
+
+GDir *sys_dir_open( const gchar *path )
+{
+  gchar *mapped = sys_path( path );
+  GDir  *ret;
+
+  ret = g_dir_open( mapped, 0, NULL );
+  g_free( mapped );
+
+  return ret;
+}
+
+FILE *sys_fopen( const gchar *path, const gchar *mode )
+{
+  gchar *mapped = sys_path( path );
+  FILE  *ret;
+
+  ret = fopen( mapped, mode );
+  g_free( mapped );
+
+  return ret;
+}
+
+gboolean sys_file_test( const gchar *path, GFileTest test )
+{
+  gchar    *mapped = sys_path( path );
+  gboolean  ret;
+
+  ret = g_file_test( mapped, test );
+  g_free( mapped );
+
+  return ret;
+}
+
+gboolean sys_file_get_contents( const gchar *path, gchar **contents, gsize *length )
+{
+  gchar    *mapped = sys_path( path );
+  gint64    start  = metrics_start();
+  gboolean  ret;
+
+  ret = g_file_get_contents( mapped, contents, length, NULL );
+  metrics_phase_done( METRICS_CONFIG_IO, start );
+  g_free( mapped );
+
+  return ret;
+}
+
+gboolean sys_file_set_contents( const gchar *path, const gchar *contents, gssize length )
+{
+  gchar    *mapped = sys_path( path );
+  gint64    start  = metrics_start();
+  gboolean  ret;
+
+  ret = g_file_set_contents( mapped, contents, length, NULL );
+  metrics_phase_done( METRICS_CONFIG_IO, start );
+  g_free( mapped );
+
+  return ret;
+}
+
+/*
+  Make glibc notice the new timezone. The simulated /etc/localtime
+  is not the one glibc reads, so point TZ to the zone file:
+ */
+void sys_tzset( void )
+{
+  if( sim_root )
+  {
+    char *zone = sys_realpath( "/etc/localtime" );
+
+    if( zone )
+    {
+      gchar *tz = g_strconcat( ":", zone, NULL );
+
+      g_setenv( "TZ", tz, TRUE );
+      g_free( tz );
+      free( zone );
+    }
+    else
+      g_setenv( "TZ", "UTC", TRUE );
+  }
+
+  tzset();
+}
@@ -0,0 +1,93 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_SYS_H__
+#define __RCL_SYS_H__
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <linux/rtc.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/timex.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/*
+  System calls which need root privileges or real hardware go through
+  a backend. The host backend calls the kernel. The simulated backend
+  keeps a virtual CLOCK_REALTIME and kernel PLL state in memory,
+  emulates /dev/rtc* by files with a configurable ioctl latency and
+  takes /etc, /dev, /sys and zoneinfo paths under a root directory,
+  so the daemon runs and can be benchmarked without privileges.
+ */
+struct sys_backend
+{
+  const gchar *name;
+
+  int      (*clock_gettime)   ( clockid_t clock_id, struct timespec *ts );
+  int      (*clock_settime)   ( clockid_t clock_id, const struct timespec *ts );
+  int      (*clock_nanosleep) ( clockid_t clock_id, int flags, const struct timespec *request );
+  int      (*settimeofday)    ( const struct timeval *tv, const struct timezone *tz );
+  int      (*adjtimex)        ( struct timex *txc );
+  int      (*open)            ( const char *path, int flags );
+  int      (*close)           ( int fd );
+  int      (*ioctl)           ( int fd, unsigned long request, void *arg );
+  gboolean (*spawn)           ( const gchar *cmd, gint *wait_status, GError **error );
+};
+
+extern gboolean     sys_set_simulated ( const gchar *root, guint rtc_latency_usec );
+extern const gchar *sys_backend_name  ( void );
+extern gchar       *sys_path          ( const gchar *path );
+
+extern int       sys_clock_gettime   ( clockid_t clock_id, struct timespec *ts );
+extern int       sys_clock_settime   ( clockid_t clock_id, const struct timespec *ts );
+extern int       sys_clock_nanosleep ( clockid_t clock_id, int flags, const struct timespec *request );
+extern int       sys_settimeofday    ( const struct timeval *tv, const struct timezone *tz );
+extern int       sys_adjtimex        ( struct timex *txc );
+extern int       sys_open            ( const char *path, int flags );
+extern int       sys_close           ( int fd );
+extern int       sys_ioctl           ( int fd, unsigned long request, void *arg );
+extern gboolean  sys_spawn           ( const gchar *cmd, gint *wait_status, GError **error );
+
+extern int       sys_symlink           ( const char *target, const char *path );
+extern int       sys_unlink            ( const char *path );
+extern int       sys_mkdir_with_parents( const gchar *path, gint mode );
+extern int       sys_stat              ( const gchar *path, GStatBuf *st );
+extern char     *sys_realpath          ( const char *path );
+extern gchar    *sys_read_link         ( const gchar *path, GError **error );
+extern GDir     *sys_dir_open          ( const gchar *path );
+extern FILE     *sys_fopen             ( const gchar *path, const gchar *mode );
+extern gboolean  sys_file_test         ( const gchar *path, GFileTest test );
+extern gboolean  sys_file_get_contents ( const gchar *path, gchar **contents, gsize *length );
+extern gboolean  sys_file_set_contents ( const gchar *path, const gchar *contents, gssize length );
+extern void      sys_tzset             ( void );
+
+
+#endif /* __RCL_SYS_H__ */
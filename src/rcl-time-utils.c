@@ -19,6 +19,9 @@
  */
 
 #include "rcl-time-utils.h"
+#include "rcl-sys.h"
+#include "rcl-metrics-utils.h"
+#include "rcl-trace.h"
 
 
 #ifndef ARRAY_SIZE
@@ -29,13 +32,34 @@
 static const char *rtc_dev_name;
 static int         rtc_dev_fd = -1;
 
+/* RTC class device (rtcN) selected by clock_set_rtc_device(), NULL for default */
+static gchar      *rtc_dev_class;
+static gchar      *rtc_dev_path;
+
+/*
+  Persistent descriptors of /sys/class/rtc/rtcN/{since_epoch,date,time}
+  attributes. Reading sysfs does not hold the RTC character device which
+  some drivers allow to be opened only once:
+ */
+enum { RTC_SYSFS_SINCE_EPOCH, RTC_SYSFS_DATE, RTC_SYSFS_TIME, RTC_SYSFS_NUM };
+
+static int         rtc_sysfs_fd[RTC_SYSFS_NUM] = { -1, -1, -1 };
+static gboolean    rtc_sysfs_probed = FALSE;
+
+/*
+  RTC may be written from a worker thread (see clock_systohc())
+  while the main loop reads it:
+ */
+G_LOCK_DEFINE_STATIC( rtc );
+G_LOCK_DEFINE_STATIC( adjtime );
+
 /***************************************************************
   Static RTC functions:
  */
 static void close_rtc( void )
 {
-  if( rtc_dev_fd != 1 )
-    close( rtc_dev_fd );
+  if( rtc_dev_fd != -1 )
+    sys_close( rtc_dev_fd );
   rtc_dev_fd = -1;
 }
 
@@ -53,13 +77,13 @@ static int open_rtc( void )
 
   if( rtc_dev_name )
   {
-    rtc_dev_fd = open( rtc_dev_name, O_RDONLY );
+    rtc_dev_fd = sys_open( rtc_dev_name, O_RDONLY | O_CLOEXEC );
   }
   else
   {
     for( i = 0; i < ARRAY_SIZE(fls); ++i )
     {
-      rtc_dev_fd = open( fls[i], O_RDONLY );
+      rtc_dev_fd = sys_open( fls[i], O_RDONLY | O_CLOEXEC );
 
       if( rtc_dev_fd < 0 )
       {
@@ -73,19 +97,195 @@ static int open_rtc( void )
       rtc_dev_name = *fls; /* default for error messages */
   }
 
-  if( rtc_dev_fd != -1 )
-    atexit( close_rtc );
+  TRACE_PROBE2( rtc__open, rtc_dev_name, rtc_dev_fd );
 
   return rtc_dev_fd;
 }
 
+static int rtc_fd_ioctl( int fd, const char *name, unsigned long request, void *arg )
+{
+  int rc;
+
+  TRACE_PROBE2( rtc__ioctl__entry, name, request );
+  rc = sys_ioctl( fd, request, arg );
+  TRACE_PROBE2( rtc__ioctl__return, request, rc );
+
+  return rc;
+}
+
+static int rtc_ioctl( unsigned long request, void *arg )
+{
+  return rtc_fd_ioctl( rtc_dev_fd, rtc_dev_name, request, arg );
+}
+
+/*
+  Name of the RTC class device (rtcN) behind the character device:
+ */
+static gchar *rtc_class_name( void )
+{
+  static const char *fls[] = {
+    "/dev/rtc0",
+    "/dev/rtc",
+    "/dev/misc/rtc"
+  };
+  gchar  *path = NULL;
+  gchar  *name;
+  size_t  i;
+
+  if( rtc_dev_class )
+    return g_strdup( rtc_dev_class );
+
+  if( rtc_dev_name )
+    path = sys_realpath( rtc_dev_name );
+
+  for( i = 0; !path && i < ARRAY_SIZE(fls); ++i )
+    path = sys_realpath( fls[i] );
+
+  if( !path )
+    return g_strdup( "rtc0" );
+
+  name = g_path_get_basename( path );
+  free( path );
+
+  if( !g_str_has_prefix( name, "rtc" ) )
+  {
+    g_free( (gpointer)name );
+    return g_strdup( "rtc0" );
+  }
+
+  return name;
+}
+
+static void open_rtc_sysfs( void )
+{
+  static const char *attrs[RTC_SYSFS_NUM] = { "since_epoch", "date", "time" };
+  gchar  *name;
+  size_t  i;
+
+  if( rtc_sysfs_probed )
+    return;
+
+  name = rtc_class_name();
+  for( i = 0; i < RTC_SYSFS_NUM; ++i )
+  {
+    gchar *path = g_strdup_printf( "/sys/class/rtc/%s/%s", name, attrs[i] );
+
+    rtc_sysfs_fd[i] = sys_open( path, O_RDONLY | O_CLOEXEC );
+    g_free( (gpointer)path );
+  }
+  g_free( (gpointer)name );
+
+  rtc_sysfs_probed = TRUE;
+}
+
+static gboolean read_rtc_sysfs_attr( int attr, gchar *buf, gsize size )
+{
+  ssize_t len;
+
+  if( rtc_sysfs_fd[attr] < 0 )
+    return FALSE;
+
+  /* sysfs regenerates the attribute on every read from offset zero */
+  len = pread( rtc_sysfs_fd[attr], buf, size - 1, 0 );
+  if( len <= 0 )
+    return FALSE;
+
+  buf[len] = '\0';
+
+  return TRUE;
+}
+
+static gboolean read_rtc_sysfs( struct tm *tm )
+{
+  gchar   buf[32];
+  gchar  *end;
+  time_t  t;
+
+  open_rtc_sysfs();
+
+  if( read_rtc_sysfs_attr( RTC_SYSFS_SINCE_EPOCH, buf, sizeof(buf) ) )
+  {
+    /* since_epoch is the RTC time taken as UTC, whatever RTC mode is */
+    t = (time_t)g_ascii_strtoll( buf, &end, 10 );
+    if( end != buf && gmtime_r( &t, tm ) )
+      return TRUE;
+  }
+
+  if( read_rtc_sysfs_attr( RTC_SYSFS_DATE, buf, sizeof(buf) ) )
+  {
+    struct tm rtc = {};
+
+    if( sscanf( buf, "%d-%d-%d", &rtc.tm_year, &rtc.tm_mon, &rtc.tm_mday ) != 3 )
+      return FALSE;
+
+    if( !read_rtc_sysfs_attr( RTC_SYSFS_TIME, buf, sizeof(buf) ) ||
+        sscanf( buf, "%d:%d:%d", &rtc.tm_hour, &rtc.tm_min, &rtc.tm_sec ) != 3 )
+      return FALSE;
+
+    rtc.tm_year -= 1900;
+    rtc.tm_mon  -= 1;
+    *tm = rtc;
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void close_rtc_sysfs( void )
+{
+  size_t i;
+
+  for( i = 0; i < RTC_SYSFS_NUM; ++i )
+  {
+    if( rtc_sysfs_fd[i] != -1 )
+      sys_close( rtc_sysfs_fd[i] );
+    rtc_sysfs_fd[i] = -1;
+  }
+  rtc_sysfs_probed = FALSE;
+}
+
+static gboolean read_sysfs_file( const gchar *path, gchar *buf, gsize size )
+{
+  ssize_t len;
+  int     fd;
+
+  fd = sys_open( path, O_RDONLY | O_CLOEXEC );
+  if( fd < 0 )
+    return FALSE;
+
+  len = read( fd, buf, size - 1 );
+  sys_close( fd );
+
+  if( len <= 0 )
+    return FALSE;
+
+  buf[len] = '\0';
+
+  return TRUE;
+}
+
+static gboolean rtc_name_is_valid( const gchar *name )
+{
+  const gchar *p;
+
+  if( !name || !g_str_has_prefix( name, "rtc" ) || !name[3] )
+    return FALSE;
+
+  for( p = name + 3; *p; ++p )
+    if( !g_ascii_isdigit( *p ) )
+      return FALSE;
+
+  return TRUE;
+}
+
 /***************************************************************
   Static functions:
  */
 static gboolean
 symlink_atomic( const char *target, const char *link_path )
 {
-  if( symlink( target, link_path ) == 0 )
+  if( sys_symlink( target, link_path ) == 0 )
     return TRUE;
   else
     return FALSE;
@@ -101,20 +301,101 @@ static gchar *skip_root( const gchar *path )
 /***************************************************************
   Clock functions:
  */
-gboolean ntp_synchronized( void )
+gboolean clock_get_timex( struct timex *txc )
 {
-  struct timex txc = {};
-
-  if( adjtimex( &txc ) < 0 )
+  if( !txc )
     return FALSE;
 
+  memset( txc, 0, sizeof(*txc) );
+
+  return ( sys_adjtimex( txc ) >= 0 );
+}
+
+gboolean timex_synchronized( const struct timex *txc )
+{
   /*
     Consider the system clock synchronized if the reported maximum error is
-    smaller than the maximum value (16 seconds). Ignore the STA_UNSYNC flag
-    as it may have been set to prevent the kernel from touching the RTC.
+    smaller than the maximum value (see TIMEX_SYNC_MAXERROR). Ignore the
+    STA_UNSYNC flag as it may have been set to prevent the kernel from
+    touching the RTC.
    */
-  /* return txc.maxerror < 16000000; */
-  return txc.maxerror < 32000000;
+  return txc->maxerror < TIMEX_SYNC_MAXERROR;
+}
+
+gboolean ntp_synchronized( void )
+{
+  struct timex txc;
+
+  if( !clock_get_timex( &txc ) )
+    return FALSE;
+
+  return timex_synchronized( &txc );
+}
+
+/*
+  Feed a measured offset to the kernel PLL (as NTP daemons do). The time
+  constant follows the poll interval, the errors make NTPSynchronized:
+ */
+gboolean clock_discipline( gint64 offset_nsec, guint poll_sec, guint64 maxerror_usec, guint64 esterror_usec )
+{
+  struct timex txc = {};
+  long         constant = 0;
+
+  /* log2(poll) - 4, the ntpd convention */
+  while( poll_sec > 16 )
+  {
+    poll_sec >>= 1;
+    ++constant;
+  }
+
+  txc.modes    = ADJ_STATUS | ADJ_NANO | ADJ_OFFSET | ADJ_TIMECONST | ADJ_MAXERROR | ADJ_ESTERROR;
+  txc.status   = STA_PLL | STA_NANO;
+  txc.offset   = (long)CLAMP( offset_nsec, -(gint64)(NSEC_PER_SEC / 2), (gint64)(NSEC_PER_SEC / 2) );
+  txc.constant = constant;
+  txc.maxerror = (long)MIN( maxerror_usec, (guint64)16000000 );
+  txc.esterror = (long)MIN( esterror_usec, (guint64)16000000 );
+
+  return ( sys_adjtimex( &txc ) >= 0 );
+}
+
+/*
+  The rest of adjustment started by clock_slew() which is not applied yet:
+ */
+gboolean clock_get_slew( gint64 *remaining_usec )
+{
+  struct timex txc = {};
+
+  txc.modes = ADJ_OFFSET_SS_READ;
+  if( sys_adjtimex( &txc ) < 0 )
+    return FALSE;
+
+  if( remaining_usec )
+    *remaining_usec = (gint64)txc.offset;
+
+  return TRUE;
+}
+
+/*
+  Slew the system clock by offset_usec (replaces the pending adjustment,
+  zero offset cancels it). The kernel speeds up or slows down the clock
+  by CLOCK_SLEW_RATE_USEC per second, so CLOCK_REALTIME never jumps:
+ */
+gboolean clock_slew( gint64 offset_usec, guint64 *convergence_usec )
+{
+  struct timex txc = {};
+
+  if( offset_usec > (gint64)LONG_MAX || offset_usec < (gint64)LONG_MIN )
+    return FALSE;
+
+  txc.modes  = ADJ_OFFSET_SINGLESHOT;
+  txc.offset = (long)offset_usec;
+  if( sys_adjtimex( &txc ) < 0 )
+    return FALSE;
+
+  if( convergence_usec )
+    *convergence_usec = (guint64)ABS( offset_usec ) * USEC_PER_SEC / CLOCK_SLEW_RATE_USEC;
+
+  return TRUE;
 }
 
 
@@ -226,7 +507,7 @@ guint64 now( clockid_t clock_id )
 {
   struct timespec ts;
 
-  if( clock_gettime( CLOCK_REALTIME, &ts ) != 0 )
+  if( sys_clock_gettime( clock_id, &ts ) != 0 )
     return (guint64)0;
 
   return (guint64)timespec_load( &ts );
@@ -236,12 +517,178 @@ guint64 now_nsec( clockid_t clock_id )
 {
   struct timespec ts;
 
-  if( clock_gettime( CLOCK_REALTIME, &ts ) != 0 )
+  if( sys_clock_gettime( clock_id, &ts ) != 0 )
     return (guint64)0;
 
   return timespec_load_nsec( &ts );
 }
 
+/*
+  Precise step mode: the daemon memory is locked and the thread which
+  steps the clock runs with SCHED_FIFO priority around the step, so the
+  step is not delayed by page faults or preemption:
+ */
+#define PRECISE_STEP_STACK  (256 * 1024) /* bytes of stack to pre-fault */
+
+#if defined( MCL_ONFAULT )
+#define RCL_MCL_ONFAULT  MCL_ONFAULT
+#else
+#define RCL_MCL_ONFAULT  0
+#endif
+
+static gboolean precise_step = FALSE;
+
+static void prefault_stack( void )
+{
+  volatile guchar stack[PRECISE_STEP_STACK];
+  size_t          i;
+
+  for( i = 0; i < sizeof(stack); i += 4096 )
+    stack[i] = 0;
+}
+
+gboolean clock_set_precise_step( gboolean enable )
+{
+  if( !enable )
+  {
+    if( precise_step )
+      (void)munlockall();
+    precise_step = FALSE;
+    return TRUE;
+  }
+
+  /*
+    Pages are locked as they are touched: populating every mapping at
+    once would fault in the whole 8 MB stack of each GTask worker. The
+    malloc tunables of the process are not changed, so nothing is left
+    behind when the mode is turned off:
+   */
+  if( mlockall( MCL_CURRENT | MCL_FUTURE | RCL_MCL_ONFAULT ) < 0 )
+  {
+    g_debug( "error: Cannot lock daemon memory: %s", g_strerror( errno ) );
+    return FALSE;
+  }
+
+  prefault_stack();
+  precise_step = TRUE;
+
+  return TRUE;
+}
+
+static gboolean rt_enter( int *policy, struct sched_param *param )
+{
+  struct sched_param rt = {};
+
+  if( pthread_getschedparam( pthread_self(), policy, param ) != 0 )
+    return FALSE;
+
+  rt.sched_priority = sched_get_priority_max( SCHED_FIFO );
+
+  return ( pthread_setschedparam( pthread_self(), SCHED_FIFO, &rt ) == 0 );
+}
+
+static void rt_leave( int policy, const struct sched_param *param )
+{
+  (void)pthread_setschedparam( pthread_self(), policy, param );
+}
+
+/*
+  Step CLOCK_REALTIME to target_nsec which was valid at since_nsec of
+  CLOCK_MONOTONIC_RAW (zero since_nsec means "now"). The time elapsed
+  since then is added to the target and returned as compensation. A
+  relative step adds target_nsec to the clock read after the priority
+  is raised.
+
+  The error is how much the clock lags behind the target after the
+  step, i.e. the delay between the target computation and the step:
+ */
+static gboolean clock_step( gint64 target_nsec, guint64 since_nsec, gboolean relative,
+                            gint64 *set_nsec, gint64 *compensation_nsec, gint64 *error_nsec )
+{
+  struct timespec    ts;
+  struct sched_param param;
+  int                policy;
+  gboolean           rt = FALSE;
+  gint64             elapsed = 0;
+  guint64            start, done;
+  gint64             real;
+  int                ret;
+
+  if( !relative && target_nsec <= 0 )
+    return FALSE;
+
+  if( precise_step )
+  {
+    rt = rt_enter( &policy, &param );
+    if( !rt )
+      g_debug( "warning: Cannot raise the clock step priority: %s", g_strerror( errno ) );
+  }
+
+  start = now_nsec( CLOCK_MONOTONIC_RAW );
+
+  if( relative )
+  {
+    gint64 n = (gint64)now_nsec( CLOCK_REALTIME );
+
+    since_nsec = 0;
+    if( (target_nsec > 0 && n > G_MAXINT64 - target_nsec) || n + target_nsec <= 0 )
+    {
+      if( rt )
+        rt_leave( policy, &param );
+      return FALSE;
+    }
+    target_nsec += n;
+  }
+
+  if( since_nsec && start > since_nsec )
+    elapsed = (gint64)(start - since_nsec);
+
+  if( target_nsec > G_MAXINT64 - elapsed )
+  {
+    if( rt )
+      rt_leave( policy, &param );
+    return FALSE;
+  }
+
+  target_nsec += elapsed;
+
+  ts.tv_sec  = (time_t)(target_nsec / (gint64)NSEC_PER_SEC);
+  ts.tv_nsec = (long)(target_nsec % (gint64)NSEC_PER_SEC);
+
+  ret  = sys_clock_settime( CLOCK_REALTIME, &ts );
+  real = (gint64)now_nsec( CLOCK_REALTIME );
+  done = now_nsec( CLOCK_MONOTONIC_RAW );
+
+  if( rt )
+    rt_leave( policy, &param );
+
+  if( ret < 0 )
+    return FALSE;
+
+  if( set_nsec )
+    *set_nsec = target_nsec;
+  if( compensation_nsec )
+    *compensation_nsec = elapsed;
+  if( error_nsec )
+    *error_nsec = (gint64)(done - start) - (real - target_nsec);
+
+  return TRUE;
+}
+
+gboolean clock_step_nsec( gint64 target_nsec, guint64 since_nsec, gint64 *compensation_nsec, gint64 *error_nsec )
+{
+  return clock_step( target_nsec, since_nsec, FALSE, NULL, compensation_nsec, error_nsec );
+}
+
+/*
+  Step CLOCK_REALTIME by offset_nsec, the time which has been set is
+  returned in target_nsec:
+ */
+gboolean clock_step_offset_nsec( gint64 offset_nsec, gint64 *target_nsec, gint64 *error_nsec )
+{
+  return clock_step( offset_nsec, 0, TRUE, target_nsec, NULL, error_nsec );
+}
+
 
 struct tm *localtime_or_gmtime_r( const time_t *t, struct tm *tm, gboolean utc )
 {
@@ -257,6 +704,122 @@ time_t mktime_or_timegm( struct tm *tm, gboolean utc )
   return utc ? timegm(tm) : mktime(tm);
 }
 
+/*
+  Select the RTC used for reads and writes by the class device name
+  (rtc1) or by the device path (/dev/rtc1). NULL or empty name restores
+  the default /dev/rtc0, /dev/rtc, /dev/misc/rtc lookup:
+ */
+gboolean clock_set_rtc_device( const gchar *name )
+{
+  gchar *class = NULL;
+
+  if( name && *name )
+  {
+    class = g_path_get_basename( name );
+    if( !rtc_name_is_valid( class ) )
+    {
+      g_debug( "error: Invalid RTC device name '%s'", name );
+      g_free( (gpointer)class );
+      return FALSE;
+    }
+  }
+
+  G_LOCK( rtc );
+
+  close_rtc();
+  close_rtc_sysfs();
+
+  g_free( (gpointer)rtc_dev_class );
+  g_free( (gpointer)rtc_dev_path );
+  rtc_dev_class = class;
+  rtc_dev_path  = class ? g_strdup_printf( "/dev/%s", class ) : NULL;
+  rtc_dev_name  = rtc_dev_path;
+
+  G_UNLOCK( rtc );
+
+  return TRUE;
+}
+
+/*
+  Class device name (rtcN) of the RTC in use, free with g_free():
+ */
+gchar *clock_get_rtc_device( void )
+{
+  gchar *name;
+
+  G_LOCK( rtc );
+  name = rtc_class_name();
+  G_UNLOCK( rtc );
+
+  return name;
+}
+
+/*
+  Sorted NULL-terminated list of RTC class devices, free with g_strfreev():
+ */
+gchar **clock_list_rtcs( void )
+{
+  GPtrArray   *names;
+  GDir        *dir;
+  const gchar *name;
+
+  names = g_ptr_array_new();
+
+  dir = sys_dir_open( "/sys/class/rtc" );
+  if( dir )
+  {
+    while( (name = g_dir_read_name( dir )) != NULL )
+    {
+      if( rtc_name_is_valid( name ) )
+        g_ptr_array_add( names, g_strdup( name ) );
+    }
+    g_dir_close( dir );
+  }
+
+  g_ptr_array_sort_values( names, (GCompareFunc)g_strcmp0 );
+  g_ptr_array_add( names, NULL );
+
+  return (gchar **)g_ptr_array_free( names, FALSE );
+}
+
+/*
+  Read any RTC through sysfs without touching the RTC in use. The
+  hctosys flag tells that the kernel has set the system clock from it:
+ */
+gboolean clock_read_rtc( const gchar *name, struct tm *tm, gboolean *hctosys )
+{
+  gchar   buf[32];
+  gchar  *path;
+  gchar  *end;
+  time_t  t;
+  gboolean ret;
+
+  if( !rtc_name_is_valid( name ) || !tm )
+    return FALSE;
+
+  if( hctosys )
+  {
+    path = g_strdup_printf( "/sys/class/rtc/%s/hctosys", name );
+    *hctosys = ( read_sysfs_file( path, buf, sizeof(buf) ) && buf[0] == '1' );
+    g_free( (gpointer)path );
+  }
+
+  path = g_strdup_printf( "/sys/class/rtc/%s/since_epoch", name );
+  ret = read_sysfs_file( path, buf, sizeof(buf) );
+  g_free( (gpointer)path );
+
+  if( !ret )
+    return FALSE;
+
+  t = (time_t)g_ascii_strtoll( buf, &end, 10 );
+  if( end == buf || !gmtime_r( &t, tm ) )
+    return FALSE;
+
+  tm->tm_isdst = -1; /* don't know whether it's dst */
+
+  return TRUE;
+}
+
 gboolean clock_get_hwclock( struct tm *tm )
 {
   int    rc = -1;
@@ -265,50 +828,176 @@ gboolean clock_get_hwclock( struct tm *tm )
   if( !tm )
     return FALSE;
 
+  G_LOCK( rtc );
+
+  if( read_rtc_sysfs( tm ) )
+  {
+    tm->tm_isdst = -1; /* don't know whether it's dst */
+    G_UNLOCK( rtc );
+    return TRUE;
+  }
+
   (void)open_rtc();
 
   if( rtc_dev_fd < 0 )
   {
     g_debug( "error: Canot open '%s' device", rtc_dev_name );
+    G_UNLOCK( rtc );
     return FALSE;
   }
 
   ioctlname = "RTC_RD_TIME";
-  rc = ioctl( rtc_dev_fd, RTC_RD_TIME, tm );
+  rc = rtc_ioctl( RTC_RD_TIME, tm );
   if( rc == -1 )
   {
     g_debug( "warning: ioctl(%s) to '%s' to read the time failed", ioctlname, rtc_dev_name );
+    close_rtc();
+    G_UNLOCK( rtc );
+    return FALSE;
   }
 
   tm->tm_isdst = -1; /* don't know whether it's dst */
 
   close_rtc();
 
+  G_UNLOCK( rtc );
+
   return TRUE;
 }
 
+gboolean clock_has_hwclock( void )
+{
+  gboolean ret;
+
+  G_LOCK( rtc );
+
+  open_rtc_sysfs();
+  ret = ( rtc_sysfs_fd[RTC_SYSFS_SINCE_EPOCH] >= 0 || rtc_sysfs_fd[RTC_SYSFS_DATE] >= 0 );
+  if( !ret )
+  {
+    ret = ( open_rtc() >= 0 );
+    close_rtc();
+  }
+
+  G_UNLOCK( rtc );
+
+  return ret;
+}
+
+/*
+  Wait for the RTC update (the seconds tick) and read the time just after it.
+  If the RTC has no update interrupts, poll it until the seconds change:
+ */
+gboolean clock_get_hwclock_sync( struct tm *tm )
+{
+  unsigned long   data;
+  struct pollfd   pfd;
+  struct tm       start;
+  gint64          deadline;
+  gint64          wait;
+  gchar          *name;
+  int             fd;
+  gboolean        ready;
+  gboolean        ret = FALSE;
+
+  if( !tm )
+    return FALSE;
+
+  G_LOCK( rtc );
+
+  if( open_rtc() < 0 )
+  {
+    g_debug( "error: Canot open '%s' device", rtc_dev_name );
+    G_UNLOCK( rtc );
+    return FALSE;
+  }
+
+  /*
+    The wait takes up to 1.5 sec: the device is taken from the shared
+    descriptor and the lock is released, so the main loop reads RTC
+    through sysfs meanwhile:
+   */
+  fd         = rtc_dev_fd;
+  rtc_dev_fd = -1;
+  name       = g_strdup( rtc_dev_name );
+
+  G_UNLOCK( rtc );
+
+  if( rtc_fd_ioctl( fd, name, RTC_UIE_ON, NULL ) == 0 )
+  {
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+
+    /* the update interrupt comes once per second */
+    wait = metrics_start();
+    ready = ( poll( &pfd, 1, 1500 ) == 1 && read( fd, &data, sizeof(data) ) == sizeof(data) );
+    metrics_phase_done( METRICS_RTC_IO, wait );
+
+    if( ready )
+      ret = ( rtc_fd_ioctl( fd, name, RTC_RD_TIME, tm ) == 0 );
+
+    (void)rtc_fd_ioctl( fd, name, RTC_UIE_OFF, NULL );
+  }
+  else if( rtc_fd_ioctl( fd, name, RTC_RD_TIME, &start ) == 0 )
+  {
+    deadline = g_get_monotonic_time() + (gint64)(3 * USEC_PER_SEC / 2);
+
+    while( g_get_monotonic_time() < deadline )
+    {
+      if( rtc_fd_ioctl( fd, name, RTC_RD_TIME, tm ) != 0 )
+        break;
+      if( tm->tm_sec != start.tm_sec )
+      {
+        ret = TRUE;
+        break;
+      }
+      wait = metrics_start();
+      g_usleep( 1000 );
+      metrics_phase_done( METRICS_RTC_IO, wait );
+    }
+  }
+
+  if( !ret )
+    g_debug( "warning: Timed out waiting for time change on '%s'", name );
+
+  tm->tm_isdst = -1; /* don't know whether it's dst */
+
+  sys_close( fd );
+  g_free( name );
+
+  return ret;
+}
+
 gboolean clock_set_hwclock( const struct tm *tm )
 {
   int    rc = -1;
   gchar *ioctlname;
 
+  G_LOCK( rtc );
+
   (void)open_rtc();
 
   if( rtc_dev_fd < 0 )
   {
     g_debug( "error: Canot open '%s' device", rtc_dev_name );
+    G_UNLOCK( rtc );
     return FALSE;
   }
 
   ioctlname = "RTC_SET_TIME";
-  rc = ioctl( rtc_dev_fd, RTC_SET_TIME, tm );
+  rc = rtc_ioctl( RTC_SET_TIME, (void *)tm );
   if( rc == -1 )
   {
     g_debug( "warning: ioctl(%s) to '%s' to set the time failed", ioctlname, rtc_dev_name );
+    close_rtc();
+    G_UNLOCK( rtc );
+    return FALSE;
   }
 
   close_rtc();
 
+  G_UNLOCK( rtc );
+
   return TRUE;
 }
 
@@ -319,7 +1008,7 @@ gboolean clock_set_timezone( int *ret_minutesdelta )
   int             minutesdelta;
   struct timezone tz;
 
-  if( clock_gettime(CLOCK_REALTIME, &ts) != 0 )
+  if( sys_clock_gettime(CLOCK_REALTIME, &ts) != 0 )
     return FALSE;
 
   if( !localtime_r( &ts.tv_sec, &tm ) )
@@ -336,7 +1025,7 @@ gboolean clock_set_timezone( int *ret_minutesdelta )
   /* If the RTC does not run in UTC but in local time, the very first call to settimeofday() will set
    * the kernel's timezone and will warp the system clock, so that it runs in UTC instead of the local
    * time we have read from the RTC. */
-  if( settimeofday( NULL, &tz ) < 0 )
+  if( sys_settimeofday( NULL, &tz ) < 0 )
     return FALSE;
 
   if( ret_minutesdelta )
@@ -346,6 +1035,349 @@ gboolean clock_set_timezone( int *ret_minutesdelta )
 }
 
 
+/***************************************************************
+  RTC drift functions:
+
+  The drift model is kept in the first two lines of ADJTIME_CONF
+  in the same format as hwclock(8) does (see adjtime_config(5)):
+
+    <drift factor> <last adjust time> <adjustment not done>
+    <last calibration time>
+    UTC|LOCAL
+
+  The drift factor is the number of seconds per day the RTC loses
+  (positive) or gains (negative) (see struct rtc_adjtime).
+ */
+static struct rtc_adjtime adjtime_data;
+static time_t             adjtime_mtime  = (time_t)-1;
+static gboolean           adjtime_loaded = FALSE;
+
+static void adjtime_load( void )
+{
+  GStatBuf  st;
+  gchar    *s = NULL;
+  gchar   **lines;
+  struct rtc_adjtime adj = {};
+
+  if( sys_stat( ADJTIME_CONF, &st ) != 0 )
+  {
+    adjtime_data   = adj;
+    adjtime_mtime  = (time_t)-1;
+    adjtime_loaded = TRUE;
+    return;
+  }
+
+  if( adjtime_loaded && st.st_mtime == adjtime_mtime )
+    return;
+
+  if( !sys_file_get_contents( ADJTIME_CONF, &s, NULL ) )
+    return;
+
+  lines = g_strsplit( (const gchar *)s, "\n", 4 );
+  if( lines[0] )
+  {
+    gchar *p = lines[0];
+
+    adj.drift_factor  = g_ascii_strtod( p, &p );
+    adj.last_adj_time = (time_t)g_ascii_strtoll( p, &p, 10 );
+    adj.not_adjusted  = g_ascii_strtod( p, &p );
+
+    if( lines[1] )
+    {
+      adj.last_calib_time = (time_t)g_ascii_strtoll( lines[1], NULL, 10 );
+
+      if( lines[2] )
+        adj.local = g_str_has_prefix( lines[2], "LOCAL" );
+    }
+  }
+  g_strfreev( lines );
+  g_free( (gpointer)s );
+
+  adjtime_data   = adj;
+  adjtime_mtime  = st.st_mtime;
+  adjtime_loaded = TRUE;
+}
+
+/*
+  The drift model as it is loaded, FALSE if there is no ADJTIME_CONF:
+ */
+gboolean rtc_adjtime_get( struct rtc_adjtime *adj )
+{
+  gboolean ret;
+
+  if( !adj ) return FALSE;
+
+  G_LOCK( adjtime );
+  adjtime_load();
+  *adj = adjtime_data;
+  ret  = ( adjtime_mtime != (time_t)-1 );
+  G_UNLOCK( adjtime );
+
+  return ret;
+}
+
+/*
+  Take the saved drift model instead of reading ADJTIME_CONF (the
+  caller knows the file is not changed since the model was saved):
+ */
+void rtc_adjtime_set( const struct rtc_adjtime *adj )
+{
+  GStatBuf st;
+
+  if( !adj || sys_stat( ADJTIME_CONF, &st ) != 0 )
+    return;
+
+  G_LOCK( adjtime );
+  adjtime_data   = *adj;
+  adjtime_mtime  = st.st_mtime;
+  adjtime_loaded = TRUE;
+  G_UNLOCK( adjtime );
+}
+
+static gboolean adjtime_save( void )
+{
+  GStatBuf  st;
+  gchar     drift[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar     not_adjusted[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar    *w;
+  gboolean  ret;
+
+  g_ascii_formatd( drift, sizeof(drift), "%.6f", adjtime_data.drift_factor );
+  g_ascii_formatd( not_adjusted, sizeof(not_adjusted), "%.6f", adjtime_data.not_adjusted );
+
+  w = g_strdup_printf( "%s %ld %s\n%ld\n%s\n",
+                       drift, (long)adjtime_data.last_adj_time, not_adjusted,
+                       (long)adjtime_data.last_calib_time,
+                       (adjtime_data.local) ? "LOCAL" : "UTC" );
+
+  ret = sys_file_set_contents( ADJTIME_CONF, w, -1 );
+  g_free( (gpointer)w );
+
+  if( ret && sys_stat( ADJTIME_CONF, &st ) == 0 )
+    adjtime_mtime = st.st_mtime;
+
+  return ret;
+}
+
+/*
+  Read the RTC just after its tick and the known-good system time for
+  rtc_drift_calibrate(). The wait for the tick takes up to 1.5 sec, so
+  it is done without the adjtime lock:
+ */
+static gboolean rtc_drift_sample( struct tm *tm, struct timespec *ts )
+{
+  time_t last_calib_time;
+
+  G_LOCK( adjtime );
+  adjtime_load();
+  last_calib_time = adjtime_data.last_calib_time;
+  G_UNLOCK( adjtime );
+
+  if( last_calib_time == 0 )
+  {
+    g_debug( "rtc-drift: Not adjusting drift factor because last calibration time is zero" );
+    return FALSE;
+  }
+
+  return ( clock_get_hwclock_sync( tm ) && sys_clock_gettime( CLOCK_REALTIME, ts ) == 0 );
+}
+
+/*
+  Update the drift factor from the difference between a known-good
+  system time and the (already drift corrected) RTC time sampled by
+  rtc_drift_sample(). Called with the adjtime lock held:
+ */
+static void rtc_drift_calibrate( const struct tm *rtc_tm, const struct timespec *ts, gboolean utc )
+{
+  struct tm       tm = *rtc_tm;
+  time_t          rtc_time, elapsed;
+  gdouble         sys, rtc, correction, factor;
+
+  if( adjtime_data.last_calib_time == 0 )
+    return;
+
+  elapsed = ts->tv_sec - adjtime_data.last_calib_time;
+  if( elapsed < RTC_DRIFT_MIN_CALIB_TIME )
+  {
+    g_debug( "rtc-drift: Not adjusting drift factor because it has been less than %d hours since the last calibration",
+                                                          RTC_DRIFT_MIN_CALIB_TIME / 3600 );
+    return;
+  }
+
+  rtc_time = mktime_or_timegm( &tm, utc );
+  if( rtc_time == (time_t)-1 )
+    return;
+
+  correction = (gdouble)(rtc_time - adjtime_data.last_adj_time) / 86400.0 * adjtime_data.drift_factor +
+               adjtime_data.not_adjusted;
+
+  /* The RTC has just ticked, so its value is exact at the moment of reading */
+  sys = (gdouble)ts->tv_sec + (gdouble)ts->tv_nsec / (gdouble)NSEC_PER_SEC;
+  rtc = (gdouble)rtc_time + correction;
+
+  factor = adjtime_data.drift_factor + (sys - rtc) / (gdouble)elapsed * 86400.0;
+
+  if( fabs( factor ) > RTC_DRIFT_MAX_FACTOR )
+  {
+    g_debug( "rtc-drift: Clock drift factor was calculated as %f seconds/day. It is far too much. Resetting to zero.", factor );
+    factor = 0.0;
+  }
+
+  g_debug( "rtc-drift: RTC error %f seconds over %ld seconds; drift factor changed from %f to %f seconds/day",
+                                             rtc - sys, (long)elapsed, adjtime_data.drift_factor, factor );
+
+  adjtime_data.drift_factor = factor;
+}
+
+gint64 rtc_drift_correction_usec( time_t rtc_time )
+{
+  gdouble correction;
+
+  G_LOCK( adjtime );
+
+  adjtime_load();
+
+  if( adjtime_data.last_adj_time == 0 )
+  {
+    G_UNLOCK( adjtime );
+    return (gint64)0;
+  }
+
+  correction = (gdouble)(rtc_time - adjtime_data.last_adj_time) / 86400.0 * adjtime_data.drift_factor +
+               adjtime_data.not_adjusted;
+
+  G_UNLOCK( adjtime );
+
+  return (gint64)(correction * (gdouble)USEC_PER_SEC);
+}
+
+/*
+  MC146818 compatible RTCs start counting the new second RTC_SET_DELAY_MSEC
+  after the time has been set. Sleep until the sub-second phase of the system
+  clock at which the write makes the RTC seconds tick in step with it:
+ */
+static gboolean rtc_wait_set_phase( struct timespec *ts )
+{
+  struct timespec target;
+  long            phase = (long)((MSEC_PER_SEC - RTC_SET_DELAY_MSEC % MSEC_PER_SEC) % MSEC_PER_SEC * NSEC_PER_MSEC);
+
+  if( sys_clock_gettime( CLOCK_REALTIME, ts ) != 0 )
+    return FALSE;
+
+  target.tv_sec  = ts->tv_sec;
+  target.tv_nsec = phase;
+  if( ts->tv_nsec > phase )
+    target.tv_sec += 1;
+
+  while( sys_clock_nanosleep( CLOCK_REALTIME, TIMER_ABSTIME, &target ) == EINTR )
+    ;
+
+  if( sys_clock_gettime( CLOCK_REALTIME, ts ) != 0 )
+    return FALSE;
+
+  return TRUE;
+}
+
+gboolean clock_systohc( gboolean utc, gboolean calibrate )
+{
+  struct timespec ts, calib_ts;
+  struct tm       tm, calib_tm;
+  gboolean        sampled = FALSE;
+
+  /*
+    The sampling and the phase wait sleep, the adjtime lock is taken
+    only to update the drift model (the main loop reads it):
+   */
+  if( calibrate )
+    sampled = rtc_drift_sample( &calib_tm, &calib_ts );
+
+  if( !rtc_wait_set_phase( &ts ) ||
+      !localtime_or_gmtime_r( &ts.tv_sec, &tm, utc ) ||
+      !clock_set_hwclock( &tm ) )
+    return FALSE;
+
+  G_LOCK( adjtime );
+
+  adjtime_load();
+
+  if( sampled )
+    rtc_drift_calibrate( &calib_tm, &calib_ts, utc );
+
+  /*
+    The RTC has been set exactly, the drift model starts from here.
+    The system time is a calibration point only if it is known-good:
+   */
+  adjtime_data.last_adj_time   = ts.tv_sec;
+  adjtime_data.not_adjusted    = 0.0;
+  adjtime_data.last_calib_time = (calibrate) ? ts.tv_sec : (time_t)0;
+  adjtime_data.local           = !utc;
+
+  if( !adjtime_save() )
+    g_debug( "rtc-drift: Cannot write '%s' (ignoring)", ADJTIME_CONF );
+
+  G_UNLOCK( adjtime );
+
+  return TRUE;
+}
+
+gboolean clock_hctosys( void )
+{
+  struct timespec ts;
+  struct timezone tz = {};
+  struct tm       tm = {};
+  gboolean        local_rtc = FALSE;
+  time_t          rtc_time;
+  long            nsec;
+
+  (void)read_data_local_rtc( &local_rtc );
+
+  /* Make glibc read the current timezone */
+  sys_tzset();
+
+  if( !local_rtc )
+  {
+    /*
+      The very first settimeofday() call with a timezone warps the clock.
+      Seal the warp with the zero offset, so that telling the kernel our
+      timezone below does not shift the UTC system clock:
+     */
+    if( sys_settimeofday( NULL, &tz ) < 0 )
+      return FALSE;
+  }
+
+  /* Tell the kernel our timezone (for localtime RTC this enables the kernel's localtime RTC mode) */
+  if( !clock_set_timezone( NULL ) )
+    return FALSE;
+
+  /* Read RTC at its seconds tick; fall back to a plain read (half a second behind on average) */
+  if( clock_get_hwclock_sync( &tm ) )
+  {
+    nsec = 0;
+  }
+  else if( clock_get_hwclock( &tm ) )
+  {
+    nsec = (long)(NSEC_PER_SEC / 2);
+  }
+  else
+    return FALSE;
+
+  rtc_time = mktime_or_timegm( &tm, !local_rtc );
+  if( rtc_time == (time_t)-1 )
+    return FALSE;
+
+  ts.tv_sec  = rtc_time;
+  ts.tv_nsec = nsec;
+  timespec_store( &ts, (guint64)((gint64)timespec_load( &ts ) + rtc_drift_correction_usec( rtc_time )) );
+
+  if( sys_clock_settime( CLOCK_REALTIME, &ts ) < 0 )
+    return FALSE;
+
+  g_debug( "hctosys: System clock set from %s RTC to %ld.%06ld", (local_rtc) ? "localtime" : "UTC",
+                                                                  (long)ts.tv_sec, ts.tv_nsec / (long)NSEC_PER_USEC );
+  return TRUE;
+}
+
+
 /***************************************************************
   Timezone functions:
  */
@@ -390,7 +1422,7 @@ gboolean timezone_is_valid( const gchar *name )
 
   fname = g_strjoin( "/", SYSTEM_ZONEINFO_DIR, name, NULL );
 
-  fd = g_open( fname, O_RDONLY | O_CLOEXEC );
+  fd = sys_open( fname, O_RDONLY | O_CLOEXEC );
   if( fd < 0 )
   {
     /* log: "Failed to open timezone file '%s': %s", fname, strerror() */
@@ -398,9 +1430,10 @@ gboolean timezone_is_valid( const gchar *name )
     return FALSE;
   }
 
-  if( !g_file_test( fname, G_FILE_TEST_IS_REGULAR ) )
+  if( !sys_file_test( fname, G_FILE_TEST_IS_REGULAR ) )
   {
     /* log: "Timezone file '%s' is not a regular file: %s", fname, strerror() */
+    sys_close( fd );
     g_free( (gpointer)fname );
     return FALSE;
   }
@@ -408,9 +1441,11 @@ gboolean timezone_is_valid( const gchar *name )
   if( read( fd, &buf, 4 ) != 4 )
   {
     /* log: "Failed to read from timezone file '%s': %m", fname, strerror() */
+    sys_close( fd );
     g_free( (gpointer)fname );
     return FALSE;
   }
+  sys_close( fd );
 
   /* Magic from tzfile(5) */
   if( memcmp( buf, "TZif", 4 ) != 0 )
@@ -435,7 +1470,7 @@ gboolean set_system_timezone( const gchar *name )
   {
     fname = g_strjoin( "/", SYSTEM_ZONEINFO_DIR, "UTC", NULL );
 
-    if( !g_file_test( fname, G_FILE_TEST_IS_REGULAR ) )
+    if( !sys_file_test( fname, G_FILE_TEST_IS_REGULAR ) )
     {
       /* log: "Timezone file '%s' is not a regular file: %s", fname, strerror() */
       g_free( (gpointer)fname );
@@ -449,12 +1484,12 @@ gboolean set_system_timezone( const gchar *name )
   }
 
   /* Create symlink to the new timezone */
-  unlink( "/etc/localtime" );
+  sys_unlink( "/etc/localtime" );
   ret = symlink_atomic( (const char *)source, "/etc/localtime" );
   g_free( (gpointer)source );
 
   /* Make glibc notice the new timezone */
-  tzset();
+  sys_tzset();
 
   /* Tell the kernel our timezone */
   (void)clock_set_timezone( NULL );
@@ -470,7 +1505,7 @@ gboolean get_system_timezone( gchar **ret )
 
   if( !ret ) return FALSE;
 
-  link_target = g_file_read_link( "/etc/localtime", &error );
+  link_target = sys_read_link( "/etc/localtime", &error );
 
   if( error != NULL )
   {
@@ -515,17 +1550,19 @@ out:
 static
 gboolean exec_cmd( const gchar *cmd )
 {
-  int       exit_status;
+  int       exit_status = -1;
   GError   *error = NULL;
   gboolean  ret = TRUE;
 
   if( !cmd || *cmd == '\0' ) return FALSE;
 
-  if( !g_spawn_command_line_sync( cmd, NULL, NULL, &exit_status, &error ) )
+  TRACE_PROBE1( spawn__entry, cmd );
+  if( !sys_spawn( cmd, &exit_status, &error ) )
   {
     g_error_free( error );
     ret = FALSE;
   }
+  TRACE_PROBE2( spawn__return, cmd, exit_status );
   g_free( (gpointer)cmd );
 
   if( exit_status != 0 )
@@ -540,12 +1577,12 @@ gboolean write_data_local_rtc( gboolean local_rtc )
   gboolean  ret = TRUE;
   gchar    *cmd;
 
-  if( !g_file_test( ADJTIME_CONF, G_FILE_TEST_EXISTS ) )
+  if( !sys_file_test( ADJTIME_CONF, G_FILE_TEST_EXISTS ) )
   {
     if( !local_rtc )
     {
       if( !(w = g_strdup( NULL_ADJTIME_UTC )) ) return FALSE;
-      if( !(g_file_set_contents( ADJTIME_CONF, w, -1, NULL )) )
+      if( !(sys_file_set_contents( ADJTIME_CONF, w, -1 )) )
       {
         g_free( (gpointer)w );
         return FALSE;
@@ -555,7 +1592,7 @@ gboolean write_data_local_rtc( gboolean local_rtc )
     else
     {
       if( !(w = g_strdup( NULL_ADJTIME_LOCAL )) ) return FALSE;
-      if( !(g_file_set_contents( ADJTIME_CONF, w, -1, NULL )) )
+      if( !(sys_file_set_contents( ADJTIME_CONF, w, -1 )) )
       {
         g_free( (gpointer)w );
         return FALSE;
@@ -566,7 +1603,7 @@ gboolean write_data_local_rtc( gboolean local_rtc )
     return ret;
   }
 
-  if( !g_file_test( HWCLOCK_CONF, G_FILE_TEST_EXISTS ) )
+  if( !sys_file_test( HWCLOCK_CONF, G_FILE_TEST_EXISTS ) )
   {
     const gchar *localtime = "#\n"
                              "# /etc/hardwareclockn\n"
@@ -586,11 +1623,11 @@ gboolean write_data_local_rtc( gboolean local_rtc )
 
     if( !local_rtc )
     {
-      if( !(g_file_set_contents( HWCLOCK_CONF, UTC, -1, NULL )) ) return FALSE;
+      if( !(sys_file_set_contents( HWCLOCK_CONF, UTC, -1 )) ) return FALSE;
     }
     else
     {
-      if( !(g_file_set_contents( HWCLOCK_CONF, localtime, -1, NULL )) ) return FALSE;
+      if( !(sys_file_set_contents( HWCLOCK_CONF, localtime, -1 )) ) return FALSE;
     }
 
     return ret;
@@ -623,12 +1660,12 @@ gboolean read_data_local_rtc( gboolean *local_rtc )
 
   if( !local_rtc ) return FALSE;
 
-  if( g_file_test( HWCLOCK_CONF, G_FILE_TEST_EXISTS ) )
+  if( sys_file_test( HWCLOCK_CONF, G_FILE_TEST_EXISTS ) )
   {
     gchar *s = NULL;
     gsize  len;
 
-    ret = g_file_get_contents( HWCLOCK_CONF, &s, &len, NULL );
+    ret = sys_file_get_contents( HWCLOCK_CONF, &s, &len );
     if( !ret )
       return FALSE;
 
@@ -650,12 +1687,12 @@ gboolean read_data_local_rtc( gboolean *local_rtc )
 
     return FALSE;
   }
-  else if( g_file_test( ADJTIME_CONF, G_FILE_TEST_EXISTS ) )
+  else if( sys_file_test( ADJTIME_CONF, G_FILE_TEST_EXISTS ) )
   {
     gchar *s = NULL;
     gsize  len;
 
-    ret = g_file_get_contents( ADJTIME_CONF, &s, &len, NULL );
+    ret = sys_file_get_contents( ADJTIME_CONF, &s, &len );
     if( !ret )
       return FALSE;
 
@@ -25,10 +25,17 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
+#include <limits.h>
 #include <time.h>
 #include <fcntl.h>
 #include <linux/rtc.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/timex.h>
@@ -80,6 +87,44 @@
 #define ADJTIME_CONF "/etc/adjtime"
 #endif
 
+#if !defined( RTC_DEVICE )
+#define RTC_DEVICE ""
+#endif
+
+#if !defined( RTC_SET_DELAY_MSEC )
+#define RTC_SET_DELAY_MSEC 500
+#endif
+
+#if !defined( SLEW_THRESHOLD_MSEC )
+#define SLEW_THRESHOLD_MSEC 500
+#endif
+
+/* NTPSynchronized: the maximum error is below 32 seconds */
+#define TIMEX_SYNC_MAXERROR       ((glong)(32 * USEC_PER_SEC))
+
+/*
+  SyncStateChanged: the clock becomes synchronized below TIMEX_SYNC_ENTER
+  max error and stays so up to TIMEX_SYNC_LEAVE:
+ */
+#define TIMEX_SYNC_ENTER          ((glong)(1 * USEC_PER_SEC))
+#define TIMEX_SYNC_LEAVE          ((glong)(2 * USEC_PER_SEC))
+
+/* The kernel slews the clock at 500 ppm, i.e. 500 usec per second */
+#define CLOCK_SLEW_RATE_USEC      500
+
+#define RTC_DRIFT_MIN_CALIB_TIME  (4 * 60 * 60) /* seconds */
+#define RTC_DRIFT_MAX_FACTOR      2145.0        /* seconds/day */
+
+/* RTC drift model kept in ADJTIME_CONF: */
+struct rtc_adjtime
+{
+  gdouble  drift_factor;
+  time_t   last_adj_time;
+  gdouble  not_adjusted;
+  time_t   last_calib_time;
+  gboolean local;
+};
+
 
 extern gboolean   ntp_synchronized      ( void );
 
@@ -91,15 +136,41 @@ extern guint64          timeval_load        ( const struct timeval *tv );
 extern struct timeval  *timeval_store       ( struct timeval *tv, guint64 u );
 extern guint64          now                 ( clockid_t clock_id );
 extern guint64          now_nsec            ( clockid_t clock_id );
+extern gboolean         clock_set_precise_step( gboolean enable );
+extern gboolean         clock_step_nsec     ( gint64 target_nsec, guint64 since_nsec,
+                                              gint64 *compensation_nsec, gint64 *error_nsec );
+extern gboolean         clock_step_offset_nsec( gint64 offset_nsec, gint64 *target_nsec, gint64 *error_nsec );
 
 extern struct tm *localtime_or_gmtime_r ( const time_t *t, struct tm *tm, gboolean utc );
 extern time_t     mktime_or_timegm      ( struct tm *tm, gboolean utc );
 
+extern gboolean   clock_set_rtc_device  ( const gchar *name );
+extern gchar     *clock_get_rtc_device  ( void );
+extern gchar    **clock_list_rtcs       ( void );
+extern gboolean   clock_read_rtc        ( const gchar *name, struct tm *tm, gboolean *hctosys );
+
 extern gboolean   clock_get_hwclock     ( struct tm *tm );
+extern gboolean   clock_get_hwclock_sync( struct tm *tm );
 extern gboolean   clock_set_hwclock     ( const struct tm *tm );
+extern gboolean   clock_has_hwclock     ( void );
 
 extern gboolean   clock_set_timezone    ( int *ret_minutesdelta );
 
+extern gboolean   clock_get_timex       ( struct timex *txc );
+extern gboolean   timex_synchronized    ( const struct timex *txc );
+
+extern gboolean   clock_discipline      ( gint64 offset_nsec, guint poll_sec,
+                                          guint64 maxerror_usec, guint64 esterror_usec );
+
+extern gboolean   clock_get_slew        ( gint64 *remaining_usec );
+extern gboolean   clock_slew            ( gint64 offset_usec, guint64 *convergence_usec );
+
+extern gboolean   rtc_adjtime_get           ( struct rtc_adjtime *adj );
+extern void       rtc_adjtime_set           ( const struct rtc_adjtime *adj );
+extern gint64     rtc_drift_correction_usec ( time_t rtc_time );
+extern gboolean   clock_systohc             ( gboolean utc, gboolean calibrate );
+extern gboolean   clock_hctosys             ( void );
+
 extern gboolean   timezone_is_valid     ( const gchar *name );
 extern gboolean   set_system_timezone   ( const gchar *name );
 extern gboolean   get_system_timezone   ( gchar **ret );
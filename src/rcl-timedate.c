@@ -23,8 +23,11 @@
 #include <string.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <sys/timerfd.h>
 
 #include <glib.h>
+#include <glib-unix.h>
 #include <glib/gi18n-lib.h>
 #include <glib-object.h>
 #include <locale.h>
@@ -35,6 +38,50 @@
 #include "rcl-time-utils.h"
 #include "rcl-ntpd-utils.h"
 #include "rcl-zone-utils.h"
+#include "rcl-leap-utils.h"
+#include "rcl-sys.h"
+#include "rcl-metrics-utils.h"
+#include "rcl-snapshot-utils.h"
+#include "rcl-trace.h"
+
+/* startup phases which run in worker threads */
+typedef enum
+{
+  RCL_DAEMON_LOAD_TIMEZONE,
+  RCL_DAEMON_LOAD_LOCAL_RTC,
+  RCL_DAEMON_LOAD_NTP,
+  RCL_DAEMON_LOAD_LEAP_SECONDS,
+  RCL_DAEMON_LOAD_PHASES
+} rcl_daemon_load_phase;
+
+struct rcl_daemon_load
+{
+  gint64    start[RCL_DAEMON_LOAD_PHASES];
+  gint64    end[RCL_DAEMON_LOAD_PHASES];
+  gboolean  applied[RCL_DAEMON_LOAD_PHASES];
+
+  gchar    *timezone;
+  gboolean  local_rtc;
+  gboolean  can_ntp;
+  gboolean  ntp_enabled;
+  gboolean  ntp_running;
+
+  gboolean  from_snapshot;  /* timezone, LocalRTC and NTP are taken from the snapshot */
+  gboolean  ntp_set;        /* SetNTP has changed the NTP state, the snapshot is not verified */
+  gboolean  timezone_set;   /* SetTimezone has changed the timezone, it is not taken at handover */
+  gboolean  local_rtc_set;  /* SetLocalRTC has changed LocalRTC, it is not taken at handover */
+};
+
+/* NTP state verified after the startup from the snapshot */
+struct rcl_daemon_verify
+{
+  gint64                    start;
+  gint64                    end;
+  const struct ntp_backend *backend;  /* probed, taken in the main loop */
+  gboolean                  can_ntp;
+  gboolean                  ntp_enabled;
+  gboolean                  ntp_running;
+};
 
 struct RclDaemonPrivate
 {
@@ -43,14 +90,72 @@ struct RclDaemonPrivate
   gboolean         local_rtc;
   gboolean         can_ntp;
   gboolean         use_ntp;
+  gboolean         rtc_drift;
+  gboolean         sync_state;
+
+  GFileMonitor    *leap_monitor;
+
+  guint            sample_timer;
+  guint            sample_interval;
+  gint64           sample_time;
+  gint64           sample_rtc_time;
+  glong            sample_freq;
+  int              jump_fd;
+  guint            jump_watch;
   PolkitAuthority *auth;
+
+  guint            arrival_filter;
+  GMutex           arrival_lock;
+  GHashTable      *arrivals;
+  gint             calls;      /* method calls without reply */
+  gint64           last_call;  /* monotonic usec of the last call arrival */
+
+  gint64           init_time;
+  gint64           startup_since;  /* --startup-profile: monotonic usec of the process start */
+  gint64           auth_start;
+  GMutex           load_lock;
+  gint             load_pending;
+  struct rcl_daemon_load load;
+  gboolean         ready;          /* all startup phases are applied */
+  GQueue           held;           /* calls which came before the daemon is ready */
+  GSList          *ready_waiters;  /* see rcl_daemon_ready_async() */
+  gboolean         started;        /* exported on the bus */
+  struct snapshot  snapshot;       /* of the published state, see rcl_daemon_save_snapshot() */
+
+  GPtrArray       *rtcs;
+  GFileMonitor    *rtc_monitor;
+  guint            rtc_scan_timer;
+
+  GSList          *hwclock_waiters;
+  gint64           hwclock_since;
+  guint            hwclock_timer;
+  gboolean         hwclock_busy;
+
+  gboolean         exiting;        /* the state is left for the next instance, see rcl_daemon_prepare_exit() */
+  gboolean         replaced;       /* the name is taken by the successor, see rcl_daemon_set_replaced() */
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (RclDaemon, rcl_daemon, RCL_TYPE_TIMEDATE_DAEMON_SKELETON)
 
 #define RCL_DAEMON_ACTION_DELAY  20 /* seconds */
+#define RCL_DAEMON_RTC_DRIFT     ((gint64)(2 * USEC_PER_SEC)) /* RTCDrift signal threshold */
+#define RCL_DAEMON_SAMPLE_MIN    250    /* msec, adjtimex sampling while the clock is moving */
+#define RCL_DAEMON_SAMPLE_MAX    300000 /* msec, adjtimex sampling of a stable clock */
+#define RCL_DAEMON_SAMPLE_OFFSET ((gint64)(20 * NSEC_PER_MSEC)) /* PLL offset of a converging clock */
+#define RCL_DAEMON_SAMPLE_RTC    1000   /* msec, RTC is read by the sampler not more often */
+#define RCL_DAEMON_SAMPLE_FREQ   6554   /* 0.1 ppm (scaled by 2^16) frequency change of a converging clock */
+#define RCL_DAEMON_SAMPLE_FRESH  50     /* msec, a snapshot this old is reused (GetAll) */
+#define RCL_DAEMON_HWCLOCK_QUIET 250  /* msec without RTC write requests before the write */
+#define RCL_DAEMON_HWCLOCK_MAX   2000 /* msec, the longest delay of RTC write */
+#define RCL_DAEMON_RTC_SCAN      500  /* msec to settle RTC hotplug events before rescan */
+#define RCL_DAEMON_ARRIVALS_MAX  1024 /* calls without reply kept at most */
 #define RCL_INTERFACE_PREFIX     "org.freedesktop.timedate1."
 
+#if !defined( TIMEDATED_RUN_DIR )
+#define TIMEDATED_RUN_DIR        "/run/timedated"
+#endif
+#define RCL_DAEMON_STATE_FILE    TIMEDATED_RUN_DIR "/state"
+
 
 /***************************************************************
   Polkit data and functions:
@@ -111,15 +216,20 @@ _check_polkit_authorization_callback( GObject      *source_object,
   PolkitAuthorizationResult *result;
   GTask                     *task;
   GError                    *error = NULL;
+  gboolean                   authorized;
 
   data = (struct check_polkit_data *)_data;
   if( (result = polkit_authority_check_authorization_finish( data->authority, res, &error)) == NULL )
   {
+    TRACE_PROBE2( polkit__response, data->action_id, -1 );
     g_task_report_error( NULL, data->callback, data->user_data, NULL, error );
     goto out;
   }
- 
-  if( !polkit_authorization_result_get_is_authorized( result ) )
+
+  authorized = polkit_authorization_result_get_is_authorized( result );
+  TRACE_PROBE2( polkit__response, data->action_id, authorized );
+
+  if( !authorized )
   {
     g_task_report_new_error( NULL,
                              data->callback,
@@ -153,6 +263,7 @@ _check_polkit_authority_callback( GObject      *source_object,
 
   if( (data->authority = polkit_authority_get_finish( result, &error )) == NULL)
   {
+    TRACE_PROBE2( polkit__response, data->action_id, -1 );
     g_task_report_error( NULL, data->callback, data->user_data, NULL, error );
     check_polkit_data_free( data );
     return;
@@ -182,6 +293,35 @@ _check_polkit_authority_callback( GObject      *source_object,
                                         data );
 }
 
+/*
+  The continuation of the call runs in the metrics scope of the call,
+  the time until it runs is the polkit phase:
+ */
+struct check_polkit_scope
+{
+  metrics_method       method;
+  gint64               start;
+  GAsyncReadyCallback  callback;
+  gpointer             user_data;
+};
+
+static void
+_check_polkit_scope_callback( GObject      *source_object,
+                              GAsyncResult *result,
+                              gpointer     _scope )
+{
+  struct check_polkit_scope *scope = (struct check_polkit_scope *)_scope;
+  metrics_method             previous;
+
+  metrics_record( scope->method, METRICS_POLKIT, scope->start );
+
+  previous = metrics_scope_enter( scope->method );
+  scope->callback( source_object, result, scope->user_data );
+  metrics_scope_leave( previous );
+
+  g_free( scope );
+}
+
 static void
 _check_polkit_for_action_async( GDBusMethodInvocation *invocation,
                                 const gchar           *function,
@@ -191,16 +331,25 @@ _check_polkit_for_action_async( GDBusMethodInvocation *invocation,
 {
   const gchar               *action = g_strjoin( "", RCL_INTERFACE_PREFIX, function, NULL );
   struct check_polkit_data  *data;
+  struct check_polkit_scope *scope;
   const gchar               *sender;
 
   sender  = g_dbus_method_invocation_get_sender( invocation );
 
+  scope = g_new( struct check_polkit_scope, 1 );
+  scope->method    = metrics_scope();
+  scope->start     = metrics_start();
+  scope->callback  = callback;
+  scope->user_data = user_data;
+
   data = g_new0( struct check_polkit_data, 1 );
   data->unique_name      = sender;
   data->action_id        = action;
   data->user_interaction = interactive;
-  data->callback         = callback;
-  data->user_data        = user_data;
+  data->callback         = _check_polkit_scope_callback;
+  data->user_data        = scope;
+
+  TRACE_PROBE2( polkit__request, action, sender );
 
   polkit_authority_get_async( NULL, _check_polkit_authority_callback, data );
 }
@@ -210,19 +359,162 @@ _check_polkit_for_action_async( GDBusMethodInvocation *invocation,
   DBus Properties:
   ===============
  */
-static gboolean get_ntpsynchronized( RclTimedateDaemon *object )
+static gboolean get_ntpsynchronized( RclTimedateDaemon *object, const struct timex *txc )
 {
-  gboolean ntp_synced = ntp_synchronized();
+  gboolean ntp_synced = txc ? timex_synchronized( txc ) : ntp_synchronized();
 
   rcl_timedate_daemon_set_ntpsynchronized( object, ntp_synced );
 
   return ntp_synced;
 }
 
+/*
+  SyncStateChanged is emitted on threshold crossings only, with its own
+  hysteresis on the max error (see TIMEX_SYNC_ENTER); NTPSynchronized
+  keeps the wide threshold:
+ */
+static void check_sync_state( RclDaemon *daemon, const struct timex *txc, gint64 offset_nsec )
+{
+  gboolean synced = daemon->priv->sync_state;
+
+  if( !synced && txc->maxerror < TIMEX_SYNC_ENTER )
+    synced = TRUE;
+  else if( synced && txc->maxerror > TIMEX_SYNC_LEAVE )
+    synced = FALSE;
+
+  if( synced == daemon->priv->sync_state )
+    return;
+
+  daemon->priv->sync_state = synced;
+
+  g_debug( "timex: Clock is %s (max error %ld usec)", synced ? "synchronized" : "not synchronized", txc->maxerror );
+
+  rcl_timedate_daemon_emit_sync_state_changed( RCL_TIMEDATE_DAEMON( daemon ), synced,
+                                               (guint64)txc->maxerror, offset_nsec );
+}
+
+/*
+  TAI offset and the next leap second from the kernel state and the leap
+  seconds list. The kernel knows about a leap second only on the last day
+  before it, but then it knows for sure:
+ */
+static void update_leap( RclTimedateDaemon *object, const struct timex *txc )
+{
+  time_t  t = (time_t)txc->time.tv_sec;
+  time_t  next  = 0;
+  gint    delta = 0;
+  gint    tai   = 0;
+
+  (void)leap_table_lookup( t, &tai, &next, &delta );
+
+  if( txc->status & (STA_INS | STA_DEL) )
+  {
+    next  = (t / 86400 + 1) * 86400; /* the next UTC midnight */
+    delta = (txc->status & STA_INS) ? 1 : -1;
+  }
+
+  if( txc->tai > 0 )
+    tai = txc->tai;
+
+  rcl_timedate_daemon_set_taioffset_sec( object, tai );
+  rcl_timedate_daemon_set_next_leap_second_usec( object, (guint64)MAX( next, 0 ) * USEC_PER_SEC );
+  rcl_timedate_daemon_set_next_leap_second_delta( object, delta );
+}
+
+/*
+  All kernel time discipline properties from a single adjtimex() snapshot:
+ */
+static void get_timex( RclTimedateDaemon *object, struct timex *ret )
+{
+  RclDaemon    *daemon = RCL_DAEMON( object );
+  struct timex  txc;
+  gint64        offset;
+
+  if( !clock_get_timex( &txc ) )
+  {
+    (void)get_ntpsynchronized( object, NULL );
+    return;
+  }
+
+  daemon->priv->sample_time = g_get_monotonic_time();
+  if( ret )
+    *ret = txc;
+
+  offset = (txc.status & STA_NANO) ? (gint64)txc.offset : (gint64)txc.offset * (gint64)NSEC_PER_USEC;
+
+  rcl_timedate_daemon_set_timex_offset_nsec( object, offset );
+  rcl_timedate_daemon_set_timex_freq_ppm( object, (gdouble)txc.freq / 65536.0 );
+  rcl_timedate_daemon_set_timex_max_error_usec( object, (guint64)MAX( txc.maxerror, 0 ) );
+  rcl_timedate_daemon_set_timex_est_error_usec( object, (guint64)MAX( txc.esterror, 0 ) );
+  rcl_timedate_daemon_set_timex_status( object, txc.status );
+  update_leap( object, &txc );
+
+  (void)get_ntpsynchronized( object, &txc );
+  check_sync_state( daemon, &txc, offset );
+}
+
+/*
+  Emit RTCDrift once the drift corrected RTC time diverges from the system
+  clock by more than the threshold; rearm when it is back within half of it:
+ */
+static void check_rtc_drift( RclDaemon *daemon, struct tm *tm )
+{
+  time_t  rtc_time;
+  gint64  offset;
+
+  tm->tm_isdst = -1;
+  rtc_time = mktime_or_timegm( tm, !daemon->priv->local_rtc );
+  if( rtc_time == (time_t)-1 )
+    return;
+
+  offset = (gint64)rtc_time * (gint64)USEC_PER_SEC + rtc_drift_correction_usec( rtc_time ) -
+           (gint64)now( CLOCK_REALTIME );
+
+  if( !daemon->priv->rtc_drift && ABS( offset ) > RCL_DAEMON_RTC_DRIFT )
+  {
+    daemon->priv->rtc_drift = TRUE;
+
+    g_debug( "rtc-drift: RTC diverges from the system clock by %" PRId64 " usec", offset );
+
+    rcl_timedate_daemon_emit_rtcdrift( RCL_TIMEDATE_DAEMON( daemon ), offset );
+  }
+  else if( daemon->priv->rtc_drift && ABS( offset ) < RCL_DAEMON_RTC_DRIFT / 2 )
+  {
+    daemon->priv->rtc_drift = FALSE;
+  }
+}
+
+/*
+  While the RTC write is pending (or just done) the RTC holds
+  the system time, so there is no need to read it back:
+ */
+static guint64 get_pending_rtctime_usec( RclTimedateDaemon *object )
+{
+  RclDaemon *daemon = RCL_DAEMON( object );
+  struct tm  tm;
+  time_t     t;
+  guint64    usec;
+
+  t = (time_t)(now( CLOCK_REALTIME ) / USEC_PER_SEC);
+  localtime_or_gmtime_r( &t, &tm, !daemon->priv->local_rtc );
+
+  usec = (guint64)timegm( &tm ) * USEC_PER_SEC;
+
+  rcl_timedate_daemon_set_rtctime_usec( object, usec );
+
+  return usec;
+}
+
 static guint64 get_rtctime_usec( RclTimedateDaemon *object )
 {
-  struct tm tm   = {};
-  guint64   usec = 0;
+  RclDaemon *daemon = RCL_DAEMON( object );
+  struct tm  tm   = {};
+  struct tm  rtc;
+  time_t     rtc_time;
+  guint64    usec = 0;
+
+  if( daemon->priv->hwclock_waiters || daemon->priv->hwclock_busy )
+    return get_pending_rtctime_usec( object );
 
   if( !clock_get_hwclock( &tm ) )
   {
@@ -232,14 +524,36 @@ static guint64 get_rtctime_usec( RclTimedateDaemon *object )
 
     return (guint64)0;
   }
+  rtc = tm;
 
-  usec = (guint64)timegm( &tm ) * USEC_PER_SEC;
+  /* RTC time with the drift correction from ADJTIME_CONF applied */
+  rtc_time = timegm( &tm );
+  usec = (guint64)((gint64)rtc_time * (gint64)USEC_PER_SEC + rtc_drift_correction_usec( rtc_time ));
 
   rcl_timedate_daemon_set_rtctime_usec( object, usec );
 
+  check_rtc_drift( daemon, &rtc );
+
   return usec;
 }
 
+/*
+  NTP service is the backend selected by ntp_backend() at startup:
+ */
+static gboolean ntp_service_running( void )
+{
+  return ( ntp_daemon_enabled() && ntp_daemon_status() );
+}
+
+/*
+  The system clock is a known-good RTC calibration point only
+  while it is disciplined by NTP daemon:
+ */
+static gboolean rcl_daemon_time_is_trusted( RclDaemon *daemon )
+{
+  return daemon->priv->use_ntp && ntp_synchronized();
+}
+
 static guint64 get_time_usec( RclTimedateDaemon *object )
 {
   guint64  usec;
@@ -251,11 +565,16 @@ static guint64 get_time_usec( RclTimedateDaemon *object )
   return usec;
 }
 
+static void rcl_daemon_save_snapshot( RclDaemon *daemon, gboolean stamp );
+
 void rcl_daemon_sync_dbus_properties( RclTimedateDaemon *object )
 {
+  /* refreshed by rcl_daemon_ready() */
+  if( !RCL_DAEMON( object )->priv->ready )
+    return;
 
-  /* Update NTPSynchronized */
-  (void)get_ntpsynchronized( object );
+  /* Update NTPSynchronized and Timex* */
+  get_timex( object, NULL );
 
   /* Update RTCTimeUSec */
   (void)get_rtctime_usec( object );
@@ -266,739 +585,2681 @@ void rcl_daemon_sync_dbus_properties( RclTimedateDaemon *object )
 
 
 /***************************************************************
-  DBus Handlers:
-  =============
- */
+  Adaptive sampler:
+  ================
 
-/*******************************
-  SetTimezone:
-  -----------
+  The kernel clock state is sampled quickly while the PLL converges or
+  the maximum error is near the synchronization thresholds, and the
+  interval doubles up to RCL_DAEMON_SAMPLE_MAX while the clock is stable.
+  SetTime, SlewTime, SetNTP and clock jumps (timerfd with
+  TFD_TIMER_CANCEL_ON_SET) re-arm the sampler at the shortest interval.
+
+  The properties which change all the time (TimeUSec, RTCTimeUSec,
+  Timex*) are refreshed when a client reads them.
  */
-struct set_timezone_data
-{
-  RclTimedateDaemon     *object;
-  GDBusMethodInvocation *invocation;
-  const gchar           *timezone;
-  gboolean               interactive;
-  RclDaemon             *daemon;
-};
+static gboolean rcl_daemon_sample( gpointer user_data );
 
-static void
-set_timezone_data_free( struct set_timezone_data * data )
+static gboolean
+clock_is_moving( RclDaemon *daemon, const struct timex *txc )
 {
-  if( data == NULL )
-    return;
+  gint64 offset;
+  glong  freq;
 
-  if( data->timezone != NULL )
-    g_free( (gpointer)data->timezone );
+  offset = (txc->status & STA_NANO) ? (gint64)txc->offset : (gint64)txc->offset * (gint64)NSEC_PER_USEC;
+  freq   = daemon->priv->sample_freq;
 
-  g_free( data );
-}
+  daemon->priv->sample_freq = txc->freq;
+
+  if( ABS( offset ) > RCL_DAEMON_SAMPLE_OFFSET )
+    return TRUE;
+
+  if( ABS( txc->freq - freq ) > RCL_DAEMON_SAMPLE_FREQ )
+    return TRUE;
 
+  /* near the thresholds of SyncStateChanged */
+  return ( txc->maxerror > TIMEX_SYNC_ENTER / 2 && txc->maxerror < TIMEX_SYNC_LEAVE * 2 );
+}
 
 static void
-set_timezone_authorized_callback( GObject      *source_object,
-                                  GAsyncResult *result,
-                                  gpointer      user_data )
+rcl_daemon_schedule_sample( RclDaemon *daemon, guint interval )
 {
-  GError                   *error = NULL;
-  struct set_timezone_data *data  = (struct set_timezone_data *)user_data;
-  gboolean                  ret   = TRUE;
+  if( daemon->priv->sample_timer )
+    g_source_remove( daemon->priv->sample_timer );
 
-  if( !check_polkit_finish( result, &error ) )
-  {
-    g_debug( "set-timezone: error: '%s'", "User is not privileged" );
-    set_timezone_data_free( data );
-    return;
-  }
+  daemon->priv->sample_interval = interval;
+  daemon->priv->sample_timer    = g_timeout_add( interval, rcl_daemon_sample, daemon );
+}
 
-  ret = set_system_timezone( data->timezone );
-  if( ret )
-  {
-    if( data->daemon->priv->local_rtc )
-    {
-      struct timespec ts;
-      struct tm       tm;
+static gboolean
+rcl_daemon_sample( gpointer user_data )
+{
+  RclDaemon    *daemon = RCL_DAEMON( user_data );
+  struct timex  txc    = {};
+  guint         interval;
 
-      /* Sync RTC from system clock, with the new delta */
-      if( clock_gettime(CLOCK_REALTIME, &ts) != 0 )
-      {
-        g_debug( "set-timezone: error: Sync RTC from system clock: '%s'", "clock_gettime(): failed" );
-        set_timezone_data_free( data );
-        return;
-      }
-      if( !localtime_r( &ts.tv_sec, &tm ) )
-      {
-        g_debug( "set-timezone: error: Sync RTC from system clock: '%s'", "localtime_r(): failed" );
-        set_timezone_data_free( data );
-        return;
-      }
-      if( !clock_set_hwclock( &tm ) )
-      {
-        g_debug( "set-timezone: error: Sync RTC from system clock: '%s'", "Cannot update '/dev/rtc' (ignoring)" );
-      }
-    }
+  daemon->priv->sample_timer = 0;
+
+  get_timex( RCL_TIMEDATE_DAEMON( daemon ), &txc );
+
+  /* RTCDrift check rides on the sampler, but fast samples do not read RTC */
+  if( g_get_monotonic_time() - daemon->priv->sample_rtc_time >= (gint64)RCL_DAEMON_SAMPLE_RTC * (gint64)USEC_PER_MSEC )
+  {
+    daemon->priv->sample_rtc_time = g_get_monotonic_time();
+    (void)get_rtctime_usec( RCL_TIMEDATE_DAEMON( daemon ) );
   }
+
+  if( clock_is_moving( daemon, &txc ) )
+    interval = RCL_DAEMON_SAMPLE_MIN;
   else
-  {
-    g_debug( "set-timezone: error: Cannot set system timezone '%s'", data->timezone );
-    set_timezone_data_free( data );
+    interval = MIN( daemon->priv->sample_interval * 2, RCL_DAEMON_SAMPLE_MAX );
+
+  rcl_daemon_schedule_sample( daemon, interval );
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+  Sample now and then at the shortest interval:
+ */
+static void
+rcl_daemon_kick_sampler( RclDaemon *daemon )
+{
+  /* the saved state is final */
+  if( daemon->priv->exiting )
     return;
-  }
 
-  g_free( (gpointer)data->daemon->priv->timezone );
-  data->daemon->priv->timezone  = g_strdup( data->timezone );
-  rcl_timedate_daemon_set_timezone( data->object, (const gchar *)data->daemon->priv->timezone );
+  if( daemon->priv->sample_timer )
+    g_source_remove( daemon->priv->sample_timer );
 
+  daemon->priv->sample_interval = RCL_DAEMON_SAMPLE_MIN / 2;
+  daemon->priv->sample_timer    = g_idle_add( rcl_daemon_sample, daemon );
+}
 
-  g_debug( "set-timezone: SetTimezone to '%s' returns successful status (interactive=%s)",
-                                          data->daemon->priv->timezone, (data->interactive) ? "true" : "false" );
+static gboolean
+arm_clock_jump( int fd )
+{
+  struct itimerspec its = {};
 
-  rcl_timedate_daemon_complete_set_timezone( data->object, data->invocation );
+  /* the far future timer never fires, but it is cancelled by a clock step */
+  its.it_value.tv_sec = (sizeof(time_t) > 4) ? (time_t)G_MAXINT64 : (time_t)G_MAXINT32;
 
-  set_timezone_data_free( data );
+  return ( timerfd_settime( fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL ) == 0 );
 }
 
-gboolean handle_set_timezone( RclTimedateDaemon     *object,
-                              GDBusMethodInvocation *invocation,
-                              const gchar           *timezone,
-                              gboolean               interactive,
-                              RclDaemon             *daemon )
+static gboolean
+clock_jump_cb( gint fd, GIOCondition condition, gpointer user_data )
 {
-  struct set_timezone_data *data;
+  RclDaemon *daemon = RCL_DAEMON( user_data );
+  guint64    expirations;
 
-  if( !timezone_is_valid( timezone ) )
+  if( read( fd, &expirations, sizeof(expirations) ) < 0 && errno == ECANCELED )
   {
-    g_dbus_method_invocation_return_error( invocation,
-                                           RCL_DAEMON_ERROR,
-                                           RCL_DAEMON_ERROR_INVALID_TIMEZONE_FILE,
-                                           "Requested timezone '%s' is invalid", timezone );
-    return TRUE;
+    g_debug( "sampler: System clock jumped" );
+    rcl_daemon_kick_sampler( daemon );
   }
 
-  if( g_strcmp0( (const char *)daemon->priv->timezone, (const char *)timezone ) == 0 )
-    goto out;
-
-  data = g_new0( struct set_timezone_data, 1 );
-  data->object         = object;
-  data->invocation     = invocation;
-  data->timezone       = (const gchar *)g_strdup( timezone );
-  data->interactive    = interactive;
-  data->daemon         = daemon;
+  if( !arm_clock_jump( fd ) )
+  {
+    daemon->priv->jump_watch = 0;
+    return G_SOURCE_REMOVE;
+  }
 
-  _check_polkit_for_action_async( invocation,
-                                  "set-timezone",
-                                  interactive,
-                                  set_timezone_authorized_callback,
-                                  data );
-out:
-  return TRUE;
+  return G_SOURCE_CONTINUE;
 }
 
-
-/*******************************
-  SetLocalRTC:
-  -----------
- */
-struct set_local_rtc_data
-{
-  RclTimedateDaemon     *object;
-  GDBusMethodInvocation *invocation;
-  gboolean               local_rtc;
-  gboolean               fix_system;
-  gboolean               interactive;
-  RclDaemon             *daemon;
-};
-
 static void
-set_local_rtc_data_free( struct set_local_rtc_data * data )
+rcl_daemon_start_sampler( RclDaemon *daemon )
 {
-  if( data == NULL )
-    return;
+  guint interval = daemon->priv->sample_interval; /* of the previous run, see rcl_daemon_load_state() */
 
-  g_free( data );
+  daemon->priv->jump_fd = timerfd_create( CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC );
+  if( daemon->priv->jump_fd < 0 || !arm_clock_jump( daemon->priv->jump_fd ) )
+    g_debug( "sampler: warning: Cannot watch clock jumps: %s", g_strerror( errno ) );
+  else
+    daemon->priv->jump_watch = g_unix_fd_add( daemon->priv->jump_fd, G_IO_IN, clock_jump_cb, daemon );
+
+  rcl_daemon_kick_sampler( daemon );
+
+  /* a stable clock is not sampled at the shortest interval again after an idle exit */
+  if( interval > RCL_DAEMON_SAMPLE_MIN )
+    daemon->priv->sample_interval = interval / 2;
 }
 
 static void
-set_local_rtc_authorized_callback( GObject      *source_object,
-                                   GAsyncResult *result,
-                                   gpointer      user_data )
+rcl_daemon_stop_sampler( RclDaemon *daemon )
 {
-  GError                    *error = NULL;
-  struct set_local_rtc_data *data  = (struct set_local_rtc_data *)user_data;
-  gboolean                   ret = TRUE;
-  struct timespec            ts;
+  if( daemon->priv->sample_timer )
+    g_source_remove( daemon->priv->sample_timer );
+  daemon->priv->sample_timer = 0;
 
-  if( !check_polkit_finish( result, &error ) )
-  {
-    g_debug( "set-local-rtc: error: '%s'", "User is not privileged" );
-    set_local_rtc_data_free( data );
-    return;
-  }
+  if( daemon->priv->jump_watch )
+    g_source_remove( daemon->priv->jump_watch );
+  daemon->priv->jump_watch = 0;
 
-  if( data->daemon->priv->local_rtc != data->local_rtc )
-  {
-    data->daemon->priv->local_rtc = data->local_rtc;
+  if( daemon->priv->jump_fd >= 0 )
+    close( daemon->priv->jump_fd );
+  daemon->priv->jump_fd = -1;
+}
 
-    /* Write new configuration files */
-    ret = write_data_local_rtc( data->daemon->priv->local_rtc );
-    if( !ret )
-    {
-      g_dbus_method_invocation_return_error( data->invocation,
-                                             RCL_DAEMON_ERROR,
-                                             RCL_DAEMON_ERROR_GENERAL,
-                                             "Cannot set LocalRTC" );
-      set_local_rtc_data_free( data );
-      return;
-    }
+/*
+  Properties read by clients are refreshed before the skeleton returns them,
+  methods and properties run in the metrics scope of the call.
 
-  }
+  Get and GetAll come to the method_call (the vtable has no get_property),
+  so the calls which come during the startup are held in a queue and
+  dispatched by rcl_daemon_ready() without blocking the main loop:
+ */
+static GDBusInterfaceVTable           rcl_daemon_vtable;
+static GDBusInterfaceMethodCallFunc   rcl_daemon_parent_method_call;
+static GDBusInterfaceGetPropertyFunc  rcl_daemon_parent_get_property;
+
+static GVariant *
+rcl_daemon_get_property( GDBusConnection  *connection,
+                         const gchar      *sender,
+                         const gchar      *object_path,
+                         const gchar      *interface_name,
+                         const gchar      *property_name,
+                         GError          **error,
+                         gpointer          user_data )
+{
+  RclDaemon         *daemon = RCL_DAEMON( user_data );
+  RclTimedateDaemon *object = RCL_TIMEDATE_DAEMON( daemon );
+  metrics_method     previous;
+  GVariant          *ret;
 
-  /* Tell the kernel our timezone */
-  ret = clock_set_timezone( NULL );
-  if( !ret )
+  TRACE_PROBE2( dbus__property__entry, property_name, sender );
+
+  previous = metrics_scope_enter( METRICS_PROPERTIES );
+
+  if( !g_strcmp0( property_name, "TimeUSec" ) )
   {
-    g_debug( "set-local-rtc: error: Cannot set timezone clock after SetLocal_RTC" );
-    set_local_rtc_data_free( data );
-    return;
+    (void)get_time_usec( object );
   }
-
-  /* Synchronize clocks */
-  if( clock_gettime(CLOCK_REALTIME, &ts) != 0 )
+  else if( !g_strcmp0( property_name, "RTCTimeUSec" ) )
   {
-    g_debug( "set-local-rtc: error: Sync RTC from system clock after SetLocalRTC: '%s'", "clock_gettime(): failed" );
-    set_local_rtc_data_free( data );
-    return;
+    (void)get_rtctime_usec( object );
+  }
+  else if( !g_strcmp0( property_name, "NTPSynchronized" ) ||
+           !g_strcmp0( property_name, "TAIOffsetSec" )    ||
+           g_str_has_prefix( property_name, "NextLeap" )    ||
+           g_str_has_prefix( property_name, "Timex" )       )
+  {
+    /* one snapshot for all properties of GetAll */
+    if( g_get_monotonic_time() - daemon->priv->sample_time > RCL_DAEMON_SAMPLE_FRESH * (gint64)USEC_PER_MSEC )
+      get_timex( object, NULL );
   }
 
-  if( data->fix_system )
+  ret = rcl_daemon_parent_get_property( connection, sender, object_path, interface_name,
+                                        property_name, error, user_data );
+  metrics_scope_leave( previous );
+
+  TRACE_PROBE1( dbus__property__return, property_name );
+
+  return ret;
+}
+
+/*
+  org.freedesktop.DBus.Properties Get and GetAll:
+ */
+static void
+rcl_daemon_properties_call( RclDaemon             *daemon,
+                            const gchar           *method_name,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation )
+{
+  GDBusConnection *connection  = g_dbus_method_invocation_get_connection( invocation );
+  const gchar     *sender      = g_dbus_method_invocation_get_sender( invocation );
+  const gchar     *object_path = g_dbus_method_invocation_get_object_path( invocation );
+  const gchar     *interface_name;
+  GVariant        *value;
+  GError          *error = NULL;
+
+  if( !g_strcmp0( method_name, "Get" ) )
   {
-    struct tm tm;
+    const gchar *property_name;
 
-    /* Sync system clock from RTC; first, initialize the timezone fields of struct tm. */
-    localtime_or_gmtime_r( &ts.tv_sec, &tm, !data->daemon->priv->local_rtc);
+    g_variant_get( parameters, "(&s&s)", &interface_name, &property_name );
 
-    /* Override the main fields of struct tm, but not the timezone fields */
-    ret = clock_get_hwclock( &tm );
-    if( !ret)
+    value = rcl_daemon_get_property( connection, sender, object_path, interface_name,
+                                     property_name, &error, daemon );
+    if( !value )
     {
-      g_debug( "set-local-rtc: error: Failed to get hardware clock (ignoring)" );
+      g_dbus_method_invocation_take_error( invocation, error );
+      return;
     }
-    else
+
+    value = g_variant_ref_sink( value );
+    g_dbus_method_invocation_return_value( invocation, g_variant_new( "(v)", value ) );
+    g_variant_unref( value );
+  }
+  else if( !g_strcmp0( method_name, "GetAll" ) )
+  {
+    GDBusInterfaceInfo *info = g_dbus_interface_skeleton_get_info( G_DBUS_INTERFACE_SKELETON( daemon ) );
+    GVariantBuilder     builder;
+    guint               i;
+
+    g_variant_get( parameters, "(&s)", &interface_name );
+    g_variant_builder_init( &builder, G_VARIANT_TYPE( "a{sv}" ) );
+
+    for( i = 0; info->properties && info->properties[i]; ++i )
     {
-      /* And set the system clock with this */
-      ts.tv_sec = mktime_or_timegm( &tm, !data->daemon->priv->local_rtc );
+      GDBusPropertyInfo *property = info->properties[i];
 
-      if( clock_settime( CLOCK_REALTIME, &ts ) < 0 )
+      if( !( property->flags & G_DBUS_PROPERTY_INFO_FLAGS_READABLE ) )
+        continue;
+
+      value = rcl_daemon_get_property( connection, sender, object_path, interface_name,
+                                       property->name, &error, daemon );
+      if( !value )
       {
-        g_debug( "set-local-rtc: error: Failed to update system clock (ignoring)" );
+        g_clear_error( &error );
+        continue;
       }
+
+      value = g_variant_ref_sink( value );
+      g_variant_builder_add( &builder, "{sv}", property->name, value );
+      g_variant_unref( value );
     }
+
+    g_dbus_method_invocation_return_value( invocation, g_variant_new( "(a{sv})", &builder ) );
+  }
+  else if( !g_strcmp0( method_name, "Set" ) )
+  {
+    const gchar *property_name;
+
+    /* all properties of the interface are read-only */
+    g_variant_get( parameters, "(&s&sv)", &interface_name, &property_name, NULL );
+    g_dbus_method_invocation_return_error( invocation, G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY,
+                                           "Property '%s' is not writable", property_name );
   }
   else
   {
-    struct tm tm;
+    g_dbus_method_invocation_return_error( invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Unknown method '%s'", method_name );
+  }
+}
 
-    /* Sync RTC from system clock */
-    localtime_or_gmtime_r( &ts.tv_sec, &tm, !data->daemon->priv->local_rtc );
+static void
+rcl_daemon_method_call( GDBusConnection       *connection,
+                        const gchar           *sender,
+                        const gchar           *object_path,
+                        const gchar           *interface_name,
+                        const gchar           *method_name,
+                        GVariant              *parameters,
+                        GDBusMethodInvocation *invocation,
+                        gpointer               user_data )
+{
+  RclDaemon      *daemon = RCL_DAEMON( user_data );
+  metrics_method  previous;
 
-    ret = clock_set_hwclock( &tm );
-    if( !ret )
-    {
-      g_debug( "set-local-rtc: error: Failed to sync time to hardware clock (ignoring)" );
-    }
+  if( !daemon->priv->ready )
+  {
+    g_debug( "Call waits for the daemon startup" );
+    g_queue_push_tail( &daemon->priv->held, invocation );
+    return;
   }
 
-  g_debug( "set-local-rtc: RTC configured to %s time", (data->daemon->priv->local_rtc) ? "localtime" : "UTC" );
+  if( !g_strcmp0( interface_name, "org.freedesktop.DBus.Properties" ) )
+  {
+    rcl_daemon_properties_call( daemon, method_name, parameters, invocation );
+    return;
+  }
 
+  TRACE_PROBE2( dbus__method__entry, method_name, sender );
 
-  rcl_timedate_daemon_set_local_rtc( data->object, data->daemon->priv->local_rtc );
+  previous = metrics_scope_enter( metrics_method_lookup( method_name ) );
+  rcl_daemon_parent_method_call( connection, sender, object_path, interface_name,
+                                 method_name, parameters, invocation, user_data );
+  metrics_scope_leave( previous );
 
-  g_debug( "set-local-rtc: SetLocalRTC to '%s' returns successful status (fix_sysrem=%s; interactive=%s)",
-                                           (data->daemon->priv->local_rtc) ? "localtime" : "UTC",
-                                           (data->fix_system)              ? "true"      : "false",
-                                           (data->interactive)             ? "true"      : "false" );
+  TRACE_PROBE1( dbus__method__return, method_name );
+}
 
-  rcl_timedate_daemon_complete_set_local_rtc( data->object, data->invocation );
+/*
+  Dispatch the calls held during the startup:
+ */
+static void
+rcl_daemon_dispatch_held( RclDaemon *daemon )
+{
+  GDBusMethodInvocation *invocation;
 
-  set_local_rtc_data_free( data );
+  while( (invocation = g_queue_pop_head( &daemon->priv->held )) != NULL )
+    rcl_daemon_method_call( g_dbus_method_invocation_get_connection( invocation ),
+                            g_dbus_method_invocation_get_sender( invocation ),
+                            g_dbus_method_invocation_get_object_path( invocation ),
+                            g_dbus_method_invocation_get_interface_name( invocation ),
+                            g_dbus_method_invocation_get_method_name( invocation ),
+                            g_dbus_method_invocation_get_parameters( invocation ),
+                            invocation,
+                            daemon );
 }
 
-gboolean handle_set_local_rtc( RclTimedateDaemon     *object,
-                               GDBusMethodInvocation *invocation,
-                               gboolean               local_rtc,
-                               gboolean               fix_system,
-                               gboolean               interactive,
-                               RclDaemon             *daemon )
+static GDBusInterfaceVTable *
+rcl_daemon_get_vtable( GDBusInterfaceSkeleton *skeleton )
 {
-  struct set_local_rtc_data *data;
+  GDBusInterfaceVTable *vtable;
 
-  if( daemon->priv->local_rtc == local_rtc && !fix_system )
-    goto out;
+  vtable = G_DBUS_INTERFACE_SKELETON_CLASS( rcl_daemon_parent_class )->get_vtable( skeleton );
 
-  data = g_new0( struct set_local_rtc_data, 1 );
-  data->object      = object;
-  data->invocation  = invocation;
-  data->local_rtc   = local_rtc;
-  data->fix_system  = fix_system;
-  data->interactive = interactive;
-  data->daemon      = daemon;
+  rcl_daemon_parent_method_call  = vtable->method_call;
+  rcl_daemon_parent_get_property = vtable->get_property;
+  rcl_daemon_vtable              = *vtable;
+  rcl_daemon_vtable.method_call  = rcl_daemon_method_call;
+  rcl_daemon_vtable.get_property = NULL;
 
-  _check_polkit_for_action_async( invocation,
-                                  "set-local-rtc",
-                                  interactive,
-                                  set_local_rtc_authorized_callback,
-                                  data );
-out:
-  return TRUE;
+  return &rcl_daemon_vtable;
 }
 
 
-/*******************************
-  SetNTP:
-  ------
+/***************************************************************
+  Leap seconds list:
+  =================
+
+  The list is parsed once and reloaded when tzdata is upgraded.
  */
-struct set_ntp_data
+static void
+rcl_daemon_publish_leap_seconds( RclDaemon *daemon )
 {
-  RclTimedateDaemon     *object;
-  GDBusMethodInvocation *invocation;
-  gboolean               use_ntp;
-  gboolean               interactive;
-  RclDaemon             *daemon;
+  time_t expires;
+
+  expires = leap_table_expires();
+  rcl_timedate_daemon_set_leap_seconds_expire_usec( RCL_TIMEDATE_DAEMON( daemon ),
+                                                    (guint64)MAX( expires, 0 ) * USEC_PER_SEC );
+}
+
+static void
+rcl_daemon_load_leap_seconds( RclDaemon *daemon )
+{
+  (void)leap_table_load( LEAP_SECONDS_LIST );
+  rcl_daemon_publish_leap_seconds( daemon );
+}
+
+static void
+leap_monitor_changed( GFileMonitor      *monitor,
+                      GFile             *file,
+                      GFile             *other_file,
+                      GFileMonitorEvent  event_type,
+                      gpointer           user_data )
+{
+  RclDaemon *daemon = RCL_DAEMON( user_data );
+
+  if( event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+      event_type != G_FILE_MONITOR_EVENT_CREATED             )
+    return;
+
+  g_debug( "leap: '%s' changed", LEAP_SECONDS_LIST );
+
+  rcl_daemon_load_leap_seconds( daemon );
+  get_timex( RCL_TIMEDATE_DAEMON( daemon ), NULL );
+}
+
+static void
+rcl_daemon_watch_leap_seconds( RclDaemon *daemon )
+{
+  GFile  *file;
+  gchar  *path;
+  GError *error = NULL;
+
+  path = sys_path( LEAP_SECONDS_LIST );
+  file = g_file_new_for_path( path );
+  g_free( path );
+  daemon->priv->leap_monitor = g_file_monitor_file( file, G_FILE_MONITOR_NONE, NULL, &error );
+  g_object_unref( file );
+
+  if( !daemon->priv->leap_monitor )
+  {
+    g_debug( "leap: warning: Cannot watch '%s': %s", LEAP_SECONDS_LIST, error->message );
+    g_error_free( error );
+    return;
+  }
+
+  g_signal_connect( daemon->priv->leap_monitor,
+                    "changed",
+                    G_CALLBACK( leap_monitor_changed ),
+                    daemon ); /* user_data */
+}
+
+
+/***************************************************************
+  RTC devices:
+  ===========
+
+  All RTCs of /sys/class/rtc are enumerated once and read in parallel
+  (through sysfs, so the RTC in use is not disturbed). The list follows
+  hotplug of RTC device nodes and is published as the RTCs property.
+ */
+struct rtc_device
+{
+  gchar    *name;
+  gboolean  hctosys;
+  guint64   read_usec;    /* RTC time of the last read */
+  guint64   latency_usec; /* duration of the last read */
 };
 
 static void
-set_ntp_data_free( struct set_ntp_data * data )
+rtc_device_free( struct rtc_device *rtc )
 {
-  if( data == NULL )
+  if( !rtc )
     return;
 
-  g_free( data );
+  g_free( rtc->name );
+  g_free( rtc );
+}
+
+static struct rtc_device *
+rcl_daemon_find_rtc( RclDaemon *daemon, const gchar *name )
+{
+  guint i;
+
+  for( i = 0; i < daemon->priv->rtcs->len; ++i )
+  {
+    struct rtc_device *rtc = g_ptr_array_index( daemon->priv->rtcs, i );
+
+    if( !g_strcmp0( rtc->name, name ) )
+      return rtc;
+  }
+
+  return NULL;
 }
 
 static void
-set_ntp_authorized_callback( GObject      *source_object,
-                             GAsyncResult *result,
-                             gpointer      user_data )
+rcl_daemon_publish_rtcs( RclDaemon *daemon )
 {
-  GError              *error = NULL;
-  struct set_ntp_data *data  = (struct set_ntp_data *)user_data;
+  GVariantBuilder builder;
+  guint           i;
 
-  if( !check_polkit_finish( result, &error ) )
+  g_variant_builder_init( &builder, G_VARIANT_TYPE( "a(sbtt)" ) );
+  for( i = 0; i < daemon->priv->rtcs->len; ++i )
   {
-    g_debug( "set-ntp: error: '%s'", "User is not privileged" );
-    set_ntp_data_free( data );
+    struct rtc_device *rtc = g_ptr_array_index( daemon->priv->rtcs, i );
+
+    g_variant_builder_add( &builder, "(sbtt)", rtc->name, rtc->hctosys, rtc->read_usec, rtc->latency_usec );
+  }
+
+  rcl_timedate_daemon_set_rtcs( RCL_TIMEDATE_DAEMON( daemon ), g_variant_builder_end( &builder ) );
+}
+
+static void
+read_rtc_thread( GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable )
+{
+  struct rtc_device *rtc = (struct rtc_device *)task_data;
+  struct tm          tm;
+  gint64             start;
+
+  start = g_get_monotonic_time();
+  if( !clock_read_rtc( rtc->name, &tm, &rtc->hctosys ) )
+  {
+    g_task_return_new_error( task, RCL_DAEMON_ERROR, RCL_DAEMON_ERROR_GENERAL,
+                             "Cannot read '%s'", rtc->name );
     return;
   }
+  rtc->latency_usec = (guint64)(g_get_monotonic_time() - start);
+  rtc->read_usec    = (guint64)timegm( &tm ) * USEC_PER_SEC;
 
-  if( data->daemon->priv->use_ntp == data->use_ntp )
-    goto out;
+  g_task_return_boolean( task, TRUE );
+}
 
-  if( data->use_ntp ) /* enable and start NTP daemon: */
+static void
+read_rtc_done( GObject      *source_object,
+               GAsyncResult *result,
+               gpointer      user_data )
+{
+  RclDaemon         *daemon = RCL_DAEMON( source_object );
+  struct rtc_device *read   = (struct rtc_device *)g_task_get_task_data( G_TASK( result ) );
+  struct rtc_device *rtc;
+  GError            *error  = NULL;
+
+  if( !g_task_propagate_boolean( G_TASK( result ), &error ) )
   {
-    if( ntp_daemon_enabled() )
+    g_debug( "rtc: error: %s", error->message );
+    g_error_free( error );
+    return;
+  }
+
+  /* the device may have gone while it was read */
+  rtc = rcl_daemon_find_rtc( daemon, read->name );
+  if( !rtc )
+    return;
+
+  rtc->hctosys      = read->hctosys;
+  rtc->read_usec    = read->read_usec;
+  rtc->latency_usec = read->latency_usec;
+
+  g_debug( "rtc: %s%s read in %" G_GUINT64_FORMAT " usec", rtc->name,
+           rtc->hctosys ? " (hctosys)" : "", rtc->latency_usec );
+
+  rcl_daemon_publish_rtcs( daemon );
+}
+
+static void
+rcl_daemon_read_rtc_async( RclDaemon *daemon, const gchar *name )
+{
+  struct rtc_device *read;
+  GTask             *task;
+
+  read = g_new0( struct rtc_device, 1 );
+  read->name = g_strdup( name );
+
+  task = g_task_new( daemon, NULL, read_rtc_done, NULL );
+  g_task_set_task_data( task, read, (GDestroyNotify)rtc_device_free );
+  g_task_run_in_thread( task, read_rtc_thread );
+  g_object_unref( task );
+}
+
+/*
+  Synchronize the list with /sys/class/rtc and read the new devices:
+ */
+static gboolean
+rcl_daemon_scan_rtcs( gpointer user_data )
+{
+  RclDaemon  *daemon = RCL_DAEMON( user_data );
+  gchar     **names;
+  guint       i;
+
+  daemon->priv->rtc_scan_timer = 0;
+
+  names = clock_list_rtcs();
+
+  for( i = daemon->priv->rtcs->len; i > 0; --i )
+  {
+    struct rtc_device *rtc = g_ptr_array_index( daemon->priv->rtcs, i - 1 );
+
+    if( !g_strv_contains( (const gchar * const *)names, rtc->name ) )
     {
-      if( ntp_daemon_status() )
-      {
-        g_debug( "set-ntp: The NTP Daemon already running" );
-        data->daemon->priv->use_ntp = TRUE;
-        /* SUCCESS */
-      }
-      else
-      {
-        if( !start_ntp_daemon() )
-        {
-          g_debug( "set-ntp: error: Cannot start NTPD daemon" );
-          g_dbus_method_invocation_return_error( data->invocation,
-                                                 RCL_DAEMON_ERROR,
-                                                 RCL_DAEMON_ERROR_GENERAL,
-                                                 "Cannot start NTP Daemon" );
-          data->daemon->priv->use_ntp = FALSE;
-          /* FAILURE */
-          set_ntp_data_free( data );
-          return;
-        }
-        else
-        {
-          g_debug( "set-ntp: The NTPD daemon started successful" );
-          data->daemon->priv->use_ntp = TRUE;
-          /* SUCCESS */
-        }
-      }
+      g_debug( "rtc: %s removed", rtc->name );
+      g_ptr_array_remove_index( daemon->priv->rtcs, i - 1 );
     }
-    else
-    {
-      if( !enable_ntp_daemon() )
-      {
-        g_debug( "set-ntp: error: Cannot enable NTPD daemon" );
-        g_dbus_method_invocation_return_error( data->invocation,
-                                               RCL_DAEMON_ERROR,
+  }
+
+  for( i = 0; names[i]; ++i )
+  {
+    struct rtc_device *rtc;
+
+    if( rcl_daemon_find_rtc( daemon, names[i] ) )
+      continue;
+
+    rtc = g_new0( struct rtc_device, 1 );
+    rtc->name = g_strdup( names[i] );
+    g_ptr_array_add( daemon->priv->rtcs, rtc );
+
+    rcl_daemon_read_rtc_async( daemon, rtc->name );
+  }
+
+  g_strfreev( names );
+
+  rcl_daemon_publish_rtcs( daemon );
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+  sysfs does not report new class devices through inotify,
+  so the hotplug is watched on the /dev/rtcN nodes:
+ */
+static void
+rtc_monitor_changed( GFileMonitor      *monitor,
+                     GFile             *file,
+                     GFile             *other_file,
+                     GFileMonitorEvent  event_type,
+                     gpointer           user_data )
+{
+  RclDaemon *daemon = RCL_DAEMON( user_data );
+  gchar     *name;
+
+  if( event_type != G_FILE_MONITOR_EVENT_CREATED && event_type != G_FILE_MONITOR_EVENT_DELETED )
+    return;
+
+  name = g_file_get_basename( file );
+  if( g_str_has_prefix( name, "rtc" ) && !daemon->priv->rtc_scan_timer )
+    daemon->priv->rtc_scan_timer = g_timeout_add( RCL_DAEMON_RTC_SCAN, rcl_daemon_scan_rtcs, daemon );
+  g_free( name );
+}
+
+static void
+rcl_daemon_watch_rtcs( RclDaemon *daemon )
+{
+  GFile  *dev;
+  GError *error = NULL;
+
+  dev = g_file_new_for_path( "/dev" );
+  daemon->priv->rtc_monitor = g_file_monitor_directory( dev, G_FILE_MONITOR_NONE, NULL, &error );
+  g_object_unref( dev );
+
+  if( !daemon->priv->rtc_monitor )
+  {
+    g_debug( "rtc: warning: Cannot watch RTC hotplug: %s", error->message );
+    g_error_free( error );
+    return;
+  }
+
+  g_signal_connect( daemon->priv->rtc_monitor,
+                    "changed",
+                    G_CALLBACK( rtc_monitor_changed ),
+                    daemon ); /* user_data */
+}
+
+
+/***************************************************************
+  RTC writer:
+  ==========
+
+  The RTC write waits for the right sub-second phase of the system
+  clock (see clock_systohc()), so it runs in a worker thread.
+
+  Every request is "write the system time to RTC", so requests are
+  queued and coalesced: the RTC is written once after a quiet period
+  (but not later than RCL_DAEMON_HWCLOCK_MAX after the first request)
+  and the result is returned to all requests of the batch.
+ */
+struct sync_hwclock_data
+{
+  gboolean        utc;
+  gboolean        calibrate;
+  metrics_method  method;   /* of the requests, background if they differ */
+  GSList         *waiters;
+};
+
+struct sync_hwclock_request
+{
+  gboolean        calibrate;
+  metrics_method  method;
+};
+
+static void
+sync_hwclock_data_free( struct sync_hwclock_data *data )
+{
+  if( data == NULL )
+    return;
+
+  g_slist_free_full( data->waiters, g_object_unref );
+
+  g_free( data );
+}
+
+static void
+sync_hwclock_thread( GTask        *task,
+                     gpointer      source_object,
+                     gpointer      task_data,
+                     GCancellable *cancellable )
+{
+  struct sync_hwclock_data *data = (struct sync_hwclock_data *)task_data;
+  metrics_method            previous;
+  gboolean                  ret;
+
+  /* the RTC I/O is counted for the method which asked for the write */
+  previous = metrics_scope_enter( data->method );
+  ret = clock_systohc( data->utc, data->calibrate );
+  metrics_scope_leave( previous );
+
+  if( !ret )
+  {
+    if( !clock_has_hwclock() )
+      g_task_return_new_error( task, RCL_DAEMON_ERROR, RCL_DAEMON_ERROR_NOT_SUPPORTED,
+                               "There is no RTC device" );
+    else
+      g_task_return_new_error( task, RCL_DAEMON_ERROR, RCL_DAEMON_ERROR_GENERAL,
+                               "Failed to write the time to RTC device" );
+    return;
+  }
+
+  g_task_return_boolean( task, TRUE );
+}
+
+static gboolean sync_hwclock_start( gpointer user_data );
+
+static void
+sync_hwclock_done( GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data )
+{
+  RclDaemon                *daemon = RCL_DAEMON( source_object );
+  struct sync_hwclock_data *data   = (struct sync_hwclock_data *)g_task_get_task_data( G_TASK( result ) );
+  GError                   *error  = NULL;
+  GSList                   *l;
+
+  (void)g_task_propagate_boolean( G_TASK( result ), &error );
+
+  for( l = data->waiters; l; l = l->next )
+  {
+    if( error != NULL )
+      g_task_return_error( G_TASK( l->data ), g_error_copy( error ) );
+    else
+      g_task_return_boolean( G_TASK( l->data ), TRUE );
+  }
+
+  /* the drift model in ADJTIME_CONF is changed */
+  if( error == NULL )
+    rcl_daemon_save_snapshot( daemon, TRUE );
+  g_clear_error( &error );
+
+  daemon->priv->hwclock_busy = FALSE;
+
+  /* Requests queued while RTC was being written */
+  if( daemon->priv->hwclock_waiters && !daemon->priv->hwclock_timer )
+    (void)sync_hwclock_start( daemon );
+}
+
+static gboolean
+sync_hwclock_start( gpointer user_data )
+{
+  RclDaemon                *daemon = RCL_DAEMON( user_data );
+  struct sync_hwclock_data *data;
+  GTask                    *task;
+  GSList                   *l;
+
+  daemon->priv->hwclock_timer = 0;
+
+  /* sync_hwclock_done() starts the next write */
+  if( daemon->priv->hwclock_busy )
+    return G_SOURCE_REMOVE;
+
+  data = g_new0( struct sync_hwclock_data, 1 );
+  data->utc       = !daemon->priv->local_rtc;
+  data->calibrate = TRUE;
+  data->method    = METRICS_BACKGROUND;
+  data->waiters   = g_slist_reverse( daemon->priv->hwclock_waiters );
+
+  daemon->priv->hwclock_waiters = NULL;
+  daemon->priv->hwclock_busy    = TRUE;
+
+  /* The RTC can be calibrated only if all requests of the batch allow it */
+  for( l = data->waiters; l; l = l->next )
+  {
+    struct sync_hwclock_request *request = g_task_get_task_data( G_TASK( l->data ) );
+
+    data->calibrate = data->calibrate && request->calibrate;
+    data->method    = ( l == data->waiters || request->method == data->method ) ? request->method
+                                                                                : METRICS_BACKGROUND;
+  }
+
+  g_debug( "rtc-writer: Write RTC for %u coalesced request(s)", g_slist_length( data->waiters ) );
+
+  task = g_task_new( daemon, NULL, sync_hwclock_done, NULL );
+  g_task_set_task_data( task, data, (GDestroyNotify)sync_hwclock_data_free );
+  g_task_run_in_thread( task, sync_hwclock_thread );
+  g_object_unref( task );
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+rcl_daemon_sync_hwclock_async( RclDaemon           *daemon,
+                               gboolean             calibrate,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data )
+{
+  struct sync_hwclock_request *request;
+  GTask                       *task;
+  gint64                       elapsed;
+
+  request = g_new( struct sync_hwclock_request, 1 );
+  request->calibrate = calibrate;
+  request->method    = metrics_scope();
+
+  task = g_task_new( daemon, NULL, callback, user_data );
+  g_task_set_source_tag( task, rcl_daemon_sync_hwclock_async );
+  g_task_set_task_data( task, request, g_free );
+
+  if( !daemon->priv->hwclock_waiters )
+    daemon->priv->hwclock_since = g_get_monotonic_time();
+
+  daemon->priv->hwclock_waiters = g_slist_prepend( daemon->priv->hwclock_waiters, task );
+
+  /* Restart the quiet period unless the first request waits too long */
+  elapsed = (g_get_monotonic_time() - daemon->priv->hwclock_since) / (gint64)USEC_PER_MSEC;
+  if( daemon->priv->hwclock_timer && elapsed + RCL_DAEMON_HWCLOCK_QUIET > RCL_DAEMON_HWCLOCK_MAX )
+    return;
+
+  if( daemon->priv->hwclock_timer )
+    g_source_remove( daemon->priv->hwclock_timer );
+
+  daemon->priv->hwclock_timer = g_timeout_add( RCL_DAEMON_HWCLOCK_QUIET, sync_hwclock_start, daemon );
+  g_source_set_name_by_id( daemon->priv->hwclock_timer, "[timedate] sync_hwclock_start" );
+}
+
+static gboolean
+rcl_daemon_sync_hwclock_finish( RclDaemon     *daemon,
+                                GAsyncResult  *result,
+                                GError       **error )
+{
+  g_return_val_if_fail( g_task_is_valid( result, daemon ), FALSE );
+
+  return g_task_propagate_boolean( G_TASK( result ), error );
+}
+
+
+/***************************************************************
+  DBus Handlers:
+  =============
+ */
+
+/*******************************
+  SetTimezone:
+  -----------
+ */
+struct set_timezone_data
+{
+  RclTimedateDaemon     *object;
+  GDBusMethodInvocation *invocation;
+  const gchar           *timezone;
+  gboolean               interactive;
+  RclDaemon             *daemon;
+};
+
+static void
+set_timezone_data_free( struct set_timezone_data * data )
+{
+  if( data == NULL )
+    return;
+
+  if( data->timezone != NULL )
+    g_free( (gpointer)data->timezone );
+
+  g_free( data );
+}
+
+
+static void
+set_timezone_complete( struct set_timezone_data *data )
+{
+  g_free( (gpointer)data->daemon->priv->timezone );
+  data->daemon->priv->timezone  = g_strdup( data->timezone );
+  rcl_timedate_daemon_set_timezone( data->object, (const gchar *)data->daemon->priv->timezone );
+  data->daemon->priv->load.timezone_set = TRUE;
+  rcl_daemon_save_snapshot( data->daemon, TRUE );
+
+
+  g_debug( "set-timezone: SetTimezone to '%s' returns successful status (interactive=%s)",
+                                          data->daemon->priv->timezone, (data->interactive) ? "true" : "false" );
+
+  rcl_timedate_daemon_complete_set_timezone( data->object, data->invocation );
+
+  set_timezone_data_free( data );
+}
+
+static void
+set_timezone_hwclock_callback( GObject      *source_object,
+                               GAsyncResult *result,
+                               gpointer      user_data )
+{
+  struct set_timezone_data *data = (struct set_timezone_data *)user_data;
+
+  if( !rcl_daemon_sync_hwclock_finish( data->daemon, result, NULL ) )
+  {
+    g_debug( "set-timezone: error: Sync RTC from system clock: '%s'", "Cannot update '/dev/rtc' (ignoring)" );
+  }
+
+  set_timezone_complete( data );
+}
+
+static void
+set_timezone_authorized_callback( GObject      *source_object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data )
+{
+  GError                   *error = NULL;
+  struct set_timezone_data *data  = (struct set_timezone_data *)user_data;
+
+  if( !check_polkit_finish( result, &error ) )
+  {
+    g_debug( "set-timezone: error: '%s'", "User is not privileged" );
+    g_dbus_method_invocation_return_error( data->invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_NOT_PRIVILEGED,
+                                           "%s", error->message );
+    g_error_free( error );
+    set_timezone_data_free( data );
+    return;
+  }
+
+  if( !set_system_timezone( data->timezone ) )
+  {
+    g_debug( "set-timezone: error: Cannot set system timezone '%s'", data->timezone );
+    g_dbus_method_invocation_return_error( data->invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_GENERAL,
+                                           "Cannot set system timezone '%s'", data->timezone );
+    set_timezone_data_free( data );
+    return;
+  }
+
+  if( data->daemon->priv->local_rtc )
+  {
+    /*
+      Sync RTC from system clock, with the new delta. The RTC still holds
+      the time of previous timezone, so it cannot be used for calibration:
+     */
+    rcl_daemon_sync_hwclock_async( data->daemon, FALSE, set_timezone_hwclock_callback, data );
+    return;
+  }
+
+  set_timezone_complete( data );
+}
+
+gboolean handle_set_timezone( RclTimedateDaemon     *object,
+                              GDBusMethodInvocation *invocation,
+                              const gchar           *timezone,
+                              gboolean               interactive,
+                              RclDaemon             *daemon )
+{
+  struct set_timezone_data *data;
+
+  if( !timezone_is_valid( timezone ) )
+  {
+    g_dbus_method_invocation_return_error( invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_INVALID_TIMEZONE_FILE,
+                                           "Requested timezone '%s' is invalid", timezone );
+    return TRUE;
+  }
+
+  if( g_strcmp0( (const char *)daemon->priv->timezone, (const char *)timezone ) == 0 )
+  {
+    /* Nothing to do */
+    rcl_timedate_daemon_complete_set_timezone( object, invocation );
+    return TRUE;
+  }
+
+  data = g_new0( struct set_timezone_data, 1 );
+  data->object         = object;
+  data->invocation     = invocation;
+  data->timezone       = (const gchar *)g_strdup( timezone );
+  data->interactive    = interactive;
+  data->daemon         = daemon;
+
+  _check_polkit_for_action_async( invocation,
+                                  "set-timezone",
+                                  interactive,
+                                  set_timezone_authorized_callback,
+                                  data );
+  return TRUE;
+}
+
+
+/*******************************
+  SetLocalRTC:
+  -----------
+ */
+struct set_local_rtc_data
+{
+  RclTimedateDaemon     *object;
+  GDBusMethodInvocation *invocation;
+  gboolean               local_rtc;
+  gboolean               fix_system;
+  gboolean               interactive;
+  RclDaemon             *daemon;
+};
+
+static void
+set_local_rtc_data_free( struct set_local_rtc_data * data )
+{
+  if( data == NULL )
+    return;
+
+  g_free( data );
+}
+
+static void
+set_local_rtc_complete( struct set_local_rtc_data *data )
+{
+  g_debug( "set-local-rtc: RTC configured to %s time", (data->daemon->priv->local_rtc) ? "localtime" : "UTC" );
+
+
+  rcl_timedate_daemon_set_local_rtc( data->object, data->daemon->priv->local_rtc );
+  rcl_daemon_save_snapshot( data->daemon, TRUE );
+
+  g_debug( "set-local-rtc: SetLocalRTC to '%s' returns successful status (fix_sysrem=%s; interactive=%s)",
+                                           (data->daemon->priv->local_rtc) ? "localtime" : "UTC",
+                                           (data->fix_system)              ? "true"      : "false",
+                                           (data->interactive)             ? "true"      : "false" );
+
+  rcl_timedate_daemon_complete_set_local_rtc( data->object, data->invocation );
+
+  set_local_rtc_data_free( data );
+}
+
+static void
+set_local_rtc_hwclock_callback( GObject      *source_object,
+                                GAsyncResult *result,
+                                gpointer      user_data )
+{
+  struct set_local_rtc_data *data = (struct set_local_rtc_data *)user_data;
+
+  if( !rcl_daemon_sync_hwclock_finish( data->daemon, result, NULL ) )
+  {
+    g_debug( "set-local-rtc: error: Failed to sync time to hardware clock (ignoring)" );
+  }
+
+  set_local_rtc_complete( data );
+}
+
+static void
+set_local_rtc_authorized_callback( GObject      *source_object,
+                                   GAsyncResult *result,
+                                   gpointer      user_data )
+{
+  GError                    *error = NULL;
+  struct set_local_rtc_data *data  = (struct set_local_rtc_data *)user_data;
+  gboolean                   ret = TRUE;
+  gboolean                   changed = FALSE;
+  struct timespec            ts;
+
+  if( !check_polkit_finish( result, &error ) )
+  {
+    g_debug( "set-local-rtc: error: '%s'", "User is not privileged" );
+    g_dbus_method_invocation_return_error( data->invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_NOT_PRIVILEGED,
+                                           "%s", error->message );
+    g_error_free( error );
+    set_local_rtc_data_free( data );
+    return;
+  }
+
+  if( data->daemon->priv->local_rtc != data->local_rtc )
+  {
+    data->daemon->priv->local_rtc = data->local_rtc;
+    data->daemon->priv->load.local_rtc_set = TRUE;
+    changed = TRUE;
+
+    /* Write new configuration files */
+    ret = write_data_local_rtc( data->daemon->priv->local_rtc );
+    if( !ret )
+    {
+      g_dbus_method_invocation_return_error( data->invocation,
+                                             RCL_DAEMON_ERROR,
+                                             RCL_DAEMON_ERROR_GENERAL,
+                                             "Cannot set LocalRTC" );
+      set_local_rtc_data_free( data );
+      return;
+    }
+
+  }
+
+  /* Tell the kernel our timezone */
+  ret = clock_set_timezone( NULL );
+  if( !ret )
+  {
+    g_debug( "set-local-rtc: error: Cannot set timezone clock after SetLocal_RTC" );
+    g_dbus_method_invocation_return_error( data->invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_GENERAL,
+                                           "Cannot set the kernel timezone" );
+    set_local_rtc_data_free( data );
+    return;
+  }
+
+  /* Synchronize clocks */
+  if( sys_clock_gettime( CLOCK_REALTIME, &ts ) != 0 )
+  {
+    g_debug( "set-local-rtc: error: Sync RTC from system clock after SetLocalRTC: '%s'", "clock_gettime(): failed" );
+    g_dbus_method_invocation_return_error( data->invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_GENERAL,
+                                           "Cannot read the system clock" );
+    set_local_rtc_data_free( data );
+    return;
+  }
+
+  if( data->fix_system )
+  {
+    struct tm tm;
+
+    /* Sync system clock from RTC; first, initialize the timezone fields of struct tm. */
+    localtime_or_gmtime_r( &ts.tv_sec, &tm, !data->daemon->priv->local_rtc);
+
+    /* Override the main fields of struct tm, but not the timezone fields */
+    ret = clock_get_hwclock( &tm );
+    if( !ret)
+    {
+      g_debug( "set-local-rtc: error: Failed to get hardware clock (ignoring)" );
+    }
+    else
+    {
+      /* And set the system clock with this (drift corrected) */
+      ts.tv_sec = mktime_or_timegm( &tm, !data->daemon->priv->local_rtc );
+      timespec_store( &ts, (guint64)((gint64)timespec_load( &ts ) + rtc_drift_correction_usec( ts.tv_sec )) );
+
+      if( sys_clock_settime( CLOCK_REALTIME, &ts ) < 0 )
+      {
+        g_debug( "set-local-rtc: error: Failed to update system clock (ignoring)" );
+      }
+    }
+  }
+  else
+  {
+    /*
+      Sync RTC from system clock. If the RTC mode has not been changed
+      the RTC error can be taken as calibration point of drift factor:
+     */
+    rcl_daemon_sync_hwclock_async( data->daemon,
+                                   !changed && rcl_daemon_time_is_trusted( data->daemon ),
+                                   set_local_rtc_hwclock_callback, data );
+    return;
+  }
+
+  set_local_rtc_complete( data );
+}
+
+gboolean handle_set_local_rtc( RclTimedateDaemon     *object,
+                               GDBusMethodInvocation *invocation,
+                               gboolean               local_rtc,
+                               gboolean               fix_system,
+                               gboolean               interactive,
+                               RclDaemon             *daemon )
+{
+  struct set_local_rtc_data *data;
+
+  if( daemon->priv->local_rtc == local_rtc && !fix_system )
+  {
+    /* Nothing to do */
+    rcl_timedate_daemon_complete_set_local_rtc( object, invocation );
+    return TRUE;
+  }
+
+  data = g_new0( struct set_local_rtc_data, 1 );
+  data->object      = object;
+  data->invocation  = invocation;
+  data->local_rtc   = local_rtc;
+  data->fix_system  = fix_system;
+  data->interactive = interactive;
+  data->daemon      = daemon;
+
+  _check_polkit_for_action_async( invocation,
+                                  "set-local-rtc",
+                                  interactive,
+                                  set_local_rtc_authorized_callback,
+                                  data );
+  return TRUE;
+}
+
+
+/*******************************
+  SetNTP:
+  ------
+ */
+struct set_ntp_data
+{
+  RclTimedateDaemon     *object;
+  GDBusMethodInvocation *invocation;
+  gboolean               use_ntp;
+  gboolean               interactive;
+  RclDaemon             *daemon;
+};
+
+static void
+set_ntp_data_free( struct set_ntp_data * data )
+{
+  if( data == NULL )
+    return;
+
+  g_free( data );
+}
+
+static void
+set_ntp_complete( struct set_ntp_data *data )
+{
+  if( data->daemon->priv->use_ntp == data->use_ntp )
+    goto out;
+
+  if( data->use_ntp ) /* enable and start NTP daemon: */
+  {
+    if( ntp_daemon_enabled() )
+    {
+      if( ntp_daemon_status() )
+      {
+        g_debug( "set-ntp: The NTP Daemon already running" );
+        data->daemon->priv->use_ntp = TRUE;
+        /* SUCCESS */
+      }
+      else
+      {
+        if( !start_ntp_daemon() )
+        {
+          g_debug( "set-ntp: error: Cannot start NTPD daemon" );
+          g_dbus_method_invocation_return_error( data->invocation,
+                                                 RCL_DAEMON_ERROR,
+                                                 RCL_DAEMON_ERROR_GENERAL,
+                                                 "Cannot start NTP Daemon" );
+          data->daemon->priv->use_ntp = FALSE;
+          /* FAILURE */
+          set_ntp_data_free( data );
+          return;
+        }
+        else
+        {
+          g_debug( "set-ntp: The NTPD daemon started successful" );
+          data->daemon->priv->use_ntp = TRUE;
+          /* SUCCESS */
+        }
+      }
+    }
+    else
+    {
+      if( !enable_ntp_daemon() )
+      {
+        g_debug( "set-ntp: error: Cannot enable NTPD daemon" );
+        g_dbus_method_invocation_return_error( data->invocation,
+                                               RCL_DAEMON_ERROR,
+                                               RCL_DAEMON_ERROR_GENERAL,
+                                               "Cannot enable NTP Daemon" );
+        data->daemon->priv->use_ntp = FALSE;
+        /* FAILURE */
+        set_ntp_data_free( data );
+        return;
+      }
+      else
+      {
+        if( !start_ntp_daemon() )
+        {
+          g_debug( "set-ntp: error: Cannot start NTPD daemon" );
+          g_dbus_method_invocation_return_error( data->invocation,
+                                                 RCL_DAEMON_ERROR,
+                                                 RCL_DAEMON_ERROR_GENERAL,
+                                                 "Cannot start NTP Daemon" );
+          data->daemon->priv->use_ntp = FALSE;
+          /* FAILURE */
+          set_ntp_data_free( data );
+          return;
+        }
+        else
+        {
+          g_debug( "set-ntp: The NTPD daemon started successful" );
+          data->daemon->priv->use_ntp = TRUE;
+          /* SUCCESS */
+        }
+      }
+    }
+  }
+  else /* stop and disable NTP daemon: */
+  {
+    if( ntp_daemon_enabled() )
+    {
+      if( ntp_daemon_status() )
+      {
+        /* daemon is running; stop it */
+        if( !stop_ntp_daemon() )
+        {
+          g_debug( "set-ntp: error: Cannot stop NTPD daemon" );
+          g_dbus_method_invocation_return_error( data->invocation,
+                                                 RCL_DAEMON_ERROR,
+                                                 RCL_DAEMON_ERROR_GENERAL,
+                                                 "Cannot stop NTP Daemon" );
+          data->daemon->priv->use_ntp = TRUE;
+          /* FAILURE */
+          set_ntp_data_free( data );
+          return;
+        }
+        else
+        {
+          g_debug( "set-ntp: The NTPD daemon stopped successful" );
+          if( !disable_ntp_daemon() )
+          {
+            g_debug( "set-ntp: Cannot disable NTPD daemon" );
+            g_dbus_method_invocation_return_error( data->invocation,
+                                                   RCL_DAEMON_ERROR,
+                                                   RCL_DAEMON_ERROR_GENERAL,
+                                                   "Cannot disable NTP Daemon" );
+            data->daemon->priv->use_ntp = FALSE;
+            /* daemon stopped but not disabled (will start after reboot) */
+            /* SUCCESS */
+          }
+          else
+          {
+            g_debug( "set-ntp: The NTPD daemon disabled successful" );
+            data->daemon->priv->use_ntp = FALSE;
+            /* SUCCESS */
+          }
+        }
+      }
+      else
+      {
+        /* daemon is stopped; disable it */
+        if( !disable_ntp_daemon() )
+        {
+          g_debug( "set-ntp: error: Cannot disable NTPD daemon" );
+          g_dbus_method_invocation_return_error( data->invocation,
+                                                 RCL_DAEMON_ERROR,
+                                                 RCL_DAEMON_ERROR_GENERAL,
+                                                 "Cannot disable NTP Daemon" );
+          data->daemon->priv->use_ntp = FALSE;
+          /* daemon stopped but not disabled (will start after reboot) */
+          /* SUCCESS */
+        }
+        else
+        {
+          g_debug( "set-ntp: The NTPD daemon disabled successful" );
+          data->daemon->priv->use_ntp = FALSE;
+          /* SUCCESS */
+        }
+      }
+    }
+    else
+    {
+      g_debug( "set-ntp: The NTPD daemon already disabled" );
+      data->daemon->priv->use_ntp = FALSE;
+      /* SUCCESS */
+    }
+  }
+
+  g_debug( "set-ntp: NTP configured to %s", (data->daemon->priv->use_ntp) ? "enabled" : "disabled" );
+
+  /* the state is changed by the call, the check of the snapshot should not override it */
+  data->daemon->priv->load.ntp_set = TRUE;
+
+  rcl_daemon_kick_sampler( data->daemon );
+
+  rcl_timedate_daemon_set_ntp( data->object, data->daemon->priv->use_ntp );
+  data->daemon->priv->snapshot.ntp_enabled = data->daemon->priv->use_ntp;
+  rcl_daemon_save_snapshot( data->daemon, TRUE );
+  /* rcl_timedate_daemon_set_ntpsynchronized( object, daemon->priv->use_ntp ); */
+
+out:
+  g_debug( "set-ntp: SetNTP to '%s' returns successful status (interactive=%s)",
+                                (data->daemon->priv->use_ntp) ? "true" : "false",
+                                (data->interactive)           ? "true" : "false" );
+
+  rcl_timedate_daemon_complete_set_ntp( data->object, data->invocation );
+
+  set_ntp_data_free( data );
+}
+
+static void
+set_ntp_hwclock_callback( GObject      *source_object,
+                          GAsyncResult *result,
+                          gpointer      user_data )
+{
+  struct set_ntp_data *data = (struct set_ntp_data *)user_data;
+
+  if( !rcl_daemon_sync_hwclock_finish( data->daemon, result, NULL ) )
+  {
+    g_debug( "set-ntp: error: Failed to sync time to hardware clock (ignoring)" );
+  }
+
+  set_ntp_complete( data );
+}
+
+static void
+set_ntp_authorized_callback( GObject      *source_object,
+                             GAsyncResult *result,
+                             gpointer      user_data )
+{
+  GError              *error = NULL;
+  struct set_ntp_data *data  = (struct set_ntp_data *)user_data;
+
+  if( !check_polkit_finish( result, &error ) )
+  {
+    g_debug( "set-ntp: error: '%s'", "User is not privileged" );
+    g_dbus_method_invocation_return_error( data->invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_NOT_PRIVILEGED,
+                                           "%s", error->message );
+    g_error_free( error );
+    set_ntp_data_free( data );
+    return;
+  }
+
+  /*
+    The system clock is known-good for the last time before the NTP
+    daemon is stopped; calibrate RTC drift:
+   */
+  if( data->daemon->priv->use_ntp && !data->use_ntp && rcl_daemon_time_is_trusted( data->daemon ) )
+  {
+    rcl_daemon_sync_hwclock_async( data->daemon, TRUE, set_ntp_hwclock_callback, data );
+    return;
+  }
+
+  set_ntp_complete( data );
+}
+
+gboolean handle_set_ntp( RclTimedateDaemon     *object,
+                         GDBusMethodInvocation *invocation,
+                         gboolean               use_ntp,
+                         gboolean               interactive,
+                         RclDaemon             *daemon )
+{
+  struct set_ntp_data *data;
+
+  /* check CanNTP (in case NTPD was uninstalled while timedated running) */
+  if( !ntp_daemon_installed() )
+  {
+    daemon->priv->can_ntp = FALSE;
+    rcl_timedate_daemon_set_can_ntp( object, daemon->priv->can_ntp );
+    rcl_daemon_save_snapshot( daemon, TRUE );
+  }
+
+  if( !daemon->priv->can_ntp )
+  {
+    if( daemon->priv->use_ntp )
+      daemon->priv->load.ntp_set = TRUE;
+    daemon->priv->use_ntp = FALSE;
+    rcl_timedate_daemon_set_ntp( object, daemon->priv->use_ntp );
+    rcl_timedate_daemon_complete_set_ntp( object, invocation );
+    return TRUE;
+  }
+
+  data = g_new0( struct set_ntp_data, 1 );
+  data->object      = object;
+  data->invocation  = invocation;
+  data->use_ntp     = use_ntp;
+  data->interactive = interactive;
+  data->daemon      = daemon;
+
+  _check_polkit_for_action_async( invocation,
+                                  "set-ntp",
+                                  interactive,
+                                  set_ntp_authorized_callback,
+                                  data );
+  return TRUE;
+}
+
+
+/*******************************
+  Call arrival time:
+  -----------------
+    SetTime compensates the time spent between the call arrival and the
+    clock step. The arrival is taken by the connection filter on the
+    GDBus worker thread, before the call waits in the main loop queue.
+
+    The filter also counts the calls of all objects on the connection
+    until their replies are sent for the idle exit, and the call count,
+    errors and total latency of the methods for the metrics interface,
+    so no handler has to report them.
+ */
+struct pending_call
+{
+  guint64         arrival;  /* CLOCK_MONOTONIC_RAW nsec, SetTime and SlewTime only */
+  metrics_method  method;
+  gint64          start;    /* see metrics_start() */
+};
+
+static gchar *
+arrival_key( const gchar *sender, guint32 serial )
+{
+  return g_strdup_printf( "%s:%u", sender ? sender : "", serial );
+}
+
+static void
+call_arrived( RclDaemon *daemon, GDBusMessage *message )
+{
+  struct pending_call *call;
+  metrics_method       method;
+  const gchar         *interface;
+  guint64              arrival = 0;
+  gint64               start;
+
+  if( g_strcmp0( g_dbus_message_get_path( message ), "/org/freedesktop/timedate1" ) )
+    return;
+
+  interface = g_dbus_message_get_interface( message );
+  if( g_strcmp0( interface, "org.freedesktop.timedate1" ) && g_strcmp0( interface, "org.freedesktop.DBus.Properties" ) )
+    return;
+
+  method = metrics_method_lookup( g_dbus_message_get_member( message ) );
+  if( method == METRICS_METHODS )
+    return;
+
+  if( method == METRICS_SET_TIME || method == METRICS_SLEW_TIME )
+    arrival = now_nsec( CLOCK_MONOTONIC_RAW );
+
+  start = metrics_start();
+  if( !arrival && !start )
+    return;
+
+  call = g_new( struct pending_call, 1 );
+  call->arrival = arrival;
+  call->method  = method;
+  call->start   = start;
+
+  g_mutex_lock( &daemon->priv->arrival_lock );
+
+  /* replies which were never sent do not keep their entries forever */
+  if( g_hash_table_size( daemon->priv->arrivals ) >= RCL_DAEMON_ARRIVALS_MAX )
+    g_hash_table_remove_all( daemon->priv->arrivals );
+
+  g_hash_table_replace( daemon->priv->arrivals,
+                        arrival_key( g_dbus_message_get_sender( message ), g_dbus_message_get_serial( message ) ),
+                        call );
+
+  g_mutex_unlock( &daemon->priv->arrival_lock );
+}
+
+static void
+call_replied( RclDaemon *daemon, GDBusMessage *message, gboolean error )
+{
+  gchar    *key;
+  gpointer  value = NULL;
+
+  key = arrival_key( g_dbus_message_get_destination( message ), g_dbus_message_get_reply_serial( message ) );
+
+  g_mutex_lock( &daemon->priv->arrival_lock );
+  (void)g_hash_table_steal_extended( daemon->priv->arrivals, key, NULL, &value );
+  g_mutex_unlock( &daemon->priv->arrival_lock );
+
+  g_free( key );
+
+  if( value )
+  {
+    struct pending_call *call = (struct pending_call *)value;
+
+    metrics_call_done( call->method, call->start, error );
+    g_free( call );
+  }
+}
+
+static GDBusMessage *
+arrival_filter( GDBusConnection *connection,
+                GDBusMessage    *message,
+                gboolean         incoming,
+                gpointer         user_data )
+{
+  RclDaemon        *daemon = RCL_DAEMON( user_data );
+  GDBusMessageType  type   = g_dbus_message_get_message_type( message );
+
+  if( !incoming && ( type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN || type == G_DBUS_MESSAGE_TYPE_ERROR ) )
+  {
+    call_replied( daemon, message, type == G_DBUS_MESSAGE_TYPE_ERROR );
+    (void)g_atomic_int_dec_and_test( &daemon->priv->calls );
+    return message;
+  }
+
+  if( !incoming || type != G_DBUS_MESSAGE_TYPE_METHOD_CALL )
+    return message;
+
+  __atomic_store_n( &daemon->priv->last_call, g_get_monotonic_time(), __ATOMIC_RELAXED );
+  if( !( g_dbus_message_get_flags( message ) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED ) )
+    g_atomic_int_inc( &daemon->priv->calls );
+
+  call_arrived( daemon, message );
+
+  return message;
+}
+
+/*
+  CLOCK_MONOTONIC_RAW nsec of the call arrival (or now if it is unknown):
+ */
+static guint64
+rcl_daemon_get_arrival( RclDaemon *daemon, GDBusMethodInvocation *invocation )
+{
+  GDBusMessage        *message = g_dbus_method_invocation_get_message( invocation );
+  struct pending_call *call;
+  gchar               *key;
+  guint64              arrival = 0;
+
+  key = arrival_key( g_dbus_message_get_sender( message ), g_dbus_message_get_serial( message ) );
+
+  g_mutex_lock( &daemon->priv->arrival_lock );
+  call = (struct pending_call *)g_hash_table_lookup( daemon->priv->arrivals, key );
+  if( call )
+    arrival = call->arrival;
+  g_mutex_unlock( &daemon->priv->arrival_lock );
+
+  g_free( key );
+
+  return arrival ? arrival : now_nsec( CLOCK_MONOTONIC_RAW );
+}
+
+
+/*******************************
+  SetTime:
+  -------
+ */
+struct set_time_data
+{
+  RclTimedateDaemon     *object;
+  GDBusMethodInvocation *invocation;
+  guint64                start;       /* CLOCK_MONOTONIC_RAW nsec of the call arrival */
+  gint64                 usec_utc;
+  gboolean               relative;
+  gboolean               interactive;
+  gboolean               slew;        /* called as SlewTime */
+  RclDaemon             *daemon;
+  guint64                time_usec;
+};
+
+static void
+set_time_data_free( struct set_time_data * data )
+{
+  if( data == NULL )
+    return;
+
+  g_free( data );
+}
+
+static void
+set_time_hwclock_callback( GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data )
+{
+  struct set_time_data *data  = (struct set_time_data *)user_data;
+  GError               *error = NULL;
+
+  rcl_timedate_daemon_set_time_usec( data->object, data->time_usec );
+
+  if( !rcl_daemon_sync_hwclock_finish( data->daemon, result, &error ) )
+  {
+    if( !g_error_matches( error, RCL_DAEMON_ERROR, RCL_DAEMON_ERROR_NOT_SUPPORTED ) )
+    {
+      g_debug( "set-time: error: Failed to update hardware clock: %s", error->message );
+      g_dbus_method_invocation_return_error( data->invocation,
+                                             RCL_DAEMON_ERROR,
+                                             RCL_DAEMON_ERROR_GENERAL,
+                                             "set-time: System clock is set but failed to update hardware clock: %s",
+                                             error->message );
+      g_error_free( error );
+      set_time_data_free( data );
+      return;
+    }
+
+    g_debug( "set-time: %s (ignoring)", error->message );
+    g_error_free( error );
+  }
+
+  g_debug( "set-time: SetTime method returns successful status" );
+
+  /* Update RTCTimeUSec (by the way); the RTC holds the system time now */
+  (void)get_pending_rtctime_usec( data->object );
+
+  g_debug( "set-time: SetTime to %" PRId64 " returns successful status(relative=%s; interactive=%s)",
+                                 data->usec_utc,
+                                 (data->relative)    ? "true" : "false",
+                                 (data->interactive) ? "true" : "false" );
+
+  if( data->slew )
+    rcl_timedate_daemon_complete_slew_time( data->object, data->invocation, TRUE, 0 );
+  else
+    rcl_timedate_daemon_complete_set_time( data->object, data->invocation );
+
+  set_time_data_free( data );
+}
+
+static void
+set_time_authorized_callback( GObject      *source_object,
+                              GAsyncResult *result,
+                              gpointer      user_data )
+{
+  GError               *error = NULL;
+  struct set_time_data *data  = (struct set_time_data *)user_data;
+  gint64                target;
+  guint64               since;
+  gint64                compensation = 0;
+  gint64                jitter = 0;
+
+  if( !check_polkit_finish( result, &error ) )
+  {
+    g_debug( "set-local-rtc: error: '%s'", "User is not privileged" );
+    g_dbus_method_invocation_return_error( data->invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_NOT_PRIVILEGED,
+                                           "%s", error->message );
+    g_error_free( error );
+    set_time_data_free( data );
+    return;
+  }
+
+  if( data->relative )
+  {
+    gint64   remaining = 0;
+
+    /* The pending slew is a part of the relative adjustment */
+    (void)clock_get_slew( &remaining );
+    data->usec_utc += remaining;
+
+    if( data->slew && ABS( data->usec_utc ) <= (gint64)(SLEW_THRESHOLD_MSEC * USEC_PER_MSEC) )
+    {
+      guint64 convergence = 0;
+
+      if( !clock_slew( data->usec_utc, &convergence ) )
+      {
+        g_debug( "set-time: error: Failed to slew local time" );
+        g_dbus_method_invocation_return_error( data->invocation,
+                                               RCL_DAEMON_ERROR,
                                                RCL_DAEMON_ERROR_GENERAL,
-                                               "Cannot enable NTP Daemon" );
-        data->daemon->priv->use_ntp = FALSE;
-        /* FAILURE */
-        set_ntp_data_free( data );
+                                               "set-time: Failed to slew local time" );
+        set_time_data_free( data );
         return;
       }
-      else
-      {
-        if( !start_ntp_daemon() )
-        {
-          g_debug( "set-ntp: error: Cannot start NTPD daemon" );
-          g_dbus_method_invocation_return_error( data->invocation,
-                                                 RCL_DAEMON_ERROR,
-                                                 RCL_DAEMON_ERROR_GENERAL,
-                                                 "Cannot start NTP Daemon" );
-          data->daemon->priv->use_ntp = FALSE;
-          /* FAILURE */
-          set_ntp_data_free( data );
-          return;
-        }
-        else
-        {
-          g_debug( "set-ntp: The NTPD daemon started successful" );
-          data->daemon->priv->use_ntp = TRUE;
-          /* SUCCESS */
-        }
-      }
+
+      /* The slew is below RTC resolution, so RTC is left alone */
+      g_debug( "set-time: Slew by %" G_GINT64_FORMAT " usec converges in %" PRIu64 " usec",
+               data->usec_utc, convergence );
+
+      rcl_daemon_kick_sampler( data->daemon );
+
+      rcl_timedate_daemon_complete_slew_time( data->object, data->invocation, FALSE, convergence );
+      set_time_data_free( data );
+      return;
+    }
+
+    if( data->usec_utc > G_MAXINT64 / (gint64)NSEC_PER_USEC ||
+        data->usec_utc < G_MININT64 / (gint64)NSEC_PER_USEC )
+    {
+      g_debug( "set-time: error: Time value overflow" );
+      g_dbus_method_invocation_return_error( data->invocation,
+                                             RCL_DAEMON_ERROR,
+                                             RCL_DAEMON_ERROR_INVALID_ARGS,
+                                             "set-time: Time value overflow" );
+      set_time_data_free( data );
+      return;
+    }
+
+    /*
+      The offset is relative to the clock as it is at the step, so nothing to
+      compensate (the clock may have been changed while the call waited for
+      authorization); clock_step_offset_nsec() reads it in the critical section:
+     */
+    target = data->usec_utc * (gint64)NSEC_PER_USEC;
+    since  = 0;
+  }
+  else
+  {
+    if( data->usec_utc > G_MAXINT64 / (gint64)NSEC_PER_USEC )
+    {
+      g_debug( "set-time: error: Time value overflow" );
+      g_dbus_method_invocation_return_error( data->invocation,
+                                             RCL_DAEMON_ERROR,
+                                             RCL_DAEMON_ERROR_INVALID_ARGS,
+                                             "set-time: Time value overflow" );
+      set_time_data_free( data );
+      return;
     }
+
+    /* The absolute time was valid at the call arrival */
+    target = data->usec_utc * (gint64)NSEC_PER_USEC;
+    since  = data->start;
+  }
+
+  /* The step overrides any pending slew */
+  (void)clock_slew( 0, NULL );
+
+  /* Set system clock */
+  if( data->relative ? !clock_step_offset_nsec( target, &target, &jitter )
+                     : !clock_step_nsec( target, since, &compensation, &jitter ) )
+  {
+    g_debug( "set-time: error: Failed to set local time" );
+    g_dbus_method_invocation_return_error( data->invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_GENERAL,
+                                           "set-time: Failed to set local time" );
+    set_time_data_free( data );
+    return;
+  }
+
+  data->time_usec = (guint64)((target + compensation) / (gint64)NSEC_PER_USEC);
+
+  if( !data->relative )
+    rcl_timedate_daemon_set_set_time_compensation_nsec( data->object, (guint64)compensation );
+
+  rcl_timedate_daemon_set_set_time_jitter_nsec( data->object, jitter );
+
+  rcl_daemon_kick_sampler( data->daemon );
+
+  g_debug( "set-time: Clock stepped, latency compensation %" G_GINT64_FORMAT " nsec, jitter %" G_GINT64_FORMAT " nsec",
+           compensation, jitter );
+
+  /* Sync down to RTC (the time set by user is not a drift calibration point) */
+  rcl_daemon_sync_hwclock_async( data->daemon, FALSE, set_time_hwclock_callback, data );
+}
+
+gboolean handle_set_time( RclTimedateDaemon     *object,
+                          GDBusMethodInvocation *invocation,
+                          gint64                 usec_utc,
+                          gboolean               relative,
+                          gboolean               interactive,
+                          RclDaemon             *daemon )
+{
+  struct set_time_data *data;
+  guint64               start;
+
+  /* Before anything else: NTP daemon status check may take a while */
+  start = rcl_daemon_get_arrival( daemon, invocation );
+
+  if( ntp_service_running() )
+  {
+    /* NTP Daemon is running */
+    g_debug( "set-time: error: Automatic time synchronization is enabled" );
+    g_dbus_method_invocation_return_error( invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_GENERAL,
+                                           "set-time: Automatic time synchronization is enabled" );
+    return TRUE;
+  }
+
+  if( !relative && usec_utc <= 0 )
+  {
+    g_debug( "set-time: error: Invalid absolute time" );
+    g_dbus_method_invocation_return_error( invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_INVALID_ARGS,
+                                           "set-time: Invalid absolute time" );
+    return TRUE;
+  }
+
+  if( relative && usec_utc == 0 )
+  {
+    /* Nothing to do */
+    rcl_timedate_daemon_complete_set_time( object, invocation );
+    return TRUE;
+  }
+
+  data = g_new0( struct set_time_data, 1 );
+  data->object      = object;
+  data->invocation  = invocation;
+  data->start       = start;
+  data->usec_utc    = usec_utc;
+  data->relative    = relative;
+  data->interactive = interactive;
+  data->daemon      = daemon;
+
+  _check_polkit_for_action_async( invocation,
+                                  "set-time",
+                                  interactive,
+                                  set_time_authorized_callback,
+                                  data );
+  return TRUE;
+}
+
+
+/*******************************
+  SlewTime:
+  --------
+ */
+gboolean handle_slew_time( RclTimedateDaemon     *object,
+                           GDBusMethodInvocation *invocation,
+                           gint64                 usec_offset,
+                           gboolean               interactive,
+                           RclDaemon             *daemon )
+{
+  struct set_time_data *data;
+  guint64               start;
+
+  start = rcl_daemon_get_arrival( daemon, invocation );
+
+  if( ntp_service_running() )
+  {
+    /* NTP Daemon is running */
+    g_debug( "slew-time: error: Automatic time synchronization is enabled" );
+    g_dbus_method_invocation_return_error( invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_GENERAL,
+                                           "slew-time: Automatic time synchronization is enabled" );
+    return TRUE;
+  }
+
+  data = g_new0( struct set_time_data, 1 );
+  data->object      = object;
+  data->invocation  = invocation;
+  data->start       = start;
+  data->usec_utc    = usec_offset;
+  data->relative    = TRUE;
+  data->interactive = interactive;
+  data->slew        = TRUE;
+  data->daemon      = daemon;
+
+  _check_polkit_for_action_async( invocation,
+                                  "set-time",
+                                  interactive,
+                                  set_time_authorized_callback,
+                                  data );
+
+  return TRUE;
+}
+
+
+/*******************************
+  ListTimezones:
+  -------------
+ */
+gboolean handle_list_timezones( RclTimedateDaemon     *object,
+                                GDBusMethodInvocation *invocation,
+                                RclDaemon             *daemon )
+{
+  gboolean ret;
+  const gchar *const *zones = { NULL };
+
+  ret = get_timezones( &zones );
+  if( !ret )
+  {
+    g_debug( "list-timezones: error: Failed to read list of time zones" );
+    g_dbus_method_invocation_return_error( invocation,
+                                           RCL_DAEMON_ERROR,
+                                           RCL_DAEMON_ERROR_GENERAL,
+                                           "list-timezones: Failed to read list of time zones" );
+    return TRUE;
+  }
+
+  g_debug( "list-timezones: ListTimesones returns successful status" );
+
+  rcl_timedate_daemon_complete_list_timezones( object, invocation, zones );
+
+  timezones_free( &zones );
+
+  return TRUE;
+}
+
+
+/***************************************************************
+  Daemon functions:
+  ================
+ */
+
+void
+rcl_daemon_set_debug( RclDaemon *daemon,
+                      gboolean  debug )
+{
+  daemon->priv->debug = debug;
+}
+
+gboolean
+rcl_daemon_get_debug( RclDaemon *daemon )
+{
+  return daemon->priv->debug;
+}
+
+
+/***************************************************************
+  Startup:
+  =======
+
+  rcl_daemon_init() only starts the phases which read the system state
+  (timezone, LocalRTC configuration, NTP backend probe and status, leap
+  seconds list) in worker threads and the polkit authority lookup, so
+  the bus name is requested at once. The properties are published as
+  the phases complete. A call which comes before all of them are done
+  is held until rcl_daemon_ready() (see rcl_daemon_method_call()).
+
+  If the snapshot of the previous run is valid (see rcl-snapshot-utils.c)
+  the timezone, LocalRTC and NTP state are published from it at once and
+  only the NTP backend probe and status are checked again, after the
+  startup, in rcl_daemon_verify_async().
+ */
+static const gchar *const load_phase_names[RCL_DAEMON_LOAD_PHASES] =
+{
+  "timezone", "local-rtc", "ntp", "leap-seconds"
+};
+
+static void
+rcl_daemon_profile( RclDaemon *daemon, const gchar *phase, gint64 start, gint64 end )
+{
+  gint64 since = daemon->priv->startup_since;
+
+  if( !since )
+    return;
+
+  g_printerr( "startup: %-14s %9.3f msec (done at %9.3f msec)\n", phase,
+              (gdouble)( end - start ) / 1000.0, (gdouble)( end - since ) / 1000.0 );
+}
+
+static void
+load_thread( GTask        *task,
+             gpointer      source_object,
+             gpointer      task_data,
+             GCancellable *cancellable )
+{
+  RclDaemon              *daemon = RCL_DAEMON( source_object );
+  struct rcl_daemon_load *load   = &daemon->priv->load;
+  rcl_daemon_load_phase   phase  = (rcl_daemon_load_phase)GPOINTER_TO_INT( task_data );
+  gint64                  start  = g_get_monotonic_time();
+
+  switch( phase )
+  {
+    case RCL_DAEMON_LOAD_TIMEZONE:
+      if( !get_system_timezone( &load->timezone ) )
+        load->timezone = NULL;
+      break;
+
+    case RCL_DAEMON_LOAD_LOCAL_RTC:
+      load->local_rtc = TRUE; /* default */
+      (void)read_data_local_rtc( &load->local_rtc );
+      break;
+
+    case RCL_DAEMON_LOAD_NTP:
+      /* the built-in client runs in the main loop, it is started and asked there */
+      load->can_ntp     = ntp_daemon_installed();
+      load->ntp_enabled = ntp_daemon_enabled();
+      load->ntp_running = !ntp_backend()->builtin && load->ntp_enabled && ntp_daemon_status();
+      break;
+
+    case RCL_DAEMON_LOAD_LEAP_SECONDS:
+      (void)leap_table_load( LEAP_SECONDS_LIST );
+      break;
+
+    default:
+      break;
   }
-  else /* stop and disable NTP daemon: */
+
+  g_mutex_lock( &daemon->priv->load_lock );
+  load->start[phase] = start;
+  load->end[phase]   = g_get_monotonic_time();
+  --daemon->priv->load_pending;
+  g_mutex_unlock( &daemon->priv->load_lock );
+
+  g_task_return_boolean( task, TRUE );
+}
+
+/*
+  Publish the result of a phase (in the main loop):
+ */
+static void
+rcl_daemon_apply_phase( RclDaemon *daemon, rcl_daemon_load_phase phase )
+{
+  RclTimedateDaemon      *object = RCL_TIMEDATE_DAEMON( daemon );
+  struct rcl_daemon_load *load   = &daemon->priv->load;
+
+  if( load->applied[phase] )
+    return;
+  load->applied[phase] = TRUE;
+
+  switch( phase )
   {
-    if( ntp_daemon_enabled() )
-    {
-      if( ntp_daemon_status() )
-      {
-        /* daemon is running; stop it */
-        if( !stop_ntp_daemon() )
-        {
-          g_debug( "set-ntp: error: Cannot stop NTPD daemon" );
-          g_dbus_method_invocation_return_error( data->invocation,
-                                                 RCL_DAEMON_ERROR,
-                                                 RCL_DAEMON_ERROR_GENERAL,
-                                                 "Cannot stop NTP Daemon" );
-          data->daemon->priv->use_ntp = TRUE;
-          /* FAILURE */
-          set_ntp_data_free( data );
-          return;
-        }
-        else
-        {
-          g_debug( "set-ntp: The NTPD daemon stopped successful" );
-          if( !disable_ntp_daemon() )
-          {
-            g_debug( "set-ntp: Cannot disable NTPD daemon" );
-            g_dbus_method_invocation_return_error( data->invocation,
-                                                   RCL_DAEMON_ERROR,
-                                                   RCL_DAEMON_ERROR_GENERAL,
-                                                   "Cannot disable NTP Daemon" );
-            data->daemon->priv->use_ntp = FALSE;
-            /* daemon stopped but not disabled (will start after reboot) */
-            /* SUCCESS */
-          }
-          else
-          {
-            g_debug( "set-ntp: The NTPD daemon disabled successful" );
-            data->daemon->priv->use_ntp = FALSE;
-            /* SUCCESS */
-          }
-        }
-      }
-      else
-      {
-        /* daemon is stopped; disable it */
-        if( !disable_ntp_daemon() )
-        {
-          g_debug( "set-ntp: error: Cannot disable NTPD daemon" );
-          g_dbus_method_invocation_return_error( data->invocation,
-                                                 RCL_DAEMON_ERROR,
-                                                 RCL_DAEMON_ERROR_GENERAL,
-                                                 "Cannot disable NTP Daemon" );
-          data->daemon->priv->use_ntp = FALSE;
-          /* daemon stopped but not disabled (will start after reboot) */
-          /* SUCCESS */
-        }
-        else
-        {
-          g_debug( "set-ntp: The NTPD daemon disabled successful" );
-          data->daemon->priv->use_ntp = FALSE;
-          /* SUCCESS */
-        }
-      }
-    }
-    else
-    {
-      g_debug( "set-ntp: The NTPD daemon already disabled" );
-      data->daemon->priv->use_ntp = FALSE;
-      /* SUCCESS */
-    }
+    case RCL_DAEMON_LOAD_TIMEZONE:
+      g_free( daemon->priv->timezone );
+      daemon->priv->timezone = load->timezone ? load->timezone : g_strdup( "Europe/Moscow" );
+      load->timezone = NULL;
+      rcl_timedate_daemon_set_timezone( object, (const gchar *)daemon->priv->timezone );
+      break;
+
+    case RCL_DAEMON_LOAD_LOCAL_RTC:
+      daemon->priv->local_rtc = load->local_rtc;
+      rcl_timedate_daemon_set_local_rtc( object, daemon->priv->local_rtc );
+      break;
+
+    case RCL_DAEMON_LOAD_NTP:
+      rcl_timedate_daemon_set_ntpbackend( object, ntp_backend()->name );
+      daemon->priv->snapshot.ntp_enabled = load->ntp_enabled;
+
+      daemon->priv->can_ntp = load->can_ntp;
+      rcl_timedate_daemon_set_can_ntp( object, daemon->priv->can_ntp );
+
+      if( ntp_backend()->builtin && load->ntp_enabled )
+        (void)start_ntp_daemon();
+      daemon->priv->use_ntp = ntp_backend()->builtin ? ntp_service_running() : load->ntp_running;
+      rcl_timedate_daemon_set_ntp( object, daemon->priv->use_ntp );
+      break;
+
+    case RCL_DAEMON_LOAD_LEAP_SECONDS:
+      rcl_daemon_publish_leap_seconds( daemon );
+      rcl_daemon_watch_leap_seconds( daemon );
+      break;
+
+    default:
+      break;
   }
 
-  g_debug( "set-ntp: NTP configured to %s", (data->daemon->priv->use_ntp) ? "enabled" : "disabled" );
+  rcl_daemon_profile( daemon, load_phase_names[phase], load->start[phase], load->end[phase] );
+}
 
-  rcl_timedate_daemon_set_ntp( data->object, data->daemon->priv->use_ntp );
-  /* rcl_timedate_daemon_set_ntpsynchronized( object, daemon->priv->use_ntp ); */
+static void
+rcl_daemon_ready( RclDaemon *daemon )
+{
+  gint phase;
 
-out:
-  g_debug( "set-ntp: SetNTP to '%s' returns successful status (interactive=%s)",
-                                (data->daemon->priv->use_ntp) ? "true" : "false",
-                                (data->interactive)           ? "true" : "false" );
+  if( daemon->priv->ready )
+    return;
 
-  rcl_timedate_daemon_complete_set_ntp( data->object, data->invocation );
+  for( phase = 0; phase < RCL_DAEMON_LOAD_PHASES; ++phase )
+    rcl_daemon_apply_phase( daemon, (rcl_daemon_load_phase)phase );
+  daemon->priv->ready = TRUE;
 
-  set_ntp_data_free( data );
+  /* NTPSynchronized, Timex*, TAIOffsetSec (the leap seconds list is loaded): */
+  get_timex( RCL_TIMEDATE_DAEMON( daemon ), NULL );
+
+  if( daemon->priv->started )
+    rcl_daemon_start_sampler( daemon );
+
+  rcl_daemon_profile( daemon, "ready", daemon->priv->init_time, g_get_monotonic_time() );
+  g_debug( "Daemon is ready" );
+
+  rcl_daemon_save_snapshot( daemon, FALSE );
+
+  rcl_daemon_dispatch_held( daemon );
+
+  while( daemon->priv->ready_waiters )
+  {
+    GTask *task = daemon->priv->ready_waiters->data;
+
+    daemon->priv->ready_waiters = g_slist_delete_link( daemon->priv->ready_waiters, daemon->priv->ready_waiters );
+    g_task_return_boolean( task, TRUE );
+    g_object_unref( task );
+  }
 }
 
-gboolean handle_set_ntp( RclTimedateDaemon     *object,
-                         GDBusMethodInvocation *invocation,
-                         gboolean               use_ntp,
-                         gboolean               interactive,
-                         RclDaemon             *daemon )
+static void
+load_done( GObject      *source_object,
+           GAsyncResult *result,
+           gpointer      user_data )
 {
-  struct set_ntp_data *data;
+  RclDaemon *daemon = RCL_DAEMON( source_object );
+  gboolean   done;
 
-  /* check CanNTP (in case NTPD was uninstalled while timedated running) */
-  if( !ntp_daemon_installed() )
+  if( daemon->priv->ready )
+    return;
+
+  rcl_daemon_apply_phase( daemon, (rcl_daemon_load_phase)GPOINTER_TO_INT( g_task_get_task_data( G_TASK( result ) ) ) );
+
+  g_mutex_lock( &daemon->priv->load_lock );
+  done = ( daemon->priv->load_pending == 0 );
+  g_mutex_unlock( &daemon->priv->load_lock );
+
+  if( done )
+    rcl_daemon_ready( daemon );
+}
+
+static void
+authority_ready( GObject      *source_object,
+                 GAsyncResult *result,
+                 gpointer      user_data )
+{
+  RclDaemon *daemon = RCL_DAEMON( user_data );
+  GError    *error  = NULL;
+
+  /* kept, so the lookup of every call finds the authority at once */
+  daemon->priv->auth = polkit_authority_get_finish( result, &error );
+  if( daemon->priv->auth == NULL )
   {
-    daemon->priv->can_ntp = FALSE;
-    rcl_timedate_daemon_set_can_ntp( object, daemon->priv->can_ntp );
+    g_warning( "timedated: warning: Cannot get polkit authority: %s", error->message );
+    g_error_free( error );
+  }
+  else
+  {
+    rcl_daemon_profile( daemon, "polkit", daemon->priv->auth_start, g_get_monotonic_time() );
   }
 
-  if( !daemon->priv->can_ntp )
+  g_object_unref( daemon );
+}
+
+/*
+  Save the published state. The stamps of the files are taken again
+  (stamp = TRUE) when the daemon has written them itself; at startup
+  they are taken before the state is read:
+ */
+static void
+rcl_daemon_fill_snapshot( RclDaemon *daemon, gboolean stamp )
+{
+  struct snapshot *snap = &daemon->priv->snapshot;
+
+  if( stamp )
+    snapshot_stamp( snap );
+
+  g_strlcpy( snap->timezone, daemon->priv->timezone ? daemon->priv->timezone : "", sizeof(snap->timezone) );
+  g_strlcpy( snap->ntp_backend, ntp_backend()->name, sizeof(snap->ntp_backend) );
+  snap->local_rtc   = daemon->priv->local_rtc;
+  snap->can_ntp     = daemon->priv->can_ntp;
+  snap->ntp_running = daemon->priv->use_ntp;
+}
+
+static void
+rcl_daemon_save_snapshot( RclDaemon *daemon, gboolean stamp )
+{
+  if( !daemon->priv->ready )
+    return;
+
+  rcl_daemon_fill_snapshot( daemon, stamp );
+  (void)snapshot_save( &daemon->priv->snapshot );
+}
+
+static void
+verify_thread( GTask        *task,
+               gpointer      source_object,
+               gpointer      task_data,
+               GCancellable *cancellable )
+{
+  struct rcl_daemon_verify *verify = (struct rcl_daemon_verify *)task_data;
+
+  const struct ntp_backend *backend;
+
+  verify->start = g_get_monotonic_time();
+
+  backend = ntp_backend_probe();
+
+  verify->backend     = backend;
+  verify->can_ntp     = backend->installed();
+  verify->ntp_enabled = backend->enabled();
+  verify->ntp_running = !backend->builtin && verify->ntp_enabled && backend->status();
+
+  verify->end = g_get_monotonic_time();
+
+  g_task_return_boolean( task, TRUE );
+}
+
+static void
+verify_done( GObject      *source_object,
+             GAsyncResult *result,
+             gpointer      user_data )
+{
+  RclDaemon                *daemon  = RCL_DAEMON( source_object );
+  RclTimedateDaemon        *object  = RCL_TIMEDATE_DAEMON( daemon );
+  struct rcl_daemon_verify *verify  = (struct rcl_daemon_verify *)g_task_get_task_data( G_TASK( result ) );
+  const struct ntp_backend *backend = verify->backend;
+  const struct ntp_backend *previous;
+  gboolean                  use_ntp;
+
+  rcl_daemon_profile( daemon, "verify", verify->start, verify->end );
+
+  if( ntp_backend_set( backend, &previous ) )
   {
-    daemon->priv->use_ntp = FALSE;
-    rcl_timedate_daemon_set_ntp( object, daemon->priv->use_ntp );
-    return TRUE;
+    g_debug( "snapshot: NTP backend is changed to %s", backend->name );
+
+    if( previous->builtin )
+      (void)previous->stop();
+    rcl_timedate_daemon_set_ntpbackend( object, backend->name );
+
+    if( backend->builtin && verify->ntp_enabled && !daemon->priv->load.ntp_set )
+      (void)start_ntp_daemon();
   }
 
-  data = g_new0( struct set_ntp_data, 1 );
-  data->object      = object;
-  data->invocation  = invocation;
-  data->use_ntp     = use_ntp;
-  data->interactive = interactive;
-  data->daemon      = daemon;
+  /* SetNTP has changed the state meanwhile */
+  if( daemon->priv->load.ntp_set )
+    return;
+
+  /* the built-in client follows the configuration (it is changed by the predecessor at handover) */
+  if( backend->builtin && verify->ntp_enabled != ntp_service_running() )
+    (void)( verify->ntp_enabled ? backend->start() : backend->stop() );
+
+  use_ntp = backend->builtin ? ntp_service_running() : verify->ntp_running;
+
+  if( daemon->priv->can_ntp != verify->can_ntp || daemon->priv->use_ntp != use_ntp )
+    g_debug( "snapshot: NTP state is changed (CanNTP=%s, NTP=%s)",
+             (verify->can_ntp) ? "true" : "false", (use_ntp) ? "true" : "false" );
+
+  daemon->priv->can_ntp = verify->can_ntp;
+  rcl_timedate_daemon_set_can_ntp( object, daemon->priv->can_ntp );
+  daemon->priv->use_ntp = use_ntp;
+  rcl_timedate_daemon_set_ntp( object, daemon->priv->use_ntp );
+  daemon->priv->snapshot.ntp_enabled = verify->ntp_enabled;
+
+  rcl_daemon_save_snapshot( daemon, FALSE );
+}
+
+static void
+rcl_daemon_verify_async( RclDaemon *daemon )
+{
+  GTask *task = g_task_new( daemon, NULL, verify_done, NULL );
+
+  g_task_set_task_data( task, g_new0( struct rcl_daemon_verify, 1 ), g_free );
+  g_task_run_in_thread( task, verify_thread );
+  g_object_unref( task );
+}
+
+/*
+  Take the timezone, LocalRTC and NTP state from the snapshot of the
+  previous run, FALSE if it is not valid:
+ */
+static gboolean
+rcl_daemon_load_snapshot( RclDaemon *daemon )
+{
+  struct snapshot        *snap  = &daemon->priv->snapshot;
+  struct rcl_daemon_load *load  = &daemon->priv->load;
+  gint64                  start = g_get_monotonic_time();
+  gint                    phase;
+
+  if( !snapshot_load( snap ) || !ntp_backend_select( snap->ntp_backend ) )
+    return FALSE;
+
+  load->timezone    = g_strdup( snap->timezone );
+  load->local_rtc   = snap->local_rtc;
+  load->can_ntp     = snap->can_ntp;
+  load->ntp_enabled = snap->ntp_enabled;
+  load->ntp_running = snap->ntp_running;
+
+  for( phase = RCL_DAEMON_LOAD_TIMEZONE; phase <= RCL_DAEMON_LOAD_NTP; ++phase )
+  {
+    load->start[phase] = start;
+    load->end[phase]   = g_get_monotonic_time();
+  }
+  load->from_snapshot = TRUE;
+
+  g_debug( "snapshot: The state is taken from '%s'", SNAPSHOT_FILE );
 
-  _check_polkit_for_action_async( invocation,
-                                  "set-ntp",
-                                  interactive,
-                                  set_ntp_authorized_callback,
-                                  data );
   return TRUE;
 }
 
+static void
+rcl_daemon_load_async( RclDaemon *daemon )
+{
+  struct rcl_daemon_load *load = &daemon->priv->load;
+  gint                    phase;
+
+  /* the stamps are taken before the state is read */
+  if( !rcl_daemon_load_snapshot( daemon ) )
+    snapshot_stamp( &daemon->priv->snapshot );
+
+  daemon->priv->load_pending = load->from_snapshot ? 1 : RCL_DAEMON_LOAD_PHASES;
+
+  for( phase = 0; phase < RCL_DAEMON_LOAD_PHASES; ++phase )
+  {
+    GTask *task;
+
+    /* the leap seconds list is not in the snapshot */
+    if( load->from_snapshot && phase != RCL_DAEMON_LOAD_LEAP_SECONDS )
+      continue;
+
+    task = g_task_new( daemon, NULL, load_done, NULL );
+    g_task_set_task_data( task, GINT_TO_POINTER( phase ), NULL );
+    g_task_run_in_thread( task, load_thread );
+    g_object_unref( task );
+  }
+
+  if( load->from_snapshot )
+  {
+    for( phase = RCL_DAEMON_LOAD_TIMEZONE; phase <= RCL_DAEMON_LOAD_NTP; ++phase )
+      rcl_daemon_apply_phase( daemon, (rcl_daemon_load_phase)phase );
+    rcl_daemon_verify_async( daemon );
+  }
+
+  daemon->priv->auth_start = g_get_monotonic_time();
+  polkit_authority_get_async( NULL, authority_ready, g_object_ref( daemon ) );
+}
+
+/***************************************************************
+  rcl_daemon_set_startup_profile:
+
+  Print the duration of the startup phases to stderr, since is
+  the monotonic time of the process start.
+ */
+void
+rcl_daemon_set_startup_profile( RclDaemon *daemon,
+                                gint64     since )
+{
+  daemon->priv->startup_since = since;
+}
+
+void
+rcl_daemon_startup_phase( RclDaemon   *daemon,
+                          const gchar *phase,
+                          gint64       start )
+{
+  rcl_daemon_profile( daemon, phase, start, g_get_monotonic_time() );
+}
+
+
+/***************************************************************
+  rcl_daemon_is_busy:
+
+  A call waits for its reply or an RTC write is pending. The daemon
+  which has lost its name does not exit before.
+ */
+gboolean
+rcl_daemon_is_busy( RclDaemon *daemon )
+{
+  if( g_atomic_int_get( &daemon->priv->calls ) > 0 )
+    return TRUE;
+
+  if( daemon->priv->hwclock_waiters || daemon->priv->hwclock_timer || daemon->priv->hwclock_busy )
+    return TRUE;
+
+  return FALSE;
+}
+
+/***************************************************************
+  rcl_daemon_is_idle:
 
-/*******************************
-  SetTime:
-  -------
+  No call waits for its reply, no RTC write is pending, the built-in
+  SNTP client does not discipline the clock and no call arrived for
+  timeout_sec seconds.
  */
-struct set_time_data
+gboolean
+rcl_daemon_is_idle( RclDaemon *daemon,
+                    guint      timeout_sec )
 {
-  RclTimedateDaemon     *object;
-  GDBusMethodInvocation *invocation;
-  guint64                start;
-  guint64                usec_utc;
-  gboolean               relative;
-  gboolean               interactive;
-  RclDaemon             *daemon;
-};
+  gint64 last_call = __atomic_load_n( &daemon->priv->last_call, __ATOMIC_RELAXED );
 
+  if( rcl_daemon_is_busy( daemon ) )
+    return FALSE;
+
+  if( !daemon->priv->ready )
+    return FALSE;
+
+  if( daemon->priv->use_ntp && ntp_backend()->builtin )
+    return FALSE;
+
+  return ( g_get_monotonic_time() - last_call >= (gint64)timeout_sec * G_USEC_PER_SEC );
+}
+
+
+/***************************************************************
+  Runtime state:
+  =============
+
+  The daemon activated again after an idle exit continues with the
+  state of the previous run, so SyncStateChanged and RTCDrift are not
+  emitted again for the same condition and the sampler keeps its
+  interval. The state is kept in tmpfs: a reboot starts over.
+ */
 static void
-set_time_data_free( struct set_time_data * data )
+rcl_daemon_load_state( RclDaemon *daemon )
 {
-  if( data == NULL )
+  GKeyFile *state;
+  gchar    *contents = NULL;
+  gsize     length   = 0;
+
+  if( !sys_file_get_contents( RCL_DAEMON_STATE_FILE, &contents, &length ) )
     return;
 
-  g_free( data );
+  state = g_key_file_new();
+  if( g_key_file_load_from_data( state, contents, length, G_KEY_FILE_NONE, NULL ) )
+  {
+    daemon->priv->sync_state      = g_key_file_get_boolean( state, "daemon", "SyncState", NULL );
+    daemon->priv->rtc_drift       = g_key_file_get_boolean( state, "daemon", "RTCDrift", NULL );
+    daemon->priv->sample_interval = (guint)MAX( g_key_file_get_integer( state, "daemon", "SampleInterval", NULL ), 0 );
+    daemon->priv->sample_freq     = (glong)g_key_file_get_int64( state, "daemon", "SampleFreq", NULL );
+
+    g_debug( "state: Continue the previous run (sync=%d, rtc-drift=%d, sample interval %u msec)",
+             daemon->priv->sync_state, daemon->priv->rtc_drift, daemon->priv->sample_interval );
+  }
+
+  g_key_file_unref( state );
+  g_free( contents );
 }
 
 static void
-set_time_authorized_callback( GObject      *source_object,
-                              GAsyncResult *result,
-                              gpointer      user_data )
+rcl_daemon_save_state( RclDaemon *daemon )
 {
-  GError               *error = NULL;
-  struct set_time_data *data  = (struct set_time_data *)user_data;
-  struct timespec       ts;
-  struct tm             tm;
+  GKeyFile *state = g_key_file_new();
+  gchar    *contents;
+  gsize     length = 0;
 
-  if( !check_polkit_finish( result, &error ) )
-  {
-    g_debug( "set-local-rtc: error: '%s'", "User is not privileged" );
-    set_time_data_free( data );
-    return;
-  }
+  g_key_file_set_boolean( state, "daemon", "SyncState", daemon->priv->sync_state );
+  g_key_file_set_boolean( state, "daemon", "RTCDrift", daemon->priv->rtc_drift );
+  g_key_file_set_integer( state, "daemon", "SampleInterval", (gint)daemon->priv->sample_interval );
+  g_key_file_set_int64( state, "daemon", "SampleFreq", (gint64)daemon->priv->sample_freq );
 
-  if( data->relative )
-  {
-    guint64  n, x;
+  contents = g_key_file_to_data( state, &length, NULL );
 
-    n = now( CLOCK_REALTIME );
-    x = n + data->usec_utc;
+  if( sys_mkdir_with_parents( TIMEDATED_RUN_DIR, 0755 ) < 0 ||
+      !sys_file_set_contents( RCL_DAEMON_STATE_FILE, contents, (gssize)length ) )
+    g_debug( "state: warning: Cannot save '%s'", RCL_DAEMON_STATE_FILE );
 
-    if( (data->usec_utc > 0 && x < n) ||
-        (data->usec_utc < 0 && x > n)   )
-    {
-      g_debug( "set-time: error: Time value overflow" );
-      g_dbus_method_invocation_return_error( data->invocation,
-                                             RCL_DAEMON_ERROR,
-                                             RCL_DAEMON_ERROR_INVALID_ARGS,
-                                             "set-time: Time value overflow" );
-      set_time_data_free( data );
-      return;
-    }
-    timespec_store( &ts, x );
-  }
-  else
-  {
-    timespec_store( &ts, (guint64)data->usec_utc);
-  }
+  g_free( contents );
+  g_key_file_unref( state );
+}
 
-  timespec_store( &ts, timespec_load( &ts ) + (now( CLOCK_MONOTONIC ) - data->start) );
 
-  /* Set system clock */
-  if( clock_settime( CLOCK_REALTIME, &ts ) < 0 )
+/***************************************************************
+  rcl_daemon_prepare_exit:
+
+  Before the names are released at the idle exit the sampler is
+  stopped and the state is saved: the instance activated by the next
+  call reads it at startup. After that the daemon only answers calls.
+  The RTC is not written here, the calibration point of the drift
+  model is kept for the next instance.
+ */
+void
+rcl_daemon_prepare_exit( RclDaemon *daemon )
+{
+  rcl_daemon_stop_sampler( daemon );
+  rcl_daemon_save_state( daemon );
+  daemon->priv->exiting = TRUE;
+}
+
+
+/***************************************************************
+  rcl_daemon_ready_async:
+
+  Completes when the state is read and published (at once if the
+  daemon is ready).
+ */
+void
+rcl_daemon_ready_async( RclDaemon           *daemon,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data )
+{
+  GTask *task;
+
+  task = g_task_new( daemon, NULL, callback, user_data );
+  g_task_set_source_tag( task, rcl_daemon_ready_async );
+
+  if( daemon->priv->ready )
   {
-    g_debug( "set-time: error: Failed to set local time" );
-    g_dbus_method_invocation_return_error( data->invocation,
-                                           RCL_DAEMON_ERROR,
-                                           RCL_DAEMON_ERROR_GENERAL,
-                                           "set-time: Failed to set local time" );
-    set_time_data_free( data );
+    g_task_return_boolean( task, TRUE );
+    g_object_unref( task );
     return;
   }
 
-  /* Sync down to RTC */
-  localtime_or_gmtime_r( &ts.tv_sec, &tm, !data->daemon->priv->local_rtc );
+  daemon->priv->ready_waiters = g_slist_append( daemon->priv->ready_waiters, task );
+}
 
-  if( !clock_set_hwclock( &tm ) )
-  {
-    g_debug( "set-time: error: Failed to update hardware clock (ignoring)" );
-  }
+gboolean
+rcl_daemon_ready_finish( RclDaemon     *daemon,
+                         GAsyncResult  *result,
+                         GError       **error )
+{
+  g_return_val_if_fail( g_task_is_valid( result, daemon ), FALSE );
 
-  g_debug( "set-time: SetTime method returns successful status" );
+  return g_task_propagate_boolean( G_TASK( result ), error );
+}
 
-  /* Update RTCTimeUSec (by the way) */
-  (void)get_rtctime_usec( data->object );
+/***************************************************************
+  rcl_daemon_set_replaced:
 
-  rcl_timedate_daemon_set_time_usec( data->object, timespec_load( &ts ) );
+  The name is taken by the successor: it keeps the RTC and its drift
+  model, the RTC is not written again at exit.
+ */
+void
+rcl_daemon_set_replaced( RclDaemon *daemon )
+{
+  daemon->priv->replaced = TRUE;
+}
 
-  g_debug( "set-time: SetTime to %" PRIu64 " returns successful status(relative=%s; interactive=%s)",
-                                 data->usec_utc,
-                                 (data->relative)    ? "true" : "false",
-                                 (data->interactive) ? "true" : "false" );
 
-  rcl_timedate_daemon_complete_set_time( data->object, data->invocation );
+/***************************************************************
+  Handover:
+  ========
+
+  The daemon started with --replace takes the state of the running
+  one (see rcl-handover-utils.h): the current state at startup in
+  place of the snapshot file. When the running daemon has answered
+  its last call and exited, the final state is read again from the
+  system files which it has written; the values changed by the calls
+  to this daemon meanwhile are kept.
+ */
+int
+rcl_daemon_export_state( RclDaemon *daemon )
+{
+  /* called when the daemon is ready, see handover_ready() */
+  rcl_daemon_fill_snapshot( daemon, TRUE );
 
-  set_time_data_free( data );
+  return snapshot_memfd( &daemon->priv->snapshot );
 }
 
-gboolean handle_set_time( RclTimedateDaemon     *object,
-                          GDBusMethodInvocation *invocation,
-                          gint64                 usec_utc,
-                          gboolean               relative,
-                          gboolean               interactive,
-                          RclDaemon             *daemon )
+struct rcl_daemon_import
 {
-  struct set_time_data *data;
-  guint64               start;
-
-  if( ntp_daemon_installed() && ntp_daemon_enabled() && ntp_daemon_status() )
-  {
-    /* NTP Daemon is running */
-    g_debug( "set-time: error: Automatic time synchronization is enabled" );
-    g_dbus_method_invocation_return_error( invocation,
-                                           RCL_DAEMON_ERROR,
-                                           RCL_DAEMON_ERROR_GENERAL,
-                                           "set-time: Automatic time synchronization is enabled" );
-    return TRUE;
-  }
+  gchar    *timezone;
+  gboolean  local_rtc;
+};
 
-  start = now( CLOCK_MONOTONIC );
+static void
+import_data_free( gpointer data )
+{
+  struct rcl_daemon_import *import = (struct rcl_daemon_import *)data;
 
-  if( !relative && usec_utc <= 0 )
-  {
-    g_debug( "set-time: error: Invalid absolute time" );
-    g_dbus_method_invocation_return_error( invocation,
-                                           RCL_DAEMON_ERROR,
-                                           RCL_DAEMON_ERROR_INVALID_ARGS,
-                                           "set-time: Invalid absolute time" );
-    return TRUE;
-  }
+  g_free( import->timezone );
+  g_free( import );
+}
 
-  if( relative && usec_utc == 0 )
-  {
-    /* Nothing to do */
-    goto out;
-  }
+static void
+import_thread( GTask        *task,
+               gpointer      source_object,
+               gpointer      task_data,
+               GCancellable *cancellable )
+{
+  struct rcl_daemon_import *import = (struct rcl_daemon_import *)task_data;
 
-  data = g_new0( struct set_time_data, 1 );
-  data->object      = object;
-  data->invocation  = invocation;
-  data->start       = start;
-  data->usec_utc    = usec_utc;
-  data->relative    = relative;
-  data->interactive = interactive;
-  data->daemon      = daemon;
+  if( !get_system_timezone( &import->timezone ) )
+    import->timezone = NULL;
 
-  _check_polkit_for_action_async( invocation,
-                                  "set-time",
-                                  interactive,
-                                  set_time_authorized_callback,
-                                  data );
+  import->local_rtc = TRUE; /* default */
+  (void)read_data_local_rtc( &import->local_rtc );
 
-out:
-  return TRUE;
+  g_task_return_boolean( task, TRUE );
 }
 
-
-/*******************************
-  ListTimezones:
-  -------------
- */
-gboolean handle_list_timezones( RclTimedateDaemon     *object,
-                                GDBusMethodInvocation *invocation,
-                                RclDaemon             *daemon )
+static void
+import_done( GObject      *source_object,
+             GAsyncResult *result,
+             gpointer      user_data )
 {
-  gboolean ret;
-  const gchar *const *zones = { NULL };
+  RclDaemon                *daemon = RCL_DAEMON( source_object );
+  RclTimedateDaemon        *object = RCL_TIMEDATE_DAEMON( daemon );
+  struct rcl_daemon_import *import = (struct rcl_daemon_import *)g_task_get_task_data( G_TASK( result ) );
 
-  ret = get_timezones( &zones );
-  if( !ret )
+  /* SetTimezone of this daemon is newer */
+  if( !daemon->priv->load.timezone_set && import->timezone &&
+      g_strcmp0( daemon->priv->timezone, import->timezone ) != 0 )
   {
-    g_debug( "list-timezones: error: Failed to read list of time zones" );
-    g_dbus_method_invocation_return_error( invocation,
-                                           RCL_DAEMON_ERROR,
-                                           RCL_DAEMON_ERROR_GENERAL,
-                                           "list-timezones: Failed to read list of time zones" );
-    return TRUE;
+    g_debug( "handover: Timezone is changed to %s", import->timezone );
+    g_free( daemon->priv->timezone );
+    daemon->priv->timezone = g_strdup( import->timezone );
+    rcl_timedate_daemon_set_timezone( object, daemon->priv->timezone );
   }
 
-  g_debug( "list-timezones: ListTimesones returns successful status" );
-
-  rcl_timedate_daemon_complete_list_timezones( object, invocation, zones );
+  /* SetLocalRTC of this daemon is newer */
+  if( !daemon->priv->load.local_rtc_set && daemon->priv->local_rtc != import->local_rtc )
+  {
+    g_debug( "handover: RTC is changed to %s time", (import->local_rtc) ? "localtime" : "UTC" );
+    daemon->priv->local_rtc = import->local_rtc;
+    rcl_timedate_daemon_set_local_rtc( object, daemon->priv->local_rtc );
+  }
 
-  timezones_free( &zones );
+  rcl_daemon_save_snapshot( daemon, TRUE );
 
-  return TRUE;
+  /* NTP state in the background, SetNTP of this daemon is kept */
+  rcl_daemon_verify_async( daemon );
 }
 
+static void
+import_ready( GObject      *source_object,
+              GAsyncResult *result,
+              gpointer      user_data )
+{
+  RclDaemon *daemon = RCL_DAEMON( source_object );
 
-/***************************************************************
-  Daemon functions:
-  ================
- */
+  if( rcl_daemon_ready_finish( daemon, result, NULL ) )
+    rcl_daemon_import_state( daemon );
+}
 
 void
-rcl_daemon_set_debug( RclDaemon *daemon,
-                      gboolean  debug )
+rcl_daemon_import_state( RclDaemon *daemon )
 {
-  daemon->priv->debug = debug;
-}
+  GTask *task;
 
-gboolean
-rcl_daemon_get_debug( RclDaemon *daemon )
-{
-  return daemon->priv->debug;
+  if( !daemon->priv->ready )
+  {
+    rcl_daemon_ready_async( daemon, import_ready, NULL );
+    return;
+  }
+
+  /* saved by the predecessor at exit */
+  rcl_daemon_load_state( daemon );
+
+  /* the RTC drift model is read again from the adjtime file when it is changed */
+  task = g_task_new( daemon, NULL, import_done, NULL );
+  g_task_set_task_data( task, g_new0( struct rcl_daemon_import, 1 ), import_data_free );
+  g_task_run_in_thread( task, import_thread );
+  g_object_unref( task );
 }
 
 
@@ -1011,17 +3272,6 @@ rcl_daemon_register_timedate_daemon( RclDaemon       *daemon,
 {
   GError *error = NULL;
 
-  daemon->priv->auth = polkit_authority_get_sync( NULL, &error );
-  if( daemon->priv->auth == NULL )
-  {
-    if( error != NULL )
-    {
-      g_critical ("timedated: error: Cannot get system bus: %s", error->message );
-      g_error_free( error );
-    }
-    return FALSE;
-  }
-
   /* export our interface on the bus */
   g_dbus_interface_skeleton_export( G_DBUS_INTERFACE_SKELETON( daemon ),
                                     connection,
@@ -1035,6 +3285,8 @@ rcl_daemon_register_timedate_daemon( RclDaemon       *daemon,
     return FALSE;
   }
 
+  daemon->priv->arrival_filter = g_dbus_connection_add_filter( connection, arrival_filter, daemon, NULL );
+
   return TRUE;
 }
 
@@ -1055,6 +3307,11 @@ rcl_daemon_startup( RclDaemon       *daemon,
     goto out;
   }
 
+  /* the sampler needs the state read by the startup phases */
+  daemon->priv->started = TRUE;
+  if( daemon->priv->ready )
+    rcl_daemon_start_sampler( daemon );
+
   g_debug( "Daemon now started" );
 
 out:
@@ -1069,6 +3326,76 @@ out:
 void
 rcl_daemon_shutdown( RclDaemon *daemon )
 {
+  GDBusMethodInvocation *invocation;
+  gboolean               synced = FALSE;
+
+  rcl_daemon_stop_sampler( daemon );
+
+  /* the daemon exits before the startup is done */
+  while( (invocation = g_queue_pop_head( &daemon->priv->held )) != NULL )
+    g_dbus_method_invocation_return_error( invocation, RCL_DAEMON_ERROR, RCL_DAEMON_ERROR_GENERAL,
+                                           "The daemon is exiting" );
+  while( daemon->priv->ready_waiters )
+  {
+    GTask *task = daemon->priv->ready_waiters->data;
+
+    daemon->priv->ready_waiters = g_slist_delete_link( daemon->priv->ready_waiters, daemon->priv->ready_waiters );
+    g_task_return_new_error( task, RCL_DAEMON_ERROR, RCL_DAEMON_ERROR_GENERAL, "The daemon is exiting" );
+    g_object_unref( task );
+  }
+
+  /* at the idle exit the state is saved before the names are released */
+  if( !daemon->priv->exiting )
+    rcl_daemon_save_state( daemon );
+
+  /* built-in backend runs inside the daemon */
+  if( ntp_backend()->builtin )
+    (void)stop_ntp_daemon();
+
+  if( daemon->priv->arrival_filter )
+  {
+    GDBusConnection *connection = g_dbus_interface_skeleton_get_connection( G_DBUS_INTERFACE_SKELETON( daemon ) );
+
+    if( connection )
+      g_dbus_connection_remove_filter( connection, daemon->priv->arrival_filter );
+    daemon->priv->arrival_filter = 0;
+  }
+
+  /*
+    The coalesced RTC write is done now and the calls waiting for it
+    are answered: the main loop is not running anymore, so the default
+    context is iterated here until their replies are sent.
+   */
+  if( daemon->priv->hwclock_timer )
+  {
+    g_source_remove( daemon->priv->hwclock_timer );
+    daemon->priv->hwclock_timer = 0;
+    (void)sync_hwclock_start( daemon );
+  }
+
+  if( daemon->priv->hwclock_busy )
+  {
+    GDBusConnection *connection = g_dbus_interface_skeleton_get_connection( G_DBUS_INTERFACE_SKELETON( daemon ) );
+
+    while( daemon->priv->hwclock_busy )
+      (void)g_main_context_iteration( NULL, TRUE );
+    while( g_main_context_pending( NULL ) )
+      (void)g_main_context_iteration( NULL, FALSE );
+
+    synced = TRUE;
+
+    if( connection )
+      (void)g_dbus_connection_flush_sync( connection, NULL, NULL );
+  }
+
+  /* systohc: keep RTC in step with the NTP disciplined system clock while we are down (not at the idle exit) */
+  if( rcl_daemon_time_is_trusted( daemon ) && !synced && !daemon->priv->exiting && !daemon->priv->replaced )
+  {
+    if( !clock_systohc( !daemon->priv->local_rtc, TRUE ) )
+      g_warning( "timedated: warning: Failed to sync time to hardware clock" );
+    else
+      g_debug( "Hardware clock synchronized from system clock" );
+  }
 }
 
 
@@ -1078,43 +3405,42 @@ rcl_daemon_shutdown( RclDaemon *daemon )
 static void
 rcl_daemon_init( RclDaemon *daemon )
 {
-  gboolean rtc = TRUE;  /* default */
-  gboolean ntp = FALSE; /* default */
+  gchar   *rtc_name;
+  struct timex txc;
 
   daemon->priv = rcl_daemon_get_instance_private( daemon );
 
-  /**********************
-    Get current Timezone:
+  daemon->priv->jump_fd   = -1;
+  daemon->priv->init_time = g_get_monotonic_time();
+
+  g_mutex_init( &daemon->priv->arrival_lock );
+  daemon->priv->arrivals  = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+  daemon->priv->last_call = g_get_monotonic_time();
+
+  g_mutex_init( &daemon->priv->load_lock );
+
+  /*****************************************************************
+    Timezone, LocalRTC, NTPBackend, CanNTP, NTP, LeapSecondsExpire:
    */
-  if( !get_system_timezone( (gchar **)&daemon->priv->timezone ) )
-  {
-    daemon->priv->timezone  = g_strdup( "Europe/Moscow" );
-  }
+  rcl_daemon_load_async( daemon );
 
   /******************
     Init Properties:
    */
-  /* Timezone: */
   rcl_timedate_daemon_set_daemon_version( RCL_TIMEDATE_DAEMON( daemon ), PACKAGE_VERSION );
-  rcl_timedate_daemon_set_timezone( RCL_TIMEDATE_DAEMON( daemon ), (const gchar *)daemon->priv->timezone );
 
-  /* LocalRTC: */
-  (void)read_data_local_rtc( &rtc );
-  daemon->priv->local_rtc = rtc;
-  rcl_timedate_daemon_set_local_rtc( RCL_TIMEDATE_DAEMON( daemon ), daemon->priv->local_rtc );
+  /* SyncStateChanged (NTPSynchronized, Timex*, TAIOffsetSec are published when ready): */
+  daemon->priv->sync_state = ( clock_get_timex( &txc ) && txc.maxerror < TIMEX_SYNC_LEAVE );
+  rcl_daemon_load_state( daemon );
 
-  /* CanNTP: */
-  ntp = ntp_daemon_installed();
-  daemon->priv->can_ntp = ntp;
-  rcl_timedate_daemon_set_can_ntp( RCL_TIMEDATE_DAEMON( daemon ), daemon->priv->can_ntp );
+  /* RTC, RTCs: */
+  rtc_name = clock_get_rtc_device();
+  rcl_timedate_daemon_set_rtc( RCL_TIMEDATE_DAEMON( daemon ), rtc_name );
+  g_free( rtc_name );
 
-  /* NTP: */
-  ntp = ( ntp_daemon_installed() && ntp_daemon_enabled() && ntp_daemon_status() );
-  daemon->priv->use_ntp = ntp;
-  rcl_timedate_daemon_set_ntp( RCL_TIMEDATE_DAEMON( daemon ), daemon->priv->use_ntp );
-
-  /* NTPSynchronized: */
-  rcl_timedate_daemon_set_ntpsynchronized( RCL_TIMEDATE_DAEMON( daemon ), ntp_synchronized() );
+  daemon->priv->rtcs = g_ptr_array_new_with_free_func( (GDestroyNotify)rtc_device_free );
+  (void)rcl_daemon_scan_rtcs( daemon );
+  rcl_daemon_watch_rtcs( daemon );
 
 
   /******************
@@ -1140,6 +3466,11 @@ rcl_daemon_init( RclDaemon *daemon )
                     G_CALLBACK( handle_set_time ),
                     daemon ); /* user_data */
 
+  g_signal_connect( RCL_TIMEDATE_DAEMON( daemon ),
+                    "handle-slew-time",
+                    G_CALLBACK( handle_slew_time ),
+                    daemon ); /* user_data */
+
   g_signal_connect( RCL_TIMEDATE_DAEMON( daemon ),
                     "handle-list-timezones",
                     G_CALLBACK( handle_list_timezones ),
@@ -1183,6 +3514,22 @@ rcl_daemon_finalize( GObject *object )
   g_free( daemon->priv->timezone );
   g_clear_object( &daemon->priv->auth );
 
+  if( daemon->priv->rtc_scan_timer )
+    g_source_remove( daemon->priv->rtc_scan_timer );
+  if( daemon->priv->rtc_monitor )
+    g_file_monitor_cancel( daemon->priv->rtc_monitor );
+  g_clear_object( &daemon->priv->rtc_monitor );
+  if( daemon->priv->leap_monitor )
+    g_file_monitor_cancel( daemon->priv->leap_monitor );
+  g_clear_object( &daemon->priv->leap_monitor );
+  g_clear_pointer( &daemon->priv->rtcs, g_ptr_array_unref );
+
+  g_clear_pointer( &daemon->priv->arrivals, g_hash_table_unref );
+  g_mutex_clear( &daemon->priv->arrival_lock );
+
+  g_free( daemon->priv->load.timezone );
+  g_mutex_clear( &daemon->priv->load_lock );
+
   G_OBJECT_CLASS( rcl_daemon_parent_class)->finalize( object );
 }
 
@@ -1192,8 +3539,11 @@ rcl_daemon_finalize( GObject *object )
 static void
 rcl_daemon_class_init( RclDaemonClass *klass )
 {
-  GObjectClass *object_class = G_OBJECT_CLASS( klass );
-  object_class->finalize = rcl_daemon_finalize;
+  GObjectClass                *object_class   = G_OBJECT_CLASS( klass );
+  GDBusInterfaceSkeletonClass *skeleton_class = G_DBUS_INTERFACE_SKELETON_CLASS( klass );
+
+  object_class->finalize     = rcl_daemon_finalize;
+  skeleton_class->get_vtable = rcl_daemon_get_vtable;
 }
 
 /***************************************************************
@@ -68,6 +68,24 @@ void      rcl_daemon_shutdown    ( RclDaemon       *daemon );
 void      rcl_daemon_set_debug   ( RclDaemon       *daemon,
                                    gboolean         debug  );
 gboolean  rcl_daemon_get_debug   ( RclDaemon       *daemon );
+gboolean  rcl_daemon_is_idle     ( RclDaemon       *daemon,
+                                   guint            timeout_sec );
+gboolean  rcl_daemon_is_busy     ( RclDaemon       *daemon );
+void      rcl_daemon_prepare_exit( RclDaemon       *daemon );
+void      rcl_daemon_ready_async        ( RclDaemon           *daemon,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data );
+gboolean  rcl_daemon_ready_finish       ( RclDaemon           *daemon,
+                                          GAsyncResult        *result,
+                                          GError             **error );
+void      rcl_daemon_set_replaced( RclDaemon       *daemon );
+int       rcl_daemon_export_state( RclDaemon       *daemon );
+void      rcl_daemon_import_state( RclDaemon       *daemon );
+void      rcl_daemon_set_startup_profile( RclDaemon   *daemon,
+                                          gint64       since );
+void      rcl_daemon_startup_phase      ( RclDaemon   *daemon,
+                                          const gchar *phase,
+                                          gint64       start );
 
 void      rcl_daemon_sync_dbus_properties( RclTimedateDaemon *object );
 
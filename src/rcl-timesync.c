@@ -0,0 +1,261 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include "config.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "rcl-timesync.h"
+#include "rcl-time-utils.h"
+#include "rcl-ntpd-utils.h"
+
+/*
+  org.freedesktop.timesync1.Manager: the peer status of the NTP backend.
+  The cached status is returned when a property is read; if it is older
+  than RCL_TIMESYNC_TTL it is queried over the control protocol in a
+  worker thread, so the next read gets the fresh one. The properties do
+  not emit PropertiesChanged, so the skeleton values are not used.
+ */
+
+struct RclTimesyncPrivate
+{
+  struct ntp_status  status;     /* the last queried status */
+  gint64             query_time; /* monotonic usec of the last query */
+  gboolean           querying;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (RclTimesync, rcl_timesync, RCL_TYPE_TIMESYNC_MANAGER_SKELETON)
+
+#define RCL_TIMESYNC_TTL   1000  /* msec the queried status is reused */
+#define RCL_TIMESYNC_PATH  "/org/freedesktop/timesync1"
+
+
+/***************************************************************
+  Properties:
+  ==========
+ */
+static GVariant *
+server_address_variant( const gchar *address )
+{
+  guint8 buf[sizeof(struct in6_addr)];
+
+  if( inet_pton( AF_INET, address, buf ) == 1 )
+    return g_variant_new( "(i@ay)", AF_INET,
+                          g_variant_new_fixed_array( G_VARIANT_TYPE_BYTE, buf, sizeof(struct in_addr), 1 ) );
+
+  if( inet_pton( AF_INET6, address, buf ) == 1 )
+    return g_variant_new( "(i@ay)", AF_INET6,
+                          g_variant_new_fixed_array( G_VARIANT_TYPE_BYTE, buf, sizeof(struct in6_addr), 1 ) );
+
+  return g_variant_new( "(i@ay)", AF_UNSPEC, g_variant_new_fixed_array( G_VARIANT_TYPE_BYTE, NULL, 0, 1 ) );
+}
+
+static GVariant *
+ntp_message_variant( const struct ntp_status *status )
+{
+  return g_variant_new( "(uuuuitt@ayttttbtt)",
+                        status->leap, status->version, status->mode, status->stratum,
+                        status->precision,
+                        (guint64)MAX( status->root_delay_usec, 0 ),
+                        (guint64)MAX( status->root_dispersion_usec, 0 ),
+                        g_variant_new_fixed_array( G_VARIANT_TYPE_BYTE, &status->refid, sizeof(status->refid), 1 ),
+                        (guint64)0, (guint64)0, (guint64)0, (guint64)0, /* origin, receive, transmit, dest */
+                        FALSE, (guint64)0, (guint64)0 );                /* spike, packet count, jitter */
+}
+
+static void
+query_thread( GTask        *task,
+              gpointer      source_object,
+              gpointer      task_data,
+              GCancellable *cancellable )
+{
+  struct ntp_status *status = (struct ntp_status *)task_data;
+
+  if( !ntp_daemon_query( status ) )
+    memset( status, 0, sizeof(*status) );
+
+  g_task_return_boolean( task, TRUE );
+}
+
+static void
+query_done( GObject      *source_object,
+            GAsyncResult *result,
+            gpointer      user_data )
+{
+  RclTimesync *timesync = RCL_TIMESYNC( source_object );
+
+  timesync->priv->status   = *(struct ntp_status *)g_task_get_task_data( G_TASK( result ) );
+  timesync->priv->querying = FALSE;
+}
+
+static void
+rcl_timesync_refresh( RclTimesync *timesync )
+{
+  GTask  *task;
+  gint64  now = g_get_monotonic_time();
+
+  if( timesync->priv->querying )
+    return;
+
+  if( timesync->priv->query_time &&
+      now - timesync->priv->query_time < RCL_TIMESYNC_TTL * (gint64)USEC_PER_MSEC )
+    return;
+
+  timesync->priv->query_time = now;
+
+  /* the built-in client runs on the main loop and answers from memory */
+  if( ntp_backend()->builtin )
+  {
+    if( !ntp_daemon_query( &timesync->priv->status ) )
+      memset( &timesync->priv->status, 0, sizeof(timesync->priv->status) );
+    return;
+  }
+
+  timesync->priv->querying = TRUE;
+
+  task = g_task_new( timesync, NULL, query_done, NULL );
+  g_task_set_task_data( task, g_new0( struct ntp_status, 1 ), g_free );
+  g_task_run_in_thread( task, query_thread );
+  g_object_unref( task );
+}
+
+/*
+  Properties read by clients are returned from the cached status:
+ */
+static GDBusInterfaceVTable           rcl_timesync_vtable;
+static GDBusInterfaceGetPropertyFunc  rcl_timesync_parent_get_property;
+
+static GVariant *
+rcl_timesync_get_property( GDBusConnection  *connection,
+                           const gchar      *sender,
+                           const gchar      *object_path,
+                           const gchar      *interface_name,
+                           const gchar      *property_name,
+                           GError          **error,
+                           gpointer          user_data )
+{
+  RclTimesync             *timesync = RCL_TIMESYNC( user_data );
+  const struct ntp_status *status   = &timesync->priv->status;
+
+  /* one query for all properties of GetAll */
+  rcl_timesync_refresh( timesync );
+
+  if( !g_strcmp0( property_name, "ServerName" ) )
+    return g_variant_new_string( status->server_name );
+  if( !g_strcmp0( property_name, "ServerAddress" ) )
+    return server_address_variant( status->server_address );
+  if( !g_strcmp0( property_name, "PollIntervalUSec" ) )
+    return g_variant_new_uint64( status->poll_usec );
+  if( !g_strcmp0( property_name, "NTPMessage" ) )
+    return ntp_message_variant( status );
+  if( !g_strcmp0( property_name, "Frequency" ) )
+    return g_variant_new_int64( (gint64)( status->freq_ppm * 65536.0 ) );
+
+  return rcl_timesync_parent_get_property( connection, sender, object_path, interface_name,
+                                           property_name, error, user_data );
+}
+
+static GDBusInterfaceVTable *
+rcl_timesync_get_vtable( GDBusInterfaceSkeleton *skeleton )
+{
+  GDBusInterfaceVTable *vtable;
+
+  vtable = G_DBUS_INTERFACE_SKELETON_CLASS( rcl_timesync_parent_class )->get_vtable( skeleton );
+
+  rcl_timesync_parent_get_property = vtable->get_property;
+  rcl_timesync_vtable              = *vtable;
+  rcl_timesync_vtable.get_property = rcl_timesync_get_property;
+
+  return &rcl_timesync_vtable;
+}
+
+
+/***************************************************************
+  rcl_timesync_register:
+ */
+gboolean
+rcl_timesync_register( RclTimesync     *timesync,
+                       GDBusConnection *connection )
+{
+  GError *error = NULL;
+
+  g_dbus_interface_skeleton_export( G_DBUS_INTERFACE_SKELETON( timesync ),
+                                    connection,
+                                    RCL_TIMESYNC_PATH,
+                                    &error );
+  if( error != NULL )
+  {
+    g_warning( "timedated: warning: Cannot export timesync1 interface: %s", error->message );
+    g_error_free( error );
+    return FALSE;
+  }
+
+  /* the first read gets the status of the backend */
+  rcl_timesync_refresh( timesync );
+
+  return TRUE;
+}
+
+/***************************************************************
+  rcl_timesync_unregister:
+ */
+void
+rcl_timesync_unregister( RclTimesync *timesync )
+{
+  if( g_dbus_interface_skeleton_get_connection( G_DBUS_INTERFACE_SKELETON( timesync ) ) )
+    g_dbus_interface_skeleton_unexport( G_DBUS_INTERFACE_SKELETON( timesync ) );
+}
+
+/***************************************************************
+  rcl_timesync_init:
+ */
+static void
+rcl_timesync_init( RclTimesync *timesync )
+{
+  timesync->priv = rcl_timesync_get_instance_private( timesync );
+
+  /* valid (empty) values until the first query */
+  memset( &timesync->priv->status, 0, sizeof(timesync->priv->status) );
+}
+
+/***************************************************************
+  rcl_timesync_class_init:
+ */
+static void
+rcl_timesync_class_init( RclTimesyncClass *klass )
+{
+  GDBusInterfaceSkeletonClass *skeleton_class = G_DBUS_INTERFACE_SKELETON_CLASS( klass );
+
+  skeleton_class->get_vtable = rcl_timesync_get_vtable;
+}
+
+/***************************************************************
+  rcl_timesync_new:
+ */
+RclTimesync *
+rcl_timesync_new( void )
+{
+  return RCL_TIMESYNC( g_object_new( RCL_TYPE_TIMESYNC, NULL ) );
+}
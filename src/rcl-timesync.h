@@ -0,0 +1,57 @@
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef __RCL_TIMESYNC_H__
+#define __RCL_TIMESYNC_H__
+
+#include <dbus/rcl-timesync-generated.h>
+
+G_BEGIN_DECLS
+
+#define RCL_TYPE_TIMESYNC         (rcl_timesync_get_type ())
+#define RCL_TIMESYNC(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), RCL_TYPE_TIMESYNC, RclTimesync))
+#define RCL_TIMESYNC_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), RCL_TYPE_TIMESYNC, RclTimesyncClass))
+#define RCL_IS_TIMESYNC(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), RCL_TYPE_TIMESYNC))
+#define RCL_IS_TIMESYNC_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), RCL_TYPE_TIMESYNC))
+#define RCL_TIMESYNC_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), RCL_TYPE_TIMESYNC, RclTimesyncClass))
+
+typedef struct RclTimesyncPrivate RclTimesyncPrivate;
+
+typedef struct
+{
+  RclTimesyncManagerSkeleton  parent;
+  RclTimesyncPrivate         *priv;
+} RclTimesync;
+
+typedef struct
+{
+  RclTimesyncManagerSkeletonClass parent_class;
+} RclTimesyncClass;
+
+GType        rcl_timesync_get_type ( void );
+RclTimesync *rcl_timesync_new      ( void );
+
+/* private */
+gboolean  rcl_timesync_register   ( RclTimesync     *timesync,
+                                    GDBusConnection *connection );
+void      rcl_timesync_unregister ( RclTimesync     *timesync );
+
+G_END_DECLS
+
+#endif /* __RCL_TIMESYNC_H__ */
@@ -0,0 +1,55 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_TRACE_H__
+#define __RCL_TRACE_H__
+
+#include "config.h"
+
+#if !defined( ENABLE_USDT )
+#define ENABLE_USDT 0
+#endif
+
+/*
+  USDT probes of the "timedated" provider (meson -Dusdt=true), e.g.:
+
+    bpftrace -e 'usdt:/usr/libexec/timedated:timedated:polkit__response { printf( "%s %d\n", str(arg0), arg1 ); }'
+
+  Without the option the probes and their arguments are compiled out.
+  With the option the arguments are evaluated even when no tracer is
+  attached (there are no SDT semaphores), so pass only values which are
+  already computed:
+ */
+#if ENABLE_USDT
+#include <sys/sdt.h>
+
+#define TRACE_PROBE( name )                DTRACE_PROBE( timedated, name )
+#define TRACE_PROBE1( name, a1 )           DTRACE_PROBE1( timedated, name, a1 )
+#define TRACE_PROBE2( name, a1, a2 )       DTRACE_PROBE2( timedated, name, a1, a2 )
+#define TRACE_PROBE3( name, a1, a2, a3 )   DTRACE_PROBE3( timedated, name, a1, a2, a3 )
+#else
+#define TRACE_PROBE( name )                do { } while( 0 )
+#define TRACE_PROBE1( name, a1 )           do { } while( 0 )
+#define TRACE_PROBE2( name, a1, a2 )       do { } while( 0 )
+#define TRACE_PROBE3( name, a1, a2, a3 )   do { } while( 0 )
+#endif
+
+
+#endif /* __RCL_TRACE_H__ */
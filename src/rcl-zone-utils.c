@@ -19,6 +19,18 @@
  */
 
 #include "rcl-zone-utils.h"
+#include "rcl-sys.h"
+#include "rcl-trace.h"
+
+/*
+  The index of timezones is parsed from TZDATA_ZI once and kept while
+  the file is not changed. The generation of the index is the mtime
+  of the file (nsec), so a saved index can be taken back if the file
+  is the same (see rcl-snapshot-utils.c):
+ */
+static gchar   **tz_index            = NULL;
+static guint64   tz_index_generation = 0;
+G_LOCK_DEFINE_STATIC( tz_index );
 
 static gsize strv_lenght( const gchar *const *list )
 {
@@ -88,10 +100,16 @@ static GSList *get_timezones_from_tzdata_zi( void )
   GSList *list = NULL;
   FILE   *fp   = NULL;
   gchar  *ln   = NULL, *line = NULL;
+  guint   entries = 0;
 
-  fp = fopen( "/usr/share/zoneinfo/tzdata.zi", "r" );
+  TRACE_PROBE( tzdata__parse__entry );
+
+  fp = sys_fopen( TZDATA_ZI, "r" );
   if( !fp )
+  {
+    TRACE_PROBE1( tzdata__parse__return, 0 );
     return list;
+  }
 
   line = (gchar *)g_malloc0( (gsize)PATH_MAX );
   if( !line )
@@ -126,6 +144,7 @@ static GSList *get_timezones_from_tzdata_zi( void )
       *q = '\0';
 
       list = g_slist_insert_sorted_unique( list, (gpointer)g_strdup( p ), (GCompareFunc)comparator );
+      ++entries;
       continue;
     }
     else if( !g_ascii_strncasecmp( ln, "L", 1 ) )
@@ -157,6 +176,7 @@ static GSList *get_timezones_from_tzdata_zi( void )
       *q = '\0';
 
       list = g_slist_insert_sorted_unique( list, (gpointer)g_strdup( p ), (GCompareFunc)comparator );
+      ++entries;
     }
     else
     {
@@ -167,6 +187,8 @@ static GSList *get_timezones_from_tzdata_zi( void )
   g_free( (gpointer)line );
   fclose( fp );
 
+  TRACE_PROBE1( tzdata__parse__return, entries );
+
   return list;
 }
 
@@ -206,25 +228,91 @@ void timezones_print( const gchar *const **list )
   }
 }
 
+guint64 timezones_generation( void )
+{
+  GStatBuf st;
+
+  if( sys_stat( TZDATA_ZI, &st ) != 0 )
+    return 0;
+
+  return (guint64)st.st_mtim.tv_sec * G_GUINT64_CONSTANT(1000000000) + (guint64)st.st_mtim.tv_nsec;
+}
+
+/*
+  Copy of the index (NULL if it is not built) and its generation:
+ */
+gchar **timezones_get_index( guint64 *generation )
+{
+  gchar **ret;
+
+  G_LOCK( tz_index );
+  ret = g_strdupv( tz_index );
+  if( generation )
+    *generation = tz_index_generation;
+  G_UNLOCK( tz_index );
+
+  return ret;
+}
+
+/*
+  Take the saved index if TZDATA_ZI is not changed since it was built:
+ */
+gboolean timezones_set_index( const gchar *const *zones, guint64 generation )
+{
+  if( !zones || !*zones || !generation || generation != timezones_generation() )
+    return FALSE;
+
+  G_LOCK( tz_index );
+  g_strfreev( tz_index );
+  tz_index            = g_strdupv( (gchar **)zones );
+  tz_index_generation = generation;
+  G_UNLOCK( tz_index );
+
+  return TRUE;
+}
+
 gboolean get_timezones( const gchar *const **list )
 {
-  GSList   *slist = NULL, *iterator = NULL;
-  gboolean  ret   = TRUE;
+  guint64   generation = timezones_generation();
+  gchar   **p;
+  gboolean  ret = TRUE;
 
-  slist = get_timezones_from_tzdata_zi();
-  if( !slist )
+  if( !generation )
     return FALSE;
 
-  for( iterator = slist; iterator; iterator = iterator->next )
+  G_LOCK( tz_index );
+
+  if( !tz_index || tz_index_generation != generation )
   {
-    gboolean rc = strv_append( list, (const gchar *)iterator->data );
+    GSList    *slist = NULL, *iterator = NULL;
+    GPtrArray *index;
+
+    slist = get_timezones_from_tzdata_zi();
+    if( !slist )
+    {
+      G_UNLOCK( tz_index );
+      return FALSE;
+    }
+
+    index = g_ptr_array_new();
+    for( iterator = slist; iterator; iterator = iterator->next )
+      g_ptr_array_add( index, iterator->data );
+    g_ptr_array_add( index, NULL );
+    g_slist_free( slist );
+
+    g_strfreev( tz_index );
+    tz_index            = (gchar **)g_ptr_array_free( index, FALSE );
+    tz_index_generation = generation;
+  }
+
+  for( p = tz_index; *p; ++p )
+  {
+    gboolean rc = strv_append( list, (const gchar *)*p );
     if( !rc )
       ret = FALSE;
-
-    g_free( (gpointer)iterator->data );
   }
-  g_slist_free(slist);
+
+  G_UNLOCK( tz_index );
 
   return ret;
 }
-
@@ -41,9 +41,17 @@
 #include <glib/gi18n-lib.h>
 #include <locale.h>
 
-extern gboolean  get_timezones   ( const gchar *const **list );
-extern void      timezones_free  ( const gchar *const **list );
-extern void      timezones_print ( const gchar *const **list );
+#if !defined( TZDATA_ZI )
+#define TZDATA_ZI "/usr/share/zoneinfo/tzdata.zi"
+#endif
+
+extern gboolean  get_timezones        ( const gchar *const **list );
+extern void      timezones_free       ( const gchar *const **list );
+extern void      timezones_print      ( const gchar *const **list );
+
+extern guint64   timezones_generation ( void );
+extern gchar   **timezones_get_index  ( guint64 *generation );
+extern gboolean  timezones_set_index  ( const gchar *const *zones, guint64 generation );
 
 
 #endif /* __RCL_ZONE_UTILS_H__ */
@@ -0,0 +1,167 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "rcl-sysroot.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#include "rcl-time-utils.h"
+#include "rcl-ntpd-utils.h"
+
+
+/***************************************************************
+  Simulated system root:
+
+  UTC system with one RTC, zoneinfo is taken from the host.
+ */
+static gboolean
+write_file( const gchar *root, const gchar *path, const gchar *contents )
+{
+  gchar    *fname = g_build_filename( root, path, NULL );
+  gchar    *dir   = g_path_get_dirname( fname );
+  gboolean  ret;
+
+  ret = ( g_mkdir_with_parents( dir, 0755 ) == 0 &&
+          g_file_set_contents( fname, contents, -1, NULL ) );
+
+  g_free( dir );
+  g_free( fname );
+
+  return ret;
+}
+
+static gboolean
+make_link( const gchar *root, const gchar *path, const gchar *target )
+{
+  gchar    *fname = g_build_filename( root, path, NULL );
+  gchar    *dir   = g_path_get_dirname( fname );
+  gboolean  ret;
+
+  ret = ( g_mkdir_with_parents( dir, 0755 ) == 0 && symlink( target, fname ) == 0 );
+
+  g_free( dir );
+  g_free( fname );
+
+  return ret;
+}
+
+static void remove_tree( const gchar *path )
+{
+  GDir        *dir;
+  const gchar *name;
+
+  if( g_file_test( path, G_FILE_TEST_IS_SYMLINK ) || !g_file_test( path, G_FILE_TEST_IS_DIR ) )
+  {
+    (void)g_unlink( path );
+    return;
+  }
+
+  dir = g_dir_open( path, 0, NULL );
+  if( dir )
+  {
+    while( (name = g_dir_read_name( dir )) != NULL )
+    {
+      gchar *child = g_build_filename( path, name, NULL );
+      remove_tree( child );
+      g_free( child );
+    }
+    g_dir_close( dir );
+  }
+  (void)g_rmdir( path );
+}
+
+gchar *sysroot_new( void )
+{
+  GError   *error = NULL;
+  gchar    *root;
+  gchar    *rtc_sys;
+  gboolean  ret;
+
+  root = g_dir_make_tmp( "timedated-bench-XXXXXX", &error );
+  if( !root )
+  {
+    g_warning( "sysroot: Cannot create simulated root: %s", error->message );
+    g_error_free( error );
+    return NULL;
+  }
+
+  rtc_sys = g_build_filename( root, "sys", "class", "rtc", "rtc0", NULL );
+
+  ret = ( write_file( root, HWCLOCK_CONF, "UTC\n" ) &&
+          write_file( root, ADJTIME_CONF, "0.0 0 0.0\n0\nUTC\n" ) &&
+          write_file( root, "/dev/rtc0", "0\n" ) &&
+          g_mkdir_with_parents( rtc_sys, 0755 ) == 0 &&
+          make_link( root, SYSTEM_ZONEINFO_DIR, SYSTEM_ZONEINFO_DIR ) &&
+          make_link( root, "/etc/localtime", "../usr/share/zoneinfo/UTC" ) );
+  g_free( rtc_sys );
+
+  if( !ret )
+  {
+    g_warning( "sysroot: Cannot populate simulated root '%s': %s", root, g_strerror( errno ) );
+    sysroot_free( root );
+    return NULL;
+  }
+
+  return root;
+}
+
+/*
+  rc.ntpd which keeps the daemon state in a file next to it, so that
+  SetNTP changes something and goes through polkit:
+ */
+gboolean sysroot_add_ntp_service( const gchar *root )
+{
+  static const gchar rc[] =
+    "#!/bin/sh\n"
+    "state=\"$(dirname \"$0\")/ntpd.running\"\n"
+    "case \"$1\" in\n"
+    "  start)  touch \"$state\" ;;\n"
+    "  stop)   rm -f \"$state\" ;;\n"
+    "  status) test -e \"$state\" ;;\n"
+    "esac\n";
+  gchar    *fname;
+  gboolean  ret;
+
+  if( !write_file( root, NTPD_CONF, "server 127.0.0.1\n" ) ||
+      !write_file( root, NTPD_RC, rc ) )
+  {
+    g_warning( "sysroot: Cannot install NTP service in '%s': %s", root, g_strerror( errno ) );
+    return FALSE;
+  }
+
+  fname = g_build_filename( root, NTPD_RC, NULL );
+  ret   = ( g_chmod( fname, 0755 ) == 0 );
+  g_free( fname );
+
+  return ret;
+}
+
+void sysroot_free( gchar *root )
+{
+  if( !root )
+    return;
+
+  remove_tree( root );
+  g_free( root );
+}
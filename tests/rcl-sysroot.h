@@ -0,0 +1,41 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RCL_SYSROOT_H__
+#define __RCL_SYSROOT_H__
+
+#include "config.h"
+
+#include <glib.h>
+
+/*
+  Temporary root for the simulated system backend (see rcl-sys.h):
+  UTC system with one RTC, zoneinfo is taken from the host.
+ */
+extern gchar    *sysroot_new  ( void );
+extern void      sysroot_free ( gchar *root );
+
+/*
+  Install a stub NTP service (see NTPD_CONF, NTPD_RC):
+ */
+extern gboolean  sysroot_add_ntp_service( const gchar *root );
+
+
+#endif /* __RCL_SYSROOT_H__ */
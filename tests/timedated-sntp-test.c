@@ -0,0 +1,301 @@
+
+
+/*
+ * Copyright (C) 2023 Andrey V.Kosteltsev <kx@radix.pro>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <glib/gi18n-lib.h>
+#include <locale.h>
+
+#include "rcl-sntp.h"
+#include "rcl-time-utils.h"
+#include "rcl-sys.h"
+
+#include "rcl-sysroot.h"
+
+/*
+  Loopback test of the built-in SNTP client: a responder on 127.0.0.1
+  answers with its own clock, the client runs against the simulated
+  system (see rcl-sys.h) and has to step the virtual clock to it. The
+  second case runs after the NTP era rollover in 2036.
+ */
+
+#define TEST_EPOCH_DELTA  2208988800ULL  /* 1900 -> 1970 */
+#define TEST_ERA1_2040    ((gint64)2208988800LL) /* 2040-01-01 00:00:00 UTC */
+#define TEST_OFFSET       ((gint64)(10 * NSEC_PER_SEC))  /* of the client clock at start */
+#define TEST_ACCURACY     ((gint64)(50 * NSEC_PER_MSEC))
+#define TEST_TIMEOUT      5  /* sec per case */
+
+struct test_ts
+{
+  guint32 sec;
+  guint32 frac;
+} __attribute__((packed));
+
+struct test_packet
+{
+  guint8          li_vn_mode;
+  guint8          stratum;
+  gint8           poll;
+  gint8           precision;
+  guint32         root_delay;
+  guint32         root_dispersion;
+  guint32         refid;
+  struct test_ts  reference;
+  struct test_ts  origin;
+  struct test_ts  receive;
+  struct test_ts  transmit;
+} __attribute__((packed));
+
+struct test_case
+{
+  const gchar *name;
+  gint64       shift;     /* of the responder clock from the host clock */
+  GMainLoop   *loop;
+  gboolean     done;
+};
+
+static GSocket *responder = NULL;
+static gint64   responder_shift = 0;
+
+
+/***************************************************************
+  Responder:
+ */
+static gint64 responder_nsec( void )
+{
+  /* the host clock is not touched by the simulated system */
+  return g_get_real_time() * (gint64)NSEC_PER_USEC + responder_shift;
+}
+
+static struct test_ts test_ts_store( gint64 nsec )
+{
+  struct test_ts ts;
+
+  ts.sec  = GUINT32_TO_BE( (guint32)((guint64)(nsec / (gint64)NSEC_PER_SEC) + TEST_EPOCH_DELTA) );
+  ts.frac = GUINT32_TO_BE( (guint32)(((guint64)(nsec % (gint64)NSEC_PER_SEC) << 32) / NSEC_PER_SEC) );
+
+  return ts;
+}
+
+static gboolean responder_cb( GSocket *socket, GIOCondition condition, gpointer user_data )
+{
+  struct test_packet  p;
+  GSocketAddress     *address = NULL;
+  gint64              receive;
+
+  if( g_socket_receive_from( socket, &address, (gchar *)&p, sizeof(p), NULL, NULL ) != (gssize)sizeof(p) )
+  {
+    g_clear_object( &address );
+    return G_SOURCE_CONTINUE;
+  }
+  receive = responder_nsec();
+
+  p.origin          = p.transmit;
+  p.li_vn_mode      = (4 << 3) | 4; /* version 4, server */
+  p.stratum         = 2;
+  p.poll            = 6;
+  p.precision       = -20;
+  p.root_delay      = 0;
+  p.root_dispersion = 0;
+  p.refid           = GUINT32_TO_BE( 0x7f000001 );
+  p.reference       = test_ts_store( receive );
+  p.receive         = test_ts_store( receive );
+  p.transmit        = test_ts_store( responder_nsec() );
+
+  (void)g_socket_send_to( socket, address, (const gchar *)&p, sizeof(p), NULL, NULL );
+  g_object_unref( address );
+
+  return G_SOURCE_CONTINUE;
+}
+
+static guint16 responder_start( void )
+{
+  GSocketAddress *address;
+  GSocketAddress *bound;
+  GInetAddress   *loopback;
+  GSource        *source;
+  GError         *error = NULL;
+  guint16         port;
+
+  responder = g_socket_new( G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, &error );
+  if( !responder )
+  {
+    g_printerr( "sntp-test: Cannot create socket: %s\n", error->message );
+    g_error_free( error );
+    return 0;
+  }
+
+  loopback = g_inet_address_new_loopback( G_SOCKET_FAMILY_IPV4 );
+  address  = g_inet_socket_address_new( loopback, 0 );
+  g_object_unref( loopback );
+
+  if( !g_socket_bind( responder, address, FALSE, &error ) )
+  {
+    g_printerr( "sntp-test: Cannot bind: %s\n", error->message );
+    g_error_free( error );
+    g_object_unref( address );
+    g_clear_object( &responder );
+    return 0;
+  }
+  g_object_unref( address );
+
+  bound = g_socket_get_local_address( responder, NULL );
+  port  = bound ? g_inet_socket_address_get_port( G_INET_SOCKET_ADDRESS( bound ) ) : 0;
+  g_clear_object( &bound );
+
+  g_socket_set_blocking( responder, FALSE );
+
+  source = g_socket_create_source( responder, G_IO_IN, NULL );
+  g_source_set_callback( source, G_SOURCE_FUNC( responder_cb ), NULL, NULL );
+  g_source_attach( source, NULL );
+  g_source_unref( source );
+
+  return port;
+}
+
+
+/***************************************************************
+  Test cases:
+ */
+static gint64 client_error_nsec( void )
+{
+  return (gint64)now_nsec( CLOCK_REALTIME ) - responder_nsec();
+}
+
+static gboolean check_cb( gpointer user_data )
+{
+  struct test_case *test = (struct test_case *)user_data;
+
+  if( ABS( client_error_nsec() ) > TEST_ACCURACY )
+    return G_SOURCE_CONTINUE;
+
+  test->done = TRUE;
+  g_main_loop_quit( test->loop );
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean timeout_cb( gpointer user_data )
+{
+  struct test_case *test = (struct test_case *)user_data;
+
+  g_main_loop_quit( test->loop );
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean run_case( struct test_case *test )
+{
+  struct timespec ts;
+  guint           check, timeout;
+
+  responder_shift = test->shift;
+
+  /* the client clock is off by TEST_OFFSET, more than the step threshold */
+  timespec_store_nsec( &ts, (guint64)(responder_nsec() - TEST_OFFSET) );
+  if( sys_clock_settime( CLOCK_REALTIME, &ts ) != 0 )
+    return FALSE;
+
+  test->loop = g_main_loop_new( NULL, FALSE );
+  test->done = FALSE;
+
+  (void)start_sntp_client();
+
+  check   = g_timeout_add( 20, check_cb, test );
+  timeout = g_timeout_add_seconds( TEST_TIMEOUT, timeout_cb, test );
+
+  g_main_loop_run( test->loop );
+
+  if( !test->done )
+    g_source_remove( check );
+  else
+    g_source_remove( timeout );
+
+  (void)stop_sntp_client();
+  g_main_loop_unref( test->loop );
+
+  g_printerr( "sntp-test: %s: %s (clock error %" G_GINT64_FORMAT " nsec)\n",
+              test->name, test->done ? "ok" : "FAIL", client_error_nsec() );
+
+  return test->done;
+}
+
+
+/*******
+  main:
+ */
+gint main( gint argc, gchar **argv )
+{
+  struct test_case  cases[] = {
+    { "era 0",              0 },
+    { "era 1 (after 2036)", 0 },
+  };
+  gchar            *root;
+  gchar            *server;
+  const gchar      *servers[2];
+  guint16           port;
+  gboolean          ret = TRUE;
+  gsize             i;
+
+  setlocale( LC_ALL, "" );
+
+  if( !ENABLE_SNTP )
+  {
+    g_printerr( "sntp-test: The built-in SNTP client is not enabled (-Dsntp=true)\n" );
+    return 77; /* skipped */
+  }
+
+  /* 2040-01-01 on the responder clock */
+  cases[1].shift = TEST_ERA1_2040 * (gint64)NSEC_PER_SEC - g_get_real_time() * (gint64)NSEC_PER_USEC;
+
+  root = sysroot_new();
+  if( !root || !sys_set_simulated( root, 0 ) )
+  {
+    sysroot_free( root );
+    return 1;
+  }
+
+  port = responder_start();
+  if( !port )
+  {
+    sysroot_free( root );
+    return 1;
+  }
+
+  server     = g_strdup_printf( "127.0.0.1:%u", port );
+  servers[0] = server;
+  servers[1] = NULL;
+  (void)sntp_client_set_servers( servers );
+
+  for( i = 0; i < G_N_ELEMENTS( cases ); ++i )
+    ret &= run_case( &cases[i] );
+
+  g_free( server );
+  g_clear_object( &responder );
+  sysroot_free( root );
+
+  return ret ? 0 : 1;
+}